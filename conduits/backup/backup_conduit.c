@@ -51,6 +51,8 @@
 
 #include <gnome-pilot-conduit-backup.h>
 #include <gnome-pilot-config.h>
+#include <gpilot-sync-stats.h>
+#include <gpilot-trace.h>
 #include "backup_conduit.h"
 
 #define DEBUG 1
@@ -65,7 +67,7 @@ typedef struct file_db {
 	gint entries;
 } file_db;
 
-#ifdef DEBUG_REC_IO
+#ifdef GPILOT_DEBUG_RECORDS
 static char*
 pi_unmktag (long type) {
 	static char tag[5];
@@ -423,6 +425,7 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
 	int err;
 	PilotRecord remote;
 	int wrote;
+	guint64 bytes = 0;
 	pi_buffer_t *piBuf = NULL;
 	int len;
 
@@ -519,8 +522,10 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
                                -1,
                                piBuf);
 
-       if (len > 0)
+       if (len > 0) {
                pi_file_set_app_info (f, piBuf->data, len);
+               bytes += len;
+       }
 
 	index = 0;
 	keep_reading = 1;
@@ -537,11 +542,9 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
 								 &type,
 								 &id) >= 0);
 
-#ifdef DEBUG_REC_IO
-			g_message ("read resource %d, type = %s, size %d, , index %d/%d",
-				   id, pi_unmktag (type), piBuf->used,
-				   index, entries);
-#endif
+			GPILOT_RECORD_LOG (("read resource %d, type = %s, size %d, index %d/%d",
+					    id, pi_unmktag (type), piBuf->used,
+					    index, entries));
 			if (keep_reading > 0) {
 				err = pi_file_append_resource (f,
 							       piBuf->data,
@@ -550,13 +553,15 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
 							       id);
 				if (err < 0) {
 					g_warning ("error in writing to file");
+					gpilot_trace (dbinfo->pilot_socket, GPILOT_TRACE_BACKUP_ERROR, id, err);
 				} else {
 					wrote++;
-#ifdef DEBUG_REC_IO
-					g_message ("write resource %d, type = %s, size %d, index %d/%d",
-						   id, pi_unmktag (type), piBuf->used,
-						   index, entries);
-#endif
+					bytes += piBuf->used;
+					gpilot_trace (dbinfo->pilot_socket, GPILOT_TRACE_BACKUP_RESOURCE,
+						      type, piBuf->used);
+					GPILOT_RECORD_LOG (("write resource %d, type = %s, size %d, index %d/%d",
+							    id, pi_unmktag (type), piBuf->used,
+							    index, entries));
 				}
 			}
 		} else {
@@ -568,11 +573,9 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
 							       &remote.flags,
 							       &remote.catID) >= 0);
 
-#ifdef DEBUG_REC_IO
-			g_message ("read record %d, size %d, index %d/%d",
-				   remote.recID, piBuf->used,
-				   index, entries);
-#endif
+			GPILOT_RECORD_LOG (("read record %d, size %d, index %d/%d",
+					    remote.recID, piBuf->used,
+					    index, entries));
 
 			if (keep_reading > 0) {
 				err = pi_file_append_record (f, 
@@ -583,13 +586,16 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
 							     remote.recID);
 				if (err < 0) {
 					g_warning ("error in writing to file");
+					gpilot_trace (dbinfo->pilot_socket, GPILOT_TRACE_BACKUP_ERROR,
+						      remote.recID, err);
 				} else {
 					wrote++;
-#ifdef DEBUG_REC_IO
-					g_message ("write record %d, size %d, index %d/%d",
-						   id, piBuf->used,
-						   index, entries);
-#endif
+					bytes += piBuf->used;
+					gpilot_trace (dbinfo->pilot_socket, GPILOT_TRACE_BACKUP_RECORD,
+						      remote.recID, piBuf->used);
+					GPILOT_RECORD_LOG (("write record %d, size %d, index %d/%d",
+							    remote.recID, piBuf->used,
+							    index, entries));
 				}
 
 			}
@@ -614,6 +620,7 @@ gnome_real_pilot_conduit_backup_backup (GnomePilotConduitBackup *conduit,
 	g_message ("Wrote %d of %d %s, which is %s",
 		   wrote, entries, PI_DBINFO (dbinfo)->flags & dlpDBFlagResource ? "resources" : "records",
 		   wrote == entries ? "good" : "BAD");
+	gpilot_sync_stats_count (dbinfo->pilot_socket, wrote, bytes);
 
 	times.actime = PI_DBINFO (dbinfo)->createDate;
 	times.modtime = PI_DBINFO (dbinfo)->modifyDate;
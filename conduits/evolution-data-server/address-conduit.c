@@ -44,14 +44,19 @@
 #include <e-pilot-map.h>
 #include <e-pilot-settings.h>
 #include <e-pilot-util.h>
+#include <e-pilot-watch.h>
 
 GnomePilotConduit * conduit_get_gpilot_conduit (guint32);
 void conduit_destroy_gpilot_conduit (GnomePilotConduit*);
+gpointer conduit_start_watch (guint32);
+void conduit_stop_watch (gpointer);
 
 #define CONDUIT_VERSION "0.1.2"
 
+/* per-record output, see configure --enable-record-debug */
+#ifdef GPILOT_DEBUG_RECORDS
 #define DEBUG_CONDUIT 1
-/* #undef DEBUG_CONDUIT */
+#endif
 
 #ifdef DEBUG_CONDUIT
 #define LOG(x) x
@@ -135,6 +140,8 @@ typedef struct _EAddrLocalRecord EAddrLocalRecord;
 typedef struct _EAddrConduitCfg EAddrConduitCfg;
 typedef struct _EAddrConduitGui EAddrConduitGui;
 typedef struct _EAddrConduitContext EAddrConduitContext;
+typedef struct _EAddrRevIndex EAddrRevIndex;
+typedef struct _EAddrContactStream EAddrContactStream;
 
 /* Local Record */
 struct _EAddrLocalRecord {
@@ -155,8 +162,10 @@ static void
 addrconduit_destroy_record (EAddrLocalRecord *local)
 {
 	g_object_unref (local->contact);
-	free_Address (local->addr);
-	g_free (local->addr);
+	if (local->addr != NULL) {
+		free_Address (local->addr);
+		g_free (local->addr);
+	}
 	g_free (local);
 }
 
@@ -170,7 +179,12 @@ struct _EAddrConduitCfg {
 	gboolean secret;
 	EContactField default_address;
 
+	/* books at least this big are paged through, not loaded whole */
+	gint stream_threshold;
+
 	gchar *last_uri;
+	/* the local change watch seen at the last sync */
+	gchar *watch_session;
 };
 
 /* NOTE: copied from calendar/conduit/common/libecalendar-common-conduit.c
@@ -181,7 +195,7 @@ struct _EAddrConduitCfg {
  *
  * NOTE: cat_to_add MUST be in PCHAR format. Evolution stores categories
  *       in UTF-8 format. A conversion must take place before calling
- *       this function (see e_pilot_utf8_to_pchar() in e-pilot-util.c)
+ *       this function (see e_pilot_charset_to_pchar() in e-pilot-util.c)
  */
 static gint
 e_pilot_add_category_if_possible(gchar *cat_to_add, struct CategoryAppInfo *category)
@@ -270,7 +284,7 @@ e_pilot_add_category_if_possible(gchar *cat_to_add, struct CategoryAppInfo *cate
 static
 void e_pilot_local_category_to_remote(gint * pilotCategory,
     EContact *contact, struct CategoryAppInfo *category,
-	const gchar *pilot_charset)
+	EPilotCharset *pilot_charset)
 {
 	GList *c_list = NULL, *l;
 	gchar * category_string, *first_category = NULL;
@@ -279,12 +293,12 @@ void e_pilot_local_category_to_remote(gint * pilotCategory,
 	c_list = e_contact_get (contact, E_CONTACT_CATEGORY_LIST);
 	if (c_list) {
 		/* remember the first category */
-		first_category = e_pilot_utf8_to_pchar((const gchar *)c_list->data, pilot_charset);
+		first_category = e_pilot_charset_to_pchar (pilot_charset, (const gchar *)c_list->data);
 	}
 	l = c_list;
 	while (l && *pilotCategory == 0) {
 		/* list != 0, so at least 1 category is assigned */
-		category_string = e_pilot_utf8_to_pchar((const gchar *)l->data, pilot_charset);
+		category_string = e_pilot_charset_to_pchar (pilot_charset, (const gchar *)l->data);
 		for (i=0; i < PILOT_MAX_CATEGORIES; i++) {
 			/* only 15 chars + nul in palm category name */
 			if (strncmp(category_string,category->name[i], 15) == 0) {
@@ -316,14 +330,14 @@ void e_pilot_local_category_to_remote(gint * pilotCategory,
 static
 void e_pilot_remote_category_to_local(gint pilotCategory,
     EContact *contact, struct CategoryAppInfo *category,
-	const gchar *pilot_charset)
+	EPilotCharset *pilot_charset)
 {
 	gchar *category_string = NULL;
 
 	if (pilotCategory != 0) {
 		/* pda has category assigned */
-		category_string = e_pilot_utf8_from_pchar(
-		    category->name[pilotCategory], pilot_charset);
+		category_string = e_pilot_charset_from_pchar (
+		    pilot_charset, category->name[pilotCategory]);
 
 		LOG(g_message("PDA Category: %s\n", category_string));
 
@@ -515,7 +529,9 @@ addrconduit_load_configuration (guint32 pilot_id)
 	else if (!strcmp (address, "other"))
 		c->default_address = E_CONTACT_ADDRESS_OTHER;
 	g_free (address);
+	c->stream_threshold = e_pilot_setup_get_int (prefix, "stream_threshold", 5000);
 	c->last_uri = e_pilot_setup_get_string (prefix, "last_uri", NULL);
+	c->watch_session = e_pilot_setup_get_string (prefix, "watch_session", NULL);
 
 	return c;
 }
@@ -542,7 +558,9 @@ addrconduit_save_configuration (EAddrConduitCfg *c)
 	default:
 		g_warning ("Unknown default_address value");
 	}
+	e_pilot_setup_set_int (prefix, "stream_threshold", c->stream_threshold);
 	e_pilot_setup_set_string (prefix, "last_uri", c->last_uri ? c->last_uri : "");
+	e_pilot_setup_set_string (prefix, "watch_session", c->watch_session ? c->watch_session : "");
 }
 
 static EAddrConduitCfg*
@@ -561,7 +579,9 @@ addrconduit_dupe_configuration (EAddrConduitCfg *c)
 		retval->source = g_object_ref (c->source);
 	retval->secret = c->secret;
 	retval->default_address = c->default_address;
+	retval->stream_threshold = c->stream_threshold;
 	retval->last_uri = g_strdup (c->last_uri);
+	retval->watch_session = g_strdup (c->watch_session);
 
 	return retval;
 }
@@ -576,6 +596,7 @@ addrconduit_destroy_configuration (EAddrConduitCfg *c)
 	if (c->source)
 		g_object_unref (c->source);
 	g_free (c->last_uri);
+	g_free (c->watch_session);
 	g_free (c);
 }
 
@@ -660,15 +681,56 @@ struct _EAddrConduitContext {
 
 	EBookClient *ebook;
 	GList *cards;
+	gboolean cards_complete;
+	GHashTable *cards_by_uid;
+
+	/* big books: full iterations page through the book, and on a
+	   first sync every contact counts as modified without being
+	   listed in changed */
+	gboolean streaming;
+	gboolean all_modified;
+	GHashTable *cleared;
+	EAddrContactStream *stream;
 	GList *changed;
 	GHashTable *changed_hash;
 	GList *locals;
 
+	/* writes to the book, sent in bulk by flush_pending_writes () */
+	GSList *pending_adds;
+	GSList *pending_mods;
+	GSList *pending_removes;
+	gboolean write_failed;
+
 	EPilotMap *map;
+	EAddrRevIndex *revs;
+	gchar *watch_session;
 
-	gchar * pilot_charset;
+	EPilotCharset *pilot_charset;
+
+	/* pre_sync_local () already ran from prepare_local */
+	gboolean prepared;
+	gint prepare_result;
+	const gchar *prepare_error;
 };
 
+static void rev_index_free (EAddrRevIndex *index);
+static void pending_writes_free (EAddrConduitContext *ctxt);
+static void contact_stream_close (EAddrContactStream *stream);
+
+static EClient *
+addr_pool_connect (ESource *source, gpointer unused, GError **error)
+{
+	return e_book_client_connect_sync (source, 30, NULL, error);
+}
+
+/* The book's pooled client, warm from an earlier sync or the watch
+   if there is one. Given back with e_pilot_client_pool_release (). */
+static EBookClient *
+addr_pool_get_client (ESource *source, GError **error)
+{
+	return (EBookClient *) e_pilot_client_pool_get (source, addr_pool_connect, NULL, error);
+}
+
 static EAddrConduitContext *
 e_addr_context_new (guint32 pilot_id)
 {
@@ -680,10 +742,19 @@ e_addr_context_new (guint32 pilot_id)
 	ctxt->ps = NULL;
 	ctxt->ebook = NULL;
 	ctxt->cards = NULL;
+	ctxt->cards_by_uid = NULL;
+	ctxt->streaming = FALSE;
+	ctxt->all_modified = FALSE;
+	ctxt->cleared = NULL;
+	ctxt->stream = NULL;
 	ctxt->changed_hash = NULL;
 	ctxt->changed = NULL;
 	ctxt->locals = NULL;
+	ctxt->pending_adds = NULL;
+	ctxt->pending_mods = NULL;
+	ctxt->pending_removes = NULL;
 	ctxt->map = NULL;
+	ctxt->revs = NULL;
 	ctxt->pilot_charset = NULL;
 
 	return ctxt;
@@ -704,7 +775,7 @@ e_addr_context_destroy (EAddrConduitContext *ctxt)
 		e_addr_gui_destroy (ctxt->gui);
 
 	if (ctxt->ebook != NULL)
-		g_object_unref (ctxt->ebook);
+		e_pilot_client_pool_release (E_CLIENT (ctxt->ebook));
 
 	if (ctxt->cards != NULL) {
 		for (l = ctxt->cards; l != NULL; l = l->next)
@@ -712,6 +783,14 @@ e_addr_context_destroy (EAddrConduitContext *ctxt)
 		g_list_free (ctxt->cards);
 	}
 
+	if (ctxt->cards_by_uid != NULL)
+		g_hash_table_destroy (ctxt->cards_by_uid);
+
+	if (ctxt->stream != NULL)
+		contact_stream_close (ctxt->stream);
+	if (ctxt->cleared != NULL)
+		g_hash_table_destroy (ctxt->cleared);
+
 	if (ctxt->changed_hash != NULL)
 		g_hash_table_destroy (ctxt->changed_hash);
 
@@ -724,8 +803,13 @@ e_addr_context_destroy (EAddrConduitContext *ctxt)
 		g_list_free (ctxt->locals);
 	}
 
+	pending_writes_free (ctxt);
+
 	if (ctxt->map != NULL)
 		e_pilot_map_destroy (ctxt->map);
+	if (ctxt->revs != NULL)
+		rev_index_free (ctxt->revs);
+	g_free (ctxt->watch_session);
 
 	g_free (ctxt);
 }
@@ -812,6 +896,1074 @@ map_name (EAddrConduitContext *ctxt)
 	return filename;
 }
 
+static gchar *
+rev_index_name (EAddrConduitContext *ctxt)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-revs-%d", ctxt->cfg->pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "addressbook", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "addressbook", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
+static gchar *
+watch_name (guint32 pilot_id)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-watch-address-%d", pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "addressbook", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "addressbook", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
+/* Revision index
+ *
+ * Remembers, per UID, the E_CONTACT_REV and a digest of the fields we
+ * sync as of the last sync. Contacts whose REV didn't move are not even
+ * fetched; those whose REV did are fetched and only count as modified
+ * if the digest changed too.
+ */
+
+#define REV_INDEX_HEADER "gnome-pilot-rev-index 1"
+
+typedef struct {
+	gchar *rev;
+	guint64 digest;
+} EAddrRevEntry;
+
+struct _EAddrRevIndex {
+	gchar *filename;
+	gchar *source_uid;
+
+	/* state at the last sync, NULL if there is none */
+	GHashTable *base;
+	/* state as of now, written out by rev_index_save () */
+	GHashTable *current;
+};
+
+static void
+rev_entry_free (EAddrRevEntry *entry)
+{
+	g_free (entry->rev);
+	g_free (entry);
+}
+
+static GHashTable *
+rev_table_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+				      (GDestroyNotify) rev_entry_free);
+}
+
+static guint64
+digest_string (guint64 digest, const gchar *str)
+{
+	if (str != NULL) {
+		for (; *str; str++) {
+			digest ^= (guchar) *str;
+			digest *= G_GUINT64_CONSTANT (1099511628211);
+		}
+	}
+
+	/* field separator, so that "ab" "" and "a" "b" differ */
+	digest ^= 0xff;
+	digest *= G_GUINT64_CONSTANT (1099511628211);
+
+	return digest;
+}
+
+/*
+ * digest of everything local_record_materialize () looks at
+ */
+static guint64
+contact_digest (EAddrConduitContext *ctxt, EContact *contact)
+{
+	static const EContactField fields [] = {
+		E_CONTACT_GIVEN_NAME,
+		E_CONTACT_FAMILY_NAME,
+		E_CONTACT_ORG,
+		E_CONTACT_TITLE,
+		E_CONTACT_NOTE,
+		E_CONTACT_CATEGORIES,
+		E_CONTACT_FIELD_LAST
+	};
+	guint64 digest = G_GUINT64_CONSTANT (14695981039346656037);
+	EContactField field;
+	gint i;
+
+	for (i = 0; fields[i] != E_CONTACT_FIELD_LAST; i++)
+		digest = digest_string (digest, e_contact_get_const (contact, fields[i]));
+
+	for (i = 0; priority[i] != E_CONTACT_FIELD_LAST; i++)
+		digest = digest_string (digest, e_contact_get_const (contact, priority[i]));
+
+	digest ^= ctxt->cfg->default_address;
+	for (field = E_CONTACT_FIRST_ADDRESS_ID; field <= E_CONTACT_LAST_ADDRESS_ID; field++) {
+		EContactAddress *address = e_contact_get (contact, field);
+
+		if (address) {
+			digest = digest_string (digest, address->street);
+			digest = digest_string (digest, address->ext);
+			digest = digest_string (digest, address->locality);
+			digest = digest_string (digest, address->region);
+			digest = digest_string (digest, address->code);
+			digest = digest_string (digest, address->country);
+			e_contact_address_free (address);
+		} else {
+			digest = digest_string (digest, NULL);
+		}
+	}
+
+	return digest;
+}
+
+static EAddrRevIndex *
+rev_index_load (const gchar *filename, const gchar *source_uid)
+{
+	EAddrRevIndex *index;
+	gchar *contents = NULL;
+	gchar **lines;
+	gint i;
+
+	index = g_new0 (EAddrRevIndex, 1);
+	index->filename = g_strdup (filename);
+	index->source_uid = g_strdup (source_uid ? source_uid : "");
+	index->current = rev_table_new ();
+
+	if (!g_file_get_contents (filename, &contents, NULL, NULL))
+		return index;
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	/* an index for another address book is as good as none */
+	if (lines[0] == NULL || strcmp (lines[0], REV_INDEX_HEADER) != 0
+	    || lines[1] == NULL || strcmp (lines[1], index->source_uid) != 0) {
+		LOG (g_message ("ignoring revision index %s", filename));
+		g_strfreev (lines);
+		return index;
+	}
+
+	index->base = rev_table_new ();
+	for (i = 2; lines[i] != NULL; i++) {
+		EAddrRevEntry *entry;
+		gchar **fields;
+
+		fields = g_strsplit (lines[i], "\t", 3);
+		if (g_strv_length (fields) == 3) {
+			entry = g_new0 (EAddrRevEntry, 1);
+			entry->digest = g_ascii_strtoull (fields[0], NULL, 16);
+			entry->rev = g_strdup (fields[1]);
+			g_hash_table_replace (index->base, g_strdup (fields[2]), entry);
+		}
+		g_strfreev (fields);
+	}
+	g_strfreev (lines);
+
+	return index;
+}
+
+static void
+rev_index_set (EAddrRevIndex *index, const gchar *uid, const gchar *rev, guint64 digest)
+{
+	EAddrRevEntry *entry;
+
+	entry = g_new0 (EAddrRevEntry, 1);
+	entry->rev = g_strdup (rev ? rev : "");
+	entry->digest = digest;
+
+	g_hash_table_replace (index->current, g_strdup (uid), entry);
+}
+
+/*
+ * Records a contact the conduit just wrote. The server assigns the new
+ * REV, so it is left empty; next time the digest decides.
+ */
+static void
+rev_index_update (EAddrConduitContext *ctxt, const gchar *uid, EContact *contact)
+{
+	if (ctxt->revs == NULL || uid == NULL)
+		return;
+
+	rev_index_set (ctxt->revs, uid, NULL, contact_digest (ctxt, contact));
+}
+
+static void
+rev_index_remove (EAddrConduitContext *ctxt, const gchar *uid)
+{
+	if (ctxt->revs == NULL || uid == NULL)
+		return;
+
+	g_hash_table_remove (ctxt->revs->current, uid);
+}
+
+static gboolean
+rev_index_save (EAddrRevIndex *index)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *str;
+	gboolean retval;
+
+	str = g_string_new (REV_INDEX_HEADER "\n");
+	g_string_append_printf (str, "%s\n", index->source_uid);
+
+	g_hash_table_iter_init (&iter, index->current);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		EAddrRevEntry *entry = value;
+
+		g_string_append_printf (str, "%" G_GINT64_MODIFIER "x\t%s\t%s\n",
+					entry->digest, entry->rev, (const gchar *) key);
+	}
+
+	retval = g_file_set_contents (index->filename, str->str, str->len, NULL);
+	if (!retval)
+		WARN ("Could not write revision index %s", index->filename);
+
+	g_string_free (str, TRUE);
+
+	return retval;
+}
+
+static void
+rev_index_free (EAddrRevIndex *index)
+{
+	if (index->base)
+		g_hash_table_destroy (index->base);
+	g_hash_table_destroy (index->current);
+	g_free (index->source_uid);
+	g_free (index->filename);
+	g_free (index);
+}
+
+static void
+rev_view_objects_added (EBookClientView *view, const GSList *contacts, GHashTable *revs)
+{
+	const GSList *l;
+
+	for (l = contacts; l != NULL; l = l->next) {
+		const gchar *uid = e_contact_get_const (l->data, E_CONTACT_UID);
+		const gchar *rev = e_contact_get_const (l->data, E_CONTACT_REV);
+
+		if (uid)
+			g_hash_table_replace (revs, g_strdup (uid), g_strdup (rev ? rev : ""));
+	}
+}
+
+static void
+rev_view_complete (EBookClientView *view, const GError *error, GMainLoop *loop)
+{
+	if (error)
+		WARN ("Listing contact revisions failed: %s", error->message);
+
+	g_main_loop_quit (loop);
+}
+
+/*
+ * Lists UID -> REV for the whole book. Only the two fields are asked
+ * for, which backends with a summary answer without parsing vcards.
+ */
+static GHashTable *
+list_contact_revisions (EAddrConduitContext *ctxt, const gchar *query_str)
+{
+	EBookClientView *view = NULL;
+	GHashTable *revs = NULL;
+	GSList *fields = NULL;
+	GMainContext *context;
+	GMainLoop *loop;
+	GError *error = NULL;
+
+	/* The view reports to the context of the thread it is made in.
+	   Give it one of its own, so running the loop here never
+	   dispatches anything else attached to the default context. */
+	context = g_main_context_new ();
+	g_main_context_push_thread_default (context);
+
+	if (!e_book_client_get_view_sync (ctxt->ebook, query_str, &view, NULL, &error)) {
+		WARN ("Could not get contact view: %s", error ? error->message : "unknown error");
+		if (error) g_error_free (error);
+		goto out;
+	}
+
+	fields = g_slist_append (fields, (gpointer) e_contact_field_name (E_CONTACT_UID));
+	fields = g_slist_append (fields, (gpointer) e_contact_field_name (E_CONTACT_REV));
+	e_book_client_view_set_fields_of_interest (view, fields, NULL);
+	g_slist_free (fields);
+
+	revs = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+	loop = g_main_loop_new (context, FALSE);
+
+	g_signal_connect (view, "objects-added", G_CALLBACK (rev_view_objects_added), revs);
+	g_signal_connect (view, "complete", G_CALLBACK (rev_view_complete), loop);
+
+	e_book_client_view_start (view, &error);
+	if (error) {
+		WARN ("Could not start contact view: %s", error->message);
+		g_error_free (error);
+		g_hash_table_destroy (revs);
+		revs = NULL;
+	} else {
+		g_main_loop_run (loop);
+		e_book_client_view_stop (view, NULL);
+	}
+
+	g_main_loop_unref (loop);
+	g_object_unref (view);
+
+	/* let the view's last idles run before the context goes */
+	while (g_main_context_iteration (context, FALSE))
+		;
+
+ out:
+	g_main_context_pop_thread_default (context);
+	g_main_context_unref (context);
+
+	return revs;
+}
+
+#define FETCH_CHUNK 100
+
+/*
+ * Fetches the contacts with the given UIDs, a chunk of UIDs per query
+ */
+static gboolean
+fetch_contacts_by_uid (EAddrConduitContext *ctxt, GPtrArray *uids, GSList **contacts)
+{
+	guint i, j;
+
+	for (i = 0; i < uids->len; i += FETCH_CHUNK) {
+		EBookQuery *qs [FETCH_CHUNK], *query;
+		GSList *slist = NULL;
+		gchar *query_str;
+		gint n = 0;
+
+		for (j = i; j < uids->len && j < i + FETCH_CHUNK; j++)
+			qs[n++] = e_book_query_field_test (E_CONTACT_UID, E_BOOK_QUERY_IS, g_ptr_array_index (uids, j));
+
+		query = e_book_query_or (n, qs, TRUE);
+		query_str = e_book_query_to_string (query);
+		e_book_query_unref (query);
+
+		if (!e_book_client_get_contacts_sync (ctxt->ebook, query_str, &slist, NULL, NULL)) {
+			g_free (query_str);
+			return FALSE;
+		}
+		g_free (query_str);
+
+		*contacts = g_slist_concat (*contacts, slist);
+	}
+
+	return TRUE;
+}
+
+static gchar *
+all_contacts_query (void)
+{
+	EBookQuery *query;
+	gchar *query_str;
+
+	if (!(query = e_book_query_any_field_contains ("")))
+		return NULL;
+
+	query_str = e_book_query_to_string (query);
+	e_book_query_unref (query);
+
+	return query_str;
+}
+
+static void
+card_index_reset (EAddrConduitContext *ctxt)
+{
+	if (ctxt->cards_by_uid == NULL)
+		ctxt->cards_by_uid = g_hash_table_new_full (g_str_hash, g_str_equal,
+							    g_free, g_object_unref);
+	else
+		g_hash_table_remove_all (ctxt->cards_by_uid);
+}
+
+static void
+card_index_insert (EAddrConduitContext *ctxt, const gchar *uid, EContact *contact)
+{
+	if (uid != NULL && ctxt->cards_by_uid != NULL)
+		g_hash_table_replace (ctxt->cards_by_uid, g_strdup (uid), g_object_ref (contact));
+}
+
+static void
+card_index_remove (EAddrConduitContext *ctxt, const gchar *uid)
+{
+	if (uid != NULL && ctxt->cards_by_uid != NULL)
+		g_hash_table_remove (ctxt->cards_by_uid, uid);
+}
+
+static EContact *
+card_index_lookup (EAddrConduitContext *ctxt, const gchar *uid)
+{
+	if (uid == NULL || ctxt->cards_by_uid == NULL)
+		return NULL;
+
+	return g_hash_table_lookup (ctxt->cards_by_uid, uid);
+}
+
+/*
+ * Replaces ctxt->cards with every contact in the book
+ */
+static gboolean
+load_all_cards (EAddrConduitContext *ctxt)
+{
+	GSList *slist = NULL, *sl;
+	gchar *query_str;
+	GList *l;
+
+	if (!(query_str = all_contacts_query ())) {
+		LOG (g_warning ("Failed to get EBookQuery"));
+		return FALSE;
+	}
+
+	if (!e_book_client_get_contacts_sync (ctxt->ebook, query_str, &slist, NULL, NULL)) {
+		LOG (g_warning ("Failed to get Contacts"));
+		g_free (query_str);
+		return FALSE;
+	}
+	g_free (query_str);
+
+	for (l = ctxt->cards; l != NULL; l = l->next)
+		g_object_unref (l->data);
+	g_list_free (ctxt->cards);
+
+	/* Convert GSList to GList for compatibility with rest of code */
+	ctxt->cards = NULL;
+	card_index_reset (ctxt);
+	for (sl = slist; sl != NULL; sl = sl->next) {
+		ctxt->cards = g_list_prepend (ctxt->cards, sl->data);
+		card_index_insert (ctxt, e_contact_get_const (sl->data, E_CONTACT_UID), sl->data);
+	}
+	ctxt->cards = g_list_reverse (ctxt->cards);
+	g_slist_free (slist);
+
+	ctxt->cards_complete = TRUE;
+
+	return TRUE;
+}
+
+/* Write batching
+ *
+ * add_record, replace_record and delete_record stage their changes
+ * instead of making a round trip to the server for each; they go out
+ * through the bulk calls a chunk at a time, and at post_sync.
+ */
+
+#define WRITE_CHUNK 100
+
+typedef struct {
+	EContact *contact;
+	/* pilot record the contact came from, mapped once it has a UID */
+	guint32 pid;
+	gboolean archived;
+} EAddrPendingAdd;
+
+static void
+pending_add_free (EAddrPendingAdd *add)
+{
+	g_object_unref (add->contact);
+	g_free (add);
+}
+
+static void
+pending_writes_free (EAddrConduitContext *ctxt)
+{
+	g_slist_free_full (ctxt->pending_adds, (GDestroyNotify) pending_add_free);
+	g_slist_free_full (ctxt->pending_mods, g_object_unref);
+	g_slist_free_full (ctxt->pending_removes, g_free);
+	ctxt->pending_adds = NULL;
+	ctxt->pending_mods = NULL;
+	ctxt->pending_removes = NULL;
+}
+
+/* Takes the first WRITE_CHUNK items off *list, in order */
+static GSList *
+next_chunk (GSList **list)
+{
+	GSList *chunk = *list, *last;
+
+	last = g_slist_nth (chunk, WRITE_CHUNK - 1);
+	if (last) {
+		*list = last->next;
+		last->next = NULL;
+	} else {
+		*list = NULL;
+	}
+
+	return chunk;
+}
+
+static void
+write_failed (EAddrConduitContext *ctxt, const gchar *what, GSList *chunk, GError *error)
+{
+	WARN ("Could not %s %d contacts: %s", what, g_slist_length (chunk),
+	      error ? error->message : "unknown error");
+	ctxt->write_failed = TRUE;
+}
+
+static void
+added (EAddrConduitContext *ctxt, EAddrPendingAdd *add, const gchar *uid)
+{
+	if (add->pid != 0)
+		e_pilot_map_insert (ctxt->map, add->pid, uid, add->archived);
+	rev_index_update (ctxt, uid, add->contact);
+	card_index_insert (ctxt, uid, add->contact);
+}
+
+/*
+ * The bulk calls fail as a whole. When one does, the chunk is sent
+ * again a contact at a time, so that only those the book refuses are
+ * lost. Each returns FALSE if any of the chunk was not written.
+ */
+static gboolean
+flush_adds (EAddrConduitContext *ctxt, GSList *chunk)
+{
+	GSList *contacts = NULL, *uids = NULL, *l, *u;
+	GError *error = NULL;
+	gboolean retval = TRUE;
+
+	for (l = chunk; l != NULL; l = l->next)
+		contacts = g_slist_prepend (contacts, ((EAddrPendingAdd *) l->data)->contact);
+	contacts = g_slist_reverse (contacts);
+
+	if (e_book_client_add_contacts_sync (ctxt->ebook, contacts, E_BOOK_OPERATION_FLAG_NONE, &uids, NULL, &error)) {
+		for (l = chunk, u = uids; l != NULL && u != NULL; l = l->next, u = u->next)
+			added (ctxt, l->data, u->data);
+	} else {
+		LOG (g_message ("adding %d contacts failed, one at a time: %s", g_slist_length (chunk),
+				error ? error->message : "unknown error"));
+		for (l = chunk; l != NULL; l = l->next) {
+			EAddrPendingAdd *add = l->data;
+			gchar *uid = NULL;
+
+			g_clear_error (&error);
+			if (e_book_client_add_contact_sync (ctxt->ebook, add->contact, E_BOOK_OPERATION_FLAG_NONE, &uid, NULL, &error)) {
+				added (ctxt, add, uid);
+				g_free (uid);
+			} else {
+				GSList one = { add, NULL };
+
+				write_failed (ctxt, "add", &one, error);
+				retval = FALSE;
+			}
+		}
+	}
+
+	g_clear_error (&error);
+	g_slist_free_full (uids, g_free);
+	g_slist_free (contacts);
+
+	return retval;
+}
+
+static gboolean
+flush_mods (EAddrConduitContext *ctxt, GSList *chunk)
+{
+	GError *error = NULL;
+	gboolean retval = TRUE;
+	GSList *l;
+
+	if (e_book_client_modify_contacts_sync (ctxt->ebook, chunk, E_BOOK_OPERATION_FLAG_NONE, NULL, &error))
+		return TRUE;
+
+	LOG (g_message ("modifying %d contacts failed, one at a time: %s", g_slist_length (chunk),
+			error ? error->message : "unknown error"));
+	for (l = chunk; l != NULL; l = l->next) {
+		g_clear_error (&error);
+		if (!e_book_client_modify_contact_sync (ctxt->ebook, l->data, E_BOOK_OPERATION_FLAG_NONE, NULL, &error)) {
+			GSList one = { l->data, NULL };
+
+			write_failed (ctxt, "modify", &one, error);
+			retval = FALSE;
+		}
+	}
+	g_clear_error (&error);
+
+	return retval;
+}
+
+static gboolean
+flush_removes (EAddrConduitContext *ctxt, GSList *chunk)
+{
+	GError *error = NULL;
+	gboolean retval = TRUE;
+	GSList *l;
+
+	if (e_book_client_remove_contacts_sync (ctxt->ebook, chunk, E_BOOK_OPERATION_FLAG_NONE, NULL, &error))
+		return TRUE;
+
+	LOG (g_message ("deleting %d contacts failed, one at a time: %s", g_slist_length (chunk),
+			error ? error->message : "unknown error"));
+	for (l = chunk; l != NULL; l = l->next) {
+		g_clear_error (&error);
+		/* already gone is as good as deleted */
+		if (!e_book_client_remove_contact_by_uid_sync (ctxt->ebook, l->data, E_BOOK_OPERATION_FLAG_NONE, NULL, &error)
+		    && !g_error_matches (error, E_BOOK_CLIENT_ERROR, E_BOOK_CLIENT_ERROR_CONTACT_NOT_FOUND)) {
+			GSList one = { l->data, NULL };
+
+			write_failed (ctxt, "delete", &one, error);
+			retval = FALSE;
+		}
+	}
+	g_clear_error (&error);
+
+	return retval;
+}
+
+/*
+ * Sends all staged writes: additions, then modifications, then
+ * removals. Returns FALSE if any of them failed; ctxt->write_failed
+ * says whether anything did since pre_sync.
+ */
+static gboolean
+flush_pending_writes (EAddrConduitContext *ctxt)
+{
+	GSList *list, *chunk;
+	gboolean retval = TRUE;
+
+	list = g_slist_reverse (ctxt->pending_adds);
+	ctxt->pending_adds = NULL;
+	while ((chunk = next_chunk (&list))) {
+		if (!flush_adds (ctxt, chunk))
+			retval = FALSE;
+		g_slist_free_full (chunk, (GDestroyNotify) pending_add_free);
+	}
+
+	list = g_slist_reverse (ctxt->pending_mods);
+	ctxt->pending_mods = NULL;
+	while ((chunk = next_chunk (&list))) {
+		if (!flush_mods (ctxt, chunk))
+			retval = FALSE;
+		g_slist_free_full (chunk, g_object_unref);
+	}
+
+	list = g_slist_reverse (ctxt->pending_removes);
+	ctxt->pending_removes = NULL;
+	while ((chunk = next_chunk (&list))) {
+		if (!flush_removes (ctxt, chunk))
+			retval = FALSE;
+		g_slist_free_full (chunk, g_free);
+	}
+
+	return retval;
+}
+
+/* Returns -1 if the flush this staging set off failed, 0 otherwise */
+static gint
+pending_writes_check (EAddrConduitContext *ctxt)
+{
+	if (g_slist_length (ctxt->pending_adds) >= WRITE_CHUNK
+	    || g_slist_length (ctxt->pending_mods) >= WRITE_CHUNK
+	    || g_slist_length (ctxt->pending_removes) >= WRITE_CHUNK)
+		return flush_pending_writes (ctxt) ? 0 : -1;
+
+	return 0;
+}
+
+static gint
+stage_add (EAddrConduitContext *ctxt, EContact *contact, guint32 pid, gboolean archived)
+{
+	EAddrPendingAdd *add;
+
+	add = g_new0 (EAddrPendingAdd, 1);
+	add->contact = g_object_ref (contact);
+	add->pid = pid;
+	add->archived = archived;
+
+	ctxt->pending_adds = g_slist_prepend (ctxt->pending_adds, add);
+	return pending_writes_check (ctxt);
+}
+
+static gint
+stage_modify (EAddrConduitContext *ctxt, EContact *contact)
+{
+	ctxt->pending_mods = g_slist_prepend (ctxt->pending_mods, g_object_ref (contact));
+	return pending_writes_check (ctxt);
+}
+
+static gint
+stage_remove (EAddrConduitContext *ctxt, const gchar *uid)
+{
+	GSList *l, *next;
+
+	/* no point modifying it first */
+	for (l = ctxt->pending_mods; l != NULL; l = next) {
+		next = l->next;
+		if (!g_strcmp0 (e_contact_get_const (l->data, E_CONTACT_UID), uid)) {
+			g_object_unref (l->data);
+			ctxt->pending_mods = g_slist_delete_link (ctxt->pending_mods, l);
+		}
+	}
+
+	ctxt->pending_removes = g_slist_prepend (ctxt->pending_removes, g_strdup (uid));
+	return pending_writes_check (ctxt);
+}
+
+/* Contact streams
+ *
+ * Page through the whole book with an EBookClientCursor, so that only
+ * a page of contacts is held at a time. Backends without cursor support
+ * fall back to loading the book into ctxt->cards.
+ */
+
+#define STREAM_PAGE 200
+
+struct _EAddrContactStream {
+	EBookClientCursor *cursor;
+	GSList *page;
+	GSList *pos;
+	gboolean done;
+	gboolean failed;
+
+	GList *list;
+};
+
+static EAddrContactStream *
+contact_stream_open (EAddrConduitContext *ctxt)
+{
+	EContactField sort_fields [] = { E_CONTACT_FAMILY_NAME, E_CONTACT_GIVEN_NAME };
+	EBookCursorSortType sort_types [] = { E_BOOK_CURSOR_SORT_ASCENDING, E_BOOK_CURSOR_SORT_ASCENDING };
+	EAddrContactStream *stream;
+	GError *error = NULL;
+
+	stream = g_new0 (EAddrContactStream, 1);
+
+	if (!e_book_client_get_cursor_sync (ctxt->ebook, NULL, sort_fields, sort_types,
+					    G_N_ELEMENTS (sort_fields), &stream->cursor, NULL, &error)) {
+		LOG (g_message ("No cursor (%s), loading the whole book", error ? error->message : "unknown error"));
+		g_clear_error (&error);
+		stream->cursor = NULL;
+
+		if (!ctxt->cards_complete && !load_all_cards (ctxt)) {
+			g_free (stream);
+			return NULL;
+		}
+		stream->list = ctxt->cards;
+	}
+
+	return stream;
+}
+
+/*
+ * Returns the next contact, valid until the next call, or NULL at the
+ * end or on error (stream->failed)
+ */
+static EContact *
+contact_stream_next (EAddrContactStream *stream)
+{
+	EContact *contact;
+
+	if (stream->cursor == NULL) {
+		if (stream->list == NULL)
+			return NULL;
+
+		contact = stream->list->data;
+		stream->list = stream->list->next;
+
+		return contact;
+	}
+
+	if (stream->pos == NULL) {
+		GError *error = NULL;
+		gint n;
+
+		if (stream->done)
+			return NULL;
+
+		g_slist_free_full (stream->page, g_object_unref);
+		stream->page = NULL;
+
+		n = e_book_client_cursor_step_sync (stream->cursor,
+						    E_BOOK_CURSOR_STEP_MOVE | E_BOOK_CURSOR_STEP_FETCH,
+						    E_BOOK_CURSOR_ORIGIN_CURRENT, STREAM_PAGE,
+						    &stream->page, NULL, &error);
+		if (n < 0) {
+			WARN ("Could not page through the address book: %s", error ? error->message : "unknown error");
+			g_clear_error (&error);
+			stream->done = stream->failed = TRUE;
+			return NULL;
+		}
+		if (n < STREAM_PAGE)
+			stream->done = TRUE;
+
+		stream->pos = stream->page;
+		if (stream->pos == NULL)
+			return NULL;
+	}
+
+	contact = stream->pos->data;
+	stream->pos = stream->pos->next;
+
+	return contact;
+}
+
+static void
+contact_stream_close (EAddrContactStream *stream)
+{
+	g_slist_free_full (stream->page, g_object_unref);
+	if (stream->cursor)
+		g_object_unref (stream->cursor);
+	g_free (stream);
+}
+
+static EBookChange *
+book_change_new (EContact *contact, EBookChangeType type)
+{
+	EBookChange *ebc;
+
+	ebc = g_new0 (EBookChange, 1);
+	ebc->change_type = type;
+	ebc->contact = contact;
+
+	return ebc;
+}
+
+/*
+ * Takes the contacts fetched because they may have changed into
+ * ctxt->cards, and those that did into ctxt->changed, both in reverse
+ */
+static void
+add_fetched_cards (EAddrConduitContext *ctxt, GSList *fetched)
+{
+	GSList *sl;
+
+	card_index_reset (ctxt);
+	for (sl = fetched; sl != NULL; sl = sl->next) {
+		EContact *contact = sl->data;
+		const gchar *uid = e_contact_get_const (contact, E_CONTACT_UID);
+		EAddrRevEntry *old;
+		guint64 digest;
+
+		digest = contact_digest (ctxt, contact);
+		rev_index_set (ctxt->revs, uid, e_contact_get_const (contact, E_CONTACT_REV), digest);
+
+		ctxt->cards = g_list_prepend (ctxt->cards, contact);
+		card_index_insert (ctxt, uid, contact);
+
+		/* REV moved but nothing we sync did */
+		old = g_hash_table_lookup (ctxt->revs->base, uid);
+		if (old && old->digest == digest)
+			continue;
+
+		ctxt->changed = g_list_prepend (ctxt->changed,
+						book_change_new (g_object_ref (contact),
+								 old ? E_BOOK_CHANGE_CARD_MODIFIED : E_BOOK_CHANGE_CARD_ADDED));
+	}
+	g_slist_free (fetched);
+}
+
+/*
+ * Fills in ctxt->changed from the revision index. Only the contacts that
+ * changed end up in ctxt->cards; *num_contacts is the size of the book.
+ */
+static gboolean
+load_changed_cards (EAddrConduitContext *ctxt, gint *num_contacts)
+{
+	GHashTable *revs;
+	GHashTableIter iter;
+	gpointer key, value;
+	GPtrArray *fetch;
+	GSList *fetched = NULL;
+	gchar *query_str;
+	GList *l;
+
+	ctxt->changed = NULL;
+
+	if (!(query_str = all_contacts_query ()))
+		return FALSE;
+	revs = list_contact_revisions (ctxt, query_str);
+	g_free (query_str);
+	if (revs == NULL)
+		return FALSE;
+
+	ctxt->streaming = ctxt->cfg->stream_threshold > 0
+		&& g_hash_table_size (revs) >= ctxt->cfg->stream_threshold;
+	LOG (g_message ("%d contacts%s", g_hash_table_size (revs), ctxt->streaming ? ", streaming" : ""));
+
+	if (ctxt->revs->base == NULL && ctxt->streaming) {
+		EAddrContactStream *stream;
+		EContact *contact;
+
+		/* No index yet, everything may have changed. Only the
+		   index is built here, the contacts are paged through
+		   again when they are needed. */
+		if (!(stream = contact_stream_open (ctxt))) {
+			g_hash_table_destroy (revs);
+			return FALSE;
+		}
+
+		while ((contact = contact_stream_next (stream)))
+			rev_index_set (ctxt->revs, e_contact_get_const (contact, E_CONTACT_UID),
+				       e_contact_get_const (contact, E_CONTACT_REV),
+				       contact_digest (ctxt, contact));
+
+		if (stream->failed) {
+			contact_stream_close (stream);
+			g_hash_table_destroy (revs);
+			return FALSE;
+		}
+		contact_stream_close (stream);
+
+		/* the fallback may have loaded the book already */
+		if (!ctxt->cards_complete)
+			card_index_reset (ctxt);
+		ctxt->all_modified = TRUE;
+		ctxt->cleared = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+		*num_contacts = g_hash_table_size (revs);
+		g_hash_table_destroy (revs);
+
+		return TRUE;
+	}
+
+	if (ctxt->revs->base == NULL) {
+		g_hash_table_destroy (revs);
+
+		/* No index yet, everything may have changed */
+		if (!load_all_cards (ctxt))
+			return FALSE;
+
+		for (l = ctxt->cards; l != NULL; l = l->next) {
+			rev_index_set (ctxt->revs, e_contact_get_const (l->data, E_CONTACT_UID),
+				       e_contact_get_const (l->data, E_CONTACT_REV),
+				       contact_digest (ctxt, l->data));
+			ctxt->changed = g_list_prepend (ctxt->changed, book_change_new (g_object_ref (l->data), E_BOOK_CHANGE_CARD_MODIFIED));
+		}
+		ctxt->changed = g_list_reverse (ctxt->changed);
+		*num_contacts = g_list_length (ctxt->cards);
+
+		return TRUE;
+	}
+
+	/* Fetch only what has a new REV (or none at all) */
+	fetch = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, revs);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		EAddrRevEntry *old = g_hash_table_lookup (ctxt->revs->base, key);
+
+		if (old && *old->rev && !strcmp (old->rev, value))
+			rev_index_set (ctxt->revs, key, old->rev, old->digest);
+		else
+			g_ptr_array_add (fetch, key);
+	}
+
+	if (!fetch_contacts_by_uid (ctxt, fetch, &fetched)) {
+		LOG (g_warning ("Failed to get Contacts"));
+		g_ptr_array_free (fetch, TRUE);
+		g_hash_table_destroy (revs);
+		return FALSE;
+	}
+	g_ptr_array_free (fetch, TRUE);
+
+	add_fetched_cards (ctxt, fetched);
+
+	/* Whatever is in the index but no longer in the book was deleted */
+	g_hash_table_iter_init (&iter, ctxt->revs->base);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		EContact *contact;
+
+		if (g_hash_table_lookup (revs, key))
+			continue;
+
+		contact = e_contact_new ();
+		e_contact_set (contact, E_CONTACT_UID, key);
+		ctxt->changed = g_list_prepend (ctxt->changed, book_change_new (contact, E_BOOK_CHANGE_CARD_DELETED));
+	}
+
+	ctxt->cards = g_list_reverse (ctxt->cards);
+	ctxt->changed = g_list_reverse (ctxt->changed);
+	ctxt->cards_complete = FALSE;
+	*num_contacts = g_hash_table_size (revs);
+
+	g_hash_table_destroy (revs);
+
+	return TRUE;
+}
+
+/*
+ * Like load_changed_cards (), for when the watch says which UIDs may
+ * have changed since the last sync: the rest of the book is taken to be
+ * as the revision index has it, without listing it.
+ */
+static gboolean
+load_watched_cards (EAddrConduitContext *ctxt, GHashTable *watched, gint *num_contacts)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GPtrArray *fetch;
+	GSList *fetched = NULL;
+
+	ctxt->changed = NULL;
+
+	fetch = g_ptr_array_new ();
+	g_hash_table_iter_init (&iter, watched);
+	while (g_hash_table_iter_next (&iter, &key, NULL))
+		g_ptr_array_add (fetch, key);
+
+	if (!fetch_contacts_by_uid (ctxt, fetch, &fetched)) {
+		LOG (g_warning ("Failed to get Contacts"));
+		g_ptr_array_free (fetch, TRUE);
+		return FALSE;
+	}
+	g_ptr_array_free (fetch, TRUE);
+
+	g_hash_table_iter_init (&iter, ctxt->revs->base);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		EAddrRevEntry *old = value;
+
+		if (!g_hash_table_lookup (watched, key))
+			rev_index_set (ctxt->revs, key, old->rev, old->digest);
+	}
+
+	add_fetched_cards (ctxt, fetched);
+
+	/* Watched, known at the last sync and not found now */
+	g_hash_table_iter_init (&iter, watched);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		EContact *contact;
+
+		if (g_hash_table_lookup (ctxt->revs->current, key)
+		    || !g_hash_table_lookup (ctxt->revs->base, key))
+			continue;
+
+		contact = e_contact_new ();
+		e_contact_set (contact, E_CONTACT_UID, key);
+		ctxt->changed = g_list_prepend (ctxt->changed, book_change_new (contact, E_BOOK_CHANGE_CARD_DELETED));
+	}
+
+	ctxt->cards = g_list_reverse (ctxt->cards);
+	ctxt->changed = g_list_reverse (ctxt->changed);
+	ctxt->cards_complete = FALSE;
+	*num_contacts = g_hash_table_size (ctxt->revs->current);
+
+	ctxt->streaming = ctxt->cfg->stream_threshold > 0
+		&& *num_contacts >= ctxt->cfg->stream_threshold;
+	LOG (g_message ("%d UIDs changed of %d contacts%s", g_hash_table_size (watched),
+			*num_contacts, ctxt->streaming ? ", streaming" : ""));
+
+	return TRUE;
+}
+
 static GList *
 next_changed_item (EAddrConduitContext *ctxt, GList *changes)
 {
@@ -1046,12 +2198,12 @@ is_syncable (EAddrConduitContext *ctxt, EAddrLocalRecord *local)
 
 static void
 set_contact_text (EContact *contact, EContactField field, struct Address address,
-	gint entry, const gchar *pilot_charset)
+	gint entry, EPilotCharset *pilot_charset)
 {
 	gchar *text = NULL;
 
 	if (address.entry[entry])
-		text = e_pilot_utf8_from_pchar (address.entry[entry], pilot_charset);
+		text = e_pilot_charset_from_pchar (pilot_charset, address.entry[entry]);
 
 	e_contact_set (contact, field, text);
 
@@ -1059,10 +2211,10 @@ set_contact_text (EContact *contact, EContactField field, struct Address address
 }
 
 static gchar *
-get_entry_text (struct Address address, gint entry, const gchar *pilot_charset)
+get_entry_text (struct Address address, gint entry, EPilotCharset *pilot_charset)
 {
 	if (address.entry[entry])
-		return e_pilot_utf8_from_pchar (address.entry[entry], pilot_charset);
+		return e_pilot_charset_from_pchar (pilot_charset, address.entry[entry]);
 
 	return NULL;
 }
@@ -1076,6 +2228,17 @@ clear_entry_text (struct Address address, gint field)
 	}
 }
 
+/*
+ * Whether a contact that is not in changed_hash still counts as modified
+ */
+static gboolean
+contact_is_modified (EAddrConduitContext *ctxt, const gchar *uid)
+{
+	return ctxt->all_modified
+		&& !g_hash_table_lookup (ctxt->cleared, uid)
+		&& !e_pilot_map_uid_is_archived (ctxt->map, uid);
+}
+
 static void
 compute_status (EAddrConduitContext *ctxt, EAddrLocalRecord *local, const gchar *uid)
 {
@@ -1087,7 +2250,10 @@ compute_status (EAddrConduitContext *ctxt, EAddrLocalRecord *local, const gchar
 	ebc = g_hash_table_lookup (ctxt->changed_hash, uid);
 
 	if (ebc == NULL) {
-		local->local.attr = GnomePilotRecordNothing;
+		if (contact_is_modified (ctxt, uid))
+			local->local.attr = GnomePilotRecordModified;
+		else
+			local->local.attr = GnomePilotRecordNothing;
 		return;
 	}
 
@@ -1137,26 +2303,46 @@ local_record_to_pilot_record (EAddrLocalRecord *local,
 	p.length = buffer->used;
 	memcpy(p.record, buffer->data, buffer->used);
 
-	pi_buffer_free(buffer);
-	return p;
+	pi_buffer_free(buffer);
+	return p;
+}
+
+/*
+ * converts a EContact to a EAddrLocalRecord. Only the fields the sync
+ * engine needs to decide what to do are filled in, the Address is
+ * built by local_record_materialize
+ */
+static void
+local_record_from_ecard (EAddrLocalRecord *local, EContact *contact, EAddrConduitContext *ctxt)
+{
+	g_return_if_fail (local != NULL);
+	g_return_if_fail (contact != NULL);
+
+	local->contact = g_object_ref (contact);
+	local->local.ID = e_pilot_map_lookup_pid (ctxt->map, e_contact_get_const (contact, E_CONTACT_UID), TRUE);
+
+	compute_status (ctxt, local, e_contact_get_const (contact, E_CONTACT_UID));
 }
 
+/*
+ * builds the Address of a EAddrLocalRecord from its contact
+ */
 static void
-local_record_from_ecard (EAddrLocalRecord *local, EContact *contact, EAddrConduitContext *ctxt)
+local_record_materialize (EAddrLocalRecord *local, EAddrConduitContext *ctxt)
 {
+	EContact *contact;
 	EContactAddress *address = NULL;
 	gint phone = entryPhone1;
 	gboolean syncable;
 	gint i;
 
 	g_return_if_fail (local != NULL);
-	g_return_if_fail (contact != NULL);
-
-	local->contact = g_object_ref (contact);
-	local->local.ID = e_pilot_map_lookup_pid (ctxt->map, e_contact_get_const (contact, E_CONTACT_UID), TRUE);
+	g_return_if_fail (local->contact != NULL);
 
-	compute_status (ctxt, local, e_contact_get_const (contact, E_CONTACT_UID));
+	if (local->addr != NULL)
+		return;
 
+	contact = local->contact;
 	local->addr = g_new0 (struct Address, 1);
 
 	/* Handle the fields and category we don't sync by making sure
@@ -1199,10 +2385,10 @@ local_record_from_ecard (EAddrLocalRecord *local, EContact *contact, EAddrCondui
 	/*Category support*/
 	e_pilot_local_category_to_remote(&(local->local.category), contact, &(ctxt->ai.category), ctxt->pilot_charset);
 
-	local->addr->entry[entryFirstname] = e_pilot_utf8_to_pchar (e_contact_get_const (contact, E_CONTACT_GIVEN_NAME), ctxt->pilot_charset);
-	local->addr->entry[entryLastname] = e_pilot_utf8_to_pchar (e_contact_get_const (contact, E_CONTACT_FAMILY_NAME), ctxt->pilot_charset);
-	local->addr->entry[entryCompany] = e_pilot_utf8_to_pchar (e_contact_get_const (contact, E_CONTACT_ORG), ctxt->pilot_charset);
-	local->addr->entry[entryTitle] = e_pilot_utf8_to_pchar (e_contact_get_const (contact, E_CONTACT_TITLE), ctxt->pilot_charset);
+	local->addr->entry[entryFirstname] = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_contact_get_const (contact, E_CONTACT_GIVEN_NAME));
+	local->addr->entry[entryLastname] = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_contact_get_const (contact, E_CONTACT_FAMILY_NAME));
+	local->addr->entry[entryCompany] = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_contact_get_const (contact, E_CONTACT_ORG));
+	local->addr->entry[entryTitle] = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_contact_get_const (contact, E_CONTACT_TITLE));
 
 	/* See if the default has something in it */
 	address = e_contact_get (contact, ctxt->cfg->default_address);
@@ -1229,13 +2415,13 @@ local_record_from_ecard (EAddrLocalRecord *local, EContact *contact, EAddrCondui
 			add = g_strdup (address->street);
 			LOG (g_warning ("Address has only one line: [%s]\n", add));
 		}
-		local->addr->entry[entryAddress] = e_pilot_utf8_to_pchar (add, ctxt->pilot_charset);
+		local->addr->entry[entryAddress] = e_pilot_charset_to_pchar (ctxt->pilot_charset, add);
 		g_free (add);
 
-		local->addr->entry[entryCity] = e_pilot_utf8_to_pchar (address->locality, ctxt->pilot_charset);
-		local->addr->entry[entryState] = e_pilot_utf8_to_pchar (address->region, ctxt->pilot_charset);
-		local->addr->entry[entryZip] = e_pilot_utf8_to_pchar (address->code, ctxt->pilot_charset);
-		local->addr->entry[entryCountry] = e_pilot_utf8_to_pchar (address->country, ctxt->pilot_charset);
+		local->addr->entry[entryCity] = e_pilot_charset_to_pchar (ctxt->pilot_charset, address->locality);
+		local->addr->entry[entryState] = e_pilot_charset_to_pchar (ctxt->pilot_charset, address->region);
+		local->addr->entry[entryZip] = e_pilot_charset_to_pchar (ctxt->pilot_charset, address->code);
+		local->addr->entry[entryCountry] = e_pilot_charset_to_pchar (ctxt->pilot_charset, address->country);
 
 		e_contact_address_free (address);
 	}
@@ -1256,7 +2442,7 @@ local_record_from_ecard (EAddrLocalRecord *local, EContact *contact, EAddrCondui
 			phone_str = e_contact_get_const (contact, priority[i]);
 			if (phone_str && *phone_str) {
 				clear_entry_text (*local->addr, phone);
-				local->addr->entry[phone] = e_pilot_utf8_to_pchar (phone_str, ctxt->pilot_charset);
+				local->addr->entry[phone] = e_pilot_charset_to_pchar (ctxt->pilot_charset, phone_str);
 				local->addr->phoneLabel[phone - entryPhone1] = priority_label[i];
 				phone++;
 			}
@@ -1305,13 +2491,13 @@ local_record_from_ecard (EAddrLocalRecord *local, EContact *contact, EAddrCondui
 
 			if (phone_str && *phone_str) {
 				clear_entry_text (*local->addr, i);
-				local->addr->entry[i] = e_pilot_utf8_to_pchar (phone_str, ctxt->pilot_charset);
+				local->addr->entry[i] = e_pilot_charset_to_pchar (ctxt->pilot_charset, phone_str);
 			}
 		}
 	}
 
 	/* Note */
-	local->addr->entry[entryNote] = e_pilot_utf8_to_pchar (e_contact_get_const (contact, E_CONTACT_NOTE), ctxt->pilot_charset);
+	local->addr->entry[entryNote] = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_contact_get_const (contact, E_CONTACT_NOTE));
 }
 
 static void
@@ -1320,19 +2506,16 @@ local_record_from_uid (EAddrLocalRecord *local,
 		       EAddrConduitContext *ctxt)
 {
 	EContact *contact = NULL;
-	const gchar *cuid;
-	GList *l;
 
 	g_assert (local != NULL);
 
-	for (l = ctxt->cards; l != NULL; l = l->next) {
-		contact = l->data;
-
-		/* FIXME Do we need to check for the empty string? */
-		if ((cuid = e_contact_get_const (contact, E_CONTACT_UID)) && !strcmp (cuid, uid))
-			break;
+	contact = card_index_lookup (ctxt, uid);
 
-		contact = NULL;
+	/* only the changed contacts were loaded up front */
+	if (contact == NULL && !ctxt->cards_complete
+	    && e_book_client_get_contact_sync (ctxt->ebook, uid, &contact, NULL, NULL)) {
+		ctxt->cards = g_list_prepend (ctxt->cards, contact);
+		card_index_insert (ctxt, uid, contact);
 	}
 
 	if (contact != NULL) {
@@ -1494,7 +2677,7 @@ check_for_slow_setting (GnomePilotConduit *c, EAddrConduitContext *ctxt)
 	gint map_count;
 	const gchar *uid;
 
-	map_count = g_hash_table_size (ctxt->map->pid_map);
+	map_count = e_pilot_map_count_pids (ctxt->map);
 	if (map_count == 0)
 		gnome_pilot_conduit_standard_set_slow (conduit, TRUE);
 
@@ -1514,60 +2697,62 @@ check_for_slow_setting (GnomePilotConduit *c, EAddrConduitContext *ctxt)
 	}
 }
 
-/* Pilot syncing callbacks */
-static gint
-pre_sync (GnomePilotConduit *conduit,
-	  GnomePilotDBInfo *dbi,
-	  EAddrConduitContext *ctxt)
+/* The configured address book, or the default one */
+static EBookClient *
+addr_open_book (EAddrConduitContext *ctxt, gboolean report)
 {
-	GnomePilotConduitSyncAbs *abs_conduit;
-	EBookQuery *query;
-	gchar *query_str;
-	GSList *slist = NULL, *sl;
-	GList *l;
-	gint len;
-	gchar *filename;
-	gchar *change_id;
-	gint num_records, add_records = 0, mod_records = 0, del_records = 0;
-	pi_buffer_t *buffer;
-
-	abs_conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit);
-
-	LOG (g_message ( "---------------------------------------------------------\n" ));
-	LOG (g_message ( "pre_sync: Addressbook Conduit v.%s", CONDUIT_VERSION ));
-	/* g_message ("Addressbook Conduit v.%s", CONDUIT_VERSION); */
-
-	ctxt->dbi = dbi;
-
-	if (NULL == dbi->pilotInfo->pilot_charset)
-		ctxt->pilot_charset = NULL;
-	else
-		ctxt->pilot_charset = g_strdup(dbi->pilotInfo->pilot_charset);
+	EBookClient *ebook = NULL;
+	GError *error = NULL;
 
 	if (ctxt->cfg->source) {
-		GError *error = NULL;
-		ctxt->ebook = (EBookClient *) e_book_client_connect_sync (
-			ctxt->cfg->source, 30, NULL, &error);
-		if (error) {
+		ebook = addr_pool_get_client (ctxt->cfg->source, &error);
+		if (error && report)
 			g_warning ("Failed to connect to address book: %s", error->message);
-			g_error_free (error);
-		}
 	} else {
 		ESource *default_source = e_source_registry_ref_default_address_book (ctxt->cfg->registry);
 		if (default_source) {
-			GError *error = NULL;
-			ctxt->ebook = (EBookClient *) e_book_client_connect_sync (
-				default_source, 30, NULL, &error);
+			ebook = addr_pool_get_client (default_source, &error);
 			g_object_unref (default_source);
-			if (error) {
+			if (error && report)
 				g_warning ("Failed to connect to default address book: %s", error->message);
-				g_error_free (error);
-			}
 		}
 	}
+	g_clear_error (&error);
+
+	return ebook;
+}
+
+/* Pilot syncing callbacks */
+
+/*
+ * The part of pre_sync that only works on the local side: connects to
+ * the book and works out what changed. Runs on a preparation thread
+ * when the manager started one, so it reports failures through
+ * ctxt->prepare_error for pre_sync to pass on.
+ */
+static gint
+pre_sync_local (GnomePilotConduitSyncAbs *abs_conduit,
+		GnomePilotDBInfo *dbi,
+		EAddrConduitContext *ctxt)
+{
+	GList *l;
+	gchar *filename;
+	const gchar *source_uid;
+	GHashTable *watched;
+	gboolean loaded;
+	gint num_records, add_records = 0, mod_records = 0, del_records = 0;
+
+	ctxt->dbi = dbi;
+	ctxt->prepare_error = NULL;
+
+	ctxt->pilot_charset = e_pilot_charset_new (dbi->pilotInfo->pilot_charset);
+
+	/* unless open_local got it already */
+	if (ctxt->ebook == NULL)
+		ctxt->ebook = addr_open_book (ctxt, TRUE);
 	if (!ctxt->ebook) {
 		WARN(_("Could not load address book"));
-		gnome_pilot_conduit_error (conduit, _("Could not load address book"));
+		ctxt->prepare_error = _("Could not load address book");
 
 		return -1;
 	}
@@ -1577,40 +2762,27 @@ pre_sync (GnomePilotConduit *conduit,
 	e_pilot_map_read (filename, &ctxt->map);
 	g_free (filename);
 
-	/* Get a list of all contacts */
-	if (!(query = e_book_query_any_field_contains (""))) {
-		LOG (g_warning ("Failed to get EBookQuery"));
-		return -1;
-	}
+	/* Work out what changed since the last sync */
+	source_uid = e_source_get_uid (e_client_get_source (E_CLIENT (ctxt->ebook)));
+	filename = rev_index_name (ctxt);
+	ctxt->revs = rev_index_load (filename, source_uid);
+	g_free (filename);
 
-	query_str = e_book_query_to_string (query);
-	e_book_query_unref (query);
+	/* With a watch on the book since the last sync, only what it saw
+	   needs looking at */
+	filename = watch_name (ctxt->cfg->pilot_id);
+	watched = e_pilot_watch_take (filename, source_uid, ctxt->cfg->watch_session, &ctxt->watch_session);
+	g_free (filename);
 
-	if (!e_book_client_get_contacts_sync (ctxt->ebook, query_str, &slist, NULL, NULL)) {
-		LOG (g_warning ("Failed to get Contacts"));
-		g_free (query_str);
+	if (watched != NULL && ctxt->revs->base != NULL)
+		loaded = load_watched_cards (ctxt, watched, &num_records);
+	else
+		loaded = load_changed_cards (ctxt, &num_records);
+	if (watched != NULL)
+		g_hash_table_destroy (watched);
+	if (!loaded)
 		return -1;
-	}
-	g_free (query_str);
-
-	/* Convert GSList to GList for compatibility with rest of code */
-	ctxt->cards = NULL;
-	for (sl = slist; sl != NULL; sl = sl->next)
-		ctxt->cards = g_list_prepend (ctxt->cards, sl->data);
-	ctxt->cards = g_list_reverse (ctxt->cards);
-	g_slist_free (slist);
 
-	/* Count and hash the changes.
-	 * e_book_get_changes() is removed in modern EDS.
-	 * Treat all contacts as potentially modified for sync purposes. */
-	ctxt->changed = NULL;
-	for (l = ctxt->cards; l != NULL; l = l->next) {
-		EBookChange *ebc = g_new0 (EBookChange, 1);
-		ebc->change_type = E_BOOK_CHANGE_CARD_MODIFIED;
-		ebc->contact = g_object_ref (l->data);
-		ctxt->changed = g_list_prepend (ctxt->changed, ebc);
-	}
-	ctxt->changed = g_list_reverse (ctxt->changed);
 	ctxt->changed_hash = g_hash_table_new (g_str_hash, g_str_equal);
 
 	for (l = ctxt->changed; l != NULL; l = l->next) {
@@ -1638,13 +2810,65 @@ pre_sync (GnomePilotConduit *conduit,
 		}
 	}
 
+	if (ctxt->all_modified)
+		mod_records = num_records;
+
 	/* Set the count information */
-	num_records = g_list_length (ctxt->cards);
 	gnome_pilot_conduit_sync_abs_set_num_local_records(abs_conduit, num_records);
 	gnome_pilot_conduit_sync_abs_set_num_new_local_records (abs_conduit, add_records);
 	gnome_pilot_conduit_sync_abs_set_num_updated_local_records (abs_conduit, mod_records);
 	gnome_pilot_conduit_sync_abs_set_num_deleted_local_records(abs_conduit, del_records);
 
+	return 0;
+}
+
+/* The client outlives the preparation, so it is connected on the
+   thread running the sync, whose main context it reports to */
+static gint
+open_local (GnomePilotConduitSyncAbs *conduit,
+	    GnomePilotDBInfo *dbi,
+	    EAddrConduitContext *ctxt)
+{
+	ctxt->ebook = addr_open_book (ctxt, FALSE);
+
+	/* pre_sync tries again and reports why */
+	return ctxt->ebook != NULL ? 0 : -1;
+}
+
+static gint
+prepare_local (GnomePilotConduitSyncAbs *conduit,
+	       GnomePilotDBInfo *dbi,
+	       EAddrConduitContext *ctxt)
+{
+	LOG (g_message ( "prepare_local: loading the address book ahead of pre_sync" ));
+
+	ctxt->prepare_result = pre_sync_local (conduit, dbi, ctxt);
+	ctxt->prepared = TRUE;
+
+	return ctxt->prepare_result;
+}
+
+static gint
+pre_sync (GnomePilotConduit *conduit,
+	  GnomePilotDBInfo *dbi,
+	  EAddrConduitContext *ctxt)
+{
+	gint len;
+	pi_buffer_t *buffer;
+
+	LOG (g_message ( "---------------------------------------------------------\n" ));
+	LOG (g_message ( "pre_sync: Addressbook Conduit v.%s", CONDUIT_VERSION ));
+	/* g_message ("Addressbook Conduit v.%s", CONDUIT_VERSION); */
+
+	if (!ctxt->prepared)
+		ctxt->prepare_result = pre_sync_local (GNOME_PILOT_CONDUIT_SYNC_ABS (conduit), dbi, ctxt);
+	ctxt->prepared = FALSE;
+	if (ctxt->prepare_result < 0) {
+		if (ctxt->prepare_error)
+			gnome_pilot_conduit_error (conduit, ctxt->prepare_error);
+		return -1;
+	}
+
 	buffer = pi_buffer_new(DLP_BUF_SIZE);
 	if (buffer == NULL) {
 		return pi_set_error(dbi->pilot_socket, PI_ERR_GENERIC_MEMORY);
@@ -1680,6 +2904,12 @@ post_sync (GnomePilotConduit *conduit,
 
 	LOG (g_message ( "post_sync: Address Conduit v.%s", CONDUIT_VERSION ));
 
+	/* Write what came from the pilot to the address book */
+	if (!flush_pending_writes (ctxt) || ctxt->write_failed) {
+		WARN ("Could not write changes to the address book");
+		return -1;
+	}
+
 	/* Write AppBlock to PDA - updates categories */
 	buf = (guchar *)g_malloc (0xffff);
 
@@ -1698,6 +2928,16 @@ post_sync (GnomePilotConduit *conduit,
 		return -1;
 	}
 
+	/* What the watch saw is taken care of once the index is saved */
+	g_free (ctxt->cfg->watch_session);
+	ctxt->cfg->watch_session = NULL;
+	if (rev_index_save (ctxt->revs)) {
+		filename = watch_name (ctxt->cfg->pilot_id);
+		e_pilot_watch_done (filename);
+		g_free (filename);
+		ctxt->cfg->watch_session = g_strdup (ctxt->watch_session);
+	}
+
 	g_free (ctxt->cfg->last_uri);
 	ctxt->cfg->last_uri = ctxt->cfg->source ?
 		g_strdup (e_source_get_uid (ctxt->cfg->source)) : NULL;
@@ -1707,10 +2947,8 @@ post_sync (GnomePilotConduit *conduit,
 	e_pilot_map_write (filename, ctxt->map);
 	g_free (filename);
 
-	/* e_book_get_changes is removed in modern EDS; no change tracking reset needed */
-
-	if (ctxt->pilot_charset)
-		g_free (ctxt->pilot_charset);
+	e_pilot_charset_free (ctxt->pilot_charset);
+	ctxt->pilot_charset = NULL;
 	LOG (g_message ( "---------------------------------------------------------\n" ));
 
 	return 0;
@@ -1738,12 +2976,63 @@ set_status_cleared (GnomePilotConduitSyncAbs *conduit,
 
 	LOG (g_message ( "set_status_cleared: clearing status\n" ));
 
-	if ((uid = e_contact_get_const (local->contact, E_CONTACT_UID)))
+	if ((uid = e_contact_get_const (local->contact, E_CONTACT_UID))) {
 		g_hash_table_remove (ctxt->changed_hash, uid);
+		if (ctxt->all_modified)
+			g_hash_table_add (ctxt->cleared, g_strdup (uid));
+	}
 
         return 0;
 }
 
+/*
+ * for_each and for_each_modified over a contact stream
+ */
+static gint
+for_each_streamed (EAddrConduitContext *ctxt, EAddrLocalRecord **local, gboolean modified_only)
+{
+	EContact *contact;
+
+	/* The engine is done with the previous record once it asks for
+	   the next one, and whatever it staged holds its own reference to
+	   the contact; only what match hands out outlives the step */
+	if (*local != NULL) {
+		ctxt->locals = g_list_remove (ctxt->locals, *local);
+		addrconduit_destroy_record (*local);
+		*local = NULL;
+	} else {
+		LOG (g_message ( "beginning streamed for_each%s", modified_only ? "_modified" : "" ));
+
+		if (ctxt->stream != NULL)
+			contact_stream_close (ctxt->stream);
+		if (!(ctxt->stream = contact_stream_open (ctxt)))
+			return -1;
+	}
+
+	while ((contact = contact_stream_next (ctxt->stream))) {
+		if (!modified_only || contact_is_modified (ctxt, e_contact_get_const (contact, E_CONTACT_UID)))
+			break;
+	}
+
+	if (contact == NULL) {
+		gboolean failed = ctxt->stream->failed;
+
+		LOG (g_message ( "streamed for_each ending" ));
+
+		contact_stream_close (ctxt->stream);
+		ctxt->stream = NULL;
+
+		*local = NULL;
+		return failed ? -1 : 0;
+	}
+
+	*local = g_new0 (EAddrLocalRecord, 1);
+	local_record_from_ecard (*local, contact, ctxt);
+	ctxt->locals = g_list_prepend (ctxt->locals, *local);
+
+	return 0;
+}
+
 static gint
 for_each (GnomePilotConduitSyncAbs *conduit,
 	  EAddrLocalRecord **local,
@@ -1754,9 +3043,15 @@ for_each (GnomePilotConduitSyncAbs *conduit,
 
 	g_return_val_if_fail (local != NULL, -1);
 
+	if (ctxt->streaming)
+		return for_each_streamed (ctxt, local, FALSE);
+
 	if (*local == NULL) {
 		LOG (g_message ( "beginning for_each" ));
 
+		if (!ctxt->cards_complete && !load_all_cards (ctxt))
+			return -1;
+
 		cards = ctxt->cards;
 		count = 0;
 
@@ -1804,6 +3099,11 @@ for_each_modified (GnomePilotConduitSyncAbs *conduit,
 
 	g_return_val_if_fail (local != NULL, 0);
 
+	/* with all_modified set, changed only holds what the
+	   conduit added itself */
+	if (ctxt->all_modified)
+		return for_each_streamed (ctxt, local, TRUE);
+
 	if (*local == NULL) {
 		LOG (g_message ( "for_each_modified beginning\n" ));
 
@@ -1882,8 +3182,6 @@ add_record (GnomePilotConduitSyncAbs *conduit,
 	    EAddrConduitContext *ctxt)
 {
 	EContact *contact;
-	GError *error = NULL;
-	gchar *uid = NULL;
 	gint retval = 0;
 
 	g_return_val_if_fail (remote != NULL, -1);
@@ -1892,18 +3190,9 @@ add_record (GnomePilotConduitSyncAbs *conduit,
 
 	contact = ecard_from_remote_record (ctxt, remote, NULL);
 
-	/* add the ecard to the server */
-	if (!e_book_client_add_contact_sync (ctxt->ebook, contact, E_BOOK_OPERATION_FLAG_NONE, &uid, NULL, &error)) {
-		WARN ("add_record: failed to add card to ebook: %s\n", error ? error->message : "unknown error");
-		if (error) g_error_free (error);
-		g_object_unref (contact);
-
-		return -1;
-	}
+	/* add the ecard to the server, it gets mapped once it has a UID */
+	retval = stage_add (ctxt, contact, remote->ID, FALSE);
 
-	e_pilot_map_insert (ctxt->map, remote->ID, uid ? uid : e_contact_get_const (contact, E_CONTACT_UID), FALSE);
-
-	g_free (uid);
 	g_object_unref (contact);
 
 	return retval;
@@ -1933,43 +3222,31 @@ replace_record (GnomePilotConduitSyncAbs *conduit,
 	local->contact = new_contact;
 
 	if (ebc && ebc->change_type == E_BOOK_CHANGE_CARD_DELETED) {
-		GError *error = NULL;
-		gchar *uid = NULL;
-		if (!e_book_client_add_contact_sync (ctxt->ebook, local->contact, E_BOOK_OPERATION_FLAG_NONE, &uid, NULL, &error)) {
-			WARN (G_STRLOC ": failed to add card: %s\n", error ? error->message : "unknown");
-			if (error) g_error_free (error);
-
-			return -1;
-		}
-		g_free (uid);
+		const gchar *uid = e_contact_get_const (local->contact, E_CONTACT_UID);
+		gboolean archived;
+
+		/* Adding a record causes wombat to assign a new uid, it is
+		   mapped and indexed under that one once the add is flushed */
+		archived = e_pilot_map_uid_is_archived (ctxt->map, old_id);
+		rev_index_remove (ctxt, old_id);
+		card_index_remove (ctxt, old_id);
+
+		g_hash_table_remove (ctxt->changed_hash, old_id);
+		g_object_unref (ebc->contact);
+		g_object_ref (local->contact);
+		ebc->contact = local->contact;
+		/* FIXME We should possibly be duplicating the uid */
+		g_hash_table_insert (ctxt->changed_hash, (gpointer) uid, ebc);
+
+		retval = stage_add (ctxt, local->contact, remote->ID, archived);
 	} else {
-		GError *error = NULL;
-		if (!e_book_client_modify_contact_sync (ctxt->ebook, local->contact, E_BOOK_OPERATION_FLAG_NONE, NULL, &error)) {
-			WARN (G_STRLOC ": failed to commit card: %s\n", error ? error->message : "unknown");
-			if (error) g_error_free (error);
+		rev_index_update (ctxt, e_contact_get_const (local->contact, E_CONTACT_UID), local->contact);
+		card_index_insert (ctxt, e_contact_get_const (local->contact, E_CONTACT_UID), local->contact);
 
-			return -1;
-		}
+		retval = stage_modify (ctxt, local->contact);
 	}
 
-	/* Adding a record causes wombat to assign a new uid so we must tidy */
-	if (ebc && ebc->change_type == E_BOOK_CHANGE_CARD_DELETED) {
-		const gchar *uid = e_contact_get_const (local->contact, E_CONTACT_UID);
-		gboolean arch;
-
-		arch = e_pilot_map_uid_is_archived (ctxt->map, uid);
-		e_pilot_map_insert (ctxt->map, remote->ID, uid, arch);
-
-		ebc = g_hash_table_lookup (ctxt->changed_hash, old_id);
-		if (ebc) {
-			g_hash_table_remove (ctxt->changed_hash, old_id);
-			g_object_unref (ebc->contact);
-			g_object_ref (local->contact);
-			ebc->contact = local->contact;
-			/* FIXME We should possibly be duplicating the uid */
-			g_hash_table_insert (ctxt->changed_hash, (gpointer) uid, ebc);
-		}
-	}
+	g_free (old_id);
 
 	return retval;
 }
@@ -1979,7 +3256,6 @@ delete_record (GnomePilotConduitSyncAbs *conduit,
 	       EAddrLocalRecord *local,
 	       EAddrConduitContext *ctxt)
 {
-	GError *error = NULL;
 	gint retval = 0;
 
 	g_return_val_if_fail (local != NULL, -1);
@@ -1988,13 +3264,9 @@ delete_record (GnomePilotConduitSyncAbs *conduit,
 	LOG (g_message ( "delete_record: delete %s\n", print_local (local) ));
 
 	e_pilot_map_remove_by_uid (ctxt->map, e_contact_get_const (local->contact, E_CONTACT_UID));
-	if (!e_book_client_remove_contact_by_uid_sync (ctxt->ebook, e_contact_get_const (local->contact, E_CONTACT_UID), E_BOOK_OPERATION_FLAG_NONE, NULL, &error)) {
-		if (error && !g_error_matches (error, E_BOOK_CLIENT_ERROR, E_BOOK_CLIENT_ERROR_CONTACT_NOT_FOUND)) {
-			WARN ("delete_record: failed to delete card in ebook: %s\n", error->message);
-			retval = -1;
-		}
-		if (error) g_error_free (error);
-	}
+	rev_index_remove (ctxt, e_contact_get_const (local->contact, E_CONTACT_UID));
+	card_index_remove (ctxt, e_contact_get_const (local->contact, E_CONTACT_UID));
+	retval = stage_remove (ctxt, e_contact_get_const (local->contact, E_CONTACT_UID));
 
 	return retval;
 }
@@ -2060,6 +3332,18 @@ free_match (GnomePilotConduitSyncAbs *conduit,
 	return 0;
 }
 
+static gint
+materialize (GnomePilotConduitSyncAbs *conduit,
+	     EAddrLocalRecord *local,
+	     EAddrConduitContext *ctxt)
+{
+	g_return_val_if_fail (local != NULL, -1);
+
+	local_record_materialize (local, ctxt);
+
+	return 0;
+}
+
 static gint
 prepare (GnomePilotConduitSyncAbs *conduit,
 	 EAddrLocalRecord *local,
@@ -2142,6 +3426,165 @@ revert_settings  (GnomePilotConduit *conduit, EAddrConduitContext *ctxt)
 	ctxt->new_cfg = addrconduit_dupe_configuration (ctxt->cfg);
 }
 
+/* Local change watch
+ *
+ * Run inside gpilotd between syncs, see e-pilot-watch.c. The view does
+ * not report the contacts already in the book, and the log only starts
+ * once it is complete.
+ */
+
+typedef struct {
+	EBookClient *ebook;
+	EBookClientView *view;
+	gchar *filename;
+	gchar *source_uid;
+	EPilotWatchLog *log;
+	gboolean dead;
+} EAddrWatch;
+
+/* The view stopped reporting, what it logged so far cannot be trusted */
+static void
+addr_watch_break (EAddrWatch *watch)
+{
+	watch->dead = TRUE;
+	if (watch->log != NULL)
+		e_pilot_watch_log_break (watch->log);
+}
+
+static void
+addr_watch_contacts_changed (EBookClientView *view, const GSList *contacts, EAddrWatch *watch)
+{
+	const GSList *l;
+
+	if (watch->log == NULL)
+		return;
+
+	for (l = contacts; l != NULL; l = l->next)
+		e_pilot_watch_log_add (watch->log, E_PILOT_WATCH_CHANGED,
+				       e_contact_get_const (l->data, E_CONTACT_UID));
+}
+
+static void
+addr_watch_contacts_removed (EBookClientView *view, const GSList *uids, EAddrWatch *watch)
+{
+	const GSList *l;
+
+	if (watch->log == NULL)
+		return;
+
+	for (l = uids; l != NULL; l = l->next)
+		e_pilot_watch_log_add (watch->log, E_PILOT_WATCH_REMOVED, l->data);
+}
+
+static void
+addr_watch_complete (EBookClientView *view, const GError *error, EAddrWatch *watch)
+{
+	if (error != NULL) {
+		WARN ("Could not watch %s: %s", watch->source_uid, error->message);
+		addr_watch_break (watch);
+		return;
+	}
+
+	if (watch->log == NULL && !watch->dead)
+		watch->log = e_pilot_watch_log_new (watch->filename, watch->source_uid);
+}
+
+static void
+addr_watch_backend_died (EClient *client, EAddrWatch *watch)
+{
+	WARN ("Backend of %s died", watch->source_uid);
+	addr_watch_break (watch);
+}
+
+static void
+addr_watch_client_dropped (EClient *client, gpointer watch)
+{
+	WARN ("Connection to %s was dropped", ((EAddrWatch *) watch)->source_uid);
+	addr_watch_break (watch);
+}
+
+void
+conduit_stop_watch (gpointer data)
+{
+	EAddrWatch *watch = data;
+
+	if (watch == NULL)
+		return;
+
+	if (watch->view != NULL) {
+		g_signal_handlers_disconnect_matched (watch->view, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, watch);
+		e_book_client_view_stop (watch->view, NULL);
+		g_object_unref (watch->view);
+	}
+	if (watch->ebook != NULL) {
+		g_signal_handlers_disconnect_matched (watch->ebook, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, watch);
+		e_pilot_client_pool_remove_dropped_func (E_CLIENT (watch->ebook), watch);
+		e_pilot_client_pool_release (E_CLIENT (watch->ebook));
+	}
+
+	e_pilot_watch_log_free (watch->log);
+	g_free (watch->source_uid);
+	g_free (watch->filename);
+	g_free (watch);
+}
+
+gpointer
+conduit_start_watch (guint32 pilot_id)
+{
+	EAddrConduitCfg *cfg;
+	EAddrWatch *watch;
+	GSList *fields;
+	gchar *query_str;
+	GError *error = NULL;
+
+	cfg = addrconduit_load_configuration (pilot_id);
+	if (cfg->sync_type == GnomePilotConduitSyncTypeNotSet || cfg->source == NULL) {
+		addrconduit_destroy_configuration (cfg);
+		return NULL;
+	}
+
+	watch = g_new0 (EAddrWatch, 1);
+	watch->filename = watch_name (pilot_id);
+	watch->source_uid = g_strdup (e_source_get_uid (cfg->source));
+
+	watch->ebook = addr_pool_get_client (cfg->source, &error);
+	addrconduit_destroy_configuration (cfg);
+
+	query_str = all_contacts_query ();
+	if (watch->ebook == NULL || query_str == NULL
+	    || !e_book_client_get_view_sync (watch->ebook, query_str, &watch->view, NULL, &error)) {
+		WARN ("Could not watch %s: %s", watch->source_uid, error ? error->message : "");
+		g_clear_error (&error);
+		g_free (query_str);
+		conduit_stop_watch (watch);
+		return NULL;
+	}
+	g_free (query_str);
+
+	/* only the UIDs are of interest, and only from now on */
+	fields = g_slist_prepend (NULL, (gpointer) e_contact_field_name (E_CONTACT_UID));
+	e_book_client_view_set_fields_of_interest (watch->view, fields, NULL);
+	g_slist_free (fields);
+	e_book_client_view_set_flags (watch->view, E_BOOK_CLIENT_VIEW_FLAGS_NONE, NULL);
+
+	g_signal_connect (watch->view, "objects-added", G_CALLBACK (addr_watch_contacts_changed), watch);
+	g_signal_connect (watch->view, "objects-modified", G_CALLBACK (addr_watch_contacts_changed), watch);
+	g_signal_connect (watch->view, "objects-removed", G_CALLBACK (addr_watch_contacts_removed), watch);
+	g_signal_connect (watch->view, "complete", G_CALLBACK (addr_watch_complete), watch);
+	g_signal_connect (watch->ebook, "backend-died", G_CALLBACK (addr_watch_backend_died), watch);
+	e_pilot_client_pool_add_dropped_func (E_CLIENT (watch->ebook), addr_watch_client_dropped, watch);
+
+	e_book_client_view_start (watch->view, &error);
+	if (error != NULL) {
+		WARN ("Could not watch %s: %s", watch->source_uid, error->message);
+		g_error_free (error);
+		conduit_stop_watch (watch);
+		return NULL;
+	}
+
+	return watch;
+}
+
 GnomePilotConduit *
 conduit_get_gpilot_conduit (guint32 pilot_id)
 {
@@ -2175,6 +3618,9 @@ conduit_get_gpilot_conduit (guint32 pilot_id)
 	g_signal_connect (retval, "free_match", G_CALLBACK (free_match), ctxt);
 
 	g_signal_connect (retval, "prepare", G_CALLBACK (prepare), ctxt);
+	g_signal_connect (retval, "materialize", G_CALLBACK (materialize), ctxt);
+	g_signal_connect (retval, "open_local", G_CALLBACK (open_local), ctxt);
+	g_signal_connect (retval, "prepare_local", G_CALLBACK (prepare_local), ctxt);
 
 	/* Gui Settings */
 	g_signal_connect (retval, "create_settings_window", G_CALLBACK (create_settings_window), ctxt);
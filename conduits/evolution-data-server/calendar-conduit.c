@@ -43,11 +43,15 @@
 
 GnomePilotConduit * conduit_get_gpilot_conduit (guint32);
 void conduit_destroy_gpilot_conduit (GnomePilotConduit*);
+gpointer conduit_start_watch (guint32);
+void conduit_stop_watch (gpointer);
 
 #define CONDUIT_VERSION "0.1.6"
 
+/* per-record output, see configure --enable-record-debug */
+#ifdef GPILOT_DEBUG_RECORDS
 #define DEBUG_CALCONDUIT 1
-/* #undef DEBUG_CALCONDUIT */
+#endif
 
 #ifdef DEBUG_CALCONDUIT
 #define LOG(x) x
@@ -153,8 +157,10 @@ static void
 calconduit_destroy_record (ECalLocalRecord *local)
 {
 	g_object_unref (local->comp);
-	free_Appointment (local->appt);
-	g_free (local->appt);
+	if (local->appt != NULL) {
+		free_Appointment (local->appt);
+		g_free (local->appt);
+	}
 	g_free (local);
 }
 
@@ -169,6 +175,8 @@ struct _ECalConduitCfg {
 	gboolean multi_day_split;
 
 	gchar *last_uri;
+	/* the local change watch seen at the last sync */
+	gchar *watch_session;
 };
 
 static ECalConduitCfg *
@@ -245,6 +253,8 @@ calconduit_load_configuration (guint32 pilot_id)
 		g_free (filename);
 	}
 
+	c->watch_session = e_pilot_setup_get_string (prefix, "watch_session", NULL);
+
 	return c;
 }
 
@@ -260,6 +270,7 @@ calconduit_save_configuration (ECalConduitCfg *c)
 	e_pilot_setup_set_bool (prefix, "secret", c->secret);
 	e_pilot_setup_set_bool (prefix, "multi_day_split", c->multi_day_split);
 	e_pilot_setup_set_string (prefix, "last_uri", c->last_uri ? c->last_uri : "");
+	e_pilot_setup_set_string (prefix, "watch_session", c->watch_session ? c->watch_session : "");
 }
 
 static ECalConduitCfg*
@@ -279,6 +290,7 @@ calconduit_dupe_configuration (ECalConduitCfg *c)
 	retval->secret = c->secret;
 	retval->multi_day_split = c->multi_day_split;
 	retval->last_uri = g_strdup (c->last_uri);
+	retval->watch_session = g_strdup (c->watch_session);
 
 	return retval;
 }
@@ -293,6 +305,7 @@ calconduit_destroy_configuration (ECalConduitCfg *c)
 	if (c->source)
 		g_object_unref (c->source);
 	g_free (c->last_uri);
+	g_free (c->watch_session);
 	g_free (c);
 }
 
@@ -365,13 +378,32 @@ struct _ECalConduitContext {
 	icaltimezone *timezone;
 	ECalComponent *default_comp;
 	GList *comps;
+	/* FALSE while comps only holds what the watch reported */
+	gboolean comps_complete;
+	gchar *watch_session;
 	GList *changed;
 	GHashTable *changed_hash;
 	GList *locals;
 
 	EPilotMap *map;
+	ECalChangeJournal *journal;
+	ECalCompIndex *index;
+	ECalWriteBatch *batch;
+
+	/* tzid -> icaltimezone, including misses, for this sync */
+	GHashTable *timezones;
+	GSList *timezone_refs;
+
+	/* uid -> ECalSplitEntry, kept between syncs */
+	gchar *splits_filename;
+	GHashTable *splits;
 
-	gchar *pilot_charset;
+	EPilotCharset *pilot_charset;
+
+	/* pre_sync_local () already ran from prepare_local */
+	gboolean prepared;
+	gint prepare_result;
+	const gchar *prepare_error;
 };
 
 static ECalConduitContext *
@@ -394,6 +426,13 @@ e_calendar_context_new (guint32 pilot_id)
 	ctxt->changed_hash = NULL;
 	ctxt->locals = NULL;
 	ctxt->map = NULL;
+	ctxt->journal = NULL;
+	ctxt->index = NULL;
+	ctxt->batch = NULL;
+	ctxt->timezones = NULL;
+	ctxt->timezone_refs = NULL;
+	ctxt->splits_filename = NULL;
+	ctxt->splits = NULL;
 
 	return ctxt;
 }
@@ -421,7 +460,7 @@ e_calendar_context_destroy (ECalConduitContext *ctxt)
 		e_cal_gui_destroy (ctxt->gui);
 
 	if (ctxt->client != NULL)
-		g_object_unref (ctxt->client);
+		e_pilot_client_pool_release (E_CLIENT (ctxt->client));
 	if (ctxt->default_comp != NULL)
 		g_object_unref (ctxt->default_comp);
 	if (ctxt->comps != NULL) {
@@ -446,6 +485,21 @@ e_calendar_context_destroy (ECalConduitContext *ctxt)
 
 	if (ctxt->map != NULL)
 		e_pilot_map_destroy (ctxt->map);
+	if (ctxt->journal != NULL)
+		e_cal_change_journal_free (ctxt->journal);
+	g_free (ctxt->watch_session);
+	if (ctxt->index != NULL)
+		e_cal_comp_index_free (ctxt->index);
+	if (ctxt->batch != NULL)
+		e_cal_write_batch_free (ctxt->batch);
+
+	if (ctxt->timezones != NULL)
+		g_hash_table_destroy (ctxt->timezones);
+	g_slist_free_full (ctxt->timezone_refs, g_object_unref);
+
+	if (ctxt->splits != NULL)
+		g_hash_table_destroy (ctxt->splits);
+	g_free (ctxt->splits_filename);
 }
 
 /* Debug routines */
@@ -519,12 +573,13 @@ start_calendar_server (ECalConduitContext *ctxt)
 	g_return_val_if_fail (ctxt != NULL, -2);
 
 	if (ctxt->cfg->source) {
-		ctxt->client = (ECalClient *) e_cal_client_connect_sync (
-			ctxt->cfg->source,
-			E_CAL_CLIENT_SOURCE_TYPE_EVENTS,
-			30, /* timeout seconds */
-			NULL, /* cancellable */
-			&error);
+		/* a warm client from an earlier sync or the watch if there
+		   is one, unless open_local got it already */
+		if (ctxt->client == NULL)
+			ctxt->client = e_cal_pool_get_client (
+				ctxt->cfg->source,
+				E_CAL_CLIENT_SOURCE_TYPE_EVENTS,
+				&error);
 
 		if (!ctxt->client) {
 			if (error) {
@@ -548,17 +603,32 @@ start_calendar_server (ECalConduitContext *ctxt)
 
 /* Utility routines */
 static icaltimezone *
-get_timezone (ECalClient *client, const gchar *tzid)
+get_timezone (ECalConduitContext *ctxt, const gchar *tzid)
 {
 	icaltimezone *timezone = NULL;
+	gpointer cached;
+
+	if (tzid == NULL)
+		return NULL;
+
+	/* Most events share a handful of zones, ask the server once */
+	if (ctxt->timezones == NULL)
+		ctxt->timezones = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+	else if (g_hash_table_lookup_extended (ctxt->timezones, tzid, NULL, &cached))
+		return cached;
 
 	timezone = icaltimezone_get_builtin_timezone_from_tzid (tzid);
 	if (timezone == NULL) {
 		ICalTimezone *izone = NULL;
-		if (e_cal_client_get_timezone_sync (client, tzid, &izone, NULL, NULL) && izone)
+		if (e_cal_client_get_timezone_sync (ctxt->client, tzid, &izone, NULL, NULL) && izone) {
 			timezone = (icaltimezone *) i_cal_object_get_native (I_CAL_OBJECT (izone));
+			/* the native zone lives as long as its wrapper */
+			ctxt->timezone_refs = g_slist_prepend (ctxt->timezone_refs, izone);
+		}
 	}
 
+	g_hash_table_insert (ctxt->timezones, g_strdup (tzid), timezone);
+
 	return timezone;
 }
 
@@ -600,6 +670,63 @@ map_name (ECalConduitContext *ctxt)
 	return filename;
 }
 
+static gchar *
+journal_name (ECalConduitContext *ctxt)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-journal-calendar-%d", ctxt->cfg->pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "calendar", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "calendar", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
+static gchar *
+watch_name (guint32 pilot_id)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-watch-calendar-%d", pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "calendar", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "calendar", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
+static gchar *
+splits_name (ECalConduitContext *ctxt)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-splits-calendar-%d", ctxt->cfg->pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "calendar", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "calendar", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
 static icalrecurrencetype_weekday
 get_ical_day (gint day)
 {
@@ -657,7 +784,7 @@ is_empty_time (struct tm time)
 }
 
 static gboolean
-is_all_day (ECalClient *client, ECalComponentDateTime *dt_start, ECalComponentDateTime *dt_end)
+is_all_day (ECalConduitContext *ctxt, ECalComponentDateTime *dt_start, ECalComponentDateTime *dt_end)
 {
 	time_t dt_start_time, dt_end_time;
 	icaltimezone *timezone;
@@ -669,9 +796,9 @@ is_all_day (ECalClient *client, ECalComponentDateTime *dt_start, ECalComponentDa
 	if (i_cal_time_is_date (start_val) && i_cal_time_is_date (end_val))
 		return TRUE;
 
-	timezone = get_timezone (client, start_tzid);
+	timezone = get_timezone (ctxt, start_tzid);
 	dt_start_time = icaltime_as_timet_with_zone (*(struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (start_val)), timezone);
-	dt_end_time = icaltime_as_timet_with_zone (*(struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (end_val)), get_timezone (client, end_tzid));
+	dt_end_time = icaltime_as_timet_with_zone (*(struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (end_val)), get_timezone (ctxt, end_tzid));
 
 	{
 		ICalTimezone *itz = wrap_icaltimezone (timezone);
@@ -684,6 +811,16 @@ is_all_day (ECalClient *client, ECalComponentDateTime *dt_start, ECalComponentDa
 	return FALSE;
 }
 
+/* The pieces replace the event, which goes with the other writes and
+   is no longer what the calendar holds */
+static void
+split_remove_original (ECalConduitContext *ctxt, const gchar *uid)
+{
+	e_cal_write_batch_remove (ctxt->batch, uid);
+	e_cal_change_journal_remove (ctxt->journal, uid);
+	e_cal_comp_index_remove (ctxt->index, uid);
+}
+
 static gboolean
 process_multi_day (ECalConduitContext *ctxt, ECalChange *ccc, GList **multi_comp, GList **multi_ccc)
 {
@@ -712,7 +849,7 @@ process_multi_day (ECalConduitContext *ctxt, ECalChange *ccc, GList **multi_comp
 	if (i_cal_time_is_date (start_val))
 		tz_start = ctxt->timezone;
 	else
-		tz_start = get_timezone (ctxt->client, e_cal_component_datetime_get_tzid (dt_start));
+		tz_start = get_timezone (ctxt, e_cal_component_datetime_get_tzid (dt_start));
 	event_start = icaltime_as_timet_with_zone (*(struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (start_val)), tz_start);
 
 	dt_end = e_cal_component_get_dtend (ccc->comp);
@@ -725,7 +862,7 @@ process_multi_day (ECalConduitContext *ctxt, ECalChange *ccc, GList **multi_comp
 	if (i_cal_time_is_date (end_val))
 		tz_end = ctxt->timezone;
 	else
-		tz_end = get_timezone (ctxt->client, e_cal_component_datetime_get_tzid (dt_end));
+		tz_end = get_timezone (ctxt, e_cal_component_datetime_get_tzid (dt_end));
 	event_end = icaltime_as_timet_with_zone (*(struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (end_val)), tz_end);
 
 	{
@@ -808,8 +945,7 @@ process_multi_day (ECalConduitContext *ctxt, ECalChange *ccc, GList **multi_comp
 	}
 
 	uid = e_cal_component_get_uid (ccc->comp);
-	/* FIXME Error handling */
-	e_cal_client_remove_object_sync (ctxt->client, uid, NULL, E_CAL_OBJ_MOD_ALL, E_CAL_OPERATION_FLAG_NONE, NULL, NULL);
+	split_remove_original (ctxt, uid);
 
 	ccc->type = E_CAL_CHANGE_DELETED;
 
@@ -820,6 +956,263 @@ process_multi_day (ECalConduitContext *ctxt, ECalChange *ccc, GList **multi_comp
 	return ret;
 }
 
+/*
+ * Split cache
+ *
+ * Remembers, per UID, what process_multi_day () made of an event last
+ * time, keyed by everything the outcome depends on. Unchanged events are
+ * then neither recomputed nor split a second time when the original was
+ * left behind in the calendar.
+ */
+
+#define SPLITS_HEADER "gnome-pilot-split-cache 1"
+
+typedef enum {
+	SPLIT_NONE,	/* fits in a day */
+	SPLIT_KEPT,	/* multi-day, but not split */
+	SPLIT_DONE	/* replaced by the clones */
+} ECalSplitState;
+
+typedef struct {
+	gchar *key;
+	ECalSplitState state;
+	gchar **clones;
+} ECalSplitEntry;
+
+static void
+split_entry_free (gpointer data)
+{
+	ECalSplitEntry *entry = data;
+
+	g_free (entry->key);
+	g_strfreev (entry->clones);
+	g_free (entry);
+}
+
+static void
+splits_load (ECalConduitContext *ctxt)
+{
+	const gchar *source_uid = e_source_get_uid (e_client_get_source (E_CLIENT (ctxt->client)));
+	gchar *contents = NULL;
+	gchar **lines;
+	gint i;
+
+	ctxt->splits_filename = splits_name (ctxt);
+	ctxt->splits = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, split_entry_free);
+
+	if (!g_file_get_contents (ctxt->splits_filename, &contents, NULL, NULL))
+		return;
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	if (lines[0] == NULL || strcmp (lines[0], SPLITS_HEADER) != 0
+	    || lines[1] == NULL || strcmp (lines[1], source_uid) != 0) {
+		LOG (g_message ("ignoring split cache %s", ctxt->splits_filename));
+		g_strfreev (lines);
+		return;
+	}
+
+	for (i = 2; lines[i] != NULL; i++) {
+		ECalSplitEntry *entry;
+		gchar **fields;
+
+		/* the uid goes last, it may hold anything but a newline */
+		fields = g_strsplit (lines[i], "\t", 4);
+		if (g_strv_length (fields) == 4) {
+			entry = g_new0 (ECalSplitEntry, 1);
+			entry->state = (ECalSplitState) g_ascii_strtoll (fields[0], NULL, 10);
+			entry->key = g_strdup (fields[1]);
+			entry->clones = g_strsplit (fields[2], ",", -1);
+			g_hash_table_replace (ctxt->splits, g_strdup (fields[3]), entry);
+		}
+		g_strfreev (fields);
+	}
+	g_strfreev (lines);
+
+	/* Forget what is no longer in the calendar, which is only known
+	   when all of it was loaded. A split event is gone by design, its
+	   entry lasts as long as one of its pieces does. */
+	if (ctxt->comps_complete) {
+		GHashTableIter iter;
+		gpointer key, value;
+
+		g_hash_table_iter_init (&iter, ctxt->splits);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			ECalSplitEntry *entry = value;
+			gboolean found = FALSE;
+
+			if (entry->state == SPLIT_DONE) {
+				for (i = 0; !found && entry->clones[i] != NULL; i++)
+					found = e_cal_comp_index_lookup (ctxt->index, entry->clones[i], NULL) != NULL;
+			} else {
+				found = e_cal_comp_index_lookup (ctxt->index, key, NULL) != NULL;
+			}
+
+			if (!found)
+				g_hash_table_iter_remove (&iter);
+		}
+	}
+}
+
+static void
+splits_save (ECalConduitContext *ctxt)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *str;
+
+	if (ctxt->splits == NULL)
+		return;
+
+	str = g_string_new (SPLITS_HEADER "\n");
+	g_string_append_printf (str, "%s\n", e_source_get_uid (e_client_get_source (E_CLIENT (ctxt->client))));
+
+	g_hash_table_iter_init (&iter, ctxt->splits);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		ECalSplitEntry *entry = value;
+		gchar *clones = g_strjoinv (",", entry->clones);
+
+		g_string_append_printf (str, "%d\t%s\t%s\t%s\n", entry->state, entry->key, clones, (const gchar *) key);
+		g_free (clones);
+	}
+
+	if (!g_file_set_contents (ctxt->splits_filename, str->str, str->len, NULL))
+		g_warning ("Could not write split cache %s", ctxt->splits_filename);
+
+	g_string_free (str, TRUE);
+}
+
+static void
+split_key_append_time (GString *str, ECalComponentDateTime *dt)
+{
+	ICalTime *value = dt ? e_cal_component_datetime_get_value (dt) : NULL;
+
+	if (value) {
+		gchar *text = i_cal_time_as_ical_string (value);
+
+		g_string_append_printf (str, "%s|%s|", text, e_cal_component_datetime_get_tzid (dt) ? e_cal_component_datetime_get_tzid (dt) : "");
+		g_free (text);
+	} else {
+		g_string_append (str, "-|");
+	}
+}
+
+/* Everything process_multi_day () looks at */
+static gchar *
+split_key (ECalConduitContext *ctxt, ECalComponent *comp)
+{
+	ECalComponentDateTime *dt;
+	GString *str;
+	gchar *key;
+
+	str = g_string_new (NULL);
+
+	dt = e_cal_component_get_dtstart (comp);
+	split_key_append_time (str, dt);
+	if (dt) e_cal_component_datetime_free (dt);
+
+	dt = e_cal_component_get_dtend (comp);
+	split_key_append_time (str, dt);
+	if (dt) e_cal_component_datetime_free (dt);
+
+	g_string_append_printf (str, "%d|%d|%s",
+				e_cal_component_has_recurrences (comp) ? 1 : 0,
+				ctxt->cfg->multi_day_split ? 1 : 0,
+				icaltimezone_get_tzid (ctxt->timezone));
+
+	key = g_compute_checksum_for_string (G_CHECKSUM_MD5, str->str, str->len);
+	g_string_free (str, TRUE);
+
+	return key;
+}
+
+static gboolean
+split_clone_exists (ECalConduitContext *ctxt, const gchar *uid)
+{
+	ECalComponent *comp;
+
+	if (e_cal_comp_index_lookup (ctxt->index, uid, NULL) != NULL)
+		return TRUE;
+	if (ctxt->comps_complete)
+		return FALSE;
+
+	/* only the changes were loaded, ask */
+	comp = e_cal_comp_index_get (ctxt->index, ctxt->client, uid, NULL);
+	if (comp == NULL)
+		return FALSE;
+
+	g_object_unref (comp);
+
+	return TRUE;
+}
+
+static gboolean
+process_multi_day_cached (ECalConduitContext *ctxt, ECalChange *ccc, GList **multi_comp, GList **multi_ccc)
+{
+	const gchar *uid = e_cal_component_get_uid (ccc->comp);
+	ECalSplitEntry *entry;
+	gboolean ret, usable = TRUE;
+	gchar *key;
+	GList *l;
+	gint i;
+
+	*multi_ccc = NULL;
+	*multi_comp = NULL;
+
+	if (uid == NULL)
+		return process_multi_day (ctxt, ccc, multi_comp, multi_ccc);
+
+	if (ccc->type == E_CAL_CHANGE_DELETED) {
+		g_hash_table_remove (ctxt->splits, uid);
+		return FALSE;
+	}
+
+	key = split_key (ctxt, ccc->comp);
+	entry = g_hash_table_lookup (ctxt->splits, uid);
+
+	if (entry != NULL && !strcmp (entry->key, key)) {
+		/* The pieces must still be around to be reused */
+		for (i = 0; usable && entry->state == SPLIT_DONE && entry->clones[i] != NULL; i++) {
+			if (!split_clone_exists (ctxt, entry->clones[i]))
+				usable = FALSE;
+		}
+
+		if (usable) {
+			g_free (key);
+
+			switch (entry->state) {
+			case SPLIT_NONE:
+				return FALSE;
+			case SPLIT_KEPT:
+				return TRUE;
+			case SPLIT_DONE:
+				LOG (g_message ("%s was split before, removing it again", uid));
+				split_remove_original (ctxt, uid);
+				ccc->type = E_CAL_CHANGE_DELETED;
+				return TRUE;
+			}
+		}
+	}
+
+	ret = process_multi_day (ctxt, ccc, multi_comp, multi_ccc);
+
+	entry = g_new0 (ECalSplitEntry, 1);
+	entry->key = key;
+	if (ccc->type == E_CAL_CHANGE_DELETED) {
+		entry->state = SPLIT_DONE;
+		entry->clones = g_new0 (gchar *, g_list_length (*multi_ccc) + 1);
+		for (l = *multi_ccc, i = 0; l != NULL; l = l->next, i++)
+			entry->clones[i] = g_strdup (e_cal_component_get_uid (((ECalChange *) l->data)->comp));
+	} else {
+		entry->state = ret ? SPLIT_KEPT : SPLIT_NONE;
+		entry->clones = g_new0 (gchar *, 1);
+	}
+	g_hash_table_replace (ctxt->splits, g_strdup (uid), entry);
+
+	return ret;
+}
+
 static short
 nth_weekday (gint pos, icalrecurrencetype_weekday weekday)
 {
@@ -956,19 +1349,15 @@ local_record_to_pilot_record (ECalLocalRecord *local,
 }
 
 /*
- * converts a ECalComponent object to a ECalLocalRecord
+ * converts a ECalComponent object to a ECalLocalRecord. Only the
+ * fields the sync engine needs to decide what to do are filled in,
+ * the Appointment is built by local_record_materialize
  */
 static void
 local_record_from_comp (ECalLocalRecord *local, ECalComponent *comp, ECalConduitContext *ctxt)
 {
 	const gchar *uid;
-	ECalComponentText *summary;
-	GSList *d_list = NULL, *edl = NULL, *l;
-	ECalComponentText *description;
-	ECalComponentDateTime *dt_start, *dt_end;
 	ECalComponentClassification classif;
-	icaltimezone *default_tz = ctxt->timezone;
-	gint i;
 
 	g_return_if_fail (local != NULL);
 	g_return_if_fail (comp != NULL);
@@ -980,6 +1369,37 @@ local_record_from_comp (ECalLocalRecord *local, ECalComponent *comp, ECalConduit
 	local->local.ID = e_pilot_map_lookup_pid (ctxt->map, uid, TRUE);
 	compute_status (ctxt, local, uid);
 
+	classif = e_cal_component_get_classification (comp);
+
+	if (classif == E_CAL_COMPONENT_CLASS_PRIVATE)
+		local->local.secret = 1;
+	else
+		local->local.secret = 0;
+
+	local->local.archived = 0;
+}
+
+/*
+ * builds the Appointment of a ECalLocalRecord from its component
+ */
+static void
+local_record_materialize (ECalLocalRecord *local, ECalConduitContext *ctxt)
+{
+	ECalComponent *comp;
+	ECalComponentText *summary;
+	GSList *d_list = NULL, *edl = NULL, *l;
+	ECalComponentText *description;
+	ECalComponentDateTime *dt_start, *dt_end;
+	icaltimezone *default_tz = ctxt->timezone;
+	gint i;
+
+	g_return_if_fail (local != NULL);
+	g_return_if_fail (local->comp != NULL);
+
+	if (local->appt != NULL)
+		return;
+
+	comp = local->comp;
 	local->appt = g_new0 (struct Appointment, 1);
 
 	/* Handle the fields and category we don't sync by making sure
@@ -1017,7 +1437,7 @@ local_record_from_comp (ECalLocalRecord *local, ECalComponent *comp, ECalConduit
 	   uses free to deallocate */
 	summary = e_cal_component_get_summary (comp);
 	if (summary && e_cal_component_text_get_value (summary))
-		local->appt->description = e_pilot_utf8_to_pchar (e_cal_component_text_get_value (summary), ctxt->pilot_charset);
+		local->appt->description = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_cal_component_text_get_value (summary));
 	if (summary)
 		e_cal_component_text_free (summary);
 
@@ -1025,7 +1445,7 @@ local_record_from_comp (ECalLocalRecord *local, ECalComponent *comp, ECalConduit
 	if (d_list) {
 		description = (ECalComponentText *) d_list->data;
 		if (description && e_cal_component_text_get_value (description))
-			local->appt->note = e_pilot_utf8_to_pchar (e_cal_component_text_get_value (description), ctxt->pilot_charset);
+			local->appt->note = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_cal_component_text_get_value (description));
 		else
 			local->appt->note = NULL;
 		g_slist_free_full (d_list, e_cal_component_text_free);
@@ -1040,20 +1460,20 @@ local_record_from_comp (ECalLocalRecord *local, ECalComponent *comp, ECalConduit
 		ICalTime *start_val = e_cal_component_datetime_get_value (dt_start);
 		struct icaltimetype *native_start = (struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (start_val));
 		icaltimezone_convert_time (native_start,
-					   get_timezone (ctxt->client, e_cal_component_datetime_get_tzid (dt_start)),
+					   get_timezone (ctxt, e_cal_component_datetime_get_tzid (dt_start)),
 					   default_tz);
 		local->appt->begin = icaltimetype_to_tm (native_start);
 	}
 
 	if (dt_start && e_cal_component_datetime_get_value (dt_start) &&
 	    dt_end && e_cal_component_datetime_get_value (dt_end)) {
-		if (is_all_day (ctxt->client, dt_start, dt_end)) {
+		if (is_all_day (ctxt, dt_start, dt_end)) {
 			local->appt->event = 1;
 		} else {
 			ICalTime *end_val = e_cal_component_datetime_get_value (dt_end);
 			struct icaltimetype *native_end = (struct icaltimetype *) i_cal_object_get_native (I_CAL_OBJECT (end_val));
 			icaltimezone_convert_time (native_end,
-						   get_timezone (ctxt->client, e_cal_component_datetime_get_tzid (dt_end)),
+						   get_timezone (ctxt, e_cal_component_datetime_get_tzid (dt_end)),
 						   default_tz);
 			local->appt->end = icaltimetype_to_tm (native_end);
 			local->appt->event = 0;
@@ -1239,15 +1659,6 @@ local_record_from_comp (ECalLocalRecord *local, ECalComponent *comp, ECalConduit
 		}
 		g_slist_free_full (uids, g_free);
 	}
-
-	classif = e_cal_component_get_classification (comp);
-
-	if (classif == E_CAL_COMPONENT_CLASS_PRIVATE)
-		local->local.secret = 1;
-	else
-		local->local.secret = 0;
-
-	local->local.archived = 0;
 }
 
 static void
@@ -1256,19 +1667,11 @@ local_record_from_uid (ECalLocalRecord *local,
 		       ECalConduitContext *ctxt)
 {
 	ECalComponent *comp;
-	ICalComponent *icalcomp;
 	GError *error = NULL;
 
 	g_assert(local!=NULL);
 
-	if (e_cal_client_get_object_sync (ctxt->client, uid, NULL, &icalcomp, NULL, &error)) {
-		comp = e_cal_component_new ();
-		if (!e_cal_component_set_icalcomponent (comp, icalcomp)) {
-			g_object_unref (comp);
-			g_object_unref (icalcomp);
-			return;
-		}
-
+	if ((comp = e_cal_comp_index_get (ctxt->index, ctxt->client, uid, &error))) {
 		local_record_from_comp (local, comp, ctxt);
 		g_object_unref (comp);
 	} else if (g_error_matches (error, E_CAL_CLIENT_ERROR, E_CAL_CLIENT_ERROR_OBJECT_NOT_FOUND)) {
@@ -1291,7 +1694,7 @@ comp_from_remote_record (GnomePilotConduitSyncAbs *conduit,
 			 ECalClient *client,
 			 icaltimezone *timezone,
 			 struct CategoryAppInfo *category,
-			 const gchar *pilot_charset)
+			 EPilotCharset *pilot_charset)
 {
 	ECalComponent *comp;
 	struct Appointment appt;
@@ -1333,7 +1736,7 @@ comp_from_remote_record (GnomePilotConduitSyncAbs *conduit,
 	e_cal_component_set_last_modified (comp, now);
 	g_object_unref (now);
 
-	txt = e_pilot_utf8_from_pchar (appt.description, pilot_charset);
+	txt = e_pilot_charset_from_pchar (pilot_charset, appt.description);
 	summary_text = e_cal_component_text_new (txt, NULL);
 	e_cal_component_set_summary (comp, summary_text);
 	e_cal_component_text_free (summary_text);
@@ -1349,7 +1752,7 @@ comp_from_remote_record (GnomePilotConduitSyncAbs *conduit,
 		GSList l;
 		ECalComponentText *text;
 
-		txt = e_pilot_utf8_from_pchar (appt.note, pilot_charset);
+		txt = e_pilot_charset_from_pchar (pilot_charset, appt.note);
 		text = e_cal_component_text_new (txt, NULL);
 		l.data = text;
 		l.next = NULL;
@@ -1606,7 +2009,7 @@ check_for_slow_setting (GnomePilotConduit *c, ECalConduitContext *ctxt)
 	const gchar *uri;
 
 	/* If there are objects but no log */
-	map_count = g_hash_table_size (ctxt->map->pid_map);
+	map_count = e_pilot_map_count_pids (ctxt->map);
 	if (map_count == 0)
 		gnome_pilot_conduit_standard_set_slow (conduit, TRUE);
 
@@ -1630,30 +2033,27 @@ check_for_slow_setting (GnomePilotConduit *c, ECalConduitContext *ctxt)
 }
 
 /* Pilot syncing callbacks */
+/*
+ * The part of pre_sync that only works on the local side: opens the
+ * calendar and works out what changed. Runs on a preparation thread when
+ * the manager started one, so failures are reported through
+ * ctxt->prepare_error for pre_sync to pass on.
+ */
 static gint
-pre_sync (GnomePilotConduit *conduit,
-	  GnomePilotDBInfo *dbi,
-	  ECalConduitContext *ctxt)
+pre_sync_local (GnomePilotConduitSyncAbs *abs_conduit,
+		GnomePilotDBInfo *dbi,
+		ECalConduitContext *ctxt)
 {
-	GnomePilotConduitSyncAbs *abs_conduit;
 	GList *removed = NULL, *added = NULL, *l;
-	gint len;
-	guchar *buf;
-	gchar *filename, *change_id;
+	gchar *filename;
+	const gchar *source_uid;
+	GHashTable *watched;
 	ICalComponent *icalcomp;
 	gint num_records, add_records = 0, mod_records = 0, del_records = 0;
-	pi_buffer_t * buffer;
-	abs_conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit);
-
-	LOG (g_message ( "---------------------------------------------------------\n" ));
-	LOG (g_message ( "pre_sync: Calendar Conduit v.%s", CONDUIT_VERSION ));
 
 	ctxt->dbi = dbi;
-	if (NULL == dbi->pilotInfo->pilot_charset)
-		ctxt->pilot_charset = NULL;
-	else
-		 ctxt->pilot_charset = g_strdup(dbi->pilotInfo->pilot_charset);
-	ctxt->client = NULL;
+	ctxt->prepare_error = NULL;
+	ctxt->pilot_charset = e_pilot_charset_new (dbi->pilotInfo->pilot_charset);
 
 	/* Get the timezone */
 	ctxt->timezone = get_default_timezone ();
@@ -1663,7 +2063,7 @@ pre_sync (GnomePilotConduit *conduit,
 
 	if (start_calendar_server (ctxt) != 0) {
 		WARN(_("Could not start evolution-data-server"));
-		gnome_pilot_conduit_error (conduit, _("Could not start evolution-data-server"));
+		ctxt->prepare_error = _("Could not start evolution-data-server");
 		return -1;
 	}
 
@@ -1683,32 +2083,60 @@ pre_sync (GnomePilotConduit *conduit,
 	e_pilot_map_read (filename, &ctxt->map);
 	g_free (filename);
 
-	/* Get the local database */
-	if (!e_cal_client_get_object_list_as_comps_sync (ctxt->client, "#t", &ctxt->comps, NULL, NULL))
-		return -1;
+	/* Work out what changed since the last sync */
+	source_uid = e_source_get_uid (e_client_get_source (E_CLIENT (ctxt->client)));
+	filename = journal_name (ctxt);
+	ctxt->journal = e_cal_change_journal_load (filename, source_uid);
+	g_free (filename);
 
-	/* Build change list from all components.
-	 * NOTE: e_cal_get_changes() was removed in modern EDS.
-	 * We treat all existing objects as modified, which effectively
-	 * forces a slow sync approach for change detection.
-	 */
-	change_id = g_strdup_printf ("pilot-sync-evolution-calendar-%d", ctxt->cfg->pilot_id);
-	ctxt->changed = NULL;
-	for (l = ctxt->comps; l != NULL; l = l->next) {
-		ECalChange *ccc = g_new0 (ECalChange, 1);
-		ccc->comp = g_object_ref (l->data);
-		ccc->type = E_CAL_CHANGE_MODIFIED;
-		ctxt->changed = g_list_prepend (ctxt->changed, ccc);
+	/* With a watch on the source since the last sync, only what it saw
+	   needs looking at */
+	filename = watch_name (ctxt->cfg->pilot_id);
+	watched = e_pilot_watch_take (filename, source_uid, ctxt->cfg->watch_session, &ctxt->watch_session);
+	g_free (filename);
+
+	if (watched != NULL && e_cal_change_journal_has_base (ctxt->journal)
+	    && e_cal_change_journal_get_changes_for_uids (ctxt->journal, ctxt->client, watched,
+							  E_CAL_COMPONENT_EVENT, &ctxt->comps, &ctxt->changed, NULL)) {
+		LOG (g_message ( "  %d UIDs changed since the last sync", g_hash_table_size (watched) ));
+	} else {
+		/* Get the local database */
+		if (!e_cal_client_get_object_list_as_comps_sync (ctxt->client, "#t", &ctxt->comps, NULL, NULL)) {
+			if (watched != NULL)
+				g_hash_table_destroy (watched);
+			return -1;
+		}
+		ctxt->comps_complete = TRUE;
+
+		ctxt->changed = e_cal_change_journal_get_changes (ctxt->journal, ctxt->comps, E_CAL_COMPONENT_EVENT);
 	}
+	if (watched != NULL)
+		g_hash_table_destroy (watched);
+
 	ctxt->changed_hash = g_hash_table_new (g_str_hash, g_str_equal);
-	g_free (change_id);
+
+	ctxt->index = e_cal_comp_index_new (ctxt->comps);
+
+	/* Changes from the pilot are written at post_sync */
+	ctxt->batch = e_cal_write_batch_new (ctxt->client, ctxt->map, ctxt->journal, ctxt->index);
+	splits_load (ctxt);
 
 	/* See if we need to split up any events */
 	for (l = ctxt->changed; l != NULL; l = l->next) {
 		ECalChange *ccc = l->data;
 		GList *multi_comp = NULL, *multi_ccc = NULL;
 
-		if (process_multi_day (ctxt, ccc, &multi_comp, &multi_ccc)) {
+		if (process_multi_day_cached (ctxt, ccc, &multi_comp, &multi_ccc)) {
+			GList *m;
+
+			/* the split is our own doing, not a local change */
+			for (m = multi_ccc; m != NULL; m = m->next) {
+				ECalComponent *split = ((ECalChange *) m->data)->comp;
+
+				e_cal_comp_index_add (ctxt->index, split);
+				e_cal_change_journal_update (ctxt->journal, ctxt->index, e_cal_component_get_uid (split));
+			}
+
 			ctxt->comps = g_list_concat (ctxt->comps, multi_comp);
 
 			added = g_list_concat (added, multi_ccc);
@@ -1757,12 +2185,68 @@ pre_sync (GnomePilotConduit *conduit,
 	}
 
 	/* Set the count information */
-	num_records = g_list_length (ctxt->comps);
+	if (ctxt->comps_complete)
+		num_records = g_list_length (ctxt->comps);
+	else
+		num_records = e_cal_change_journal_count (ctxt->journal);
 	gnome_pilot_conduit_sync_abs_set_num_local_records(abs_conduit, num_records);
 	gnome_pilot_conduit_sync_abs_set_num_new_local_records (abs_conduit, add_records);
 	gnome_pilot_conduit_sync_abs_set_num_updated_local_records (abs_conduit, mod_records);
 	gnome_pilot_conduit_sync_abs_set_num_deleted_local_records(abs_conduit, del_records);
 
+	return 0;
+}
+
+/* The client outlives the preparation, so it is connected on the
+   thread running the sync, whose main context it reports to */
+static gint
+open_local (GnomePilotConduitSyncAbs *conduit,
+	    GnomePilotDBInfo *dbi,
+	    ECalConduitContext *ctxt)
+{
+	if (ctxt->cfg->source == NULL)
+		return -1;
+
+	ctxt->client = e_cal_pool_get_client (ctxt->cfg->source, E_CAL_CLIENT_SOURCE_TYPE_EVENTS, NULL);
+
+	/* pre_sync tries again and reports why */
+	return ctxt->client != NULL ? 0 : -1;
+}
+
+static gint
+prepare_local (GnomePilotConduitSyncAbs *conduit,
+	       GnomePilotDBInfo *dbi,
+	       ECalConduitContext *ctxt)
+{
+	LOG (g_message ( "prepare_local: loading the calendar ahead of pre_sync" ));
+
+	ctxt->prepare_result = pre_sync_local (conduit, dbi, ctxt);
+	ctxt->prepared = TRUE;
+
+	return ctxt->prepare_result;
+}
+
+static gint
+pre_sync (GnomePilotConduit *conduit,
+	  GnomePilotDBInfo *dbi,
+	  ECalConduitContext *ctxt)
+{
+	gint len;
+	guchar *buf;
+	pi_buffer_t * buffer;
+
+	LOG (g_message ( "---------------------------------------------------------\n" ));
+	LOG (g_message ( "pre_sync: Calendar Conduit v.%s", CONDUIT_VERSION ));
+
+	if (!ctxt->prepared)
+		ctxt->prepare_result = pre_sync_local (GNOME_PILOT_CONDUIT_SYNC_ABS (conduit), dbi, ctxt);
+	ctxt->prepared = FALSE;
+	if (ctxt->prepare_result < 0) {
+		if (ctxt->prepare_error)
+			gnome_pilot_conduit_error (conduit, ctxt->prepare_error);
+		return -1;
+	}
+
 	buffer = pi_buffer_new(DLP_BUF_SIZE);
 	if (buffer == NULL) {
 		pi_set_error(dbi->pilot_socket, PI_ERR_GENERIC_MEMORY);
@@ -1805,6 +2289,12 @@ post_sync (GnomePilotConduit *conduit,
 
 	LOG (g_message ( "post_sync: Calendar Conduit v.%s", CONDUIT_VERSION ));
 
+	/* Write what came from the pilot to the calendar */
+	if (!e_cal_write_batch_flush (ctxt->batch, NULL)) {
+		WARN ("Could not write changes to the calendar");
+		return -1;
+	}
+
 	/* Write AppBlock to PDA - updates categories */
 	buf = (guchar *)g_malloc (0xffff);
 
@@ -1823,6 +2313,16 @@ post_sync (GnomePilotConduit *conduit,
 		return -1;
 	}
 
+	/* What the watch saw is taken care of once the journal is saved */
+	g_free (ctxt->cfg->watch_session);
+	ctxt->cfg->watch_session = NULL;
+	if (e_cal_change_journal_save (ctxt->journal)) {
+		filename = watch_name (ctxt->cfg->pilot_id);
+		e_pilot_watch_done (filename);
+		g_free (filename);
+		ctxt->cfg->watch_session = g_strdup (ctxt->watch_session);
+	}
+
 	g_free (ctxt->cfg->last_uri);
 	{
 		ESource *source = e_client_get_source (E_CLIENT (ctxt->client));
@@ -1833,8 +2333,9 @@ post_sync (GnomePilotConduit *conduit,
 	filename = map_name (ctxt);
 	e_pilot_map_write (filename, ctxt->map);
 	g_free (filename);
-	if (ctxt->pilot_charset)
-		g_free (ctxt->pilot_charset);
+	splits_save (ctxt);
+	e_pilot_charset_free (ctxt->pilot_charset);
+	ctxt->pilot_charset = NULL;
 
 	LOG (g_message ( "---------------------------------------------------------\n" ));
 
@@ -1886,6 +2387,13 @@ for_each (GnomePilotConduitSyncAbs *conduit,
 	if (*local == NULL) {
 		LOG (g_message ( "beginning for_each" ));
 
+		/* only the changes were loaded at pre_sync */
+		if (!ctxt->comps_complete) {
+			if (!e_cal_comp_index_load_all (ctxt->index, ctxt->client, &ctxt->comps, NULL))
+				return -1;
+			ctxt->comps_complete = TRUE;
+		}
+
 		comps = ctxt->comps;
 		count = 0;
 
@@ -2040,10 +2548,11 @@ add_record (GnomePilotConduitSyncAbs *conduit,
 	uid = e_util_generate_uid ();
 	e_cal_component_set_uid (comp, uid);
 
-	if (!e_cal_client_create_object_sync (ctxt->client, e_cal_component_get_icalcomponent (comp), E_CAL_OPERATION_FLAG_NONE, NULL, NULL, NULL))
-		return -1;
-
 	e_pilot_map_insert (ctxt->map, remote->ID, uid, FALSE);
+	e_cal_comp_index_add (ctxt->index, comp);
+	e_cal_change_journal_update (ctxt->journal, ctxt->index, e_cal_component_get_uid (comp));
+	if (!e_cal_write_batch_create (ctxt->batch, comp, remote->ID))
+		retval = -1;
 
 	g_free (uid);
 
@@ -2071,9 +2580,11 @@ ctxt->pilot_charset);
 	g_object_unref (local->comp);
 	local->comp = new_comp;
 
-	if (!e_cal_client_modify_object_sync (ctxt->client, e_cal_component_get_icalcomponent (new_comp),
-				       E_CAL_OBJ_MOD_ALL, E_CAL_OPERATION_FLAG_NONE, NULL, NULL))
-		return -1;
+	e_cal_comp_index_add (ctxt->index, new_comp);
+	e_cal_change_journal_update (ctxt->journal, ctxt->index, e_cal_component_get_uid (new_comp));
+
+	if (!e_cal_write_batch_modify (ctxt->batch, new_comp))
+		retval = -1;
 
 	return retval;
 }
@@ -2093,8 +2604,10 @@ delete_record (GnomePilotConduitSyncAbs *conduit,
 	LOG (g_message ( "delete_record: deleting %s\n", uid ));
 
 	e_pilot_map_remove_by_uid (ctxt->map, uid);
-	/* FIXME Error handling */
-	e_cal_client_remove_object_sync (ctxt->client, uid, NULL, E_CAL_OBJ_MOD_ALL, E_CAL_OPERATION_FLAG_NONE, NULL, NULL);
+	e_cal_change_journal_remove (ctxt->journal, uid);
+	e_cal_comp_index_remove (ctxt->index, uid);
+	if (!e_cal_write_batch_remove (ctxt->batch, uid))
+		return -1;
 
         return 0;
 }
@@ -2162,6 +2675,18 @@ free_match (GnomePilotConduitSyncAbs *conduit,
 	return 0;
 }
 
+static gint
+materialize (GnomePilotConduitSyncAbs *conduit,
+	     ECalLocalRecord *local,
+	     ECalConduitContext *ctxt)
+{
+	g_return_val_if_fail (local != NULL, -1);
+
+	local_record_materialize (local, ctxt);
+
+	return 0;
+}
+
 static gint
 prepare (GnomePilotConduitSyncAbs *conduit,
 	 ECalLocalRecord *local,
@@ -2278,6 +2803,9 @@ conduit_get_gpilot_conduit (guint32 pilot_id)
 	g_signal_connect (retval, "free_match", G_CALLBACK (free_match), ctxt);
 
 	g_signal_connect (retval, "prepare", G_CALLBACK (prepare), ctxt);
+	g_signal_connect (retval, "materialize", G_CALLBACK (materialize), ctxt);
+	g_signal_connect (retval, "open_local", G_CALLBACK (open_local), ctxt);
+	g_signal_connect (retval, "prepare_local", G_CALLBACK (prepare_local), ctxt);
 
 	/* Gui Settings */
 	g_signal_connect (retval, "create_settings_window", G_CALLBACK (create_settings_window), ctxt);
@@ -2299,3 +2827,27 @@ conduit_destroy_gpilot_conduit (GnomePilotConduit *conduit)
 
 	g_object_unref (obj);
 }
+
+gpointer
+conduit_start_watch (guint32 pilot_id)
+{
+	ECalConduitCfg *cfg;
+	ECalWatch *watch = NULL;
+	gchar *filename;
+
+	cfg = calconduit_load_configuration (pilot_id);
+	if (cfg->sync_type != GnomePilotConduitSyncTypeNotSet && cfg->source != NULL) {
+		filename = watch_name (pilot_id);
+		watch = e_cal_watch_start (cfg->source, E_CAL_CLIENT_SOURCE_TYPE_EVENTS, filename);
+		g_free (filename);
+	}
+	calconduit_destroy_configuration (cfg);
+
+	return watch;
+}
+
+void
+conduit_stop_watch (gpointer watch)
+{
+	e_cal_watch_stop (watch);
+}
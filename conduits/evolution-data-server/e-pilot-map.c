@@ -24,85 +24,829 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
 
 #include <glib.h>
+#include <glib/gstdio.h>
 #include <libxml/parser.h>
 
-#include <libedataserver/libedataserver.h>
-
 #include "e-pilot-map.h"
 
+/*
+ * Map files
+ *
+ * A map is kept in a binary file that is memory-mapped on read, sorted
+ * by uid with a pid index after the entries, so that nothing has to be
+ * parsed before the first lookup. Changes go to the node table in the
+ * EPilotMap and are appended to a log next to the file on write; the
+ * file is rewritten when the log has grown too big, on slow syncs and
+ * when migrating an old XML map.
+ *
+ *   header    magic, version, generation, n_entries, n_pids, since
+ *   entries   n_entries x (pid, flags, uid offset), sorted by uid
+ *   pids      n_pids x entry index, sorted by pid
+ *   pool      nul terminated uids
+ *
+ * The log starts with the generation of the file it applies to, so a
+ * log left behind by an interrupted compaction is ignored.
+ */
+
+#define MAP_MAGIC "EPLTMAP"
+#define MAP_LOG_MAGIC "EPLTMLG"
+#define MAP_VERSION 1
+
+#define MAP_HEADER_SIZE 32
+#define MAP_ENTRY_SIZE 12
+#define MAP_LOG_HEADER_SIZE 16
+#define MAP_LOG_RECORD_SIZE 8
+
+/* the log is folded back into the file past this size, or the size of
+   the file itself if that is bigger */
+#define MAP_LOG_MAX 65536
+
+#define MAP_ENTRY_ARCHIVED 1
+
+enum {
+	MAP_LOG_INSERT = 1,
+	MAP_LOG_REMOVE,
+	MAP_LOG_SINCE
+};
+
+enum {
+	MAP_BASE_REMOVED = 1 << 0,
+	MAP_BASE_TOUCHED = 1 << 1
+};
+
+struct _EPilotMapStore
+{
+	GMappedFile *file;
+	guint32 generation;
+	guint32 n_entries;
+	guint32 n_pids;
+	const guint8 *entries;
+	const guint8 *pids;
+	const gchar *pool;
+	gsize pool_len;
+
+	/* MAP_BASE_* per entry, allocated on first use */
+	guint8 *flags;
+	guint32 n_removed_pids;
+
+	/* log records not written yet */
+	GByteArray *pending;
+	/* bytes of the log on disk that apply to the file, 0 if none */
+	gsize log_len;
+
+	gboolean compact;
+};
+
+/*
+ * Changed entries
+ *
+ * Nodes live in one array and their uids in a string chunk; two open
+ * addressing tables of node indexes, probed linearly, find them by uid
+ * and by pid. Removed nodes are only dropped when the tables are
+ * rebuilt.
+ */
+
+#define MAP_SLOT_EMPTY 0
+#define MAP_SLOT_DELETED G_MAXUINT32
+#define MAP_MIN_SLOTS 64
+
 typedef struct
 {
-	gchar *uid;
-	gboolean archived;
-	gboolean touched;
-} EPilotMapPidNode;
+	const gchar *uid;
+	guint uid_hash;
+	guint32 pid;
+	guint8 archived;
+	guint8 touched;
+	guint8 removed;
+} EPilotMapNode;
+
+struct _EPilotMapTable
+{
+	GStringChunk *strings;
+	GArray *nodes;
+
+	/* node index + 1, or MAP_SLOT_EMPTY/MAP_SLOT_DELETED */
+	guint32 *uid_slots;
+	guint32 *pid_slots;
+	guint32 n_slots;
+	guint32 uid_used;
+	guint32 pid_used;
+
+	guint32 n_live;
+	guint32 n_pids;
+
+	/* bytes handed to strings, which keeps no count of its own */
+	gsize strings_len;
+};
 
 typedef struct
 {
+	const gchar *uid;
 	guint32 pid;
 	gboolean archived;
-	gboolean touched;
-} EPilotMapUidNode;
+} EPilotMapEntry;
 
-typedef struct
+static guint32
+map_read32 (const guint8 *p)
+{
+	guint32 v;
+
+	memcpy (&v, p, sizeof (v));
+
+	return GUINT32_FROM_LE (v);
+}
+
+static void
+map_append32 (GByteArray *array, guint32 v)
 {
-	gboolean touched_only;
-	xmlNodePtr root;
-} EPilotMapWriteData;
+	v = GUINT32_TO_LE (v);
+	g_byte_array_append (array, (const guint8 *) &v, sizeof (v));
+}
 
 static void
-real_e_pilot_map_insert (EPilotMap *map,
-                         guint32 pid,
-                         const gchar *uid,
-                         gboolean archived,
-                         gboolean touch)
+map_append64 (GByteArray *array, gint64 v)
 {
-	gchar *new_uid;
-	guint32 *new_pid = NULL;
-	EPilotMapPidNode *pnode = NULL;
-	EPilotMapUidNode *unode;
+	v = GINT64_TO_LE (v);
+	g_byte_array_append (array, (const guint8 *) &v, sizeof (v));
+}
 
-	g_return_if_fail (map != NULL);
-	g_return_if_fail (uid != NULL);
+static gchar *
+map_file_name (const gchar *filename)
+{
+	if (g_str_has_suffix (filename, ".xml"))
+		return g_strdup_printf ("%.*s.map", (gint) strlen (filename) - 4, filename);
 
-	/* Keys */
-	if (pid != 0) {
-		new_pid = g_new (guint32, 1);
-		*new_pid = pid;
+	return g_strconcat (filename, ".map", NULL);
+}
+
+/* Base entries */
+
+static guint32
+base_pid (EPilotMapStore *store, guint32 i)
+{
+	return map_read32 (store->entries + i * MAP_ENTRY_SIZE);
+}
+
+static gboolean
+base_archived (EPilotMapStore *store, guint32 i)
+{
+	return (map_read32 (store->entries + i * MAP_ENTRY_SIZE + 4) & MAP_ENTRY_ARCHIVED) != 0;
+}
+
+static const gchar *
+base_uid (EPilotMapStore *store, guint32 i)
+{
+	guint32 offset = map_read32 (store->entries + i * MAP_ENTRY_SIZE + 8);
+
+	/* the pool ends with a nul, see store_open () */
+	if (offset >= store->pool_len)
+		return "";
+
+	return store->pool + offset;
+}
+
+static guint8 *
+base_flags (EPilotMapStore *store)
+{
+	if (store->flags == NULL)
+		store->flags = g_malloc0 (MAX (store->n_entries, 1));
+
+	return store->flags;
+}
+
+static gboolean
+base_live (EPilotMapStore *store, guint32 i)
+{
+	return store->flags == NULL || !(store->flags[i] & MAP_BASE_REMOVED);
+}
+
+static gint
+base_find_uid (EPilotMapStore *store, const gchar *uid)
+{
+	guint32 lo = 0, hi = store->n_entries;
+
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+		gint cmp = strcmp (uid, base_uid (store, mid));
+
+		if (cmp == 0)
+			return base_live (store, mid) ? (gint) mid : -1;
+		if (cmp < 0)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
-	new_uid = g_strdup (uid);
 
-	/* Values */
-	if (pid != 0) {
-		pnode = g_new0 (EPilotMapPidNode, 1);
-		pnode->uid = new_uid;
-		pnode->archived = archived;
-		if (touch)
-			pnode->touched = TRUE;
+	return -1;
+}
+
+static gint
+base_find_pid (EPilotMapStore *store, guint32 pid)
+{
+	guint32 lo = 0, hi = store->n_pids;
+
+	while (lo < hi) {
+		guint32 mid = lo + (hi - lo) / 2;
+		guint32 i = map_read32 (store->pids + mid * 4);
+		guint32 mid_pid;
+
+		if (i >= store->n_entries)
+			return -1;
+
+		mid_pid = base_pid (store, i);
+		if (pid == mid_pid)
+			return base_live (store, i) ? (gint) i : -1;
+		if (pid < mid_pid)
+			hi = mid;
+		else
+			lo = mid + 1;
 	}
 
-	unode = g_new0 (EPilotMapUidNode, 1);
-	unode->pid = pid;
-	unode->archived = archived;
-	if (touch)
-		unode->touched = TRUE;
+	return -1;
+}
+
+static void
+base_remove (EPilotMapStore *store, guint32 i)
+{
+	base_flags (store)[i] |= MAP_BASE_REMOVED;
+	if (base_pid (store, i) != 0)
+		store->n_removed_pids++;
+}
+
+static void
+base_touch (EPilotMapStore *store, guint32 i)
+{
+	base_flags (store)[i] |= MAP_BASE_TOUCHED;
+}
+
+static void
+store_close (EPilotMapStore *store)
+{
+	if (store->file)
+		g_mapped_file_unref (store->file);
+	g_free (store->flags);
+
+	store->file = NULL;
+	store->flags = NULL;
+	store->generation = 0;
+	store->n_entries = store->n_pids = store->n_removed_pids = 0;
+	store->entries = store->pids = NULL;
+	store->pool = NULL;
+	store->pool_len = 0;
+	store->log_len = 0;
+}
+
+static gboolean
+store_open (EPilotMapStore *store, const gchar *filename, time_t *since)
+{
+	GError *error = NULL;
+	const guint8 *data;
+	gint64 stamp;
+	gsize len, needed;
+
+	store->file = g_mapped_file_new (filename, FALSE, &error);
+	if (store->file == NULL) {
+		g_warning ("Pilot map file '%s' could not be read: %s\n", filename, error->message);
+		g_error_free (error);
+		return FALSE;
+	}
+
+	data = (const guint8 *) g_mapped_file_get_contents (store->file);
+	len = g_mapped_file_get_length (store->file);
+
+	if (len < MAP_HEADER_SIZE
+	    || memcmp (data, MAP_MAGIC, sizeof (MAP_MAGIC))
+	    || map_read32 (data + 8) != MAP_VERSION)
+		goto corrupt;
+
+	store->generation = map_read32 (data + 12);
+	store->n_entries = map_read32 (data + 16);
+	store->n_pids = map_read32 (data + 20);
+	memcpy (&stamp, data + 24, sizeof (stamp));
+	*since = (time_t) GINT64_FROM_LE (stamp);
+
+	if (store->n_pids > store->n_entries || store->n_entries > len / MAP_ENTRY_SIZE)
+		goto corrupt;
+	needed = MAP_HEADER_SIZE + (gsize) store->n_entries * MAP_ENTRY_SIZE + (gsize) store->n_pids * 4;
+	if (len < needed)
+		goto corrupt;
+
+	store->entries = data + MAP_HEADER_SIZE;
+	store->pids = store->entries + (gsize) store->n_entries * MAP_ENTRY_SIZE;
+	store->pool = (const gchar *) data + needed;
+	store->pool_len = len - needed;
+
+	if (store->pool_len > 0 && store->pool[store->pool_len - 1] != '\0')
+		goto corrupt;
+
+	return TRUE;
+
+ corrupt:
+	g_warning ("Pilot map file '%s' is corrupt\n", filename);
+	store_close (store);
+	return FALSE;
+}
+
+/* Log records */
+
+static void
+log_append (EPilotMapStore *store, guint8 op, guint32 pid, gboolean archived,
+	    const guint8 *payload, guint16 len)
+{
+	guint8 head[4] = { op, archived ? 1 : 0, len & 0xff, len >> 8 };
+
+	g_byte_array_append (store->pending, head, sizeof (head));
+	map_append32 (store->pending, pid);
+	g_byte_array_append (store->pending, payload, len);
+}
+
+static void
+log_uid (EPilotMapStore *store, guint8 op, guint32 pid, gboolean archived, const gchar *uid)
+{
+	gsize len = strlen (uid);
+
+	/* Nothing we sync has uids anywhere near that long, but never
+	   write a record we cannot read back */
+	if (len > G_MAXUINT16) {
+		store->compact = TRUE;
+		return;
+	}
+
+	log_append (store, op, pid, archived, (const guint8 *) uid, len);
+}
+
+/* Overlay and base together */
+
+static guint
+pid_hash (guint32 pid)
+{
+	return pid * 2654435761u;
+}
+
+static EPilotMapNode *
+table_node (EPilotMapTable *table, guint32 i)
+{
+	return &g_array_index (table->nodes, EPilotMapNode, i);
+}
+
+static EPilotMapTable *
+table_new (void)
+{
+	EPilotMapTable *table = g_new0 (EPilotMapTable, 1);
+
+	table->strings = g_string_chunk_new (4096);
+	table->nodes = g_array_new (FALSE, FALSE, sizeof (EPilotMapNode));
+
+	return table;
+}
+
+static void
+table_clear (EPilotMapTable *table)
+{
+	g_string_chunk_clear (table->strings);
+	g_array_set_size (table->nodes, 0);
+	g_free (table->uid_slots);
+	g_free (table->pid_slots);
+
+	table->uid_slots = table->pid_slots = NULL;
+	table->n_slots = table->uid_used = table->pid_used = 0;
+	table->n_live = table->n_pids = 0;
+	table->strings_len = 0;
+}
+
+static void
+table_free (EPilotMapTable *table)
+{
+	table_clear (table);
+	g_string_chunk_free (table->strings);
+	g_array_free (table->nodes, TRUE);
+	g_free (table);
+}
+
+/* Slot holding uid, or -1 */
+static gint
+table_uid_slot (EPilotMapTable *table, const gchar *uid)
+{
+	guint hash, mask, i;
+
+	if (table->n_slots == 0)
+		return -1;
+
+	hash = g_str_hash (uid);
+	mask = table->n_slots - 1;
+
+	for (i = hash & mask;; i = (i + 1) & mask) {
+		guint32 slot = table->uid_slots[i];
+		EPilotMapNode *node;
+
+		if (slot == MAP_SLOT_EMPTY)
+			return -1;
+		if (slot == MAP_SLOT_DELETED)
+			continue;
+
+		node = table_node (table, slot - 1);
+		if (node->uid_hash == hash && !strcmp (node->uid, uid))
+			return i;
+	}
+}
+
+static gint
+table_pid_slot (EPilotMapTable *table, guint32 pid)
+{
+	guint mask, i;
+
+	if (table->n_slots == 0 || pid == 0)
+		return -1;
+
+	mask = table->n_slots - 1;
+
+	for (i = pid_hash (pid) & mask;; i = (i + 1) & mask) {
+		guint32 slot = table->pid_slots[i];
+
+		if (slot == MAP_SLOT_EMPTY)
+			return -1;
+		if (slot != MAP_SLOT_DELETED && table_node (table, slot - 1)->pid == pid)
+			return i;
+	}
+}
+
+static EPilotMapNode *
+table_lookup_uid (EPilotMapTable *table, const gchar *uid)
+{
+	gint i = table_uid_slot (table, uid);
+
+	return i < 0 ? NULL : table_node (table, table->uid_slots[i] - 1);
+}
+
+static EPilotMapNode *
+table_lookup_pid (EPilotMapTable *table, guint32 pid)
+{
+	gint i = table_pid_slot (table, pid);
+
+	return i < 0 ? NULL : table_node (table, table->pid_slots[i] - 1);
+}
 
-	/* Insertion */
+static void
+table_place (EPilotMapTable *table, guint32 index)
+{
+	EPilotMapNode *node = table_node (table, index);
+	guint mask = table->n_slots - 1, i;
+
+	for (i = node->uid_hash & mask; table->uid_slots[i] != MAP_SLOT_EMPTY
+		     && table->uid_slots[i] != MAP_SLOT_DELETED; i = (i + 1) & mask);
+	if (table->uid_slots[i] == MAP_SLOT_EMPTY)
+		table->uid_used++;
+	table->uid_slots[i] = index + 1;
+
+	if (node->pid == 0)
+		return;
+
+	for (i = pid_hash (node->pid) & mask; table->pid_slots[i] != MAP_SLOT_EMPTY
+		     && table->pid_slots[i] != MAP_SLOT_DELETED; i = (i + 1) & mask);
+	if (table->pid_slots[i] == MAP_SLOT_EMPTY)
+		table->pid_used++;
+	table->pid_slots[i] = index + 1;
+}
+
+/* Drops removed nodes and makes room for at least one more */
+static void
+table_rebuild (EPilotMapTable *table)
+{
+	GArray *nodes;
+	guint32 i, n_slots = MAP_MIN_SLOTS;
+
+	while (n_slots / 2 < table->n_live + 1)
+		n_slots *= 2;
+
+	nodes = g_array_sized_new (FALSE, FALSE, sizeof (EPilotMapNode), table->n_live + 1);
+	for (i = 0; i < table->nodes->len; i++) {
+		if (!table_node (table, i)->removed)
+			g_array_append_val (nodes, *table_node (table, i));
+	}
+	g_array_free (table->nodes, TRUE);
+	table->nodes = nodes;
+
+	g_free (table->uid_slots);
+	g_free (table->pid_slots);
+	table->uid_slots = g_new0 (guint32, n_slots);
+	table->pid_slots = g_new0 (guint32, n_slots);
+	table->n_slots = n_slots;
+	table->uid_used = table->pid_used = 0;
+
+	for (i = 0; i < nodes->len; i++)
+		table_place (table, i);
+}
+
+/* uid and pid must not be in the table already */
+static void
+table_insert (EPilotMapTable *table, guint32 pid, const gchar *uid, gboolean archived, gboolean touch)
+{
+	EPilotMapNode node;
+
+	/* Keep at least a quarter of the slots empty so probes end */
+	if ((MAX (table->uid_used, table->pid_used) + 1) * 4 > table->n_slots * 3)
+		table_rebuild (table);
+
+	node.uid = g_string_chunk_insert_const (table->strings, uid);
+	table->strings_len += strlen (uid) + 1;
+	node.uid_hash = g_str_hash (uid);
+	node.pid = pid;
+	node.archived = archived ? 1 : 0;
+	node.touched = touch ? 1 : 0;
+	node.removed = 0;
+
+	g_array_append_val (table->nodes, node);
+	table_place (table, table->nodes->len - 1);
+
+	table->n_live++;
 	if (pid != 0)
-		g_hash_table_insert (map->pid_map, new_pid, pnode);
-	g_hash_table_insert (map->uid_map, new_uid, unode);
+		table->n_pids++;
+}
+
+static void
+table_remove (EPilotMapTable *table, EPilotMapNode *node)
+{
+	gint i;
+
+	if ((i = table_pid_slot (table, node->pid)) >= 0) {
+		table->pid_slots[i] = MAP_SLOT_DELETED;
+		table->n_pids--;
+	}
+	if ((i = table_uid_slot (table, node->uid)) >= 0)
+		table->uid_slots[i] = MAP_SLOT_DELETED;
+
+	node->removed = 1;
+	table->n_live--;
+}
+
+static gboolean
+map_drop_pid (EPilotMap *map, guint32 pid)
+{
+	EPilotMapNode *node;
+	gint i;
+
+	if ((node = table_lookup_pid (map->table, pid)) != NULL) {
+		table_remove (map->table, node);
+		return TRUE;
+	}
+
+	if ((i = base_find_pid (map->store, pid)) >= 0) {
+		base_remove (map->store, i);
+		return TRUE;
+	}
+
+	return FALSE;
+}
+
+static gboolean
+map_drop_uid (EPilotMap *map, const gchar *uid)
+{
+	EPilotMapNode *node;
+	gint i;
+
+	if ((node = table_lookup_uid (map->table, uid)) != NULL) {
+		table_remove (map->table, node);
+		return TRUE;
+	}
+
+	if ((i = base_find_uid (map->store, uid)) >= 0) {
+		base_remove (map->store, i);
+		return TRUE;
+	}
+
+	return FALSE;
 }
 
 static void
-map_set_node_timet (xmlNodePtr node, const gchar *name, time_t t)
+map_replace (EPilotMap *map, guint32 pid, const gchar *uid, gboolean archived, gboolean touch)
 {
-	gchar *tstring;
+	/* In case the pid<->uid mapping is not the same anymore */
+	if (pid != 0)
+		map_drop_pid (map, pid);
+	map_drop_uid (map, uid);
 
-	tstring = g_strdup_printf ("%ld", t);
-	xmlSetProp (node, (guchar *)name, (guchar *)tstring);
-	g_free (tstring);
+	table_insert (map->table, pid, uid, archived, touch);
+}
+
+static void
+map_replay_log (EPilotMap *map, const gchar *filename, time_t *since)
+{
+	EPilotMapStore *store = map->store;
+	gchar *data = NULL;
+	gsize len = 0, pos;
+
+	if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+		return;
+
+	if (!g_file_get_contents (filename, &data, &len, NULL)
+	    || len < MAP_LOG_HEADER_SIZE
+	    || memcmp (data, MAP_LOG_MAGIC, sizeof (MAP_LOG_MAGIC))
+	    || map_read32 ((guint8 *) data + 8) != store->generation) {
+		/* Left over from before the last compaction */
+		g_free (data);
+		return;
+	}
+
+	pos = MAP_LOG_HEADER_SIZE;
+	while (pos + MAP_LOG_RECORD_SIZE <= len) {
+		const guint8 *rec = (const guint8 *) data + pos;
+		guint16 rlen = rec[2] | (rec[3] << 8);
+		guint32 pid = map_read32 (rec + 4);
+		const gchar *payload = (const gchar *) rec + MAP_LOG_RECORD_SIZE;
+		gchar *uid;
+
+		if (pos + MAP_LOG_RECORD_SIZE + rlen > len)
+			break;
+
+		switch (rec[0]) {
+		case MAP_LOG_INSERT:
+			uid = g_strndup (payload, rlen);
+			map_replace (map, pid, uid, rec[1] != 0, FALSE);
+			g_free (uid);
+			break;
+		case MAP_LOG_REMOVE:
+			uid = g_strndup (payload, rlen);
+			map_drop_uid (map, uid);
+			g_free (uid);
+			break;
+		case MAP_LOG_SINCE:
+			if (rlen == sizeof (gint64)) {
+				gint64 stamp;
+
+				memcpy (&stamp, payload, sizeof (stamp));
+				*since = (time_t) GINT64_FROM_LE (stamp);
+			}
+			break;
+		default:
+			goto done;
+		}
+
+		pos += MAP_LOG_RECORD_SIZE + rlen;
+	}
+
+ done:
+	/* A torn write at the end, don't append after it */
+	if (pos != len)
+		store->compact = TRUE;
+
+	store->log_len = pos;
+	g_free (data);
+}
+
+static gint
+map_entry_compare (gconstpointer a, gconstpointer b)
+{
+	return strcmp (((const EPilotMapEntry *) a)->uid, ((const EPilotMapEntry *) b)->uid);
+}
+
+static gint
+map_pid_compare (gconstpointer a, gconstpointer b, gpointer data)
+{
+	const EPilotMapEntry *entries = data;
+	guint32 pa = entries[*(const guint32 *) a].pid;
+	guint32 pb = entries[*(const guint32 *) b].pid;
+
+	return pa < pb ? -1 : pa > pb ? 1 : 0;
+}
+
+static gint
+map_compact (EPilotMap *map, const gchar *filename, const gchar *log_filename)
+{
+	EPilotMapStore *store = map->store;
+	EPilotMapEntry *entries;
+	GByteArray *data;
+	GString *pool;
+	guint32 *pids;
+	guint32 i, n = 0, n_pids = 0;
+	GError *error = NULL;
+	gboolean ret;
+
+	entries = g_new (EPilotMapEntry, store->n_entries + map->table->n_live + 1);
+
+	for (i = 0; i < store->n_entries; i++) {
+		if (!base_live (store, i))
+			continue;
+		if (map->write_touched_only
+		    && (store->flags == NULL || !(store->flags[i] & MAP_BASE_TOUCHED)))
+			continue;
+
+		entries[n].uid = base_uid (store, i);
+		entries[n].pid = base_pid (store, i);
+		entries[n].archived = base_archived (store, i);
+		n++;
+	}
+
+	for (i = 0; i < map->table->nodes->len; i++) {
+		EPilotMapNode *node = table_node (map->table, i);
+
+		if (node->removed || (map->write_touched_only && !node->touched))
+			continue;
+
+		entries[n].uid = node->uid;
+		entries[n].pid = node->pid;
+		entries[n].archived = node->archived;
+		n++;
+	}
+
+	qsort (entries, n, sizeof (EPilotMapEntry), map_entry_compare);
+
+	/* Like the XML maps, archived records lose their pid */
+	pids = g_new (guint32, n + 1);
+	for (i = 0; i < n; i++) {
+		if (entries[i].archived)
+			entries[i].pid = 0;
+		else if (entries[i].pid != 0)
+			pids[n_pids++] = i;
+	}
+	g_qsort_with_data (pids, n_pids, sizeof (guint32), map_pid_compare, entries);
+
+	data = g_byte_array_sized_new (MAP_HEADER_SIZE + n * (MAP_ENTRY_SIZE + 4 + 40));
+	pool = g_string_sized_new (n * 40);
+
+	g_byte_array_append (data, (const guint8 *) MAP_MAGIC, sizeof (MAP_MAGIC));
+	map_append32 (data, MAP_VERSION);
+	map_append32 (data, g_random_int ());
+	map_append32 (data, n);
+	map_append32 (data, n_pids);
+	map_append64 (data, map->since);
+
+	for (i = 0; i < n; i++) {
+		map_append32 (data, entries[i].pid);
+		map_append32 (data, entries[i].archived ? MAP_ENTRY_ARCHIVED : 0);
+		map_append32 (data, pool->len);
+		g_string_append_len (pool, entries[i].uid, strlen (entries[i].uid) + 1);
+	}
+	for (i = 0; i < n_pids; i++)
+		map_append32 (data, pids[i]);
+	g_byte_array_append (data, (const guint8 *) pool->str, pool->len);
+
+	ret = g_file_set_contents (filename, (const gchar *) data->data, data->len, &error);
+	if (!ret) {
+		g_warning ("Pilot map file '%s' could not be saved: %s\n", filename, error->message);
+		g_error_free (error);
+	} else {
+		g_unlink (log_filename);
+	}
+
+	g_byte_array_free (data, TRUE);
+	g_string_free (pool, TRUE);
+	g_free (pids);
+	g_free (entries);
+
+	/* What is mapped and logged from here on belongs to the old file */
+	g_byte_array_set_size (store->pending, 0);
+	store->log_len = 0;
+	store->compact = TRUE;
+
+	return ret ? 0 : -1;
+}
+
+static gint
+map_append_log (EPilotMap *map, const gchar *log_filename)
+{
+	EPilotMapStore *store = map->store;
+	gint64 stamp = GINT64_TO_LE ((gint64) map->since);
+	GByteArray *header;
+	FILE *fp;
+	gboolean ok;
+
+	log_append (store, MAP_LOG_SINCE, 0, FALSE, (const guint8 *) &stamp, sizeof (stamp));
+
+	fp = g_fopen (log_filename, store->log_len > 0 ? "ab" : "wb");
+	if (fp == NULL) {
+		g_warning ("Pilot map log '%s' could not be opened\n", log_filename);
+		return -1;
+	}
+
+	ok = TRUE;
+	if (store->log_len == 0) {
+		header = g_byte_array_new ();
+		g_byte_array_append (header, (const guint8 *) MAP_LOG_MAGIC, sizeof (MAP_LOG_MAGIC));
+		map_append32 (header, store->generation);
+		map_append32 (header, 0);
+		ok = fwrite (header->data, 1, header->len, fp) == header->len;
+		store->log_len = header->len;
+		g_byte_array_free (header, TRUE);
+	}
+
+	ok = ok && fwrite (store->pending->data, 1, store->pending->len, fp) == store->pending->len;
+	ok = ok && fflush (fp) == 0 && fsync (fileno (fp)) == 0;
+	ok = fclose (fp) == 0 && ok;
+
+	if (!ok) {
+		g_warning ("Pilot map log '%s' could not be written\n", log_filename);
+		store->compact = TRUE;
+		return -1;
+	}
+
+	store->log_len += store->pending->len;
+	g_byte_array_set_size (store->pending, 0);
+
+	return 0;
 }
 
 static void
@@ -147,176 +891,145 @@ map_sax_start_element (gpointer data, const xmlChar *name,
 		g_return_if_fail (uid != NULL);
 		g_return_if_fail (pid != 0 || archived);
 
-		real_e_pilot_map_insert (map, pid, uid, archived, FALSE);
-	}
-}
-
-static void
-map_write_foreach (gpointer key, gpointer value, gpointer data)
-{
-	EPilotMapWriteData *wd = data;
-	xmlNodePtr root = wd->root;
-	gchar *uid = key;
-	EPilotMapUidNode *unode = value;
-	xmlNodePtr mnode;
-
-	if (wd->touched_only && !unode->touched)
-		return;
-
-	mnode = xmlNewChild (root, NULL, (const guchar *)"map", NULL);
-	xmlSetProp (mnode, (const guchar *)"uid", (guchar *)uid);
-
-	if (unode->archived) {
-		xmlSetProp (mnode, (const guchar *)"archived", (const guchar *)"1");
-	} else {
-		gchar *pidstr;
-
-		pidstr = g_strdup_printf ("%d", unode->pid);
-		xmlSetProp (mnode, (const guchar *)"pilot_id", (guchar *)pidstr);
-		g_free (pidstr);
-		xmlSetProp (mnode, (const guchar *)"archived", (const guchar *)"0");
+		map_replace (map, pid, uid, archived, FALSE);
 	}
 }
 
 gboolean
 e_pilot_map_pid_is_archived (EPilotMap *map, guint32 pid)
 {
-	EPilotMapPidNode *pnode;
+	EPilotMapNode *node;
+	gint i;
 
 	g_return_val_if_fail (map != NULL, FALSE);
 
-	pnode = g_hash_table_lookup (map->pid_map, &pid);
+	node = table_lookup_pid (map->table, pid);
 
-	if (pnode == NULL)
-		return FALSE;
+	if (node != NULL)
+		return node->archived;
+
+	i = base_find_pid (map->store, pid);
 
-	return pnode->archived;
+	return i >= 0 && base_archived (map->store, i);
 }
 
 gboolean
 e_pilot_map_uid_is_archived (EPilotMap *map, const gchar *uid)
 {
-	EPilotMapUidNode *unode;
+	EPilotMapNode *node;
+	gint i;
 
 	g_return_val_if_fail (map != NULL, FALSE);
 	g_return_val_if_fail (uid != NULL, FALSE);
 
-	unode = g_hash_table_lookup (map->uid_map, uid);
+	node = table_lookup_uid (map->table, uid);
 
-	if (unode == NULL)
-		return FALSE;
+	if (node != NULL)
+		return node->archived;
+
+	i = base_find_uid (map->store, uid);
 
-	return unode->archived;
+	return i >= 0 && base_archived (map->store, i);
 }
 
 void
 e_pilot_map_insert (EPilotMap *map, guint32 pid, const gchar *uid, gboolean archived)
 {
-        EPilotMapPidNode *pnode;
-        EPilotMapUidNode *unode;
-
-        pnode = g_hash_table_lookup (map->pid_map, &pid);
-        if (pnode != NULL) {
-		/* In case the pid<->uid mapping is not the same anymore */
-                g_hash_table_remove (map->uid_map, pnode->uid);
-
-		g_hash_table_remove (map->pid_map, &pid);
-	}
-
-        unode = g_hash_table_lookup (map->uid_map, uid);
-        if (unode != NULL) {
-		/* In case the pid<->uid mapping is not the same anymore */
-                g_hash_table_remove (map->pid_map, &unode->pid);
-
-		g_hash_table_remove (map->uid_map, uid);
-	}
+	g_return_if_fail (map != NULL);
+	g_return_if_fail (uid != NULL);
 
-	real_e_pilot_map_insert (map, pid, uid, archived, TRUE);
+	map_replace (map, pid, uid, archived, TRUE);
+	log_uid (map->store, MAP_LOG_INSERT, archived ? 0 : pid, archived, uid);
 }
 
 void
 e_pilot_map_remove_by_pid (EPilotMap *map, guint32 pid)
 {
-	EPilotMapPidNode *pnode;
-	EPilotMapUidNode *unode;
+	const gchar *found;
+	gchar *uid;
 
 	g_return_if_fail (map != NULL);
 
-        pnode = g_hash_table_lookup (map->pid_map, &pid);
-        if (pnode == NULL)
+	found = e_pilot_map_lookup_uid (map, pid, FALSE);
+	if (found == NULL)
 		return;
 
-        unode = g_hash_table_lookup (map->uid_map, pnode->uid);
-	g_return_if_fail (unode != NULL);
-
-	g_hash_table_remove (map->uid_map, pnode->uid);
-	g_hash_table_remove (map->pid_map, &pid);
+	uid = g_strdup (found);
+	map_drop_pid (map, pid);
+	log_uid (map->store, MAP_LOG_REMOVE, 0, FALSE, uid);
+	g_free (uid);
 }
 
 void
 e_pilot_map_remove_by_uid (EPilotMap *map, const gchar *uid)
 {
-	EPilotMapUidNode *unode;
-
 	g_return_if_fail (map != NULL);
 	g_return_if_fail (uid != NULL);
 
-        unode = g_hash_table_lookup (map->uid_map, uid);
-        if (unode == NULL)
-		return;
-
-	g_hash_table_remove (map->pid_map, &unode->pid);
-	g_hash_table_remove (map->uid_map, uid);
+	if (map_drop_uid (map, uid))
+		log_uid (map->store, MAP_LOG_REMOVE, 0, FALSE, uid);
 }
 
 guint32
 e_pilot_map_lookup_pid (EPilotMap *map, const gchar *uid, gboolean touch)
 {
-	EPilotMapUidNode *unode = NULL;
+	EPilotMapNode *node;
+	gint i;
 
 	g_return_val_if_fail (map != NULL, 0);
 	g_return_val_if_fail (uid != NULL, 0);
 
-	unode = g_hash_table_lookup (map->uid_map, uid);
+	node = table_lookup_uid (map->table, uid);
 
-	if (unode == NULL)
-		return 0;
+	if (node == NULL) {
+		if ((i = base_find_uid (map->store, uid)) < 0)
+			return 0;
 
-	if (touch) {
-		EPilotMapPidNode *pnode = NULL;
+		if (touch)
+			base_touch (map->store, i);
 
-		pnode = g_hash_table_lookup (map->pid_map, &unode->pid);
-		if (pnode != NULL)
-			pnode->touched = TRUE;
-		unode->touched = TRUE;
+		return base_pid (map->store, i);
 	}
 
-	return unode->pid;
+	if (touch)
+		node->touched = 1;
+
+	return node->pid;
 }
 
 const gchar *
 e_pilot_map_lookup_uid (EPilotMap *map, guint32 pid, gboolean touch)
 {
-	EPilotMapPidNode *pnode = NULL;
+	EPilotMapNode *node;
+	gint i;
 
 	g_return_val_if_fail (map != NULL, NULL);
 
-	pnode = g_hash_table_lookup (map->pid_map, &pid);
-
-	if (pnode == NULL)
-		return NULL;
+	node = table_lookup_pid (map->table, pid);
 
-	if (touch) {
-		EPilotMapUidNode *unode = NULL;
+	if (node == NULL) {
+		if ((i = base_find_pid (map->store, pid)) < 0)
+			return NULL;
 
-		unode = g_hash_table_lookup (map->uid_map, pnode->uid);
-		g_return_val_if_fail (unode != NULL, NULL);
+		if (touch)
+			base_touch (map->store, i);
 
-		unode->touched = TRUE;
-		pnode->touched = TRUE;
+		return base_uid (map->store, i);
 	}
 
-	return pnode->uid;
+	if (touch)
+		node->touched = 1;
+
+	return node->uid;
+}
+
+guint
+e_pilot_map_count_pids (EPilotMap *map)
+{
+	g_return_val_if_fail (map != NULL, 0);
+
+	return map->table->n_pids
+		+ map->store->n_pids - map->store->n_removed_pids;
 }
 
 gint
@@ -324,6 +1037,7 @@ e_pilot_map_read (const gchar *filename, EPilotMap **map)
 {
 	xmlSAXHandler handler;
 	EPilotMap *new_map;
+	gchar *map_filename, *log_filename;
 
 	g_return_val_if_fail (filename != NULL, -1);
 	g_return_val_if_fail (map != NULL, -1);
@@ -331,25 +1045,36 @@ e_pilot_map_read (const gchar *filename, EPilotMap **map)
 	*map = NULL;
 	new_map = g_new0 (EPilotMap, 1);
 
-	memset (&handler, 0, sizeof (xmlSAXHandler));
-	handler.startElement = map_sax_start_element;
+	new_map->table = table_new ();
 
-	new_map->pid_map = g_hash_table_new_full (
-                g_int_hash, g_int_equal,
-                (GDestroyNotify) g_free,
-                (GDestroyNotify) g_free);
-	new_map->uid_map = g_hash_table_new_full (
-                g_str_hash, g_str_equal,
-                (GDestroyNotify) g_free,
-                (GDestroyNotify) g_free);
+	new_map->store = g_new0 (EPilotMapStore, 1);
+	new_map->store->pending = g_byte_array_new ();
+
+	map_filename = map_file_name (filename);
+	log_filename = g_strconcat (map_filename, ".log", NULL);
+
+	if (g_file_test (map_filename, G_FILE_TEST_EXISTS)
+	    && store_open (new_map->store, map_filename, &new_map->since)) {
+		map_replay_log (new_map, log_filename, &new_map->since);
+	} else if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
+		/* An old XML map, it gets converted on write */
+		memset (&handler, 0, sizeof (xmlSAXHandler));
+		handler.startElement = map_sax_start_element;
 
-	if (g_file_test (filename, G_FILE_TEST_EXISTS)) {
 		if (xmlSAXUserParseFile (&handler, new_map, filename) < 0) {
-			g_free (new_map);
+			g_free (map_filename);
+			g_free (log_filename);
+			e_pilot_map_destroy (new_map);
 			return -1;
 		}
+		new_map->store->compact = TRUE;
+	} else {
+		new_map->store->compact = TRUE;
 	}
 
+	g_free (map_filename);
+	g_free (log_filename);
+
 	new_map->write_touched_only = FALSE;
 
 	*map = new_map;
@@ -360,39 +1085,61 @@ e_pilot_map_read (const gchar *filename, EPilotMap **map)
 gint
 e_pilot_map_write (const gchar *filename, EPilotMap *map)
 {
-	EPilotMapWriteData wd;
-	xmlDocPtr doc;
+	EPilotMapStore *store;
+	gchar *map_filename, *log_filename;
+	gsize limit;
 	gint ret;
 
 	g_return_val_if_fail (filename != NULL, -1);
 	g_return_val_if_fail (map != NULL, -1);
 
-	doc = xmlNewDoc ((const guchar *)"1.0");
-	if (doc == NULL) {
-		g_warning ("Pilot map file could not be created\n");
-		return -1;
-	}
-	xmlDocSetRootElement (
-		doc, xmlNewDocNode (
-		doc, NULL, (const guchar *)"PilotMap", NULL));
+	store = map->store;
 	map->since = time (NULL);
-	map_set_node_timet (xmlDocGetRootElement (doc), "timestamp", map->since);
 
-	wd.touched_only = map->write_touched_only;
-	wd.root = xmlDocGetRootElement(doc);
-	g_hash_table_foreach (map->uid_map, map_write_foreach, &wd);
+	map_filename = map_file_name (filename);
+	log_filename = g_strconcat (map_filename, ".log", NULL);
 
-	/* Write the file */
-	xmlSetDocCompressMode (doc, 0);
-	ret = e_xml_save_file (filename, doc);
-	if (ret < 0) {
-		g_warning ("Pilot map file '%s' could not be saved\n", filename);
-		return -1;
+	limit = MAX (MAP_LOG_MAX, store->file ? g_mapped_file_get_length (store->file) : 0);
+
+	/* Slow syncs drop whatever they did not touch, so they always
+	   rewrite the file */
+	if (store->compact || map->write_touched_only
+	    || store->log_len + store->pending->len > limit) {
+		ret = map_compact (map, map_filename, log_filename);
+
+		/* Migrated */
+		if (ret == 0 && g_file_test (filename, G_FILE_TEST_EXISTS))
+			g_unlink (filename);
+	} else {
+		ret = map_append_log (map, log_filename);
 	}
 
-	xmlFreeDoc (doc);
+	g_free (map_filename);
+	g_free (log_filename);
 
-	return 0;
+	return ret;
+}
+
+void
+e_pilot_map_get_footprint (EPilotMap *map, gsize *mapped, gsize *strings, gsize *heap)
+{
+	EPilotMapTable *table;
+	EPilotMapStore *store;
+
+	g_return_if_fail (map != NULL);
+
+	table = map->table;
+	store = map->store;
+
+	if (mapped)
+		*mapped = store->file ? g_mapped_file_get_length (store->file) : 0;
+	if (strings)
+		*strings = table->strings_len;
+	if (heap)
+		*heap = table->nodes->len * sizeof (EPilotMapNode)
+			+ 2 * table->n_slots * sizeof (guint32)
+			+ (store->flags ? MAX (store->n_entries, 1) : 0)
+			+ store->pending->len;
 }
 
 void
@@ -400,8 +1147,11 @@ e_pilot_map_clear (EPilotMap *map)
 {
 	g_return_if_fail (map != NULL);
 
-        g_hash_table_remove_all (map->pid_map);
-        g_hash_table_remove_all (map->uid_map);
+	table_clear (map->table);
+
+	store_close (map->store);
+	g_byte_array_set_size (map->store->pending, 0);
+	map->store->compact = TRUE;
 
 	map->since = 0;
 	map->write_touched_only = FALSE;
@@ -412,7 +1162,9 @@ e_pilot_map_destroy (EPilotMap *map)
 {
 	g_return_if_fail (map != NULL);
 
-	g_hash_table_destroy (map->pid_map);
-	g_hash_table_destroy (map->uid_map);
+	table_free (map->table);
+	store_close (map->store);
+	g_byte_array_free (map->store->pending, TRUE);
+	g_free (map->store);
 	g_free (map);
 }
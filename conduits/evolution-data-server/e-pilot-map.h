@@ -29,15 +29,20 @@
 #include <time.h>
 
 typedef struct _EPilotMap EPilotMap;
+typedef struct _EPilotMapTable EPilotMapTable;
+typedef struct _EPilotMapStore EPilotMapStore;
 
 struct _EPilotMap
 {
-	GHashTable *pid_map;
-	GHashTable *uid_map;
+	/* Entries changed since the map file was last rewritten, the
+	 * others are looked up in the file itself */
+	EPilotMapTable *table;
 
 	time_t since;
 
 	gboolean write_touched_only;
+
+	EPilotMapStore *store;
 };
 
 gboolean e_pilot_map_pid_is_archived (EPilotMap *map, guint32 pid);
@@ -50,6 +55,12 @@ void e_pilot_map_remove_by_uid (EPilotMap *map, const gchar *uid);
 guint32 e_pilot_map_lookup_pid (EPilotMap *map, const gchar *uid, gboolean touch);
 const gchar * e_pilot_map_lookup_uid (EPilotMap *map, guint32 pid, gboolean touch);
 
+guint e_pilot_map_count_pids (EPilotMap *map);
+
+/* Bytes of the map file mapped in, of uids in the string chunk (an
+ * upper bound, re-added uids are shared) and of the other tables */
+void e_pilot_map_get_footprint (EPilotMap *map, gsize *mapped, gsize *strings, gsize *heap);
+
 gint e_pilot_map_read (const gchar *filename, EPilotMap **map);
 gint e_pilot_map_write (const gchar *filename, EPilotMap *map);
 
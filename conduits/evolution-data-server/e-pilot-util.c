@@ -66,6 +66,184 @@ e_pilot_utf8_from_pchar (const gchar *string, const gchar *pilot_charset)
 	return ustring;
 }
 
+/*
+ * Like pilot-link, fall back to $PILOT_CHARSET and then CP1252.
+ *
+ * Most fields are plain ASCII, which every charset the pilot uses
+ * leaves alone; those are copied without going through iconv once
+ * the converters have been checked to agree.
+ */
+
+#define PILOT_DEFAULT_CHARSET "CP1252"
+
+struct _EPilotCharset {
+	GIConv to_pilot;
+	GIConv from_pilot;
+	gboolean ascii_safe;
+
+	/* scratch output, reused between conversions */
+	gchar *buffer;
+	gsize buffer_size;
+};
+
+static gboolean
+is_ascii (const gchar *string, gsize len)
+{
+	const gulong high = G_MAXULONG / 0xff * 0x80;
+	gsize i = 0;
+
+	/* a word at a time, then the tail */
+	for (; i + sizeof (gulong) <= len; i += sizeof (gulong)) {
+		gulong w;
+
+		memcpy (&w, string + i, sizeof (w));
+		if (w & high)
+			return FALSE;
+	}
+
+	for (; i < len; i++) {
+		if (string[i] & 0x80)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gchar *
+copy_len (const gchar *string, gsize len)
+{
+	gchar *copy;
+
+	/* Callers free() these, as they did with pilot-link's */
+	copy = malloc (len + 1);
+	memcpy (copy, string, len);
+	copy[len] = '\0';
+
+	return copy;
+}
+
+static gchar *
+charset_convert (EPilotCharset *charset, GIConv cd, const gchar *string, gsize len)
+{
+	gchar *in, *out;
+	gsize in_left, out_left, needed;
+
+	/* pilot-link never needed more than this either */
+	needed = len * 4 + 1;
+	if (charset->buffer_size < needed) {
+		charset->buffer_size = MAX (needed, 256);
+		charset->buffer = g_realloc (charset->buffer, charset->buffer_size);
+	}
+
+	g_iconv (cd, NULL, NULL, NULL, NULL);
+
+	in = (gchar *) string;
+	in_left = len;
+	out = charset->buffer;
+	out_left = charset->buffer_size - 1;
+
+	if (g_iconv (cd, &in, &in_left, &out, &out_left) == (gsize) -1
+	    || g_iconv (cd, NULL, NULL, &out, &out_left) == (gsize) -1)
+		return NULL;
+
+	return copy_len (charset->buffer, out - charset->buffer);
+}
+
+static gboolean
+charset_keeps_ascii (EPilotCharset *charset, GIConv cd)
+{
+	gchar ascii[127];
+	gchar *converted;
+	gboolean same;
+	gint i;
+
+	for (i = 0; i < 127; i++)
+		ascii[i] = i + 1;
+
+	converted = charset_convert (charset, cd, ascii, sizeof (ascii));
+	same = converted != NULL && strlen (converted) == sizeof (ascii)
+		&& !memcmp (converted, ascii, sizeof (ascii));
+	free (converted);
+
+	return same;
+}
+
+EPilotCharset *
+e_pilot_charset_new (const gchar *pilot_charset)
+{
+	EPilotCharset *charset;
+
+	if (pilot_charset == NULL)
+		pilot_charset = g_getenv ("PILOT_CHARSET");
+	if (pilot_charset == NULL)
+		pilot_charset = PILOT_DEFAULT_CHARSET;
+
+	charset = g_new0 (EPilotCharset, 1);
+	charset->to_pilot = g_iconv_open (pilot_charset, "UTF-8");
+	charset->from_pilot = g_iconv_open ("UTF-8", pilot_charset);
+
+	if (charset->to_pilot == (GIConv) -1 || charset->from_pilot == (GIConv) -1)
+		g_warning ("Cannot convert between UTF-8 and '%s'", pilot_charset);
+
+	/* Without a converter everything is copied as is anyway */
+	charset->ascii_safe = (charset->to_pilot == (GIConv) -1 || charset_keeps_ascii (charset, charset->to_pilot))
+		&& (charset->from_pilot == (GIConv) -1 || charset_keeps_ascii (charset, charset->from_pilot));
+
+	return charset;
+}
+
+static gchar *
+charset_convert_or_copy (EPilotCharset *charset, GIConv cd, const gchar *string)
+{
+	gchar *result = NULL;
+	gsize len;
+
+	if (!string)
+		return NULL;
+
+	len = strlen (string);
+
+	if (cd != (GIConv) -1 && !(charset->ascii_safe && is_ascii (string, len)))
+		result = charset_convert (charset, cd, string, len);
+
+	if (result == NULL)
+		result = copy_len (string, len);
+
+	return result;
+}
+
+gchar *
+e_pilot_charset_to_pchar (EPilotCharset *charset, const gchar *string)
+{
+	if (charset == NULL)
+		return e_pilot_utf8_to_pchar (string, NULL);
+
+	return charset_convert_or_copy (charset, charset->to_pilot, string);
+}
+
+gchar *
+e_pilot_charset_from_pchar (EPilotCharset *charset, const gchar *string)
+{
+	if (charset == NULL)
+		return e_pilot_utf8_from_pchar (string, NULL);
+
+	return charset_convert_or_copy (charset, charset->from_pilot, string);
+}
+
+void
+e_pilot_charset_free (EPilotCharset *charset)
+{
+	if (charset == NULL)
+		return;
+
+	if (charset->to_pilot != (GIConv) -1)
+		g_iconv_close (charset->to_pilot);
+	if (charset->from_pilot != (GIConv) -1)
+		g_iconv_close (charset->from_pilot);
+	g_free (charset->buffer);
+	g_free (charset);
+}
+
 ESource *
 e_pilot_get_sync_source (ESourceRegistry *registry, const gchar *extension_name)
 {
@@ -93,3 +271,224 @@ e_pilot_set_sync_source (ESourceRegistry *registry, const gchar *extension_name,
 	/* In modern EDS, arbitrary properties on ESource are not supported.
 	 * Sync source selection is persisted in the conduit's own config. */
 }
+
+/* A pooled client is asked whether its backend is still there when
+   borrowed, at most this often */
+#define CLIENT_POOL_CHECK_INTERVAL (60 * G_USEC_PER_SEC)
+
+/* and dropped once nobody borrowed it for this long */
+#define CLIENT_POOL_IDLE_TIMEOUT (3600 * G_USEC_PER_SEC)
+
+typedef struct {
+	EPilotClientDroppedFunc func;
+	gpointer user_data;
+} EPilotDroppedFunc;
+
+typedef struct {
+	gchar *uid;
+	EClient *client;
+	guint borrowers;
+	gint64 last_used;
+	gint64 last_checked;
+	GSList *dropped_funcs;
+} EPilotPooledClient;
+
+/* Syncs prepare on worker threads, see prepare_local */
+static GMutex client_pool_lock;
+
+/* source UID -> EPilotPooledClient */
+static GHashTable *client_pool = NULL;
+
+static void
+client_pool_entry_free (EPilotPooledClient *entry)
+{
+	g_slist_free_full (entry->dropped_funcs, g_free);
+	g_object_unref (entry->client);
+	g_free (entry->uid);
+	g_free (entry);
+}
+
+/* Looks up the entry still holding client, with the lock held */
+static EPilotPooledClient *
+client_pool_lookup (EClient *client)
+{
+	EPilotPooledClient *entry;
+
+	if (client_pool == NULL)
+		return NULL;
+
+	entry = g_hash_table_lookup (client_pool, e_source_get_uid (e_client_get_source (client)));
+	if (entry == NULL || entry->client != client)
+		return NULL;
+
+	return entry;
+}
+
+static gboolean
+client_pool_entry_expired (gpointer key, EPilotPooledClient *entry, gint64 *now)
+{
+	return entry->borrowers == 0 && *now - entry->last_used > CLIENT_POOL_IDLE_TIMEOUT;
+}
+
+static gboolean
+client_pool_entry_check (EPilotPooledClient *entry, gint64 now)
+{
+	GError *error = NULL;
+
+	if (now - entry->last_checked < CLIENT_POOL_CHECK_INTERVAL)
+		return TRUE;
+
+	if (!e_source_get_enabled (e_client_get_source (entry->client)))
+		return FALSE;
+
+	/* a round trip to the backend, which fails once it went away */
+	if (!e_client_retrieve_properties_sync (entry->client, NULL, &error)) {
+		g_warning ("Dropping the connection to %s: %s", entry->uid,
+			   error ? error->message : "unknown error");
+		g_clear_error (&error);
+		return FALSE;
+	}
+
+	entry->last_checked = now;
+	return TRUE;
+}
+
+/*
+ * Borrows the pooled client for source, connecting with connect_func
+ * when there is none or it failed its health check. Returns a new
+ * reference, to be given back with e_pilot_client_pool_release ().
+ */
+EClient *
+e_pilot_client_pool_get (ESource *source, EPilotClientConnectFunc connect_func,
+			 gpointer user_data, GError **error)
+{
+	EPilotPooledClient *entry, *dropped = NULL;
+	EClient *client;
+	const gchar *uid;
+	gint64 now;
+	GSList *l;
+
+	g_return_val_if_fail (E_IS_SOURCE (source), NULL);
+	g_return_val_if_fail (connect_func != NULL, NULL);
+
+	uid = e_source_get_uid (source);
+	now = g_get_monotonic_time ();
+
+	g_mutex_lock (&client_pool_lock);
+	if (client_pool == NULL)
+		client_pool = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+						     (GDestroyNotify) client_pool_entry_free);
+	g_hash_table_foreach_remove (client_pool, (GHRFunc) client_pool_entry_expired, &now);
+
+	entry = g_hash_table_lookup (client_pool, uid);
+	if (entry != NULL && !client_pool_entry_check (entry, now)) {
+		/* borrowers keep their own references */
+		g_hash_table_steal (client_pool, uid);
+		dropped = entry;
+		entry = NULL;
+	}
+	if (entry != NULL) {
+		entry->borrowers++;
+		client = g_object_ref (entry->client);
+		g_mutex_unlock (&client_pool_lock);
+		return client;
+	}
+	g_mutex_unlock (&client_pool_lock);
+
+	/* a watch still on the dropped client missed what happened since */
+	if (dropped != NULL) {
+		for (l = dropped->dropped_funcs; l != NULL; l = l->next) {
+			EPilotDroppedFunc *df = l->data;
+
+			df->func (dropped->client, df->user_data);
+		}
+		client_pool_entry_free (dropped);
+	}
+
+	/* connecting can take long, do it unlocked */
+	client = connect_func (source, user_data, error);
+	if (client == NULL)
+		return NULL;
+
+	g_mutex_lock (&client_pool_lock);
+	entry = g_hash_table_lookup (client_pool, uid);
+	if (entry == NULL) {
+		entry = g_new0 (EPilotPooledClient, 1);
+		entry->uid = g_strdup (uid);
+		entry->client = client;
+		entry->last_checked = g_get_monotonic_time ();
+		g_hash_table_insert (client_pool, entry->uid, entry);
+	} else {
+		/* another thread connected meanwhile */
+		g_object_unref (client);
+	}
+	entry->borrowers++;
+	client = g_object_ref (entry->client);
+	g_mutex_unlock (&client_pool_lock);
+
+	return client;
+}
+
+void
+e_pilot_client_pool_release (EClient *client)
+{
+	EPilotPooledClient *entry = NULL;
+
+	if (client == NULL)
+		return;
+
+	g_mutex_lock (&client_pool_lock);
+	entry = client_pool_lookup (client);
+	/* a client dropped from the pool is only unreferenced */
+	if (entry != NULL && entry->borrowers > 0) {
+		entry->borrowers--;
+		entry->last_used = g_get_monotonic_time ();
+	}
+	g_mutex_unlock (&client_pool_lock);
+
+	g_object_unref (client);
+}
+
+/* Has func called when client, borrowed by the caller, is dropped */
+void
+e_pilot_client_pool_add_dropped_func (EClient *client, EPilotClientDroppedFunc func, gpointer user_data)
+{
+	EPilotPooledClient *entry;
+	EPilotDroppedFunc *df;
+
+	g_return_if_fail (E_IS_CLIENT (client));
+	g_return_if_fail (func != NULL);
+
+	g_mutex_lock (&client_pool_lock);
+	entry = client_pool_lookup (client);
+	if (entry != NULL) {
+		df = g_new0 (EPilotDroppedFunc, 1);
+		df->func = func;
+		df->user_data = user_data;
+		entry->dropped_funcs = g_slist_prepend (entry->dropped_funcs, df);
+	}
+	g_mutex_unlock (&client_pool_lock);
+}
+
+void
+e_pilot_client_pool_remove_dropped_func (EClient *client, gpointer user_data)
+{
+	EPilotPooledClient *entry;
+	GSList *l;
+
+	if (client == NULL)
+		return;
+
+	g_mutex_lock (&client_pool_lock);
+	entry = client_pool_lookup (client);
+	for (l = entry ? entry->dropped_funcs : NULL; l != NULL; l = l->next) {
+		EPilotDroppedFunc *df = l->data;
+
+		if (df->user_data == user_data) {
+			entry->dropped_funcs = g_slist_delete_link (entry->dropped_funcs, l);
+			g_free (df);
+			break;
+		}
+	}
+	g_mutex_unlock (&client_pool_lock);
+}
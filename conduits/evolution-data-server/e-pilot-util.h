@@ -31,7 +31,32 @@
 gchar *e_pilot_utf8_to_pchar (const gchar *string, const gchar *pilot_charset);
 gchar *e_pilot_utf8_from_pchar (const gchar *string, const gchar *pilot_charset);
 
+/* Conversions for the length of a sync, with the converters kept open */
+typedef struct _EPilotCharset EPilotCharset;
+
+EPilotCharset *e_pilot_charset_new (const gchar *pilot_charset);
+gchar *e_pilot_charset_to_pchar (EPilotCharset *charset, const gchar *string);
+gchar *e_pilot_charset_from_pchar (EPilotCharset *charset, const gchar *string);
+void e_pilot_charset_free (EPilotCharset *charset);
+
 ESource *e_pilot_get_sync_source (ESourceRegistry *registry, const gchar *extension_name);
 void e_pilot_set_sync_source (ESourceRegistry *registry, const gchar *extension_name, ESource *source);
 
+/* Connected clients shared by the syncs and watches of a conduit and
+   kept between syncs, keyed by ESource UID. Conduit modules are never
+   unloaded, so a pool lasts as long as gpilotd. Clients report to the
+   main context, so they are only connected from the thread running
+   it. */
+typedef EClient *(*EPilotClientConnectFunc) (ESource *source, gpointer user_data, GError **error);
+
+/* Called when a borrowed client failed its health check and the pool
+   connected a new one */
+typedef void (*EPilotClientDroppedFunc) (EClient *client, gpointer user_data);
+
+EClient *e_pilot_client_pool_get (ESource *source, EPilotClientConnectFunc connect_func,
+				  gpointer user_data, GError **error);
+void e_pilot_client_pool_release (EClient *client);
+void e_pilot_client_pool_add_dropped_func (EClient *client, EPilotClientDroppedFunc func, gpointer user_data);
+void e_pilot_client_pool_remove_dropped_func (EClient *client, gpointer user_data);
+
 #endif /* E_PILOT_UTIL_H */
@@ -0,0 +1,296 @@
+/*
+ * Evolution Conduits - Local change log kept between syncs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+/*
+ * While gpilotd runs, a conduit may keep a view on its source open and
+ * append every UID the view reports to "<name>", one "op\tuid" line per
+ * change, synced to disk before the next change is handled.
+ * "<name>.session" identifies the view that writes the log; it only
+ * exists once the view has caught up, and goes away when it is closed.
+ *
+ * At pre_sync the conduit moves the log aside to "<name>.sync", so
+ * that changes arriving during the sync are kept for the next one. The
+ * log is only trusted if the session that wrote it is still running
+ * and is the one seen at the previous successful sync: anything else
+ * means changes may have been missed, and the conduit has to scan.
+ */
+
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <glib/gstdio.h>
+
+#include "e-pilot-watch.h"
+
+#define WATCH_HEADER "gnome-pilot-watch 1"
+
+struct _EPilotWatchLog {
+	gchar *filename;
+	gchar *session_filename;
+	gboolean broken;
+};
+
+/* Serialises the view's appends with taking the log, see
+   e_pilot_watch_take () */
+static GMutex watch_lock;
+
+static gchar *
+watch_session_name (const gchar *filename)
+{
+	return g_strconcat (filename, ".session", NULL);
+}
+
+static gchar *
+watch_sync_name (const gchar *filename)
+{
+	return g_strconcat (filename, ".sync", NULL);
+}
+
+EPilotWatchLog *
+e_pilot_watch_log_new (const gchar *filename, const gchar *source_uid)
+{
+	EPilotWatchLog *log;
+	gchar *contents;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+	g_return_val_if_fail (source_uid != NULL, NULL);
+
+	log = g_new0 (EPilotWatchLog, 1);
+	log->filename = g_strdup (filename);
+	log->session_filename = watch_session_name (filename);
+
+	/* the pid tells a dead gpilotd's session from a live one */
+	contents = g_strdup_printf ("%s\n%s\n%d-%08x\n", WATCH_HEADER, source_uid,
+				    (gint) getpid (), g_random_int ());
+	g_mutex_lock (&watch_lock);
+	if (!g_file_set_contents (log->session_filename, contents, -1, NULL)) {
+		g_warning ("Could not write %s", log->session_filename);
+		log->broken = TRUE;
+	}
+	g_mutex_unlock (&watch_lock);
+	g_free (contents);
+
+	return log;
+}
+
+/* Forgets the session, so that the next sync scans */
+static void
+watch_log_break (EPilotWatchLog *log)
+{
+	if (log->broken)
+		return;
+
+	g_warning ("Lost track of local changes in %s", log->filename);
+	g_unlink (log->session_filename);
+	log->broken = TRUE;
+}
+
+void
+e_pilot_watch_log_break (EPilotWatchLog *log)
+{
+	g_return_if_fail (log != NULL);
+
+	g_mutex_lock (&watch_lock);
+	watch_log_break (log);
+	g_mutex_unlock (&watch_lock);
+}
+
+static gboolean
+watch_log_append (EPilotWatchLog *log, EPilotWatchOp op, const gchar *uid)
+{
+	FILE *file;
+	gboolean ok;
+
+	if (uid == NULL || *uid == '\0' || strchr (uid, '\n') != NULL)
+		return FALSE;
+
+	file = g_fopen (log->filename, "a");
+	if (file == NULL)
+		return FALSE;
+
+	ok = fprintf (file, "%c\t%s\n", (gchar) op, uid) > 0;
+	ok = fflush (file) == 0 && ok;
+	ok = fsync (fileno (file)) == 0 && ok;
+	ok = fclose (file) == 0 && ok;
+
+	return ok;
+}
+
+void
+e_pilot_watch_log_add (EPilotWatchLog *log, EPilotWatchOp op, const gchar *uid)
+{
+	g_return_if_fail (log != NULL);
+
+	g_mutex_lock (&watch_lock);
+	if (!log->broken && !watch_log_append (log, op, uid))
+		watch_log_break (log);
+	g_mutex_unlock (&watch_lock);
+}
+
+void
+e_pilot_watch_log_free (EPilotWatchLog *log)
+{
+	if (log == NULL)
+		return;
+
+	g_mutex_lock (&watch_lock);
+	if (!log->broken)
+		g_unlink (log->session_filename);
+	g_mutex_unlock (&watch_lock);
+
+	g_free (log->session_filename);
+	g_free (log->filename);
+	g_free (log);
+}
+
+static gchar *
+watch_read_session (const gchar *filename, const gchar *source_uid)
+{
+	gchar *session_filename, *contents = NULL, *session = NULL;
+	gchar **lines;
+
+	session_filename = watch_session_name (filename);
+	if (!g_file_get_contents (session_filename, &contents, NULL, NULL)) {
+		g_free (session_filename);
+		return NULL;
+	}
+	g_free (session_filename);
+
+	lines = g_strsplit (contents, "\n", 4);
+	g_free (contents);
+
+	if (g_strv_length (lines) >= 3
+	    && !strcmp (lines[0], WATCH_HEADER)
+	    && !strcmp (lines[1], source_uid)
+	    && g_ascii_strtoll (lines[2], NULL, 10) == getpid ())
+		session = g_strdup (lines[2]);
+
+	g_strfreev (lines);
+
+	return session;
+}
+
+/* Appends the current log to what is left over from a failed sync */
+static gboolean
+watch_move_aside (const gchar *filename, const gchar *sync_filename)
+{
+	gchar *contents = NULL;
+	gsize length;
+	FILE *file;
+	gboolean ok;
+
+	if (!g_file_test (filename, G_FILE_TEST_EXISTS))
+		return TRUE;
+
+	if (!g_file_test (sync_filename, G_FILE_TEST_EXISTS))
+		return g_rename (filename, sync_filename) == 0;
+
+	if (!g_file_get_contents (filename, &contents, &length, NULL))
+		return FALSE;
+
+	file = g_fopen (sync_filename, "a");
+	if (file == NULL) {
+		g_free (contents);
+		return FALSE;
+	}
+
+	ok = fwrite (contents, 1, length, file) == length;
+	ok = fclose (file) == 0 && ok;
+	g_free (contents);
+
+	return ok && g_unlink (filename) == 0;
+}
+
+/*
+ * Returns the UIDs changed since the last successful sync, mapped to
+ * the last EPilotWatchOp seen for each, or NULL if the conduit has to
+ * find out by itself. *session is set to the session that is writing
+ * the log, to be saved and passed as last_session next time.
+ */
+GHashTable *
+e_pilot_watch_take (const gchar *filename, const gchar *source_uid, const gchar *last_session, gchar **session)
+{
+	GHashTable *changes;
+	gchar *sync_filename, *contents = NULL;
+	gchar **lines;
+	gboolean moved;
+	gint i;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+	g_return_val_if_fail (source_uid != NULL, NULL);
+	g_return_val_if_fail (session != NULL, NULL);
+
+	/* the log is appended to from the main loop while the sync may
+	   be preparing on a thread of its own */
+	sync_filename = watch_sync_name (filename);
+	g_mutex_lock (&watch_lock);
+	*session = watch_read_session (filename, source_uid);
+	moved = watch_move_aside (filename, sync_filename);
+	g_mutex_unlock (&watch_lock);
+
+	if (!moved) {
+		g_warning ("Could not move %s aside", filename);
+		g_free (sync_filename);
+		g_free (*session);
+		*session = NULL;
+		return NULL;
+	}
+
+	if (*session == NULL || last_session == NULL || strcmp (*session, last_session) != 0) {
+		g_free (sync_filename);
+		return NULL;
+	}
+
+	changes = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	/* a session that saw nothing leaves no log */
+	if (!g_file_get_contents (sync_filename, &contents, NULL, NULL)) {
+		g_free (sync_filename);
+		return changes;
+	}
+	g_free (sync_filename);
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	for (i = 0; lines[i] != NULL; i++) {
+		const gchar *line = lines[i];
+
+		if ((line[0] != E_PILOT_WATCH_CHANGED && line[0] != E_PILOT_WATCH_REMOVED)
+		    || line[1] != '\t' || line[2] == '\0')
+			continue;
+
+		g_hash_table_replace (changes, g_strdup (line + 2), GINT_TO_POINTER ((gint) line[0]));
+	}
+	g_strfreev (lines);
+
+	return changes;
+}
+
+/* What was taken at pre_sync is now part of the sync state */
+void
+e_pilot_watch_done (const gchar *filename)
+{
+	gchar *sync_filename;
+
+	g_return_if_fail (filename != NULL);
+
+	sync_filename = watch_sync_name (filename);
+	g_unlink (sync_filename);
+	g_free (sync_filename);
+}
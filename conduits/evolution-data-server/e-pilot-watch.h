@@ -0,0 +1,43 @@
+/*
+ * Evolution Conduits - Local change log kept between syncs
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with the program; if not, see <http://www.gnu.org/licenses/>
+ *
+ */
+
+#include <glib.h>
+
+#ifndef E_PILOT_WATCH_H
+#define E_PILOT_WATCH_H
+
+/* What a client view told us happened to a UID */
+typedef enum {
+	E_PILOT_WATCH_CHANGED = 'M',
+	E_PILOT_WATCH_REMOVED = 'R'
+} EPilotWatchOp;
+
+/* Written to from inside gpilotd by a view kept open between syncs */
+typedef struct _EPilotWatchLog EPilotWatchLog;
+
+EPilotWatchLog *e_pilot_watch_log_new (const gchar *filename, const gchar *source_uid);
+void e_pilot_watch_log_add (EPilotWatchLog *log, EPilotWatchOp op, const gchar *uid);
+/* For when the view stops reporting changes */
+void e_pilot_watch_log_break (EPilotWatchLog *log);
+void e_pilot_watch_log_free (EPilotWatchLog *log);
+
+/* Read back by the conduit at pre_sync and dropped at post_sync */
+GHashTable *e_pilot_watch_take (const gchar *filename, const gchar *source_uid, const gchar *last_session, gchar **session);
+void e_pilot_watch_done (const gchar *filename);
+
+#endif /* E_PILOT_WATCH_H */
@@ -27,6 +27,7 @@
 
 #include <libedataserver/libedataserver.h>
 #include <e-pilot-util.h>
+#include <e-pilot-map.h>
 #include <pi-appinfo.h>
 #include <glib.h>
 #include "libecalendar-common-conduit.h"
@@ -64,6 +65,1188 @@ e_cal_free_change_list (GList *list)
 #define LOG(x) x
 #endif
 
+/* Change journal
+ *
+ * One line per UID, with the newest LAST-MODIFIED, the SEQUENCE and a
+ * hash of the component text as of the last sync. LAST-MODIFIED and
+ * SEQUENCE are checked first, the (more expensive) hash only when they
+ * differ, so that a touched but otherwise identical component doesn't
+ * count as a change.
+ */
+
+#define JOURNAL_HEADER "gnome-pilot-change-journal 1"
+
+typedef struct {
+	gint64 last_modified;
+	gint sequence;
+	guint64 hash;
+	GSList *comps;
+} JournalEntry;
+
+struct _ECalChangeJournal {
+	gchar *filename;
+	gchar *source_uid;
+
+	/* state at the last sync, NULL if there is none */
+	GHashTable *base;
+	/* state as of now, written out by _save () */
+	GHashTable *current;
+};
+
+static void
+journal_entry_free (JournalEntry *entry)
+{
+	g_slist_free (entry->comps);
+	g_free (entry);
+}
+
+static GHashTable *
+journal_table_new (void)
+{
+	return g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+				      (GDestroyNotify) journal_entry_free);
+}
+
+/* Properties the server rewrites on every store, they say nothing
+ * about the content */
+static gboolean
+journal_skip_line (const gchar *line)
+{
+	return g_str_has_prefix (line, "LAST-MODIFIED")
+		|| g_str_has_prefix (line, "DTSTAMP")
+		|| g_str_has_prefix (line, "SEQUENCE")
+		|| g_str_has_prefix (line, "CREATED");
+}
+
+static guint64
+journal_comp_hash (ECalComponent *comp)
+{
+	gchar *str;
+	const gchar *line, *end;
+	guint64 hash = G_GUINT64_CONSTANT (14695981039346656037);
+
+	str = e_cal_component_get_as_string (comp);
+	if (str == NULL)
+		return 0;
+
+	for (line = str; *line; line = end) {
+		end = strchr (line, '\n');
+		end = end ? end + 1 : line + strlen (line);
+
+		if (journal_skip_line (line))
+			continue;
+
+		for (; line < end; line++) {
+			hash ^= (guchar) *line;
+			hash *= G_GUINT64_CONSTANT (1099511628211);
+		}
+	}
+
+	g_free (str);
+
+	return hash;
+}
+
+static void
+journal_entry_stamp (JournalEntry *entry, ECalComponent *comp)
+{
+	ICalTime *tt;
+	gint64 last_modified = 0;
+
+	tt = e_cal_component_get_last_modified (comp);
+	if (tt) {
+		last_modified = i_cal_time_as_timet (tt);
+		g_object_unref (tt);
+	}
+
+	/* detached instances share the UID of their master */
+	entry->last_modified = MAX (entry->last_modified, last_modified);
+	entry->sequence += e_cal_component_get_sequence (comp) + 1;
+}
+
+static void
+journal_entry_hash (JournalEntry *entry)
+{
+	GSList *l;
+
+	entry->hash = 0;
+	for (l = entry->comps; l != NULL; l = l->next)
+		entry->hash += journal_comp_hash (l->data);
+}
+
+ECalChangeJournal *
+e_cal_change_journal_load (const gchar *filename, const gchar *source_uid)
+{
+	ECalChangeJournal *journal;
+	gchar *contents = NULL;
+	gchar **lines;
+	gint i;
+
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	journal = g_new0 (ECalChangeJournal, 1);
+	journal->filename = g_strdup (filename);
+	journal->source_uid = g_strdup (source_uid ? source_uid : "");
+	journal->current = journal_table_new ();
+
+	if (!g_file_get_contents (filename, &contents, NULL, NULL))
+		return journal;
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	/* a journal for another source is as good as none */
+	if (lines[0] == NULL || strcmp (lines[0], JOURNAL_HEADER) != 0
+	    || lines[1] == NULL || strcmp (lines[1], journal->source_uid) != 0) {
+		LOG (g_message ("ignoring change journal %s", filename));
+		g_strfreev (lines);
+		return journal;
+	}
+
+	journal->base = journal_table_new ();
+	for (i = 2; lines[i] != NULL; i++) {
+		JournalEntry *entry;
+		gchar **fields;
+
+		fields = g_strsplit (lines[i], "\t", 4);
+		if (g_strv_length (fields) == 4) {
+			entry = g_new0 (JournalEntry, 1);
+			entry->last_modified = g_ascii_strtoll (fields[0], NULL, 10);
+			entry->sequence = (gint) g_ascii_strtoll (fields[1], NULL, 10);
+			entry->hash = g_ascii_strtoull (fields[2], NULL, 16);
+			g_hash_table_replace (journal->base, g_strdup (fields[3]), entry);
+		}
+		g_strfreev (fields);
+	}
+	g_strfreev (lines);
+
+	return journal;
+}
+
+static ECalChange *
+journal_change_new (ECalComponent *comp, ECalChangeType type)
+{
+	ECalChange *ccc;
+
+	ccc = g_new0 (ECalChange, 1);
+	ccc->comp = comp;
+	ccc->type = type;
+
+	return ccc;
+}
+
+/* Fills journal->current in from comps */
+static void
+journal_add_comps (ECalChangeJournal *journal, GList *comps)
+{
+	GList *l;
+
+	for (l = comps; l != NULL; l = l->next) {
+		ECalComponent *comp = l->data;
+		JournalEntry *entry;
+		const gchar *uid;
+
+		uid = e_cal_component_get_uid (comp);
+		if (uid == NULL)
+			continue;
+
+		entry = g_hash_table_lookup (journal->current, uid);
+		if (entry == NULL) {
+			entry = g_new0 (JournalEntry, 1);
+			g_hash_table_insert (journal->current, g_strdup (uid), entry);
+		}
+		entry->comps = g_slist_append (entry->comps, comp);
+		journal_entry_stamp (entry, comp);
+	}
+}
+
+/*
+ * Classifies what is in journal->current against the base. With uids,
+ * only those UIDs are looked at, everything else in journal->current
+ * having been carried over from the base.
+ */
+static GList *
+journal_classify (ECalChangeJournal *journal, GHashTable *uids, ECalComponentVType vtype)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GList *changes = NULL;
+
+	g_hash_table_iter_init (&iter, journal->current);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		JournalEntry *entry = value, *old = NULL;
+		ECalComponent *comp;
+
+		if (entry->comps == NULL)
+			continue;
+		comp = entry->comps->data;
+
+		if (journal->base)
+			old = g_hash_table_lookup (journal->base, key);
+
+		if (old && old->last_modified != 0
+		    && old->last_modified == entry->last_modified
+		    && old->sequence == entry->sequence) {
+			entry->hash = old->hash;
+			continue;
+		}
+
+		journal_entry_hash (entry);
+
+		if (journal->base == NULL)
+			changes = g_list_prepend (changes, journal_change_new (g_object_ref (comp), E_CAL_CHANGE_MODIFIED));
+		else if (old == NULL)
+			changes = g_list_prepend (changes, journal_change_new (g_object_ref (comp), E_CAL_CHANGE_ADDED));
+		else if (old->hash != entry->hash)
+			changes = g_list_prepend (changes, journal_change_new (g_object_ref (comp), E_CAL_CHANGE_MODIFIED));
+	}
+
+	if (journal->base) {
+		g_hash_table_iter_init (&iter, uids ? uids : journal->base);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			ECalComponent *comp;
+
+			if (g_hash_table_lookup (journal->current, key)
+			    || !g_hash_table_lookup (journal->base, key))
+				continue;
+
+			comp = e_cal_component_new ();
+			e_cal_component_set_new_vtype (comp, vtype);
+			e_cal_component_set_uid (comp, key);
+			changes = g_list_prepend (changes, journal_change_new (comp, E_CAL_CHANGE_DELETED));
+		}
+	}
+
+	/* the component lists are only needed while classifying */
+	g_hash_table_iter_init (&iter, journal->current);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		JournalEntry *entry = value;
+
+		g_slist_free (entry->comps);
+		entry->comps = NULL;
+	}
+
+	return changes;
+}
+
+/*
+ * Compares comps (the complete local database) against the state at the
+ * last sync and returns the differences as a list of ECalChange, to be
+ * freed with e_cal_free_change_list (). Deleted components are returned
+ * as a stub of the given vtype carrying only the UID. Without a previous
+ * state every component is reported as modified.
+ */
+GList *
+e_cal_change_journal_get_changes (ECalChangeJournal *journal, GList *comps, ECalComponentVType vtype)
+{
+	g_return_val_if_fail (journal != NULL, NULL);
+
+	g_hash_table_remove_all (journal->current);
+	journal_add_comps (journal, comps);
+
+	return journal_classify (journal, NULL, vtype);
+}
+
+gboolean
+e_cal_change_journal_has_base (ECalChangeJournal *journal)
+{
+	g_return_val_if_fail (journal != NULL, FALSE);
+
+	return journal->base != NULL;
+}
+
+/*
+ * Like e_cal_change_journal_get_changes (), for when all that may have
+ * changed since the last sync is known to be in uids: only those are
+ * fetched from the client, and appended to *comps. Needs a previous
+ * state, see e_cal_change_journal_has_base ().
+ */
+gboolean
+e_cal_change_journal_get_changes_for_uids (ECalChangeJournal *journal, ECalClient *client,
+					   GHashTable *uids, ECalComponentVType vtype,
+					   GList **comps, GList **changes, GError **error)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GList *fetched = NULL;
+
+	g_return_val_if_fail (journal != NULL, FALSE);
+	g_return_val_if_fail (journal->base != NULL, FALSE);
+	g_return_val_if_fail (uids != NULL, FALSE);
+	g_return_val_if_fail (changes != NULL, FALSE);
+
+	*changes = NULL;
+
+	g_hash_table_iter_init (&iter, uids);
+	while (g_hash_table_iter_next (&iter, &key, NULL)) {
+		GSList *objects = NULL, *o;
+		GError *local_error = NULL;
+
+		if (!e_cal_client_get_objects_for_uid_sync (client, key, &objects, NULL, &local_error)) {
+			if (g_error_matches (local_error, E_CAL_CLIENT_ERROR, E_CAL_CLIENT_ERROR_OBJECT_NOT_FOUND)) {
+				/* removed, or added and removed again */
+				g_clear_error (&local_error);
+				continue;
+			}
+			g_propagate_error (error, local_error);
+			g_list_free_full (fetched, g_object_unref);
+			return FALSE;
+		}
+
+		for (o = objects; o != NULL; o = o->next)
+			fetched = g_list_prepend (fetched, o->data);
+		g_slist_free (objects);
+	}
+	fetched = g_list_reverse (fetched);
+
+	/* what wasn't touched is as it was */
+	g_hash_table_remove_all (journal->current);
+	g_hash_table_iter_init (&iter, journal->base);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		JournalEntry *entry;
+
+		if (g_hash_table_lookup (uids, key))
+			continue;
+
+		entry = g_new0 (JournalEntry, 1);
+		*entry = *(JournalEntry *) value;
+		entry->comps = NULL;
+		g_hash_table_insert (journal->current, g_strdup (key), entry);
+	}
+
+	journal_add_comps (journal, fetched);
+	*changes = journal_classify (journal, uids, vtype);
+
+	*comps = g_list_concat (*comps, fetched);
+
+	return TRUE;
+}
+
+/* The number of UIDs in the local database, as far as the journal knows */
+guint
+e_cal_change_journal_count (ECalChangeJournal *journal)
+{
+	g_return_val_if_fail (journal != NULL, 0);
+
+	return g_hash_table_size (journal->current);
+}
+
+/*
+ * Records the components with this UID as they now are in index, the
+ * master and its detached instances together as at load, so that
+ * changes the conduit makes itself are not picked up as local changes
+ * next time. Call after the index has the changed component.
+ */
+void
+e_cal_change_journal_update (ECalChangeJournal *journal, ECalCompIndex *index, const gchar *uid)
+{
+	JournalEntry *entry;
+	GSList *l;
+
+	g_return_if_fail (journal != NULL);
+	g_return_if_fail (index != NULL);
+
+	if (uid == NULL)
+		return;
+
+	entry = g_new0 (JournalEntry, 1);
+	entry->comps = e_cal_comp_index_list (index, uid);
+	if (entry->comps == NULL) {
+		g_free (entry);
+		g_hash_table_remove (journal->current, uid);
+		return;
+	}
+
+	for (l = entry->comps; l != NULL; l = l->next)
+		journal_entry_stamp (entry, l->data);
+	journal_entry_hash (entry);
+	g_slist_free (entry->comps);
+	entry->comps = NULL;
+
+	/* the server sets its own LAST-MODIFIED, which can't be known
+	   here; leave it to the hash next time */
+	entry->last_modified = 0;
+
+	g_hash_table_replace (journal->current, g_strdup (uid), entry);
+}
+
+void
+e_cal_change_journal_remove (ECalChangeJournal *journal, const gchar *uid)
+{
+	g_return_if_fail (journal != NULL);
+	g_return_if_fail (uid != NULL);
+
+	g_hash_table_remove (journal->current, uid);
+}
+
+gboolean
+e_cal_change_journal_save (ECalChangeJournal *journal)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *str;
+	gboolean retval;
+
+	g_return_val_if_fail (journal != NULL, FALSE);
+
+	str = g_string_new (JOURNAL_HEADER "\n");
+	g_string_append_printf (str, "%s\n", journal->source_uid);
+
+	g_hash_table_iter_init (&iter, journal->current);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		JournalEntry *entry = value;
+
+		g_string_append_printf (str, "%" G_GINT64_FORMAT "\t%d\t%" G_GINT64_MODIFIER "x\t%s\n",
+					entry->last_modified, entry->sequence,
+					entry->hash, (const gchar *) key);
+	}
+
+	retval = g_file_set_contents (journal->filename, str->str, str->len, NULL);
+	if (!retval)
+		g_warning ("Could not write change journal %s", journal->filename);
+
+	g_string_free (str, TRUE);
+
+	return retval;
+}
+
+void
+e_cal_change_journal_free (ECalChangeJournal *journal)
+{
+	if (journal == NULL)
+		return;
+
+	if (journal->base)
+		g_hash_table_destroy (journal->base);
+	g_hash_table_destroy (journal->current);
+	g_free (journal->source_uid);
+	g_free (journal->filename);
+	g_free (journal);
+}
+
+/* Component index
+ *
+ * Masters are keyed by their UID, detached recurrence instances by
+ * RECURRENCE-ID in a table per UID, so that a lookup without a
+ * RECURRENCE-ID gets the master like e_cal_client_get_object_sync ()
+ * would, and everything under one UID is found without a scan.
+ */
+
+struct _ECalCompIndex {
+	/* UID -> master */
+	GHashTable *comps;
+	/* UID -> (RECURRENCE-ID -> detached instance) */
+	GHashTable *instances;
+};
+
+ECalCompIndex *
+e_cal_comp_index_new (GList *comps)
+{
+	ECalCompIndex *index;
+	GList *l;
+
+	index = g_new0 (ECalCompIndex, 1);
+	index->comps = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+	index->instances = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+						  (GDestroyNotify) g_hash_table_destroy);
+
+	for (l = comps; l != NULL; l = l->next)
+		e_cal_comp_index_add (index, l->data);
+
+	return index;
+}
+
+void
+e_cal_comp_index_add (ECalCompIndex *index, ECalComponent *comp)
+{
+	GHashTable *instances;
+	const gchar *uid;
+	gchar *rid;
+
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (comp != NULL);
+
+	uid = e_cal_component_get_uid (comp);
+	if (uid == NULL)
+		return;
+
+	rid = e_cal_component_get_recurid_as_string (comp);
+	if (rid == NULL || *rid == '\0') {
+		g_hash_table_replace (index->comps, g_strdup (uid), g_object_ref (comp));
+		g_free (rid);
+		return;
+	}
+
+	instances = g_hash_table_lookup (index->instances, uid);
+	if (instances == NULL) {
+		instances = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_object_unref);
+		g_hash_table_insert (index->instances, g_strdup (uid), instances);
+	}
+	g_hash_table_replace (instances, rid, g_object_ref (comp));
+}
+
+/*
+ * Removes the component with this UID and all its detached instances
+ */
+void
+e_cal_comp_index_remove (ECalCompIndex *index, const gchar *uid)
+{
+	g_return_if_fail (index != NULL);
+	g_return_if_fail (uid != NULL);
+
+	g_hash_table_remove (index->comps, uid);
+	g_hash_table_remove (index->instances, uid);
+}
+
+ECalComponent *
+e_cal_comp_index_lookup (ECalCompIndex *index, const gchar *uid, const gchar *rid)
+{
+	GHashTable *instances;
+
+	g_return_val_if_fail (index != NULL, NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+
+	if (rid == NULL || *rid == '\0')
+		return g_hash_table_lookup (index->comps, uid);
+
+	instances = g_hash_table_lookup (index->instances, uid);
+
+	return instances ? g_hash_table_lookup (instances, rid) : NULL;
+}
+
+/*
+ * The master and the detached instances with this UID, master first.
+ * The list is to be freed with g_slist_free (), the components belong
+ * to the index.
+ */
+GSList *
+e_cal_comp_index_list (ECalCompIndex *index, const gchar *uid)
+{
+	GHashTable *instances;
+	GHashTableIter iter;
+	gpointer value;
+	GSList *comps = NULL;
+	ECalComponent *comp;
+
+	g_return_val_if_fail (index != NULL, NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+
+	instances = g_hash_table_lookup (index->instances, uid);
+	if (instances) {
+		g_hash_table_iter_init (&iter, instances);
+		while (g_hash_table_iter_next (&iter, NULL, &value))
+			comps = g_slist_prepend (comps, value);
+	}
+
+	if ((comp = g_hash_table_lookup (index->comps, uid)))
+		comps = g_slist_prepend (comps, comp);
+
+	return comps;
+}
+
+/*
+ * Returns a new reference to the master component with this UID, asking
+ * the server only if it was not loaded. Fails like
+ * e_cal_client_get_object_sync () does.
+ */
+ECalComponent *
+e_cal_comp_index_get (ECalCompIndex *index, ECalClient *client, const gchar *uid, GError **error)
+{
+	ECalComponent *comp;
+	ICalComponent *icalcomp;
+
+	g_return_val_if_fail (index != NULL, NULL);
+	g_return_val_if_fail (uid != NULL, NULL);
+
+	comp = e_cal_comp_index_lookup (index, uid, NULL);
+	if (comp != NULL)
+		return g_object_ref (comp);
+
+	LOG (g_message ("%s not loaded, asking the server", uid));
+
+	if (!e_cal_client_get_object_sync (client, uid, NULL, &icalcomp, NULL, error))
+		return NULL;
+
+	comp = e_cal_component_new ();
+	if (!e_cal_component_set_icalcomponent (comp, icalcomp)) {
+		g_object_unref (comp);
+		g_object_unref (icalcomp);
+		g_set_error_literal (error, E_CAL_CLIENT_ERROR, E_CAL_CLIENT_ERROR_INVALID_OBJECT,
+				     "Invalid object");
+		return NULL;
+	}
+
+	e_cal_comp_index_add (index, comp);
+
+	return comp;
+}
+
+/*
+ * Replaces *comps with every component in the client, for when only
+ * part of the local database was loaded at pre_sync. Components the
+ * index already has are kept, they may carry changes not written yet.
+ */
+gboolean
+e_cal_comp_index_load_all (ECalCompIndex *index, ECalClient *client, GList **comps, GError **error)
+{
+	GSList *objects = NULL, *o;
+	GList *all = NULL;
+
+	g_return_val_if_fail (index != NULL, FALSE);
+	g_return_val_if_fail (comps != NULL, FALSE);
+
+	if (!e_cal_client_get_object_list_as_comps_sync (client, "#t", &objects, NULL, error))
+		return FALSE;
+
+	for (o = objects; o != NULL; o = o->next) {
+		ECalComponent *comp = o->data, *known;
+		const gchar *uid;
+		gchar *rid;
+
+		uid = e_cal_component_get_uid (comp);
+		if (uid == NULL) {
+			g_object_unref (comp);
+			continue;
+		}
+
+		rid = e_cal_component_get_recurid_as_string (comp);
+		known = e_cal_comp_index_lookup (index, uid, rid);
+		g_free (rid);
+
+		if (known != NULL) {
+			g_object_unref (comp);
+			comp = g_object_ref (known);
+		} else {
+			e_cal_comp_index_add (index, comp);
+		}
+		all = g_list_prepend (all, comp);
+	}
+	g_slist_free (objects);
+
+	g_list_free_full (*comps, g_object_unref);
+	*comps = g_list_reverse (all);
+
+	return TRUE;
+}
+
+void
+e_cal_comp_index_free (ECalCompIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	g_hash_table_destroy (index->comps);
+	g_hash_table_destroy (index->instances);
+	g_free (index);
+}
+
+/* Write batch
+ *
+ * add_record, replace_record and delete_record stage their changes here
+ * instead of making a round trip to the server each. The staged changes
+ * go out in chunks through the bulk calls, when a chunk's worth has
+ * piled up and at post_sync. Several changes to one UID are folded into
+ * one. A chunk the server refuses is sent again an item at a time, so
+ * one bad component only fails itself.
+ */
+
+#define WRITE_BATCH_CHUNK 100
+
+typedef enum {
+	WRITE_OP_NONE,
+	WRITE_OP_CREATE,
+	WRITE_OP_MODIFY,
+	WRITE_OP_REMOVE
+} WriteOpType;
+
+typedef struct {
+	WriteOpType type;
+	gchar *uid;
+	ECalComponent *comp;
+	/* pilot record the created component belongs to */
+	guint32 pid;
+} WriteOp;
+
+struct _ECalWriteBatch {
+	ECalClient *client;
+	EPilotMap *map;
+	ECalChangeJournal *journal;
+	ECalCompIndex *index;
+
+	GQueue ops;
+	GHashTable *by_uid;
+	gboolean failed;
+};
+
+static gboolean write_batch_flush (ECalWriteBatch *batch, GError **error);
+
+static void
+write_op_free (WriteOp *op)
+{
+	if (op->comp)
+		g_object_unref (op->comp);
+	g_free (op->uid);
+	g_free (op);
+}
+
+/*
+ * Components the server was asked to create are mapped, journalled and
+ * indexed under the UIDs it gave them, so map, journal and index must
+ * be the ones those components went into; any may be NULL.
+ */
+ECalWriteBatch *
+e_cal_write_batch_new (ECalClient *client, EPilotMap *map, ECalChangeJournal *journal, ECalCompIndex *index)
+{
+	ECalWriteBatch *batch;
+
+	g_return_val_if_fail (client != NULL, NULL);
+
+	batch = g_new0 (ECalWriteBatch, 1);
+	batch->client = g_object_ref (client);
+	batch->map = map;
+	batch->journal = journal;
+	batch->index = index;
+	g_queue_init (&batch->ops);
+	batch->by_uid = g_hash_table_new (g_str_hash, g_str_equal);
+
+	return batch;
+}
+
+/* Returns FALSE if the flush this staging set off failed */
+static gboolean
+write_batch_stage (ECalWriteBatch *batch, WriteOpType type, const gchar *uid, ECalComponent *comp, guint32 pid)
+{
+	WriteOp *op;
+
+	op = g_hash_table_lookup (batch->by_uid, uid);
+	if (op != NULL && op->type == WRITE_OP_REMOVE && type == WRITE_OP_CREATE) {
+		/* creations go out before removals, the old one has to be
+		   gone first or the server still has the UID */
+		if (!write_batch_flush (batch, NULL))
+			return FALSE;
+		op = NULL;
+	}
+
+	if (op == NULL) {
+		op = g_new0 (WriteOp, 1);
+		op->uid = g_strdup (uid);
+		op->type = type;
+		g_queue_push_tail (&batch->ops, op);
+		g_hash_table_insert (batch->by_uid, op->uid, op);
+	} else if (op->type == WRITE_OP_CREATE && type == WRITE_OP_MODIFY) {
+		/* still a creation, just of the newer version */
+	} else if (op->type == WRITE_OP_CREATE && type == WRITE_OP_REMOVE) {
+		/* never reached the server */
+		op->type = WRITE_OP_NONE;
+	} else {
+		op->type = type;
+	}
+
+	if (op->comp)
+		g_object_unref (op->comp);
+	op->comp = comp ? g_object_ref (comp) : NULL;
+	if (pid)
+		op->pid = pid;
+
+	if (g_queue_get_length (&batch->ops) >= WRITE_BATCH_CHUNK)
+		return write_batch_flush (batch, NULL);
+
+	return TRUE;
+}
+
+gboolean
+e_cal_write_batch_create (ECalWriteBatch *batch, ECalComponent *comp, guint32 pid)
+{
+	g_return_val_if_fail (batch != NULL, FALSE);
+	g_return_val_if_fail (comp != NULL, FALSE);
+
+	return write_batch_stage (batch, WRITE_OP_CREATE, e_cal_component_get_uid (comp), comp, pid);
+}
+
+gboolean
+e_cal_write_batch_modify (ECalWriteBatch *batch, ECalComponent *comp)
+{
+	g_return_val_if_fail (batch != NULL, FALSE);
+	g_return_val_if_fail (comp != NULL, FALSE);
+
+	return write_batch_stage (batch, WRITE_OP_MODIFY, e_cal_component_get_uid (comp), comp, 0);
+}
+
+gboolean
+e_cal_write_batch_remove (ECalWriteBatch *batch, const gchar *uid)
+{
+	g_return_val_if_fail (batch != NULL, FALSE);
+	g_return_val_if_fail (uid != NULL, FALSE);
+
+	return write_batch_stage (batch, WRITE_OP_REMOVE, uid, NULL, 0);
+}
+
+/* The server created op->comp as new_uid instead of op->uid */
+static void
+write_batch_rekey (ECalWriteBatch *batch, WriteOp *op, const gchar *new_uid)
+{
+	LOG (g_message ("%s was created as %s", op->uid, new_uid));
+
+	if (batch->index)
+		e_cal_comp_index_remove (batch->index, op->uid);
+	if (batch->journal)
+		e_cal_change_journal_remove (batch->journal, op->uid);
+
+	e_cal_component_set_uid (op->comp, new_uid);
+
+	if (batch->index)
+		e_cal_comp_index_add (batch->index, op->comp);
+	if (batch->journal && batch->index)
+		e_cal_change_journal_update (batch->journal, batch->index, new_uid);
+	if (op->pid != 0 && batch->map != NULL)
+		e_pilot_map_insert (batch->map, op->pid, new_uid, e_pilot_map_uid_is_archived (batch->map, op->uid));
+}
+
+static gboolean
+write_batch_send (ECalWriteBatch *batch, WriteOpType type, GSList *ops, GError **error)
+{
+	GSList *items = NULL, *uids = NULL, *l, *u;
+	gboolean retval;
+
+	for (l = ops; l != NULL; l = l->next) {
+		WriteOp *op = l->data;
+
+		if (type == WRITE_OP_REMOVE)
+			items = g_slist_prepend (items, e_cal_component_id_new (op->uid, NULL));
+		else
+			items = g_slist_prepend (items, e_cal_component_get_icalcomponent (op->comp));
+	}
+	items = g_slist_reverse (items);
+
+	switch (type) {
+	case WRITE_OP_CREATE:
+		retval = e_cal_client_create_objects_sync (batch->client, items, E_CAL_OPERATION_FLAG_NONE,
+							   &uids, NULL, error);
+		g_slist_free (items);
+
+		/* the server may have picked other UIDs than we did */
+		for (l = ops, u = uids; retval && l != NULL && u != NULL; l = l->next, u = u->next) {
+			WriteOp *op = l->data;
+
+			if (g_strcmp0 (op->uid, u->data) != 0)
+				write_batch_rekey (batch, op, u->data);
+		}
+		g_slist_free_full (uids, g_free);
+		break;
+	case WRITE_OP_MODIFY:
+		retval = e_cal_client_modify_objects_sync (batch->client, items, E_CAL_OBJ_MOD_ALL,
+							   E_CAL_OPERATION_FLAG_NONE, NULL, error);
+		g_slist_free (items);
+		break;
+	case WRITE_OP_REMOVE:
+		retval = e_cal_client_remove_objects_sync (batch->client, items, E_CAL_OBJ_MOD_ALL,
+							   E_CAL_OPERATION_FLAG_NONE, NULL, error);
+		g_slist_free_full (items, (GDestroyNotify) e_cal_component_id_free);
+		break;
+	default:
+		g_assert_not_reached ();
+	}
+
+	return retval;
+}
+
+static void
+write_batch_failed (ECalWriteBatch *batch, GError *local_error, GError **error)
+{
+	if (!batch->failed && local_error)
+		g_propagate_error (error, local_error);
+	else
+		g_clear_error (&local_error);
+	batch->failed = TRUE;
+}
+
+static gboolean
+write_batch_send_chunk (ECalWriteBatch *batch, WriteOpType type, GSList *chunk, GError **error)
+{
+	GError *local_error = NULL;
+	gboolean retval = TRUE;
+	GSList *l;
+
+	if (write_batch_send (batch, type, chunk, &local_error))
+		return TRUE;
+
+	if (chunk->next == NULL) {
+		/* already gone is as good as removed */
+		if (type == WRITE_OP_REMOVE
+		    && g_error_matches (local_error, E_CAL_CLIENT_ERROR, E_CAL_CLIENT_ERROR_OBJECT_NOT_FOUND)) {
+			g_clear_error (&local_error);
+			return TRUE;
+		}
+
+		g_warning ("Could not write %s to the calendar: %s", ((WriteOp *) chunk->data)->uid,
+			   local_error ? local_error->message : "unknown error");
+		write_batch_failed (batch, local_error, error);
+		return FALSE;
+	}
+
+	/* find the ones the server won't take, and write the others */
+	LOG (g_message ("writing %d changes failed, retrying them one at a time: %s", g_slist_length (chunk),
+			local_error ? local_error->message : "unknown error"));
+	g_clear_error (&local_error);
+
+	for (l = chunk; l != NULL; l = l->next) {
+		GSList one = { l->data, NULL };
+
+		if (!write_batch_send_chunk (batch, type, &one, error))
+			retval = FALSE;
+	}
+
+	return retval;
+}
+
+/* Sends everything staged, returns FALSE if any of it failed */
+static gboolean
+write_batch_flush (ECalWriteBatch *batch, GError **error)
+{
+	static const WriteOpType order [] = { WRITE_OP_CREATE, WRITE_OP_MODIFY, WRITE_OP_REMOVE };
+	gboolean retval = TRUE;
+	GList *l;
+	gint i;
+
+	for (i = 0; i < G_N_ELEMENTS (order); i++) {
+		GSList *chunk = NULL;
+		gint n = 0;
+
+		for (l = batch->ops.head; l != NULL; l = l->next) {
+			WriteOp *op = l->data;
+
+			if (op->type != order[i])
+				continue;
+
+			chunk = g_slist_prepend (chunk, op);
+			if (++n == WRITE_BATCH_CHUNK) {
+				chunk = g_slist_reverse (chunk);
+				if (!write_batch_send_chunk (batch, order[i], chunk, error))
+					retval = FALSE;
+				g_slist_free (chunk);
+				chunk = NULL;
+				n = 0;
+			}
+		}
+
+		if (chunk != NULL) {
+			chunk = g_slist_reverse (chunk);
+			if (!write_batch_send_chunk (batch, order[i], chunk, error))
+				retval = FALSE;
+			g_slist_free (chunk);
+		}
+	}
+
+	g_hash_table_remove_all (batch->by_uid);
+	while (!g_queue_is_empty (&batch->ops))
+		write_op_free (g_queue_pop_head (&batch->ops));
+
+	return retval;
+}
+
+/*
+ * Sends everything staged so far: creations first, then modifications,
+ * then removals. Returns FALSE if anything failed to be written since
+ * the batch was created.
+ */
+gboolean
+e_cal_write_batch_flush (ECalWriteBatch *batch, GError **error)
+{
+	g_return_val_if_fail (batch != NULL, FALSE);
+
+	write_batch_flush (batch, error);
+
+	return !batch->failed;
+}
+
+/*
+ * Frees the batch, dropping whatever was not flushed
+ */
+void
+e_cal_write_batch_free (ECalWriteBatch *batch)
+{
+	if (batch == NULL)
+		return;
+
+	if (!g_queue_is_empty (&batch->ops))
+		LOG (g_message ("dropping %d unwritten changes", g_queue_get_length (&batch->ops)));
+
+	g_hash_table_destroy (batch->by_uid);
+	while (!g_queue_is_empty (&batch->ops))
+		write_op_free (g_queue_pop_head (&batch->ops));
+	g_object_unref (batch->client);
+	g_free (batch);
+}
+
+/* Local change watch
+ *
+ * Run inside gpilotd between syncs: a view on the whole source, set up
+ * not to report what is already there, feeding an EPilotWatchLog. The
+ * log only starts once the view is complete, so that nothing it misses
+ * while starting up can be mistaken for "unchanged".
+ */
+
+struct _ECalWatch {
+	ECalClient *client;
+	ECalClientView *view;
+	gchar *filename;
+	gchar *source_uid;
+	EPilotWatchLog *log;
+	gboolean dead;
+};
+
+/* The view stopped reporting, what it logged so far cannot be trusted */
+static void
+cal_watch_break (ECalWatch *watch)
+{
+	watch->dead = TRUE;
+	if (watch->log != NULL)
+		e_pilot_watch_log_break (watch->log);
+}
+
+static void
+cal_watch_objects_changed (ECalClientView *view, const GSList *objects, ECalWatch *watch)
+{
+	const GSList *l;
+
+	if (watch->log == NULL)
+		return;
+
+	for (l = objects; l != NULL; l = l->next)
+		e_pilot_watch_log_add (watch->log, E_PILOT_WATCH_CHANGED,
+				       i_cal_component_get_uid (l->data));
+}
+
+static void
+cal_watch_objects_removed (ECalClientView *view, const GSList *ids, ECalWatch *watch)
+{
+	const GSList *l;
+
+	if (watch->log == NULL)
+		return;
+
+	for (l = ids; l != NULL; l = l->next) {
+		const gchar *rid = e_cal_component_id_get_rid (l->data);
+
+		/* a removed instance changes its master */
+		e_pilot_watch_log_add (watch->log,
+				       rid && *rid ? E_PILOT_WATCH_CHANGED : E_PILOT_WATCH_REMOVED,
+				       e_cal_component_id_get_uid (l->data));
+	}
+}
+
+static void
+cal_watch_complete (ECalClientView *view, const GError *error, ECalWatch *watch)
+{
+	if (error != NULL) {
+		g_warning ("Could not watch %s: %s", watch->source_uid, error->message);
+		cal_watch_break (watch);
+		return;
+	}
+
+	if (watch->log == NULL && !watch->dead)
+		watch->log = e_pilot_watch_log_new (watch->filename, watch->source_uid);
+}
+
+static void
+cal_watch_backend_died (EClient *client, ECalWatch *watch)
+{
+	g_warning ("Backend of %s died", watch->source_uid);
+	cal_watch_break (watch);
+}
+
+static void
+cal_watch_client_dropped (EClient *client, gpointer watch)
+{
+	g_warning ("Connection to %s was dropped", ((ECalWatch *) watch)->source_uid);
+	cal_watch_break (watch);
+}
+
+static EClient *
+cal_pool_connect (ESource *source, gpointer source_type, GError **error)
+{
+	return e_cal_client_connect_sync (source, GPOINTER_TO_INT (source_type),
+					  30, /* timeout seconds */
+					  NULL, error);
+}
+
+ECalClient *
+e_cal_pool_get_client (ESource *source, ECalClientSourceType source_type, GError **error)
+{
+	return (ECalClient *) e_pilot_client_pool_get (source, cal_pool_connect,
+						       GINT_TO_POINTER (source_type), error);
+}
+
+ECalWatch *
+e_cal_watch_start (ESource *source, ECalClientSourceType source_type, const gchar *filename)
+{
+	ECalWatch *watch;
+	GSList *fields;
+	GError *error = NULL;
+
+	g_return_val_if_fail (source != NULL, NULL);
+	g_return_val_if_fail (filename != NULL, NULL);
+
+	watch = g_new0 (ECalWatch, 1);
+	watch->filename = g_strdup (filename);
+	watch->source_uid = g_strdup (e_source_get_uid (source));
+
+	watch->client = e_cal_pool_get_client (source, source_type, &error);
+	if (watch->client == NULL
+	    || !e_cal_client_get_view_sync (watch->client, "#t", &watch->view, NULL, &error)) {
+		g_warning ("Could not watch %s: %s", watch->source_uid, error ? error->message : "");
+		g_clear_error (&error);
+		e_cal_watch_stop (watch);
+		return NULL;
+	}
+
+	/* only the UIDs are of interest, and only from now on */
+	fields = g_slist_prepend (NULL, (gpointer) "UID");
+	e_cal_client_view_set_fields_of_interest (watch->view, fields, NULL);
+	g_slist_free (fields);
+	e_cal_client_view_set_flags (watch->view, E_CAL_CLIENT_VIEW_FLAGS_NONE, NULL);
+
+	g_signal_connect (watch->view, "objects-added", G_CALLBACK (cal_watch_objects_changed), watch);
+	g_signal_connect (watch->view, "objects-modified", G_CALLBACK (cal_watch_objects_changed), watch);
+	g_signal_connect (watch->view, "objects-removed", G_CALLBACK (cal_watch_objects_removed), watch);
+	g_signal_connect (watch->view, "complete", G_CALLBACK (cal_watch_complete), watch);
+	g_signal_connect (watch->client, "backend-died", G_CALLBACK (cal_watch_backend_died), watch);
+	e_pilot_client_pool_add_dropped_func (E_CLIENT (watch->client), cal_watch_client_dropped, watch);
+
+	e_cal_client_view_start (watch->view, &error);
+	if (error != NULL) {
+		g_warning ("Could not watch %s: %s", watch->source_uid, error->message);
+		g_error_free (error);
+		e_cal_watch_stop (watch);
+		return NULL;
+	}
+
+	return watch;
+}
+
+void
+e_cal_watch_stop (ECalWatch *watch)
+{
+	if (watch == NULL)
+		return;
+
+	if (watch->view != NULL) {
+		g_signal_handlers_disconnect_matched (watch->view, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, watch);
+		e_cal_client_view_stop (watch->view, NULL);
+		g_object_unref (watch->view);
+	}
+	if (watch->client != NULL) {
+		g_signal_handlers_disconnect_matched (watch->client, G_SIGNAL_MATCH_DATA, 0, 0, NULL, NULL, watch);
+		e_pilot_client_pool_remove_dropped_func (E_CLIENT (watch->client), watch);
+	}
+	e_pilot_client_pool_release (E_CLIENT (watch->client));
+
+	e_pilot_watch_log_free (watch->log);
+	g_free (watch->source_uid);
+	g_free (watch->filename);
+	g_free (watch);
+}
+
 /*
  * Adds a category to the category app info structure (name and ID),
  * sets category->renamed[i] to true if possible to rename.
@@ -72,7 +1255,7 @@ e_cal_free_change_list (GList *list)
  *
  * NOTE: cat_to_add MUST be in PCHAR format. Evolution stores categories
  *       in UTF-8 format. A conversion must take place before calling
- *       this function (see e_pilot_utf8_to_pchar() in e-pilot-util.c)
+ *       this function (see e_pilot_charset_to_pchar() in e-pilot-util.c)
  */
 gint
 e_pilot_add_category_if_possible(gchar *cat_to_add, struct CategoryAppInfo *category)
@@ -142,7 +1325,7 @@ e_pilot_add_category_if_possible(gchar *cat_to_add, struct CategoryAppInfo *cate
 /*
  *conversion from an evolution category to a palm category
  */
-void e_pilot_local_category_to_remote(gint * pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, const gchar *pilot_charset)
+void e_pilot_local_category_to_remote(gint * pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, EPilotCharset *pilot_charset)
 {
 	GSList *c_list = NULL;
 	gchar * category_string;
@@ -150,7 +1333,7 @@ void e_pilot_local_category_to_remote(gint * pilotCategory, ECalComponent *comp,
 	c_list = e_cal_component_get_categories_list (comp);
 	if (c_list) {
 		/* list != 0, so at least 1 category is assigned */
-		category_string = e_pilot_utf8_to_pchar((const gchar *)c_list->data, pilot_charset);
+		category_string = e_pilot_charset_to_pchar (pilot_charset, (const gchar *)c_list->data);
 		if (c_list->next != 0) {
 			LOG (g_message ("Note: item has more categories in evolution, first chosen"));
 		}
@@ -178,13 +1361,13 @@ void e_pilot_local_category_to_remote(gint * pilotCategory, ECalComponent *comp,
 /*
  *conversion from a palm category to an evolution category
  */
-void e_pilot_remote_category_to_local(gint pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, const gchar *pilot_charset)
+void e_pilot_remote_category_to_local(gint pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, EPilotCharset *pilot_charset)
 {
 	gchar *category_string = NULL;
 
 	if (pilotCategory != 0) {
 		/* pda has category assigned */
-		category_string = e_pilot_utf8_from_pchar(category->name[pilotCategory], pilot_charset);
+		category_string = e_pilot_charset_from_pchar (pilot_charset, category->name[pilotCategory]);
 
 		LOG(g_message("Category: %s\n", category_string));
 
@@ -21,6 +21,9 @@
 #include <libedataserver/libedataserver.h>
 #include <libecal/libecal.h>
 #include <pi-appinfo.h>
+#include <e-pilot-map.h>
+#include <e-pilot-util.h>
+#include <e-pilot-watch.h>
 
 /* Compatibility: ECalChange was removed from modern EDS.
  * Provide a local definition for conduit change tracking. */
@@ -37,11 +40,55 @@ typedef struct {
 
 void e_cal_free_change_list (GList *list);
 
+/* Persistent per-pilot record of the components seen at the last sync,
+ * used to work out what was added, modified and deleted since. */
+typedef struct _ECalChangeJournal ECalChangeJournal;
+typedef struct _ECalCompIndex ECalCompIndex;
+
+ECalChangeJournal *e_cal_change_journal_load (const gchar *filename, const gchar *source_uid);
+GList *e_cal_change_journal_get_changes (ECalChangeJournal *journal, GList *comps, ECalComponentVType vtype);
+gboolean e_cal_change_journal_has_base (ECalChangeJournal *journal);
+gboolean e_cal_change_journal_get_changes_for_uids (ECalChangeJournal *journal, ECalClient *client, GHashTable *uids, ECalComponentVType vtype, GList **comps, GList **changes, GError **error);
+guint e_cal_change_journal_count (ECalChangeJournal *journal);
+void e_cal_change_journal_update (ECalChangeJournal *journal, ECalCompIndex *index, const gchar *uid);
+void e_cal_change_journal_remove (ECalChangeJournal *journal, const gchar *uid);
+gboolean e_cal_change_journal_save (ECalChangeJournal *journal);
+void e_cal_change_journal_free (ECalChangeJournal *journal);
+
+/* UID -> component lookups over the components loaded at pre_sync */
+ECalCompIndex *e_cal_comp_index_new (GList *comps);
+void e_cal_comp_index_add (ECalCompIndex *index, ECalComponent *comp);
+void e_cal_comp_index_remove (ECalCompIndex *index, const gchar *uid);
+ECalComponent *e_cal_comp_index_lookup (ECalCompIndex *index, const gchar *uid, const gchar *rid);
+GSList *e_cal_comp_index_list (ECalCompIndex *index, const gchar *uid);
+ECalComponent *e_cal_comp_index_get (ECalCompIndex *index, ECalClient *client, const gchar *uid, GError **error);
+gboolean e_cal_comp_index_load_all (ECalCompIndex *index, ECalClient *client, GList **comps, GError **error);
+void e_cal_comp_index_free (ECalCompIndex *index);
+
+/* Writes to the calendar staged during the sync and sent in bulk */
+typedef struct _ECalWriteBatch ECalWriteBatch;
+
+ECalWriteBatch *e_cal_write_batch_new (ECalClient *client, EPilotMap *map, ECalChangeJournal *journal, ECalCompIndex *index);
+gboolean e_cal_write_batch_create (ECalWriteBatch *batch, ECalComponent *comp, guint32 pid);
+gboolean e_cal_write_batch_modify (ECalWriteBatch *batch, ECalComponent *comp);
+gboolean e_cal_write_batch_remove (ECalWriteBatch *batch, const gchar *uid);
+gboolean e_cal_write_batch_flush (ECalWriteBatch *batch, GError **error);
+void e_cal_write_batch_free (ECalWriteBatch *batch);
+
+/* Borrows the pooled client for source, see e_pilot_client_pool_get () */
+ECalClient *e_cal_pool_get_client (ESource *source, ECalClientSourceType source_type, GError **error);
+
+/* Keeps a view open between syncs, logging the UIDs that change */
+typedef struct _ECalWatch ECalWatch;
+
+ECalWatch *e_cal_watch_start (ESource *source, ECalClientSourceType source_type, const gchar *filename);
+void e_cal_watch_stop (ECalWatch *watch);
+
 #define PILOT_MAX_CATEGORIES 16
 
 gint e_pilot_add_category_if_possible(gchar *cat_to_add, struct CategoryAppInfo *category);
-void e_pilot_local_category_to_remote(gint * pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, const gchar *pilot_charset);
-void e_pilot_remote_category_to_local(gint   pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, const gchar *pilot_charset);
+void e_pilot_local_category_to_remote(gint * pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, EPilotCharset *pilot_charset);
+void e_pilot_remote_category_to_local(gint   pilotCategory, ECalComponent *comp, struct CategoryAppInfo *category, EPilotCharset *pilot_charset);
 
 gboolean e_pilot_setup_get_bool (const gchar *path, const gchar *key, gboolean def);
 void e_pilot_setup_set_bool (const gchar *path, const gchar *key, gboolean value);
@@ -46,11 +46,15 @@
 
 GnomePilotConduit * conduit_get_gpilot_conduit (guint32);
 void conduit_destroy_gpilot_conduit (GnomePilotConduit*);
+gpointer conduit_start_watch (guint32);
+void conduit_stop_watch (gpointer);
 
 #define CONDUIT_VERSION "0.1.6"
 
+/* per-record output, see configure --enable-record-debug */
+#ifdef GPILOT_DEBUG_RECORDS
 #define DEBUG_TODOCONDUIT 1
-/* #undef DEBUG_TODOCONDUIT */
+#endif
 
 #ifdef DEBUG_TODOCONDUIT
 #define LOG(x) x
@@ -131,8 +135,10 @@ static void
 todoconduit_destroy_record (EToDoLocalRecord *local)
 {
 	g_object_unref (local->comp);
-	free_ToDo (local->todo);
-	g_free (local->todo);
+	if (local->todo != NULL) {
+		free_ToDo (local->todo);
+		g_free (local->todo);
+	}
 	g_free (local);
 }
 
@@ -147,6 +153,8 @@ struct _EToDoConduitCfg {
 	gint priority;
 
 	gchar *last_uri;
+	/* the local change watch seen at the last sync */
+	gchar *watch_session;
 };
 
 static EToDoConduitCfg *
@@ -196,6 +204,8 @@ todoconduit_load_configuration (guint32 pilot_id)
 	c->priority = e_pilot_setup_get_int (prefix, "priority", 3);
 	c->last_uri = e_pilot_setup_get_string (prefix, "last_uri", NULL);
 
+	c->watch_session = e_pilot_setup_get_string (prefix, "watch_session", NULL);
+
 	return c;
 }
 
@@ -210,6 +220,7 @@ todoconduit_save_configuration (EToDoConduitCfg *c)
 	e_pilot_setup_set_bool (prefix, "secret", c->secret);
 	e_pilot_setup_set_int (prefix, "priority", c->priority);
 	e_pilot_setup_set_string (prefix, "last_uri", c->last_uri ? c->last_uri : "");
+	e_pilot_setup_set_string (prefix, "watch_session", c->watch_session ? c->watch_session : "");
 }
 
 static EToDoConduitCfg*
@@ -229,6 +240,7 @@ todoconduit_dupe_configuration (EToDoConduitCfg *c)
 	retval->secret = c->secret;
 	retval->priority = c->priority;
 	retval->last_uri = g_strdup (c->last_uri);
+	retval->watch_session = g_strdup (c->watch_session);
 
 	return retval;
 }
@@ -243,6 +255,7 @@ todoconduit_destroy_configuration (EToDoConduitCfg *c)
 	if (c->source)
 		g_object_unref (c->source);
 	g_free (c->last_uri);
+	g_free (c->watch_session);
 	g_free (c);
 }
 
@@ -319,12 +332,23 @@ struct _EToDoConduitContext {
 	icaltimezone *timezone;
 	ECalComponent *default_comp;
 	GList *comps;
+	/* FALSE while comps only holds what the watch reported */
+	gboolean comps_complete;
+	gchar *watch_session;
 	GList *changed;
 	GHashTable *changed_hash;
 	GList *locals;
 
 	EPilotMap *map;
-	gchar *pilot_charset;
+	ECalChangeJournal *journal;
+	ECalCompIndex *index;
+	ECalWriteBatch *batch;
+	EPilotCharset *pilot_charset;
+
+	/* pre_sync_local () already ran from prepare_local */
+	gboolean prepared;
+	gint prepare_result;
+	const gchar *prepare_error;
 };
 
 static EToDoConduitContext *
@@ -344,6 +368,9 @@ e_todo_context_new (guint32 pilot_id)
 	ctxt->changed = NULL;
 	ctxt->locals = NULL;
 	ctxt->map = NULL;
+	ctxt->journal = NULL;
+	ctxt->index = NULL;
+	ctxt->batch = NULL;
 	ctxt->pilot_charset = NULL;
 
 	return ctxt;
@@ -372,7 +399,7 @@ e_todo_context_destroy (EToDoConduitContext *ctxt)
 		e_todo_gui_destroy (ctxt->gui);
 
 	if (ctxt->client != NULL)
-		g_object_unref (ctxt->client);
+		e_pilot_client_pool_release (E_CLIENT (ctxt->client));
 
 	if (ctxt->default_comp != NULL)
 		g_object_unref (ctxt->default_comp);
@@ -398,6 +425,13 @@ e_todo_context_destroy (EToDoConduitContext *ctxt)
 
 	if (ctxt->map != NULL)
 		e_pilot_map_destroy (ctxt->map);
+	if (ctxt->journal != NULL)
+		e_cal_change_journal_free (ctxt->journal);
+	g_free (ctxt->watch_session);
+	if (ctxt->index != NULL)
+		e_cal_comp_index_free (ctxt->index);
+	if (ctxt->batch != NULL)
+		e_cal_write_batch_free (ctxt->batch);
 
 	g_free (ctxt);
 }
@@ -431,7 +465,7 @@ print_local (EToDoLocalRecord *local)
 	return buff;
 }
 
-static gchar *print_remote (GnomePilotRecord *remote, const gchar *pilot_charset)
+static gchar *print_remote (GnomePilotRecord *remote, EPilotCharset *pilot_charset)
 {
 	static gchar buff[ 4096 ];
 	struct ToDo todo;
@@ -459,9 +493,9 @@ static gchar *print_remote (GnomePilotRecord *remote, const gchar *pilot_charset
 		    todo.priority,
 		    todo.complete,
 		    todo.description ?
-		    e_pilot_utf8_from_pchar(todo.description, pilot_charset) : "",
+		    e_pilot_charset_from_pchar (pilot_charset, todo.description) : "",
 		    todo.note ?
-		    e_pilot_utf8_from_pchar(todo.note, pilot_charset) : "",
+		    e_pilot_charset_from_pchar (pilot_charset, todo.note) : "",
 		    remote->category);
 
 	free_ToDo (&todo);
@@ -477,12 +511,13 @@ start_calendar_server (EToDoConduitContext *ctxt)
 	g_return_val_if_fail (ctxt != NULL, -2);
 
 	if (ctxt->cfg->source) {
-		ctxt->client = (ECalClient *) e_cal_client_connect_sync (
-			ctxt->cfg->source,
-			E_CAL_CLIENT_SOURCE_TYPE_TASKS,
-			30, /* timeout seconds */
-			NULL, /* cancellable */
-			&error);
+		/* a warm client from an earlier sync or the watch if there
+		   is one, unless open_local got it already */
+		if (ctxt->client == NULL)
+			ctxt->client = e_cal_pool_get_client (
+				ctxt->cfg->source,
+				E_CAL_CLIENT_SOURCE_TYPE_TASKS,
+				&error);
 
 		if (!ctxt->client) {
 			if (error) {
@@ -560,6 +595,44 @@ map_name (EToDoConduitContext *ctxt)
 	return filename;
 }
 
+static gchar *
+journal_name (EToDoConduitContext *ctxt)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-journal-todo-%d", ctxt->cfg->pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "tasks", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "tasks", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
+static gchar *
+watch_name (guint32 pilot_id)
+{
+	gchar *basename;
+	gchar *filename;
+
+	basename = g_strdup_printf ("pilot-watch-todo-%d", pilot_id);
+
+#if EDS_CHECK_VERSION(2,31,6)
+	filename = g_build_filename (e_get_user_data_dir (), "tasks", "system", basename, NULL);
+#else
+	filename = g_build_filename (g_get_home_dir (), ".evolution", "tasks", "local", "system", basename, NULL);
+#endif
+
+	g_free (basename);
+
+	return filename;
+}
+
 static gboolean
 is_empty_time (struct tm time)
 {
@@ -656,20 +729,15 @@ local_record_to_pilot_record (EToDoLocalRecord *local,
 }
 
 /*
- * converts a ECalComponent object to a EToDoLocalRecord
+ * converts a ECalComponent object to a EToDoLocalRecord. Only the
+ * fields the sync engine needs to decide what to do are filled in,
+ * the ToDo is built by local_record_materialize
  */
 static void
 local_record_from_comp (EToDoLocalRecord *local, ECalComponent *comp, EToDoConduitContext *ctxt)
 {
 	const gchar *uid;
-	gint priority_val;
-	ICalPropertyStatus status;
-	ECalComponentText *summary;
-	GSList *d_list = NULL;
-	ECalComponentText *description;
-	ECalComponentDateTime *due;
 	ECalComponentClassification classif;
-	icaltimezone *default_tz = get_default_timezone ();
 
 	LOG (g_message ( "local_record_from_comp\n" ));
 
@@ -684,6 +752,40 @@ local_record_from_comp (EToDoLocalRecord *local, ECalComponent *comp, EToDoCondu
 
 	compute_status (ctxt, local, uid);
 
+	classif = e_cal_component_get_classification (comp);
+
+	if (classif == E_CAL_COMPONENT_CLASS_PRIVATE)
+		local->local.secret = 1;
+	else
+		local->local.secret = 0;
+
+	local->local.archived = 0;
+}
+
+/*
+ * builds the ToDo of a EToDoLocalRecord from its component
+ */
+static void
+local_record_materialize (EToDoLocalRecord *local, EToDoConduitContext *ctxt)
+{
+	ECalComponent *comp;
+	gint priority_val;
+	ICalPropertyStatus status;
+	ECalComponentText *summary;
+	GSList *d_list = NULL;
+	ECalComponentText *description;
+	ECalComponentDateTime *due;
+	icaltimezone *default_tz = get_default_timezone ();
+
+	LOG (g_message ( "local_record_materialize\n" ));
+
+	g_return_if_fail (local != NULL);
+	g_return_if_fail (local->comp != NULL);
+
+	if (local->todo != NULL)
+		return;
+
+	comp = local->comp;
 	local->todo = g_new0 (struct ToDo,1);
 
 	/* Don't overwrite the category */
@@ -712,7 +814,7 @@ local_record_from_comp (EToDoLocalRecord *local, ECalComponent *comp, EToDoCondu
 	   uses free to deallocate */
 	summary = e_cal_component_get_summary (comp);
 	if (summary && e_cal_component_text_get_value (summary))
-		local->todo->description = e_pilot_utf8_to_pchar (e_cal_component_text_get_value (summary), ctxt->pilot_charset);
+		local->todo->description = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_cal_component_text_get_value (summary));
 	if (summary)
 		e_cal_component_text_free (summary);
 
@@ -720,7 +822,7 @@ local_record_from_comp (EToDoLocalRecord *local, ECalComponent *comp, EToDoCondu
 	if (d_list) {
 		description = (ECalComponentText *) d_list->data;
 		if (description && e_cal_component_text_get_value (description))
-			local->todo->note = e_pilot_utf8_to_pchar (e_cal_component_text_get_value (description), ctxt->pilot_charset);
+			local->todo->note = e_pilot_charset_to_pchar (ctxt->pilot_charset, e_cal_component_text_get_value (description));
 		else
 			local->todo->note = NULL;
 		g_slist_free_full (d_list, e_cal_component_text_free);
@@ -764,15 +866,6 @@ local_record_from_comp (EToDoLocalRecord *local, ECalComponent *comp, EToDoCondu
 	} else {
 		local->todo->priority = ctxt->cfg->priority;
 	}
-
-	classif = e_cal_component_get_classification (comp);
-
-	if (classif == E_CAL_COMPONENT_CLASS_PRIVATE)
-		local->local.secret = 1;
-	else
-		local->local.secret = 0;
-
-	local->local.archived = 0;
 }
 
 static void
@@ -781,21 +874,13 @@ local_record_from_uid (EToDoLocalRecord *local,
 		       EToDoConduitContext *ctxt)
 {
 	ECalComponent *comp;
-	ICalComponent *icalcomp;
 	GError *error = NULL;
 
 	g_assert(local!=NULL);
 
 	LOG(g_message("local_record_from_uid\n"));
 
-	if (e_cal_client_get_object_sync (ctxt->client, uid, NULL, &icalcomp, NULL, &error)) {
-		comp = e_cal_component_new ();
-		if (!e_cal_component_set_icalcomponent (comp, icalcomp)) {
-			g_object_unref (comp);
-			g_object_unref (icalcomp);
-			return;
-		}
-
+	if ((comp = e_cal_comp_index_get (ctxt->index, ctxt->client, uid, &error))) {
 		local_record_from_comp (local, comp, ctxt);
 		g_object_unref (comp);
 	} else if (g_error_matches (error, E_CAL_CLIENT_ERROR, E_CAL_CLIENT_ERROR_OBJECT_NOT_FOUND)) {
@@ -817,7 +902,7 @@ comp_from_remote_record (GnomePilotConduitSyncAbs *conduit,
 			 ECalComponent *in_comp,
 			 icaltimezone *timezone,
 			 struct ToDoAppInfo *ai,
-			 const gchar *pilot_charset)
+			 EPilotCharset *pilot_charset)
 {
 	ECalComponent *comp;
 	struct ToDo todo;
@@ -860,7 +945,7 @@ comp_from_remote_record (GnomePilotConduitSyncAbs *conduit,
 
 	{
 		ECalComponentText *summary_text;
-		txt = e_pilot_utf8_from_pchar (todo.description, pilot_charset);
+		txt = e_pilot_charset_from_pchar (pilot_charset, todo.description);
 		summary_text = e_cal_component_text_new (txt, NULL);
 		e_cal_component_set_summary (comp, summary_text);
 		e_cal_component_text_free (summary_text);
@@ -877,7 +962,7 @@ comp_from_remote_record (GnomePilotConduitSyncAbs *conduit,
 		GSList l;
 		ECalComponentText *text;
 
-		txt = e_pilot_utf8_from_pchar (todo.note, pilot_charset);
+		txt = e_pilot_charset_from_pchar (pilot_charset, todo.note);
 		text = e_cal_component_text_new (txt, NULL);
 		l.data = text;
 		l.next = NULL;
@@ -960,7 +1045,7 @@ check_for_slow_setting (GnomePilotConduit *c, EToDoConduitContext *ctxt)
 	const gchar *uri;
 
 	/* If there are no objects or objects but no log */
-	map_count = g_hash_table_size (ctxt->map->pid_map);
+	map_count = e_pilot_map_count_pids (ctxt->map);
 	if (map_count == 0)
 		gnome_pilot_conduit_standard_set_slow (conduit, TRUE);
 
@@ -984,33 +1069,28 @@ check_for_slow_setting (GnomePilotConduit *c, EToDoConduitContext *ctxt)
 }
 
 /* Pilot syncing callbacks */
+/*
+ * The part of pre_sync that only works on the local side: opens the
+ * task list and works out what changed. Runs on a preparation thread when
+ * the manager started one, so failures are reported through
+ * ctxt->prepare_error for pre_sync to pass on.
+ */
 static gint
-pre_sync (GnomePilotConduit *conduit,
-	  GnomePilotDBInfo *dbi,
-	  EToDoConduitContext *ctxt)
+pre_sync_local (GnomePilotConduitSyncAbs *abs_conduit,
+		GnomePilotDBInfo *dbi,
+		EToDoConduitContext *ctxt)
 {
-	GnomePilotConduitSyncAbs *abs_conduit;
 	GList *l;
-	gint len;
-	guchar *buf;
-	gchar *filename, *change_id;
+	gchar *filename;
+	const gchar *source_uid;
+	GHashTable *watched;
 	ICalComponent *icalcomp;
 	gint num_records, add_records = 0, mod_records = 0, del_records = 0;
-	pi_buffer_t * buffer;
-
-	abs_conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit);
-
-	LOG (g_message ( "---------------------------------------------------------\n" ));
-	LOG (g_message ( "pre_sync: ToDo Conduit v.%s", CONDUIT_VERSION ));
-	g_message ("ToDo Conduit v.%s", CONDUIT_VERSION);
 
 	ctxt->dbi = dbi;
-	ctxt->client = NULL;
+	ctxt->prepare_error = NULL;
 
-	if (NULL == dbi->pilotInfo->pilot_charset)
-		ctxt->pilot_charset = NULL;
-	else
-		ctxt->pilot_charset = g_strdup(dbi->pilotInfo->pilot_charset);
+	ctxt->pilot_charset = e_pilot_charset_new (dbi->pilotInfo->pilot_charset);
 
 	/* Get the timezone */
 	ctxt->timezone = get_default_timezone ();
@@ -1020,7 +1100,7 @@ pre_sync (GnomePilotConduit *conduit,
 
 	if (start_calendar_server (ctxt) != 0) {
 		WARN(_("Could not start evolution-data-server"));
-		gnome_pilot_conduit_error (conduit, _("Could not start evolution-data-server"));
+		ctxt->prepare_error = _("Could not start evolution-data-server");
 		return -1;
 	}
 
@@ -1041,25 +1121,42 @@ pre_sync (GnomePilotConduit *conduit,
 	e_pilot_map_read (filename, &ctxt->map);
 	g_free (filename);
 
-	/* Get the local database */
-	if (!e_cal_client_get_object_list_as_comps_sync (ctxt->client, "#t", &ctxt->comps, NULL, NULL))
-		return -1;
+	/* Work out what changed since the last sync */
+	source_uid = e_source_get_uid (e_client_get_source (E_CLIENT (ctxt->client)));
+	filename = journal_name (ctxt);
+	ctxt->journal = e_cal_change_journal_load (filename, source_uid);
+	g_free (filename);
 
-	/* Build change list from all components.
-	 * NOTE: e_cal_get_changes() was removed in modern EDS.
-	 * We treat all existing objects as modified.
-	 */
-	change_id = g_strdup_printf ("pilot-sync-evolution-todo-%d", ctxt->cfg->pilot_id);
-	ctxt->changed = NULL;
-	for (l = ctxt->comps; l != NULL; l = l->next) {
-		ECalChange *ccc = g_new0 (ECalChange, 1);
-		ccc->comp = g_object_ref (l->data);
-		ccc->type = E_CAL_CHANGE_MODIFIED;
-		ctxt->changed = g_list_prepend (ctxt->changed, ccc);
+	/* With a watch on the source since the last sync, only what it saw
+	   needs looking at */
+	filename = watch_name (ctxt->cfg->pilot_id);
+	watched = e_pilot_watch_take (filename, source_uid, ctxt->cfg->watch_session, &ctxt->watch_session);
+	g_free (filename);
+
+	if (watched != NULL && e_cal_change_journal_has_base (ctxt->journal)
+	    && e_cal_change_journal_get_changes_for_uids (ctxt->journal, ctxt->client, watched,
+							  E_CAL_COMPONENT_TODO, &ctxt->comps, &ctxt->changed, NULL)) {
+		LOG (g_message ( "  %d UIDs changed since the last sync", g_hash_table_size (watched) ));
+	} else {
+		/* Get the local database */
+		if (!e_cal_client_get_object_list_as_comps_sync (ctxt->client, "#t", &ctxt->comps, NULL, NULL)) {
+			if (watched != NULL)
+				g_hash_table_destroy (watched);
+			return -1;
+		}
+		ctxt->comps_complete = TRUE;
+
+		ctxt->changed = e_cal_change_journal_get_changes (ctxt->journal, ctxt->comps, E_CAL_COMPONENT_TODO);
 	}
+	if (watched != NULL)
+		g_hash_table_destroy (watched);
 
 	ctxt->changed_hash = g_hash_table_new (g_str_hash, g_str_equal);
-	g_free (change_id);
+
+	ctxt->index = e_cal_comp_index_new (ctxt->comps);
+
+	/* Changes from the pilot are written at post_sync */
+	ctxt->batch = e_cal_write_batch_new (ctxt->client, ctxt->map, ctxt->journal, ctxt->index);
 
 	for (l = ctxt->changed; l != NULL; l = l->next) {
 		ECalChange *ccc = l->data;
@@ -1087,7 +1184,10 @@ pre_sync (GnomePilotConduit *conduit,
 	}
 
 	/* Set the count information */
-	num_records = g_list_length (ctxt->comps);
+	if (ctxt->comps_complete)
+		num_records = g_list_length (ctxt->comps);
+	else
+		num_records = e_cal_change_journal_count (ctxt->journal);
 	gnome_pilot_conduit_sync_abs_set_num_local_records(abs_conduit, num_records);
 	gnome_pilot_conduit_sync_abs_set_num_new_local_records (abs_conduit, add_records);
 	gnome_pilot_conduit_sync_abs_set_num_updated_local_records (abs_conduit, mod_records);
@@ -1096,6 +1196,60 @@ pre_sync (GnomePilotConduit *conduit,
 	g_message("num_records: %d\nadd_records: %d\nmod_records: %d\ndel_records: %d\n",
 			num_records, add_records, mod_records, del_records);
 
+	return 0;
+}
+
+/* The client outlives the preparation, so it is connected on the
+   thread running the sync, whose main context it reports to */
+static gint
+open_local (GnomePilotConduitSyncAbs *conduit,
+	    GnomePilotDBInfo *dbi,
+	    EToDoConduitContext *ctxt)
+{
+	if (ctxt->cfg->source == NULL)
+		return -1;
+
+	ctxt->client = e_cal_pool_get_client (ctxt->cfg->source, E_CAL_CLIENT_SOURCE_TYPE_TASKS, NULL);
+
+	/* pre_sync tries again and reports why */
+	return ctxt->client != NULL ? 0 : -1;
+}
+
+static gint
+prepare_local (GnomePilotConduitSyncAbs *conduit,
+	       GnomePilotDBInfo *dbi,
+	       EToDoConduitContext *ctxt)
+{
+	LOG (g_message ( "prepare_local: loading the task list ahead of pre_sync" ));
+
+	ctxt->prepare_result = pre_sync_local (conduit, dbi, ctxt);
+	ctxt->prepared = TRUE;
+
+	return ctxt->prepare_result;
+}
+
+static gint
+pre_sync (GnomePilotConduit *conduit,
+	  GnomePilotDBInfo *dbi,
+	  EToDoConduitContext *ctxt)
+{
+	gint len;
+	guchar *buf;
+	pi_buffer_t * buffer;
+
+	LOG (g_message ( "---------------------------------------------------------\n" ));
+	LOG (g_message ( "pre_sync: ToDo Conduit v.%s", CONDUIT_VERSION ));
+	g_message ("ToDo Conduit v.%s", CONDUIT_VERSION);
+
+	if (!ctxt->prepared)
+		ctxt->prepare_result = pre_sync_local (GNOME_PILOT_CONDUIT_SYNC_ABS (conduit), dbi, ctxt);
+	ctxt->prepared = FALSE;
+	if (ctxt->prepare_result < 0) {
+		if (ctxt->prepare_error)
+			gnome_pilot_conduit_error (conduit, ctxt->prepare_error);
+		return -1;
+	}
+
 	buffer = pi_buffer_new(DLP_BUF_SIZE);
 	if (buffer == NULL) {
 		pi_set_error(dbi->pilot_socket, PI_ERR_GENERIC_MEMORY);
@@ -1137,6 +1291,12 @@ post_sync (GnomePilotConduit *conduit,
 	guchar *buf;
 	gint dlpRetVal, len;
 
+	/* Write what came from the pilot to the tasks */
+	if (!e_cal_write_batch_flush (ctxt->batch, NULL)) {
+		WARN ("Could not write changes to the tasks");
+		return -1;
+	}
+
 	buf = (guchar *)g_malloc (0xffff);
 
 	len = pack_ToDoAppInfo (&(ctxt->ai), buf, 0xffff);
@@ -1156,6 +1316,16 @@ post_sync (GnomePilotConduit *conduit,
 
 	LOG (g_message ( "post_sync: ToDo Conduit v.%s", CONDUIT_VERSION ));
 
+	/* What the watch saw is taken care of once the journal is saved */
+	g_free (ctxt->cfg->watch_session);
+	ctxt->cfg->watch_session = NULL;
+	if (e_cal_change_journal_save (ctxt->journal)) {
+		filename = watch_name (ctxt->cfg->pilot_id);
+		e_pilot_watch_done (filename);
+		g_free (filename);
+		ctxt->cfg->watch_session = g_strdup (ctxt->watch_session);
+	}
+
 	g_free (ctxt->cfg->last_uri);
 	{
 		ESource *source = e_client_get_source (E_CLIENT (ctxt->client));
@@ -1166,8 +1336,8 @@ post_sync (GnomePilotConduit *conduit,
 	filename = map_name (ctxt);
 	e_pilot_map_write (filename, ctxt->map);
 	g_free (filename);
-	if (ctxt->pilot_charset)
-		g_free (ctxt->pilot_charset);
+	e_pilot_charset_free (ctxt->pilot_charset);
+	ctxt->pilot_charset = NULL;
 	LOG (g_message ( "---------------------------------------------------------\n" ));
 
 	return 0;
@@ -1218,6 +1388,13 @@ for_each (GnomePilotConduitSyncAbs *conduit,
 	if (*local == NULL) {
 		LOG (g_message ( "beginning for_each" ));
 
+		/* only the changes were loaded at pre_sync */
+		if (!ctxt->comps_complete) {
+			if (!e_cal_comp_index_load_all (ctxt->index, ctxt->client, &ctxt->comps, NULL))
+				return -1;
+			ctxt->comps_complete = TRUE;
+		}
+
 		comps = ctxt->comps;
 		count = 0;
 
@@ -1372,10 +1549,11 @@ add_record (GnomePilotConduitSyncAbs *conduit,
 	uid = e_util_generate_uid ();
 	e_cal_component_set_uid (comp, uid);
 
-	if (!e_cal_client_create_object_sync (ctxt->client, e_cal_component_get_icalcomponent (comp), E_CAL_OPERATION_FLAG_NONE, NULL, NULL, NULL))
-		return -1;
-
 	e_pilot_map_insert (ctxt->map, remote->ID, uid, FALSE);
+	e_cal_comp_index_add (ctxt->index, comp);
+	e_cal_change_journal_update (ctxt->journal, ctxt->index, e_cal_component_get_uid (comp));
+	if (!e_cal_write_batch_create (ctxt->batch, comp, remote->ID))
+		retval = -1;
 
 	g_object_unref (comp);
 	g_free (uid);
@@ -1401,9 +1579,11 @@ replace_record (GnomePilotConduitSyncAbs *conduit,
 	g_object_unref (local->comp);
 	local->comp = new_comp;
 
-	if (!e_cal_client_modify_object_sync (ctxt->client, e_cal_component_get_icalcomponent (new_comp),
-				       E_CAL_OBJ_MOD_ALL, E_CAL_OPERATION_FLAG_NONE, NULL, NULL))
-		return -1;
+	e_cal_comp_index_add (ctxt->index, new_comp);
+	e_cal_change_journal_update (ctxt->journal, ctxt->index, e_cal_component_get_uid (new_comp));
+
+	if (!e_cal_write_batch_modify (ctxt->batch, new_comp))
+		retval = -1;
 
 	return retval;
 }
@@ -1423,8 +1603,10 @@ delete_record (GnomePilotConduitSyncAbs *conduit,
 	LOG (g_message ( "delete_record: deleting %s\n", uid ));
 
 	e_pilot_map_remove_by_uid (ctxt->map, uid);
-	/* FIXME Error handling */
-	e_cal_client_remove_object_sync (ctxt->client, uid, NULL, E_CAL_OBJ_MOD_ALL, E_CAL_OPERATION_FLAG_NONE, NULL, NULL);
+	e_cal_change_journal_remove (ctxt->journal, uid);
+	e_cal_comp_index_remove (ctxt->index, uid);
+	if (!e_cal_write_batch_remove (ctxt->batch, uid))
+		return -1;
 
         return 0;
 }
@@ -1492,6 +1674,18 @@ free_match (GnomePilotConduitSyncAbs *conduit,
 	return 0;
 }
 
+static gint
+materialize (GnomePilotConduitSyncAbs *conduit,
+	     EToDoLocalRecord *local,
+	     EToDoConduitContext *ctxt)
+{
+	g_return_val_if_fail (local != NULL, -1);
+
+	local_record_materialize (local, ctxt);
+
+	return 0;
+}
+
 static gint
 prepare (GnomePilotConduitSyncAbs *conduit,
 	 EToDoLocalRecord *local,
@@ -1607,6 +1801,9 @@ conduit_get_gpilot_conduit (guint32 pilot_id)
 	g_signal_connect (retval, "free_match", G_CALLBACK (free_match), ctxt);
 
 	g_signal_connect (retval, "prepare", G_CALLBACK (prepare), ctxt);
+	g_signal_connect (retval, "materialize", G_CALLBACK (materialize), ctxt);
+	g_signal_connect (retval, "open_local", G_CALLBACK (open_local), ctxt);
+	g_signal_connect (retval, "prepare_local", G_CALLBACK (prepare_local), ctxt);
 
 	/* Gui Settings */
 	g_signal_connect (retval, "create_settings_window", G_CALLBACK (create_settings_window), ctxt);
@@ -1628,3 +1825,27 @@ conduit_destroy_gpilot_conduit (GnomePilotConduit *conduit)
 
 	g_object_unref (obj);
 }
+
+gpointer
+conduit_start_watch (guint32 pilot_id)
+{
+	EToDoConduitCfg *cfg;
+	ECalWatch *watch = NULL;
+	gchar *filename;
+
+	cfg = todoconduit_load_configuration (pilot_id);
+	if (cfg->sync_type != GnomePilotConduitSyncTypeNotSet && cfg->source != NULL) {
+		filename = watch_name (pilot_id);
+		watch = e_cal_watch_start (cfg->source, E_CAL_CLIENT_SOURCE_TYPE_TASKS, filename);
+		g_free (filename);
+	}
+	todoconduit_destroy_configuration (cfg);
+
+	return watch;
+}
+
+void
+conduit_stop_watch (gpointer watch)
+{
+	e_cal_watch_stop (watch);
+}
@@ -40,6 +40,7 @@
 #include <signal.h>
 
 #include <gnome-pilot-conduit-file.h>
+#include <gpilot-sync-log.h>
 
 /* pilot stuff begin */
 #include <stdio.h>
@@ -415,7 +416,7 @@ gnome_real_pilot_conduit_file_install_db (GnomePilotConduitFile *conduit,
 			log = g_strdup_printf ("Install of %s failed\n ", dbi.name);
 			dlp_DeleteDB (psock, cardno, dbi.name);
 		}
-		dlp_AddSyncLogEntry (psock, log);
+		gpilot_sync_log_add (psock, log);
 		g_free (log);
 	}
 
@@ -451,6 +451,10 @@ static GObjectClass *parent_class = NULL;
 #define self_conduit gnome_pilot_client_conduit
 #define self_get_users gnome_pilot_client_get_users
 #define self_get_databases_from_cache gnome_pilot_client_get_databases_from_cache
+#define self_get_sync_stats gnome_pilot_client_get_sync_stats
+#define self_get_dlp_profile gnome_pilot_client_get_dlp_profile
+#define self_get_sync_history gnome_pilot_client_get_sync_history
+#define self_get_trace gnome_pilot_client_get_trace
 #define self_get_cradles gnome_pilot_client_get_cradles
 #define self_get_pilots gnome_pilot_client_get_pilots
 #define self_get_pilot_ids gnome_pilot_client_get_pilot_ids
@@ -2588,6 +2592,154 @@ gnome_pilot_client_get_databases_from_cache (GnomePilotClient * self, const gcha
 #line 2728 "gnome-pilot-client.c"
 #undef __GOB_FUNCTION__
 
+/**
+ * gnome_pilot_client_get_sync_stats:
+ * @count: number of sessions to get, 0 for all the daemon keeps
+ * @output: where to store the sessions, most recent first, as an
+ * "a(sttba(sstut))" #GVariant, see GetSyncStats in gpilot-daemon.xml.
+ * Unref it when done.
+ **/
+gint 
+gnome_pilot_client_get_sync_stats (GnomePilotClient * self, guint count, GVariant ** output)
+{
+	GError     *error;
+	GVariant   *_result;
+
+	g_return_val_if_fail (self != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (GNOME_IS_PILOT_CLIENT (self), (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (output != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (self->proxy != NULL, GPILOTD_ERR_NOT_CONNECTED);
+
+	error = NULL;
+	_result = g_dbus_proxy_call_sync (self->proxy,
+				"GetSyncStats",
+				g_variant_new ("(u)", count),
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+	if (_result == NULL) {
+		g_warning ("Unable to GetSyncStats : %s", error->message);
+		g_error_free (error);
+		return GPILOTD_ERR_FAILED;
+	}
+
+	g_variant_get (_result, "(@a(sttba(sstut)))", output);
+	g_variant_unref (_result);
+
+	return GPILOTD_OK;
+}
+
+/**
+ * gnome_pilot_client_get_dlp_profile:
+ * @enabled: set to whether the daemon is profiling DLP calls
+ * @output: where to store the calls of the last sync as an
+ * "a(ssuuttat)" #GVariant, see GetDlpProfile in gpilot-daemon.xml.
+ * Unref it when done.
+ **/
+gint 
+gnome_pilot_client_get_dlp_profile (GnomePilotClient * self, gboolean * enabled, GVariant ** output)
+{
+	GError     *error;
+	GVariant   *_result;
+
+	g_return_val_if_fail (self != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (GNOME_IS_PILOT_CLIENT (self), (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (enabled != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (output != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (self->proxy != NULL, GPILOTD_ERR_NOT_CONNECTED);
+
+	error = NULL;
+	_result = g_dbus_proxy_call_sync (self->proxy,
+				"GetDlpProfile",
+				NULL,
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+	if (_result == NULL) {
+		g_warning ("Unable to GetDlpProfile : %s", error->message);
+		g_error_free (error);
+		return GPILOTD_ERR_FAILED;
+	}
+
+	g_variant_get (_result, "(b@a(ssuuttat))", enabled, output);
+	g_variant_unref (_result);
+
+	return GPILOTD_OK;
+}
+
+/**
+ * gnome_pilot_client_get_sync_history:
+ * @pilot_name: the PDA to get the history of, or %NULL for all
+ * @count: number of sessions to get, 0 for all the daemon stored
+ * @output: where to store the sessions, most recent first, as an
+ * "a(ussxtuutuba(stuub))" #GVariant, see GetSyncHistory in
+ * gpilot-daemon.xml. Unref it when done.
+ **/
+gint 
+gnome_pilot_client_get_sync_history (GnomePilotClient * self, const gchar * pilot_name, guint count, GVariant ** output)
+{
+	GError     *error;
+	GVariant   *_result;
+
+	g_return_val_if_fail (self != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (GNOME_IS_PILOT_CLIENT (self), (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (output != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (self->proxy != NULL, GPILOTD_ERR_NOT_CONNECTED);
+
+	error = NULL;
+	_result = g_dbus_proxy_call_sync (self->proxy,
+				"GetSyncHistory",
+				g_variant_new ("(su)", pilot_name ? pilot_name : "", count),
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+	if (_result == NULL) {
+		g_warning ("Unable to GetSyncHistory : %s", error->message);
+		g_error_free (error);
+		return GPILOTD_ERR_FAILED;
+	}
+
+	g_variant_get (_result, "(@a(ussxtuutuba(stuub)))", output);
+	g_variant_unref (_result);
+
+	return GPILOTD_OK;
+}
+
+/**
+ * gnome_pilot_client_get_trace:
+ * @count: number of events to get, 0 for all the daemon keeps
+ * @events: where to store the events, oldest first, as an "a(tisuu)"
+ * #GVariant, see GetTrace in gpilot-daemon.xml. Unref it when done.
+ * @counters: where to store the event counts of the last sync as an
+ * "a(su)" #GVariant. Unref it when done.
+ **/
+gint 
+gnome_pilot_client_get_trace (GnomePilotClient * self, guint count, GVariant ** events, GVariant ** counters)
+{
+	GError     *error;
+	GVariant   *_result;
+
+	g_return_val_if_fail (self != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (GNOME_IS_PILOT_CLIENT (self), (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (events != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (counters != NULL, (gint )GPILOTD_ERR_INVAL);
+	g_return_val_if_fail (self->proxy != NULL, GPILOTD_ERR_NOT_CONNECTED);
+
+	error = NULL;
+	_result = g_dbus_proxy_call_sync (self->proxy,
+				"GetTrace",
+				g_variant_new ("(u)", count),
+				G_DBUS_CALL_FLAGS_NONE, -1, NULL, &error);
+
+	if (_result == NULL) {
+		g_warning ("Unable to GetTrace : %s", error->message);
+		g_error_free (error);
+		return GPILOTD_ERR_FAILED;
+	}
+
+	g_variant_get (_result, "(@a(tisuu)@a(su))", events, counters);
+	g_variant_unref (_result);
+
+	return GPILOTD_OK;
+}
+
 #line 1071 "gnome-pilot-client.gob"
 gint 
 gnome_pilot_client_get_cradles (GnomePilotClient * self, GList ** output)
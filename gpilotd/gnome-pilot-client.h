@@ -260,6 +260,20 @@ gint 	gnome_pilot_client_get_databases_from_cache	(GnomePilotClient * self,
 					const gchar * pilot_name,
 					GList ** output);
 #line 263 "gnome-pilot-client.h"
+gint 	gnome_pilot_client_get_sync_stats	(GnomePilotClient * self,
+					guint count,
+					GVariant ** output);
+gint 	gnome_pilot_client_get_dlp_profile	(GnomePilotClient * self,
+					gboolean * enabled,
+					GVariant ** output);
+gint 	gnome_pilot_client_get_sync_history	(GnomePilotClient * self,
+					const gchar * pilot_name,
+					guint count,
+					GVariant ** output);
+gint 	gnome_pilot_client_get_trace	(GnomePilotClient * self,
+					guint count,
+					GVariant ** events,
+					GVariant ** counters);
 #line 1071 "gnome-pilot-client.gob"
 gint 	gnome_pilot_client_get_cradles	(GnomePilotClient * self,
 					GList ** output);
@@ -20,6 +20,8 @@ struct _GnomePilotConduitManagementPrivate {
 	GnomePilotConduitLoadFunc load_func;
 #line 130 "gnome-pilot-conduit-management.gob"
 	GnomePilotConduitDestroyFunc destroy_func;
+	GnomePilotConduitStartWatchFunc start_watch_func;
+	GnomePilotConduitStopWatchFunc stop_watch_func;
 #line 134 "gnome-pilot-conduit-management.gob"
 	GnomePilotConduitMgmtData * mgmtdata;
 #line 26 "gnome-pilot-conduit-management-private.h"
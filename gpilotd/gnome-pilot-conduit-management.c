@@ -976,6 +976,14 @@ gnome_pilot_conduit_management_shlib_loader (GnomePilotConduitManagement * self)
 				  g_module_error ());
 			return GNOME_PILOT_CONDUIT_MGMT_ERROR;
 		}
+		/* Watching local changes between syncs is optional */
+		if (g_module_symbol (dlhandle,"conduit_start_watch",
+				     (gpointer)&(self->_priv->start_watch_func))==FALSE ||
+		    g_module_symbol (dlhandle,"conduit_stop_watch",
+				     (gpointer)&(self->_priv->stop_watch_func))==FALSE) {
+			self->_priv->start_watch_func = NULL;
+			self->_priv->stop_watch_func = NULL;
+		}
 		self->_priv->loaded = TRUE;
 		return GNOME_PILOT_CONDUIT_MGMT_OK;
 	}}
@@ -1057,6 +1065,52 @@ gnome_pilot_conduit_management_destroy_conduit (GnomePilotConduitManagement * se
 #line 1058 "gnome-pilot-conduit-management.c"
 #undef __GOB_FUNCTION__
 
+gpointer 
+gnome_pilot_conduit_management_start_watch (GnomePilotConduitManagement * self, GPilotPilot * pilot)
+{
+#define __GOB_FUNCTION__ "Gnome:Pilot:Conduit:Management::start_watch"
+	g_return_val_if_fail (self != NULL, (gpointer )NULL);
+	g_return_val_if_fail (GNOME_IS_PILOT_CONDUIT_MANAGEMENT (self), (gpointer )NULL);
+	g_return_val_if_fail (pilot != NULL, (gpointer )NULL);
+{
+	
+		gint err = GNOME_PILOT_CONDUIT_MGMT_OK;
+		gpointer watch = NULL;
+		LOCK_INSTANCE;
+		if (self->_priv->loaded==FALSE) {
+			switch (self->_priv->mgmtdata->type) {
+			case GNOME_PILOT_CONDUIT_TYPE_SHLIB: 
+				err = self_shlib_loader (self);
+				break;
+			default:
+				err = GNOME_PILOT_CONDUIT_MGMT_ERROR;
+				break;
+			}
+		}
+		if (err == GNOME_PILOT_CONDUIT_MGMT_OK && self->_priv->start_watch_func) {
+			watch = self->_priv->start_watch_func (pilot->pilot_id);
+		}
+		UNLOCK_INSTANCE;
+		return watch;
+	}}
+#undef __GOB_FUNCTION__
+
+void 
+gnome_pilot_conduit_management_stop_watch (GnomePilotConduitManagement * self, gpointer watch)
+{
+#define __GOB_FUNCTION__ "Gnome:Pilot:Conduit:Management::stop_watch"
+	g_return_if_fail (self != NULL);
+	g_return_if_fail (GNOME_IS_PILOT_CONDUIT_MANAGEMENT (self));
+{
+	
+		LOCK_INSTANCE;
+		if (self->_priv->loaded==TRUE && self->_priv->stop_watch_func && watch) {
+			self->_priv->stop_watch_func (watch);
+		}
+		UNLOCK_INSTANCE;
+	}}
+#undef __GOB_FUNCTION__
+
 #line 777 "gnome-pilot-conduit-management.gob"
 
 
@@ -128,6 +128,10 @@ gint 	gnome_pilot_conduit_management_instantiate_conduit	(GnomePilotConduitManag
 gint 	gnome_pilot_conduit_management_destroy_conduit	(GnomePilotConduitManagement * self,
 					GnomePilotConduit ** instance);
 #line 131 "gnome-pilot-conduit-management.h"
+gpointer 	gnome_pilot_conduit_management_start_watch	(GnomePilotConduitManagement * self,
+					GPilotPilot * pilot);
+void 	gnome_pilot_conduit_management_stop_watch	(GnomePilotConduitManagement * self,
+					gpointer watch);
 
 #ifdef __cplusplus
 }
@@ -35,6 +35,8 @@
 #include "gnome-pilot-conduit-standard-abs.h"
 #include "gpmarshal.h"
 #include "manager.h"
+#include "gpilot-sync-log.h"
+#include "gpilot-trace.h"
 
 
 /* Compatibility routines for old API in pilot-link-0.11 */
@@ -1038,7 +1040,8 @@ standard_abs_delete_from_pilot(GnomePilotConduitStandardAbs *conduit,
 {
 	int err;
 	
-	g_message("gpilotd: deleting record %ld from pilot",remote->ID);
+	gpilot_trace (handle, GPILOT_TRACE_RECORD_DELETE_PILOT, remote->ID, 0);
+	GPILOT_RECORD_LOG (("gpilotd: deleting record %ld from pilot",remote->ID));
 	err = dlp_DeleteRecord(handle,db,0,remote->ID);
 	if (err<0) {
 		g_warning("dlp_DeleteRecord returned %d",err);
@@ -1064,7 +1067,7 @@ standard_abs_add_to_pilot (GnomePilotConduitStandardAbs *conduit,
 	recordid_t assigned_id;
 	int err;
 
-	g_message("gpilotd: adding record to pilot");
+	GPILOT_RECORD_LOG (("gpilotd: adding record to pilot"));
 
 	err = gnome_pilot_conduit_standard_abs_transmit (conduit, local, &remote);
 	if (err < 0 || remote==NULL) {
@@ -1083,6 +1086,7 @@ standard_abs_add_to_pilot (GnomePilotConduitStandardAbs *conduit,
 		g_warning("dlp_WriteRecord returned %d",err);
 		return 0;
 	}
+	gpilot_trace (handle, GPILOT_TRACE_RECORD_TO_PILOT, assigned_id, remote->length);
 
 	conduit->record_ids_to_ignore = g_slist_prepend(conduit->record_ids_to_ignore,
 						     GINT_TO_POINTER(assigned_id));
@@ -1091,6 +1095,19 @@ standard_abs_add_to_pilot (GnomePilotConduitStandardAbs *conduit,
 	return assigned_id;
 }
 
+/* Record which of the cases below a record took */
+static void
+standard_abs_trace_case (int handle,
+			 LocalRecord *local,
+			 PilotRecord *remote,
+			 guint which)
+{
+	recordid_t id = remote ? remote->ID : (local ? local->ID : 0);
+
+	gpilot_trace (handle, GPILOT_TRACE_RECORD_CASE, id, which);
+	GPILOT_RECORD_LOG (("gpilotd: sync_record: case %u, record %lu", which, (gulong) id));
+}
+
 /*
   This is messy, but its my first attempt at implementing the
   algoritm of conduit.pdf page 39-40 (see below). And yes, I'll try to collapse
@@ -1189,7 +1206,8 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 
 	if (local==NULL && remote!=NULL) {
 		if (g_slist_find(conduit->record_ids_to_ignore,GINT_TO_POINTER(remote->ID))!=NULL) {
-			g_message("gpilotd: this record has already been processed");
+			gpilot_trace (handle, GPILOT_TRACE_RECORD_SKIPPED, remote->ID, 0);
+			GPILOT_RECORD_LOG (("gpilotd: this record has already been processed"));
 			return 0;
 		}
        		gnome_pilot_conduit_standard_abs_match_record (conduit, &local, remote);
@@ -1197,11 +1215,13 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 	} else if (remote==NULL && local!=NULL) {
 		int index;
 		if (g_slist_find(conduit->record_ids_to_ignore,GINT_TO_POINTER(local->ID))!=NULL) {
-			g_message("gpilotd: this record has already been processed");
+			gpilot_trace (handle, GPILOT_TRACE_RECORD_SKIPPED, local->ID, 0);
+			GPILOT_RECORD_LOG (("gpilotd: this record has already been processed"));
 			return 0;
 		}
 
-		g_message("gpilotd: retrieve %ld from pilot",local->ID);
+		gpilot_trace (handle, GPILOT_TRACE_RECORD_RETRIEVE, local->ID, 0);
+		GPILOT_RECORD_LOG (("gpilotd: retrieve %ld from pilot",local->ID));
 		remote = g_new0(PilotRecord,1);
 		remote->record = malloc(0xffff);
 		gnome_pilot_compat_with_pilot_link_0_11_dlp_ReadRecordById(handle,db,
@@ -1228,19 +1248,19 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 				if (remote->attr == GnomePilotRecordModified) {
 					if (gnome_pilot_conduit_standard_abs_compare(conduit,local,remote) != 0) {
 					 	/* CASE 15 */	
-						g_message("gpilotd: sync_record: case 15");
+						standard_abs_trace_case (handle, local, remote, 15);
 						if ( direction & SyncToRemote ) {
 							standard_abs_add_to_pilot (conduit, handle, db, local);
 						}
 						if ( direction & SyncToLocal ) {
 							gnome_pilot_conduit_standard_abs_store_remote (conduit, remote);
 						}
-						dlp_AddSyncLogEntry (handle, LOG_CASE15);
+						gpilot_sync_log_add (handle, LOG_CASE15);
 						gnome_pilot_conduit_send_message(GNOME_PILOT_CONDUIT(conduit), 
 										 LOG_CASE15);
 					} else {
 						/* CASE 14 */
-						g_message("gpilotd: sync_record: case 14");
+						standard_abs_trace_case (handle, local, remote, 14);
 						remote->attr = GnomePilotRecordNothing;
 						remote->archived = 0;
 						if ( direction & SyncToLocal )
@@ -1252,10 +1272,10 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 					}
 				} else {
 					/* CASE 13 */
-					g_message("gpilotd: sync_record: case 13");
+					standard_abs_trace_case (handle, local, remote, 13);
 					if ( direction & SyncToRemote ) {
 						standard_abs_add_to_pilot (conduit, handle, db, local);
-						dlp_AddSyncLogEntry (handle, LOG_CASE13);
+						gpilot_sync_log_add (handle, LOG_CASE13);
 						gnome_pilot_conduit_send_message(GNOME_PILOT_CONDUIT(conduit), 
 										 LOG_CASE13);
 					}
@@ -1263,7 +1283,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 				break;
 			case GnomePilotRecordNothing:
 				/* CASE 11 No Modify */
-				g_message("gpilotd: sync_record: case 11 No Modify");
+				standard_abs_trace_case (handle, local, remote, 11);
 				remote->attr = GnomePilotRecordNothing;
 				remote->archived = 0;
 				if ( direction & SyncToLocal )
@@ -1271,7 +1291,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 				break;
 			case GnomePilotRecordDeleted:
 				/* CASE 12  */
-				g_message("gpilotd: sync_record: case 12");
+				standard_abs_trace_case (handle, local, remote, 12);
 				remote->attr = GnomePilotRecordNothing;
 				remote->archived = 0;
 				if ( direction & SyncToLocal )
@@ -1287,36 +1307,36 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 					if (gnome_pilot_conduit_standard_abs_compare (conduit, local, remote) != 0) {
 						if (local->archived) {
 							/* CASE 20 */
-							g_message("gpilotd: sync_record: case 20");
+							standard_abs_trace_case (handle, local, remote, 20);
 							if ( direction & SyncToLocal )
 								gnome_pilot_conduit_standard_abs_store_remote (conduit, remote);
 							if ( direction & SyncToRemote )
 								standard_abs_add_to_pilot (conduit, handle, db, local);
-							dlp_AddSyncLogEntry (handle, LOG_CASE20);
+							gpilot_sync_log_add (handle, LOG_CASE20);
 							gnome_pilot_conduit_send_message (GNOME_PILOT_CONDUIT(conduit), LOG_CASE20);
 						} else {
 							/* CASE 10 */
-							g_message("gpilotd: sync_record: case 10");
+							standard_abs_trace_case (handle, local, remote, 10);
 							if ( direction & SyncToRemote ) {
 								standard_abs_add_to_pilot (conduit, handle, db, local);
 							}
 							if ( direction & SyncToLocal ) {
 								gnome_pilot_conduit_standard_abs_store_remote (conduit, remote);
 							}
-							dlp_AddSyncLogEntry (handle, LOG_CASE10);
+							gpilot_sync_log_add (handle, LOG_CASE10);
 							gnome_pilot_conduit_send_message (GNOME_PILOT_CONDUIT(conduit), LOG_CASE10);
 						}
 					} else {
 						if (local->archived) {
 							/* CASE 19 */
-							g_message("gpilotd: sync_record: case 19");
+							standard_abs_trace_case (handle, local, remote, 19);
 							if ( direction & SyncToLocal )
 								gnome_pilot_conduit_standard_abs_archive_local (conduit, local);
 							if ( direction & SyncToRemote )
 								standard_abs_delete_from_pilot(conduit,handle,db,remote);
 						} else {
 							/* CASE 9 */
-							g_message("gpilotd: sync_record: case 9");
+							standard_abs_trace_case (handle, local, remote, 9);
 							if ( direction & SyncToLocal )
 								gnome_pilot_conduit_standard_abs_set_status (conduit, local, GnomePilotRecordNothing);
 						}
@@ -1325,27 +1345,27 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 				case GnomePilotRecordNothing:
 					if(local->archived) {
 						/* CASE 18 */
-						g_message("gpilotd: sync_record: case 18");
+						standard_abs_trace_case (handle, local, remote, 18);
 						if ( direction & SyncToLocal ) {
 							gnome_pilot_conduit_standard_abs_store_remote (conduit, remote);
 							/* FIXME: should this be loged on pilot? */
-							dlp_AddSyncLogEntry (handle, LOG_CASE18);
+							gpilot_sync_log_add (handle, LOG_CASE18);
 							gnome_pilot_conduit_send_message (GNOME_PILOT_CONDUIT(conduit), LOG_CASE18);
 						}
 					} else {
 						/* CASE 7*/
-						g_message("gpilotd: sync_record: case 7");
+						standard_abs_trace_case (handle, local, remote, 7);
 						if ( direction & SyncToLocal ) 
 							gnome_pilot_conduit_standard_abs_store_remote (conduit, remote);
 					}
 					break;
 				case GnomePilotRecordDeleted:
 					/* CASE 6 */
-					g_message("gpilotd: sync_record: case 6");
+					standard_abs_trace_case (handle, local, remote, 6);
 					if ( direction & SyncToLocal )
 					{
 						gnome_pilot_conduit_standard_abs_store_remote (conduit, remote);
-						dlp_AddSyncLogEntry(handle, LOG_CASE6);
+						gpilot_sync_log_add (handle, LOG_CASE6);
 						gnome_pilot_conduit_send_message (GNOME_PILOT_CONDUIT(conduit), LOG_CASE6);
 					}
 					break;
@@ -1358,7 +1378,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 			case GnomePilotRecordDeleted:
 				if(local->archived) {
 					/* CASE 17 */
-					g_message("gpilotd: sync_record: case 17");
+					standard_abs_trace_case (handle, local, remote, 17);
 					if ( direction & SyncToLocal )
 						gnome_pilot_conduit_standard_abs_archive_local (conduit, local);
 					if ( direction & SyncToRemote )
@@ -1368,10 +1388,10 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 					switch (local->attr) {
 					case GnomePilotRecordModified:
 						/* CASE 5 */
-						g_message("gpilotd: sync_record: case 5");
+						standard_abs_trace_case (handle, local, remote, 5);
 						if ( direction & SyncToRemote ) {
 							standard_abs_add_to_pilot (conduit, handle, db, local);
-							dlp_AddSyncLogEntry(handle, LOG_CASE5);
+							gpilot_sync_log_add (handle, LOG_CASE5);
 							gnome_pilot_conduit_send_message (GNOME_PILOT_CONDUIT(conduit), LOG_CASE5);
 						}
 						break;
@@ -1380,7 +1400,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 						break;
 					case GnomePilotRecordNothing:
 						/* CASE 3 */
-						g_message("gpilotd: sync_record: case 3");
+						standard_abs_trace_case (handle, local, remote, 3);
 						/* can be collapsed with case GnomePilotRecordDeleted */
 						if ( direction & SyncToRemote ) {
 							standard_abs_delete_from_pilot(conduit,handle,db,remote);
@@ -1401,7 +1421,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 			case GnomePilotRecordNothing:
 				if (local->archived) {
 					/* CASE 16 */
-					g_message("gpilotd: sync_record: case 16");
+					standard_abs_trace_case (handle, local, remote, 16);
 					if ( direction & SyncToLocal )
 						gnome_pilot_conduit_standard_abs_archive_local (conduit, local);
 					if ( direction & SyncToRemote )
@@ -1410,7 +1430,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 					switch (local->attr) {
 					case GnomePilotRecordDeleted:
 						/* CASE 4 */
-						g_message("gpilotd: sync_record: case 4, deleting record %ld",remote->ID);
+						standard_abs_trace_case (handle, local, remote, 4);
 						if ( direction & SyncToRemote )
 							standard_abs_delete_from_pilot(conduit,handle,db,remote);
 						if ( direction & SyncToLocal )
@@ -1418,7 +1438,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 						break;
 					case GnomePilotRecordModified: {
 						/* CASE 8 */
-						g_message("gpilotd: sync_record: case 8");
+						standard_abs_trace_case (handle, local, remote, 8);
 						if ( direction & SyncToRemote ) 
 							standard_abs_add_to_pilot (conduit, handle, db, local);
 					}
@@ -1446,7 +1466,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 		/* no local record exists */
 		if (remote->archived) {
 			/* CASE 11 No Record */
-			g_message("gpilotd: sync_record: case 11 No Record");
+			standard_abs_trace_case (handle, local, remote, 11);
 			remote->attr = GnomePilotRecordNothing;
 			remote->archived = 0;
 			if ( direction & SyncToLocal )
@@ -1455,7 +1475,7 @@ standard_abs_sync_record (GnomePilotConduitStandardAbs *conduit,
 										 remote);
 		} else {
 			/* CASE 1 */
-			g_message("gpilotd: sync_record: case 1");
+			standard_abs_trace_case (handle, local, remote, 1);
                         /* maybe it'd be nice if StoreRemote returned a localRecord ? */
 			if ( direction & SyncToLocal ) {
 				gnome_pilot_conduit_standard_abs_store_remote (conduit, 
@@ -1493,7 +1513,8 @@ standard_abs_check_locally_deleted_records(GnomePilotConduitStandardAbs *conduit
 	  This isn't done in the merge calls, since they merge, not synchronize.
 	*/
 	while(gnome_pilot_conduit_standard_abs_iterate_specific (conduit, &local, GnomePilotRecordDeleted, 0)) {
-		g_message("gpilotd: locally deleted record...");
+		gpilot_trace (handle, GPILOT_TRACE_RECORD_DELETE_LOCAL, local->ID, 0);
+		GPILOT_RECORD_LOG (("gpilotd: locally deleted record..."));
 		standard_abs_sync_record(conduit, handle, db, local, NULL, direction);
 		gnome_pilot_conduit_send_progress(GNOME_PILOT_CONDUIT(conduit),
 						  conduit->total_progress, 
@@ -1599,6 +1620,7 @@ SlowSync (int handle,
 	remote.record = buffer;
 
 	g_message("Performing Slow Synchronization");
+	gpilot_trace (handle, GPILOT_TRACE_SLOW_SYNC, 0, 0);
 
 	while (gnome_pilot_compat_with_pilot_link_0_11_dlp_ReadRecordByIndex (handle, db,
 				     index,
@@ -1639,6 +1661,7 @@ FastSync (int handle,
 	remote.record = buffer;
 
 	g_message("Performing Fast Synchronization");
+	gpilot_trace (handle, GPILOT_TRACE_FAST_SYNC, 0, 0);
 
 	while (gnome_pilot_compat_with_pilot_link_0_11_dlp_ReadNextModifiedRec (handle, db,
 					remote.record,
@@ -31,6 +31,9 @@
 #include <pi-sync.h>
 #include "gpmarshal.h"
 #include "gnome-pilot-conduit-sync-abs.h"
+#include "gpilot-digest-snapshot.h"
+#include "gpilot-sync-stats.h"
+#include "gpilot-trace.h"
 #include "manager.h"
 
 enum {
@@ -48,13 +51,35 @@ enum {
 	MATCH,
 	FREE_MATCH,
 	PREPARE,
+	MATERIALIZE,
+	PREPARE_LOCAL,
+	OPEN_LOCAL,
 	LAST_SIGNAL
 };
 
+/* A prepare_local emission running on a thread of its own, see
+   gnome_pilot_conduit_sync_abs_prepare_local () */
 typedef struct
 {
 	GnomePilotConduitSyncAbs *conduit;
 	GnomePilotDBInfo *dbinfo;
+	GThread *thread;
+} SyncAbsPreparation;
+
+#define SYNC_ABS_PREPARATION_KEY "gnome-pilot-conduit-sync-abs-preparation"
+
+typedef struct
+{
+	GnomePilotConduitSyncAbs *conduit;
+	GnomePilotDBInfo *dbinfo;
+
+	/* record digests as this host last saw them, see
+	   gpilot-digest-snapshot.h */
+	GPilotDigestSnapshot *digests;
+	gboolean use_digests;
+	guint64 prepared_digest;
+	/* when the record transfer started, after pre_sync */
+	gint64 transfer_started;
 } gp_closure;
 
 /* Standard class methods */
@@ -95,8 +120,12 @@ static gint gnome_pilot_conduit_sync_abs_free_match (SyncHandler *sh, DesktopRec
 
 static gint gnome_pilot_conduit_sync_abs_prepare (SyncHandler *sh, DesktopRecord *dr, PilotRecord *pr);
 
+static gint sync_abs_materialize (GnomePilotConduitSyncAbs *conduit, GnomePilotDesktopRecord *gdr);
+
 /* Local utility routines */
 static gboolean gpilot_sync_pc_match (GnomePilotDBInfo *);
+static GPilotDigestSnapshot *sync_abs_load_digests (GnomePilotConduitSyncAbs *conduit,
+						    GnomePilotDBInfo *dbinfo);
 
 static GnomePilotConduitStandardClass *parent_class = NULL;
 static guint pilot_conduit_sync_abs_signals[LAST_SIGNAL] = { 0 };
@@ -281,6 +310,36 @@ gnome_pilot_conduit_sync_abs_class_init (GnomePilotConduitSyncAbsClass *klass)
 				gp_marshal_INT__POINTER_POINTER,
 				G_TYPE_INT, 2, G_TYPE_POINTER, G_TYPE_POINTER);
 
+	pilot_conduit_sync_abs_signals[MATERIALIZE] =
+		g_signal_new   ("materialize",
+				G_TYPE_FROM_CLASS (object_class),
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET (GnomePilotConduitSyncAbsClass, materialize),
+				NULL,
+				NULL,
+				gp_marshal_INT__POINTER,
+				G_TYPE_INT, 1, G_TYPE_POINTER);
+
+	pilot_conduit_sync_abs_signals[PREPARE_LOCAL] =
+		g_signal_new   ("prepare_local",
+				G_TYPE_FROM_CLASS (object_class),
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET (GnomePilotConduitSyncAbsClass, prepare_local),
+				NULL,
+				NULL,
+				gp_marshal_INT__POINTER,
+				G_TYPE_INT, 1, G_TYPE_POINTER);
+
+	pilot_conduit_sync_abs_signals[OPEN_LOCAL] =
+		g_signal_new   ("open_local",
+				G_TYPE_FROM_CLASS (object_class),
+				G_SIGNAL_RUN_LAST,
+				G_STRUCT_OFFSET (GnomePilotConduitSyncAbsClass, open_local),
+				NULL,
+				NULL,
+				gp_marshal_INT__POINTER,
+				G_TYPE_INT, 1, G_TYPE_POINTER);
+
 	conduit_standard_class->copy_to_pilot = gnome_pilot_conduit_standard_real_copy_to_pilot;
 	conduit_standard_class->copy_from_pilot = gnome_pilot_conduit_standard_real_copy_from_pilot;
 	conduit_standard_class->merge_to_pilot = gnome_pilot_conduit_standard_real_merge_to_pilot;
@@ -339,6 +398,32 @@ gpilot_sync_pc_match(GnomePilotDBInfo *dbinfo)
 	return FALSE;
 }
 
+static GPilotDigestSnapshot *
+sync_abs_load_digests (GnomePilotConduitSyncAbs *conduit,
+		       GnomePilotDBInfo *dbinfo)
+{
+	GnomePilotSyncStamp *stamp;
+
+	stamp = (GnomePilotSyncStamp *)dbinfo->manager_data;
+
+	return gpilot_digest_snapshot_load (dbinfo->pu->userID,
+					    gnome_pilot_conduit_standard_get_db_name (GNOME_PILOT_CONDUIT_STANDARD (conduit)),
+					    stamp->sync_PC_Id);
+}
+
+/* Copying and merging change the pilot without keeping track of the
+   digests, so the snapshot can no longer be trusted */
+static void
+sync_abs_discard_digests (GnomePilotConduitSyncAbs *conduit,
+			  GnomePilotDBInfo *dbinfo)
+{
+	GPilotDigestSnapshot *digests;
+
+	digests = sync_abs_load_digests (conduit, dbinfo);
+	gpilot_digest_snapshot_discard (digests);
+	gpilot_digest_snapshot_free (digests);
+}
+
 static SyncHandler *
 sync_abs_new_sync_handler (GnomePilotConduitSyncAbs *conduit,
 			   GnomePilotDBInfo *dbinfo)
@@ -377,6 +462,16 @@ sync_abs_new_sync_handler (GnomePilotConduitSyncAbs *conduit,
 	return sh;
 }
 
+static void
+sync_abs_stats_add (gp_closure *gpc, GPilotSyncPhase phase, gint64 since)
+{
+	gchar *name;
+
+	name = gnome_pilot_conduit_get_name (GNOME_PILOT_CONDUIT (gpc->conduit));
+	gpilot_sync_stats_add (gpc->dbinfo->pilot_socket, phase, name, since, 0, 0);
+	g_free (name);
+}
+
 static void
 sync_abs_free_sync_handler (SyncHandler *sh)
 {
@@ -385,13 +480,11 @@ sync_abs_free_sync_handler (SyncHandler *sh)
 	g_free (sh);
 }
 
-static GnomePilotRecord *
-sync_abs_pr_to_gpr (PilotRecord *pr)
+/* Records only live for the callback they are passed to, so the
+   caller keeps gpr on its stack */
+static void
+sync_abs_pr_to_gpr (PilotRecord *pr, GnomePilotRecord *gpr)
 {
-	GnomePilotRecord *gpr;
-	
-	gpr = g_new (GnomePilotRecord, 1);
-
 	gpr->ID = pr->recID;
 	gpr->category = pr->catID;
 	gpr->record = pr->buffer;
@@ -406,8 +499,6 @@ sync_abs_pr_to_gpr (PilotRecord *pr)
 		gpr->attr = GnomePilotRecordModified;
 	else
 		gpr->attr = GnomePilotRecordNothing;
-
-	return gpr;
 }
 
 static PilotRecord
@@ -492,6 +583,28 @@ sync_abs_fill_dr (GnomePilotDesktopRecord *gdr)
 	}
 }
 
+/* Records handed out by for_each, for_each_modified and match may be
+   lightweight handles, holding only what the engine needs to decide
+   what to do with them. Give the conduit a chance to build the full
+   record before the bytes are actually needed, and pick up whatever
+   fields (eg. the category) that filled in. */
+static gint
+sync_abs_materialize (GnomePilotConduitSyncAbs *conduit,
+		      GnomePilotDesktopRecord *gdr)
+{
+	gint retval = 0;
+
+	g_signal_emit   (G_OBJECT (conduit),
+			 pilot_conduit_sync_abs_signals [MATERIALIZE],
+			 0,
+			 gdr, &retval);
+
+	if (retval >= 0)
+		sync_abs_fill_dr (gdr);
+
+	return retval;
+}
+
 static gint
 gnome_pilot_conduit_standard_real_copy_to_pilot (GnomePilotConduitStandard *conduit_standard,
 						 GnomePilotDBInfo *dbinfo)
@@ -505,6 +618,7 @@ gnome_pilot_conduit_standard_real_copy_to_pilot (GnomePilotConduitStandard *cond
 	conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit_standard);
 
 	sh = sync_abs_new_sync_handler (conduit, dbinfo);
+	sync_abs_discard_digests (conduit, dbinfo);
 
 	/* Set the counters for the progress bar */
 	/* Total_records is set in the pre_sync callback */
@@ -536,6 +650,7 @@ gnome_pilot_conduit_standard_real_copy_from_pilot (GnomePilotConduitStandard *co
 	conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit_standard);
 
 	sh = sync_abs_new_sync_handler (conduit, dbinfo);
+	sync_abs_discard_digests (conduit, dbinfo);
 
 	if (sync_CopyFromPilot (sh) != 0) {
 		g_warning(_("Copy from PDA failed!"));
@@ -560,6 +675,7 @@ gnome_pilot_conduit_standard_real_merge_to_pilot (GnomePilotConduitStandard *con
 	conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit_standard);
 
 	sh = sync_abs_new_sync_handler (conduit, dbinfo);
+	sync_abs_discard_digests (conduit, dbinfo);
 
 	if (sync_MergeToPilot (sh) != 0) {
 		g_warning(_("Merge to PDA failed!"));
@@ -584,6 +700,7 @@ gnome_pilot_conduit_standard_real_merge_from_pilot (GnomePilotConduitStandard *c
 	conduit = GNOME_PILOT_CONDUIT_SYNC_ABS (conduit_standard);
 
 	sh = sync_abs_new_sync_handler (conduit, dbinfo);
+	sync_abs_discard_digests (conduit, dbinfo);
 
 	if (sync_MergeFromPilot (sh) != 0) {
 		g_warning(_("Merge from PDA failed!"));
@@ -638,13 +755,19 @@ gnome_pilot_conduit_standard_real_synchronize (GnomePilotConduitStandard *condui
 			conduit->total_progress += conduit->total_records;
 		}
 	}
+	((gp_closure *)sh->data)->digests = sync_abs_load_digests (conduit, dbinfo);
+
 	retval = sync_Synchronize (sh);
 
 	if (retval != 0) {
 		g_warning(_("Synchronization failed!"));
+		gpilot_digest_snapshot_discard (((gp_closure *)sh->data)->digests);
+		gpilot_digest_snapshot_free (((gp_closure *)sh->data)->digests);
 		return -1;
 	}
 
+	gpilot_digest_snapshot_save (((gp_closure *)sh->data)->digests);
+	gpilot_digest_snapshot_free (((gp_closure *)sh->data)->digests);
 	sync_abs_free_sync_handler (sh);
 
 	/* now disable the slow=true setting, so it doesn't pass on to next time */
@@ -657,14 +780,22 @@ gnome_pilot_conduit_standard_real_synchronize (GnomePilotConduitStandard *condui
 static gint
 gnome_pilot_conduit_sync_abs_pre_sync (SyncHandler *sh, int dbhandle, int *slow)
 {
+	gp_closure *gpc;
 	GnomePilotConduitSyncAbs *conduit;
 	GnomePilotDBInfo *dbinfo;
 	gint retval = 0;
+	gint64 started;
 
-	conduit = ((gp_closure *)sh->data)->conduit;
-	dbinfo = ((gp_closure *)sh->data)->dbinfo;
+	gpc = (gp_closure *)sh->data;
+	conduit = gpc->conduit;
+	dbinfo = gpc->dbinfo;
+	started = g_get_monotonic_time ();
 	
 	dbinfo->db_handle = dbhandle;
+
+	/* the local preparation started by the manager has to be over
+	   before pre_sync is emitted */
+	gnome_pilot_conduit_sync_abs_wait_prepared (conduit);
 	
 	dlp_ReadOpenDBInfo (dbinfo->pilot_socket, dbinfo->db_handle, &conduit->total_records);
 
@@ -675,6 +806,21 @@ gnome_pilot_conduit_sync_abs_pre_sync (SyncHandler *sh, int dbhandle, int *slow)
 			 &retval);
 
 	*slow = GNOME_PILOT_CONDUIT_STANDARD (conduit)->slow ? 1 : 0;
+	gpilot_sync_stats_set_slow (dbinfo->pilot_socket, *slow);
+	gpilot_trace (dbinfo->pilot_socket,
+		      *slow ? GPILOT_TRACE_SLOW_SYNC : GPILOT_TRACE_FAST_SYNC, 0, 0);
+
+	/* A slow sync reads every record on the pilot, so the digests
+	   collected add up to a complete snapshot. If we have one from
+	   the last time this host synced, use it to tell which records
+	   changed on the pilot since then. */
+	if (gpc->digests != NULL) {
+		gpilot_digest_snapshot_begin (gpc->digests, *slow);
+		gpc->use_digests = *slow && gpilot_digest_snapshot_has_base (gpc->digests);
+	}
+
+	sync_abs_stats_add (gpc, GPILOT_SYNC_PHASE_PRE_SYNC, started);
+	gpc->transfer_started = g_get_monotonic_time ();
 
 	return retval;
 }
@@ -682,18 +828,29 @@ gnome_pilot_conduit_sync_abs_pre_sync (SyncHandler *sh, int dbhandle, int *slow)
 static gint
 gnome_pilot_conduit_sync_abs_post_sync (SyncHandler *sh, int dbhandle)
 {
+	gp_closure *gpc;
 	GnomePilotConduitSyncAbs *conduit;
 	GnomePilotDBInfo *dbinfo;
 	gint retval = 0;
+	gint64 started;
 
-	conduit = ((gp_closure *)sh->data)->conduit;
-	dbinfo = ((gp_closure *)sh->data)->dbinfo;
+	gpc = (gp_closure *)sh->data;
+	conduit = gpc->conduit;
+	dbinfo = gpc->dbinfo;
+
+	/* the records counted in the callbacks go with the transfer */
+	if (gpc->transfer_started != 0)
+		sync_abs_stats_add (gpc, GPILOT_SYNC_PHASE_TRANSFER, gpc->transfer_started);
+	started = g_get_monotonic_time ();
 
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [POST_SYNC],
 			 0,
 			 dbinfo,
 			 &retval);
+
+	sync_abs_stats_add (gpc, GPILOT_SYNC_PHASE_POST_SYNC, started);
+
 	return retval;
 }
 
@@ -712,6 +869,11 @@ gnome_pilot_conduit_sync_abs_set_pilot_id (SyncHandler *sh, DesktopRecord *dr, r
 			 pilot_conduit_sync_abs_signals [SET_PILOT_ID],
 			 0,
 			 gdr, id, &retval);
+
+	/* a new record was just written to the pilot by prepare */
+	if (((gp_closure *)sh->data)->digests != NULL)
+		gpilot_digest_snapshot_set (((gp_closure *)sh->data)->digests, id,
+					    ((gp_closure *)sh->data)->prepared_digest);
 	
 	sync_abs_fill_dr (gdr);
 	
@@ -786,22 +948,40 @@ gnome_pilot_conduit_sync_abs_for_each_modified (SyncHandler *sh, DesktopRecord *
 static gint
 gnome_pilot_conduit_sync_abs_compare (SyncHandler *sh, PilotRecord *pr, DesktopRecord *dr)
 {
+	gp_closure *gpc;
 	GnomePilotConduitSyncAbs *conduit;
 	GnomePilotDesktopRecord *gdr;
-	GnomePilotRecord *gpr;
+	GnomePilotRecord gpr;
 	gint retval = 0;
 
-	conduit = ((gp_closure *)sh->data)->conduit;
-	gpr = sync_abs_pr_to_gpr (pr);
+	gpc = (gp_closure *)sh->data;
+	conduit = gpc->conduit;
 	gdr = (GnomePilotDesktopRecord *)dr;
 	sync_abs_fill_gdr (gdr);
 
+	/* Unchanged on the desktop, and on the pilot it is still what
+	   this host saw last time, so there is nothing to compare */
+	if (gpc->use_digests && gdr->attr == GnomePilotRecordNothing) {
+		guint64 digest;
+
+		if (gpilot_digest_snapshot_lookup (gpc->digests, pr->recID, &digest)
+		    && digest == gpilot_record_digest (pr->buffer, pr->len, pr->catID, pr->flags)) {
+			gpilot_trace (sh->sd, GPILOT_TRACE_RECORD_UNCHANGED, pr->recID, 0);
+			return 0;
+		}
+	}
+
+	retval = sync_abs_materialize (conduit, gdr);
+	if (retval < 0)
+		return retval;
+
+	sync_abs_pr_to_gpr (pr, &gpr);
+
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [COMPARE],
 			 0,
-			 gdr, gpr, &retval);
+			 gdr, &gpr, &retval);
 
-	g_free (gpr);
 	
 	return retval;
 }
@@ -810,18 +990,19 @@ static gint
 gnome_pilot_conduit_sync_abs_add_record (SyncHandler *sh, PilotRecord *pr)
 {
 	GnomePilotConduitSyncAbs *conduit;
-	GnomePilotRecord *gpr;
+	GnomePilotRecord gpr;
 	gint retval = 0;
 
 	conduit = ((gp_closure *)sh->data)->conduit;
-	gpr = sync_abs_pr_to_gpr (pr);
+	sync_abs_pr_to_gpr (pr, &gpr);
 
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [ADD_RECORD],
 			 0,
-			 gpr, &retval);
+			 &gpr, &retval);
 
-	g_free (gpr);
+	gpilot_sync_stats_count (sh->sd, 1, pr->len);
+	gpilot_trace (sh->sd, GPILOT_TRACE_RECORD_ADD, pr->recID, pr->len);
 	
 	return retval;
 }
@@ -831,20 +1012,21 @@ gnome_pilot_conduit_sync_abs_replace_record (SyncHandler *sh, DesktopRecord *dr,
 {
 	GnomePilotConduitSyncAbs *conduit;
 	GnomePilotDesktopRecord *gdr;
-	GnomePilotRecord *gpr;
+	GnomePilotRecord gpr;
 	gint retval = 0;
 
 	conduit = ((gp_closure *)sh->data)->conduit;
 	gdr = (GnomePilotDesktopRecord *)dr;
 	sync_abs_fill_gdr (gdr);
-	gpr = sync_abs_pr_to_gpr (pr);
+	sync_abs_pr_to_gpr (pr, &gpr);
 
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [REPLACE_RECORD],
 			 0,
-			 gdr, gpr, &retval);
+			 gdr, &gpr, &retval);
 
-	g_free (gpr);
+	gpilot_sync_stats_count (sh->sd, 1, pr->len);
+	gpilot_trace (sh->sd, GPILOT_TRACE_RECORD_REPLACE, pr->recID, pr->len);
 	
 	return retval;
 }
@@ -864,6 +1046,7 @@ gnome_pilot_conduit_sync_abs_delete_record (SyncHandler *sh, DesktopRecord *dr)
 			 pilot_conduit_sync_abs_signals [DELETE_RECORD],
 			 0,
 			 gdr, &retval);
+	gpilot_trace (sh->sd, GPILOT_TRACE_RECORD_DELETE, dr->recID, 0);
 
 	return retval;
 }
@@ -879,10 +1062,16 @@ gnome_pilot_conduit_sync_abs_archive_record (SyncHandler *sh, DesktopRecord *dr,
 	gdr = (GnomePilotDesktopRecord *)dr;
 	sync_abs_fill_gdr (gdr);
 
+	/* the record is kept as it is, category and all */
+	retval = sync_abs_materialize (conduit, gdr);
+	if (retval < 0)
+		return retval;
+
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [ARCHIVE_RECORD],
 			 0,
 			 gdr, archive ? TRUE : FALSE, &retval);
+	gpilot_trace (sh->sd, GPILOT_TRACE_RECORD_ARCHIVE, dr->recID, archive);
 
 	sync_abs_fill_dr (gdr);
 
@@ -892,25 +1081,56 @@ gnome_pilot_conduit_sync_abs_archive_record (SyncHandler *sh, DesktopRecord *dr,
 static gint
 gnome_pilot_conduit_sync_abs_match (SyncHandler *sh, PilotRecord *pr, DesktopRecord **dr)
 {
+	gp_closure *gpc;
 	GnomePilotConduitSyncAbs *conduit;
-	GnomePilotRecord *gpr;
+	GnomePilotRecord gpr;
 	GnomePilotDesktopRecord *gdr = NULL;
 	gint retval = 0;
 
-	conduit = ((gp_closure *)sh->data)->conduit;
-	gpr = sync_abs_pr_to_gpr (pr);
+	gpc = (gp_closure *)sh->data;
+	conduit = gpc->conduit;
+
+	if (gpc->digests != NULL) {
+		if (pr->flags & dlpRecAttrDeleted) {
+			gpilot_digest_snapshot_remove (gpc->digests, pr->recID);
+		} else {
+			guint64 digest, old_digest;
+
+			digest = gpilot_record_digest (pr->buffer, pr->len, pr->catID, pr->flags);
+
+			/* The dirty flag was cleared by whichever host the
+			   pilot synced with last, flag what changed since
+			   this host saw it */
+			if (gpc->use_digests
+			    && !(gpilot_digest_snapshot_lookup (gpc->digests, pr->recID, &old_digest)
+				 && old_digest == digest))
+				pr->flags |= dlpRecAttrDirty;
+
+			gpilot_digest_snapshot_set (gpc->digests, pr->recID, digest);
+		}
+	}
+
+	sync_abs_pr_to_gpr (pr, &gpr);
 
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [MATCH],
 			 0,
-			 gpr, &gdr, &retval);
+			 &gpr, &gdr, &retval);
+
+	/* the match is compared next, and its category read before
+	   that, so there is nothing to gain from keeping it a handle */
+	if (gdr != NULL && retval >= 0) {
+		gint materialized = sync_abs_materialize (conduit, gdr);
+
+		if (materialized < 0)
+			retval = materialized;
+	}
 
 	if (gdr != NULL)
 		sync_abs_fill_dr (gdr);
 
 	*dr = (DesktopRecord *)gdr;
 	
-	g_free (gpr);
 	
 	return retval;
 }
@@ -937,23 +1157,40 @@ gnome_pilot_conduit_sync_abs_free_match (SyncHandler *sh, DesktopRecord *dr)
 static gint
 gnome_pilot_conduit_sync_abs_prepare (SyncHandler *sh, DesktopRecord *dr, PilotRecord *pr)
 {
+	gp_closure *gpc;
 	GnomePilotConduitSyncAbs *conduit;
 	GnomePilotDesktopRecord *gdr;
-	GnomePilotRecord *gpr = NULL;
+	GnomePilotRecord gpr;
 	gint retval = 0;
 
-	conduit = ((gp_closure *)sh->data)->conduit;
+	gpc = (gp_closure *)sh->data;
+	conduit = gpc->conduit;
 	gdr = (GnomePilotDesktopRecord *)dr;
 	sync_abs_fill_gdr (gdr);
-	gpr = sync_abs_pr_to_gpr (pr);
+
+	retval = sync_abs_materialize (conduit, gdr);
+	if (retval < 0)
+		return retval;
+
+	sync_abs_pr_to_gpr (pr, &gpr);
 
 	g_signal_emit   (G_OBJECT (conduit),
 			 pilot_conduit_sync_abs_signals [PREPARE],
 			 0,
-			 gdr, gpr, &retval);
+			 gdr, &gpr, &retval);
 
-	*pr = sync_abs_gpr_to_pr (gpr);
-	g_free (gpr);
+	*pr = sync_abs_gpr_to_pr (&gpr);
+
+	if (retval >= 0)
+		gpilot_sync_stats_count (sh->sd, 1, pr->len);
+
+	/* pr is about to be written to the pilot. New records only get
+	   their id in set_pilot_id, keep the digest until then */
+	if (gpc->digests != NULL && retval >= 0) {
+		gpc->prepared_digest = gpilot_record_digest (pr->buffer, pr->len, pr->catID, pr->flags);
+		if (pr->recID != 0)
+			gpilot_digest_snapshot_set (gpc->digests, pr->recID, gpc->prepared_digest);
+	}
 	
 	return retval;
 }
@@ -1022,6 +1259,93 @@ gnome_pilot_conduit_sync_abs_set_num_deleted_local_records (GnomePilotConduitSyn
 	conduit->num_deleted_local_records = num;
 }
 
+static gpointer
+sync_abs_prepare_local_thread (SyncAbsPreparation *preparation)
+{
+	GMainContext *context;
+	gint retval = 0;
+
+	/* Handlers waiting on a main loop get one of their own, the
+	   default context belongs to the thread running the sync.
+	   Nothing attached to it may outlive the emission, see
+	   open_local */
+	context = g_main_context_new ();
+	g_main_context_push_thread_default (context);
+
+	g_signal_emit   (G_OBJECT (preparation->conduit),
+			 pilot_conduit_sync_abs_signals [PREPARE_LOCAL],
+			 0,
+			 preparation->dbinfo,
+			 &retval);
+
+	g_main_context_pop_thread_default (context);
+	g_main_context_unref (context);
+
+	return GINT_TO_POINTER (retval);
+}
+
+/* Emit open_local, then start emitting prepare_local for dbinfo on a
+   thread of its own. Returns FALSE when the conduit has no
+   prepare_local handler, open_local failed or a preparation is
+   already running. dbinfo must stay around until
+   gnome_pilot_conduit_sync_abs_wait_prepared () returned. */
+gboolean
+gnome_pilot_conduit_sync_abs_prepare_local (GnomePilotConduitSyncAbs *conduit,
+					    GnomePilotDBInfo *dbinfo)
+{
+	SyncAbsPreparation *preparation;
+	gint retval = 0;
+
+	g_return_val_if_fail (conduit != NULL, FALSE);
+	g_return_val_if_fail (GNOME_IS_PILOT_CONDUIT_SYNC_ABS (conduit), FALSE);
+
+	if (g_object_get_data (G_OBJECT (conduit), SYNC_ABS_PREPARATION_KEY) != NULL)
+		return FALSE;
+	if (!g_signal_has_handler_pending (G_OBJECT (conduit),
+					   pilot_conduit_sync_abs_signals [PREPARE_LOCAL],
+					   0, FALSE))
+		return FALSE;
+
+	g_signal_emit   (G_OBJECT (conduit),
+			 pilot_conduit_sync_abs_signals [OPEN_LOCAL],
+			 0,
+			 dbinfo,
+			 &retval);
+	if (retval < 0)
+		return FALSE;
+
+	preparation = g_new0 (SyncAbsPreparation, 1);
+	preparation->conduit = conduit;
+	preparation->dbinfo = dbinfo;
+	preparation->thread = g_thread_new ("gpilotd-prepare",
+					    (GThreadFunc) sync_abs_prepare_local_thread,
+					    preparation);
+	g_object_set_data (G_OBJECT (conduit), SYNC_ABS_PREPARATION_KEY, preparation);
+
+	return TRUE;
+}
+
+/* Wait for the preparation started on conduit, if any. Returns what
+   the prepare_local handler returned, 0 when none was running. */
+gint
+gnome_pilot_conduit_sync_abs_wait_prepared (GnomePilotConduitSyncAbs *conduit)
+{
+	SyncAbsPreparation *preparation;
+	gint retval;
+
+	g_return_val_if_fail (conduit != NULL, 0);
+	g_return_val_if_fail (GNOME_IS_PILOT_CONDUIT_SYNC_ABS (conduit), 0);
+
+	preparation = g_object_steal_data (G_OBJECT (conduit), SYNC_ABS_PREPARATION_KEY);
+	if (preparation == NULL)
+		return 0;
+
+	retval = GPOINTER_TO_INT (g_thread_join (preparation->thread));
+	g_free (preparation);
+
+	return retval;
+}
+
 
 
 
@@ -139,6 +139,30 @@ struct _GnomePilotConduitSyncAbsClass
 	int (*prepare)          (GnomePilotConduitSyncAbs *conduit,
 				 GnomePilotDesktopRecord *dr,
 				 GnomePilotRecord *pr);
+
+	/* Records returned by for_each and for_each_modified only
+	   need ID, status, secret and archived filled in. Emitted
+	   before compare, prepare and archive_record and right after
+	   match so the conduit can build the full record for dr (the
+	   category included), must be a no-op if it already has */
+	int (*materialize)      (GnomePilotConduitSyncAbs *conduit,
+				 GnomePilotDesktopRecord *dr);
+
+	/* Emitted on a thread of its own as soon as the databases on
+	   the pilot are known, so loading the local data overlaps the
+	   transfers made before the conduit's turn. Must not talk to
+	   the pilot nor emit progress, message or error; pre_sync is
+	   only emitted once it has returned. */
+	int (*prepare_local)    (GnomePilotConduitSyncAbs *conduit,
+				 GnomePilotDBInfo *dbinfo);
+
+	/* Emitted on the thread running the sync right before
+	   prepare_local is started. Whatever outlives the preparation
+	   (eg. clients whose signals go to the thread-default main
+	   context) is opened here, prepare_local's thread has a main
+	   context of its own that goes away when it returns. */
+	int (*open_local)       (GnomePilotConduitSyncAbs *conduit,
+				 GnomePilotDBInfo *dbinfo);
 };
 
 GType    gnome_pilot_conduit_sync_abs_get_type (void);
@@ -154,6 +178,10 @@ void gnome_pilot_conduit_sync_abs_set_num_new_local_records (GnomePilotConduitSy
 void gnome_pilot_conduit_sync_abs_set_num_deleted_local_records (GnomePilotConduitSyncAbs *conduit,
 								 gint num);
 
+gboolean gnome_pilot_conduit_sync_abs_prepare_local (GnomePilotConduitSyncAbs *conduit,
+						     GnomePilotDBInfo *dbinfo);
+gint gnome_pilot_conduit_sync_abs_wait_prepared (GnomePilotConduitSyncAbs *conduit);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
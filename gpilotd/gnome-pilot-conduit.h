@@ -213,6 +213,9 @@ const gchar * 	gnome_pilot_conduit_get_base_dir	(GnomePilotConduit * self);
 typedef GnomePilotConduit *(*GnomePilotConduitOldLoadFunc)(guint32);
 typedef GnomePilotConduit *(*GnomePilotConduitLoadFunc)(GPilotPilot*);
 typedef void (*GnomePilotConduitDestroyFunc)(GnomePilotConduit *);
+/* optional, for conduits that can follow local changes between syncs */
+typedef gpointer (*GnomePilotConduitStartWatchFunc)(guint32);
+typedef void (*GnomePilotConduitStopWatchFunc)(gpointer);
 
 
 #ifdef __cplusplus
@@ -232,3 +232,27 @@ save_pilot_cache_kfile (GKeyFile *kfile,
 	g_free (pilot);
 	return ret;
 }
+
+gchar*
+get_gpilotd_data_file (const gchar *dir,
+		       const gchar *file)
+{
+	const char *homedir = g_getenv ("HOME");
+	gchar      *dirname;
+	gchar      *filename;
+
+	g_return_val_if_fail (IS_STR_SET (dir), NULL);
+	g_return_val_if_fail (IS_STR_SET (file), NULL);
+
+	if (!homedir)
+		homedir = g_get_home_dir ();
+
+	dirname = g_build_filename (homedir, NEW_PREFIX, dir, NULL);
+	if (g_mkdir_with_parents (dirname, 0700) != 0)
+		g_warning ("Could not create directory '%s'", dirname);
+
+	filename = g_build_filename (dirname, file, NULL);
+	g_free (dirname);
+
+	return filename;
+}
@@ -38,4 +38,9 @@ gboolean  save_conduits_kfile    (GKeyFile *kfile,
 gboolean  save_pilot_cache_kfile (GKeyFile *kfile,
 				  gint      id);
 
+/* path of file in the subdirectory dir of the gnome-pilot config
+   directory, dir is created if it does not exist */
+gchar*    get_gpilotd_data_file  (const gchar *dir,
+				  const gchar *file);
+
 #endif /* _GPILOT_CONFIG_H_ */
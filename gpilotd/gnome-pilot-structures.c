@@ -115,6 +115,66 @@ GPilotContext *gpilot_context_new (void)
 		error = NULL;
 	}
 
+	/* progress signals to clients are sent at most once per
+	   notify_interval msec per pilot, 0 sends every one of them */
+	retval->notify_interval = g_key_file_get_integer (kfile, "General", "notify_interval", &error);
+	if (error) {
+		retval->notify_interval = 250;
+		g_key_file_set_integer (kfile, "General", "notify_interval", retval->notify_interval);
+		g_error_free (error);
+		error = NULL;
+	}
+
+	/* conduits that can keep local databases open between syncs
+	   record what changed instead of scanning at the next sync */
+	retval->watch_local_changes = g_key_file_get_boolean (kfile, "General", "watch_local_changes", &error);
+	if (error) {
+		retval->watch_local_changes = FALSE;
+		g_key_file_set_boolean (kfile, "General", "watch_local_changes", retval->watch_local_changes);
+		g_error_free (error);
+		error = NULL;
+	}
+
+	/* GPILOTD_PROFILE_DLP in the environment turns it on as well */
+	retval->profile_dlp = g_key_file_get_boolean (kfile, "General", "profile_dlp", &error);
+	if (error) {
+		retval->profile_dlp = FALSE;
+		g_key_file_set_boolean (kfile, "General", "profile_dlp", retval->profile_dlp);
+		g_error_free (error);
+		error = NULL;
+	}
+	if (g_getenv ("GPILOTD_PROFILE_DLP") != NULL)
+		retval->profile_dlp = TRUE;
+
+	/* a sync that lost its connection is picked up where it stopped
+	   when the pilot syncs again within resume_window sec */
+	retval->resume_window = g_key_file_get_integer (kfile, "General", "resume_window", &error);
+	if (error) {
+		retval->resume_window = 600;
+		g_key_file_set_integer (kfile, "General", "resume_window", retval->resume_window);
+		g_error_free (error);
+		error = NULL;
+	}
+
+	/* a quick sync runs every conduit, but leaves out the backups that
+	   would take it over quick_sync_budget sec. Those are made by the
+	   first sync once the last full one is full_sync_interval hours
+	   old, 0 leaving that to syncs with no budget. */
+	retval->quick_sync_budget = g_key_file_get_integer (kfile, "General", "quick_sync_budget", &error);
+	if (error) {
+		retval->quick_sync_budget = 0;
+		g_key_file_set_integer (kfile, "General", "quick_sync_budget", retval->quick_sync_budget);
+		g_error_free (error);
+		error = NULL;
+	}
+	retval->full_sync_interval = g_key_file_get_integer (kfile, "General", "full_sync_interval", &error);
+	if (error) {
+		retval->full_sync_interval = 24;
+		g_key_file_set_integer (kfile, "General", "full_sync_interval", retval->full_sync_interval);
+		g_error_free (error);
+		error = NULL;
+	}
+
 	save_gpilotd_kfile (kfile);
 	g_key_file_free (kfile);
 
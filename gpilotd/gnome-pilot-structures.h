@@ -87,6 +87,13 @@ struct _GPilotContext {
 	guint visor_in_handle;
 	guint visor_err_handle;
 #endif
+
+	gint notify_interval; /* msec between coalesced progress signals */
+	gboolean watch_local_changes; /* conduits follow local changes between syncs */
+	gboolean profile_dlp; /* account every DLP call, see gpilot-dlp-profile.h */
+	guint resume_window; /* sec an interrupted sync can be resumed, 0 never */
+	guint quick_sync_budget; /* sec for a quick sync, 0 for full syncs only */
+	guint full_sync_interval; /* hours between full syncs when quick syncing */
 };
 typedef struct _GPilotContext GPilotContext;
 
@@ -53,6 +53,11 @@
 #include "gpmarshal.h"
 #include "gpilot-gui.h"
 #include "manager.h"
+#include "gpilot-sync-log.h"
+#include "gpilot-sync-stats.h"
+#include "gpilot-dlp-profile.h"
+#include "gpilot-sync-history.h"
+#include "gpilot-trace.h"
 
 #include <gio/gio.h>
 
@@ -82,7 +87,7 @@ static int pilot_connect (GPilotDevice *device,int *error);
 static int check_usb_config (GPilotDevice *device);
 static gboolean do_cradle_events (int pfd, GPilotContext *context, struct PilotUser *pu, GPilotDevice *device);
 static void gpilot_syncing_unknown_pilot (struct PilotUser pu, int pfd, GPilotDevice *device, GPilotContext *context);
-static void gpilot_syncing_known_pilot (GPilotPilot *pilot, struct PilotUser pu, int pfd, GPilotDevice *device, GPilotContext *context);
+static gboolean gpilot_syncing_known_pilot (GPilotPilot *pilot, struct PilotUser pu, int pfd, GPilotDevice *device, GPilotContext *context);
 static void pilot_disconnect (int sd);
 static void load_devices_xml (void);
 static int  known_usb_device (gchar *match_str);
@@ -104,6 +109,8 @@ struct GpilotDaemonPrivate
 {
         GPilotContext   *gpilotd_context;
         GDBusConnection *connection;
+        GpilotDaemonDaemon *skeleton;
+        GList           *watches;
 };
 
 /* Global D-Bus connection for signal emission from static functions */
@@ -727,7 +734,7 @@ do_cradle_events (int pfd,
   vs copy to/from blablabla).
 
  */
-static void 
+static gboolean
 do_sync (int pfd,   
 	GPilotContext *context,
 	struct PilotUser *pu,
@@ -737,8 +744,10 @@ do_sync (int pfd,
 	GList *conduit_list, *backup_conduit_list, *file_conduit_list;
 	GnomePilotSyncStamp stamp;
 	char *pilot_name;
+	gboolean completed = FALSE;
 
 	pilot_name = pilot_name_from_id (pu->userID,context);
+	gpilot_sync_stats_set_pilot (pfd, pilot->pilot_id, pilot->name);
 
 	gpilot_load_conduits (context,
 			     pilot,
@@ -759,6 +768,10 @@ do_sync (int pfd,
 		  pilot->name,
 		  pu->username);
   
+	/* Log entries are collected during the sync and written to the
+	   pilot in one go before the sync stamp */
+	gpilot_sync_log_begin (pfd);
+
 	/* Set a log entry in the pilot */
 	{
 		char hostname[64];
@@ -787,11 +800,14 @@ do_sync (int pfd,
 				     context);
 		g_message (_("Synchronization ended")); 
 		gpilot_add_log_entry (pfd,"Synchronization completed");
+		completed = TRUE;
 	} else {
 		g_message (_("Synchronization ended early"));
 		gpilot_add_log_entry (pfd,"Synchronization terminated");
 	}
 
+	gpilot_sync_log_flush (pfd);
+
 	write_sync_stamp (pilot,pfd,pu,stamp.sync_PC_Id,time (NULL));
   
 	g_free (pilot_name);
@@ -799,13 +815,15 @@ do_sync (int pfd,
 	gpilot_unload_conduits (conduit_list);
 	gpilot_unload_conduits (backup_conduit_list);
 	gpilot_unload_conduits (file_conduit_list);
+
+	return completed;
 }
 
 /*
  * This function handles when sync_device (...) encounters a known pilot
  */
 
-static void
+static gboolean
 gpilot_syncing_known_pilot (GPilotPilot *pilot,
 			    struct PilotUser pu,
 			    int pfd,
@@ -814,6 +832,7 @@ gpilot_syncing_known_pilot (GPilotPilot *pilot,
 {
 	struct stat buf; 
 	int ret;
+	gboolean completed = FALSE;
 
 	iconv_t ic;
 
@@ -875,9 +894,11 @@ gpilot_syncing_known_pilot (GPilotPilot *pilot,
 		}
 		
 		if (pwd_ok) {
-			do_sync (pfd, context, &pu, pilot, device);
+			completed = do_sync (pfd, context, &pu, pilot, device);
 		}
 	}
+
+	return completed;
 }
 
 /*
@@ -989,14 +1010,22 @@ sync_device (GPilotDevice *device, GPilotContext *context)
 	struct PilotUser pu;
 	struct SysInfo ps;
 	int pfd;
+	gint64 started;
+	gboolean synced = FALSE;
+	GPilotSyncSession *session;
 	
 	g_assert (context != NULL);
 	g_return_val_if_fail (device != NULL, FALSE);
 
 	/* signal (SIGHUP,SIG_DFL); */
+	started = g_get_monotonic_time ();
 	pfd = pilot_connect (device,&connect_error);
 
 	if (!connect_error) {
+		gpilot_sync_stats_begin (pfd, device->name, started);
+		gpilot_trace_begin (pfd);
+		started = g_get_monotonic_time ();
+
                /* connect succeeded, try to read the systeminfo */
                if (dlp_ReadSysInfo (pfd, &ps) < 0) {
                        /* no ? drop connection then */
@@ -1009,6 +1038,7 @@ sync_device (GPilotDevice *device, GPilotContext *context)
 			/* no ? drop connection then */
 			g_warning (_("An error occurred while getting the PDA's user data"));
 		} else {
+			gpilot_sync_stats_add (pfd, GPILOT_SYNC_PHASE_HANDSHAKE, NULL, started, 0, 0);
 	
 			/* If there are cradle specific events, handle them and stop */
 			if (do_cradle_events (pfd,context,&pu,device)) {
@@ -1023,12 +1053,17 @@ sync_device (GPilotDevice *device, GPilotContext *context)
 				} else {
 					/* Pilot is known, make connect notifications */
 					dbus_notify_connected (pilot->name,pu);				
-					gpilot_syncing_known_pilot (pilot, pu, pfd, device, context);
+					synced = gpilot_syncing_known_pilot (pilot, pu, pfd, device, context);
 					dbus_notify_disconnected (pilot->name);
 				}				
 			}
 		}
+		gpilot_trace (pfd, GPILOT_TRACE_SESSION_END, 0, synced);
+		session = gpilot_sync_stats_end (pfd, synced);
+		if (session != NULL)
+			gpilot_sync_history_append (session);
 		pilot_disconnect (pfd);
+		gpilot_dlp_profile_end (pfd);
 		/* now restart the listener.  fairly brute force
 		 * approach, but ensures we re-initialise the listening
 		 * socket correctly.  */
@@ -1554,9 +1589,12 @@ gpilot_daemon_reread_config (GpilotDaemon   *daemon,
         priv = daemon->priv;
 
         g_message (_("Shutting down devices"));
+        gpilot_stop_watches (&priv->watches);
         gpilot_context_free (priv->gpilotd_context);
         g_message (_("Rereading configuration..."));
         gpilot_context_init_user (priv->gpilotd_context);
+        gpilot_start_watches (priv->gpilotd_context, &priv->watches);
+        gpilot_dlp_profile_set_enabled (priv->gpilotd_context->profile_dlp);
         g_list_foreach (priv->gpilotd_context->devices, (GFunc)monitor_channel, priv->gpilotd_context);
 
         return TRUE;
@@ -2204,6 +2242,242 @@ gpilot_daemon_get_databases_from_cache (GpilotDaemon   *daemon,
         return TRUE;
 }
 
+/* Example:
+dbus-send --session --dest=org.gnome.GnomePilot \
+--type=method_call --print-reply \
+/org/gnome/GnomePilot/Daemon \
+org.gnome.GnomePilot.Daemon.GetSyncStats \
+uint32:5
+*/
+gboolean
+gpilot_daemon_get_sync_stats (GpilotDaemon   *daemon,
+                              guint           count,
+                              GVariant      **sessions,
+                              GError        **error)
+{
+        GVariantBuilder builder;
+        GList *iterator;
+        guint n = 0;
+
+        g_return_val_if_fail (GPILOT_IS_DAEMON (daemon), FALSE);
+
+        LOG (("get_sync_stats(...)"));
+
+        if (sessions == NULL)
+                return FALSE;
+
+        g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(sttba(sstut))"));
+        for (iterator = gpilot_sync_stats_get_history ();
+             iterator != NULL && (count == 0 || n < count);
+             iterator = g_list_next (iterator), n++) {
+                GPilotSyncSession *session = iterator->data;
+                guint i;
+
+                g_variant_builder_open (&builder, G_VARIANT_TYPE ("(sttba(sstut))"));
+                g_variant_builder_add (&builder, "s", session->pilot_name ? session->pilot_name : "");
+                g_variant_builder_add (&builder, "t", (guint64) session->started);
+                g_variant_builder_add (&builder, "t", (guint64) session->usecs);
+                g_variant_builder_add (&builder, "b", session->completed);
+                g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(sstut)"));
+                for (i = 0; i < session->timings->len; i++) {
+                        GPilotSyncTiming *timing = &g_array_index (session->timings, GPilotSyncTiming, i);
+
+                        g_variant_builder_add (&builder, "(sstut)",
+                                               gpilot_sync_phase_to_str (timing->phase),
+                                               timing->name ? timing->name : "",
+                                               (guint64) timing->usecs,
+                                               timing->records,
+                                               timing->bytes);
+                }
+                g_variant_builder_close (&builder);
+                g_variant_builder_close (&builder);
+        }
+        *sessions = g_variant_ref_sink (g_variant_builder_end (&builder));
+
+        return TRUE;
+}
+
+/* Example:
+dbus-send --session --dest=org.gnome.GnomePilot \
+--type=method_call --print-reply \
+/org/gnome/GnomePilot/Daemon \
+org.gnome.GnomePilot.Daemon.GetDlpProfile
+*/
+gboolean
+gpilot_daemon_get_dlp_profile (GpilotDaemon   *daemon,
+                               gboolean       *enabled,
+                               GVariant      **calls,
+                               GError        **error)
+{
+        g_return_val_if_fail (GPILOT_IS_DAEMON (daemon), FALSE);
+
+        LOG (("get_dlp_profile(...)"));
+
+        if (enabled == NULL || calls == NULL)
+                return FALSE;
+
+        *enabled = gpilot_dlp_profile_get_enabled ();
+        *calls = g_variant_ref_sink (gpilot_dlp_profile_get_last ());
+
+        return TRUE;
+}
+
+/* Example:
+dbus-send --session --dest=org.gnome.GnomePilot \
+--type=method_call --print-reply \
+/org/gnome/GnomePilot/Daemon \
+org.gnome.GnomePilot.Daemon.GetSyncHistory \
+string:"MyPilot" uint32:20
+*/
+gboolean
+gpilot_daemon_get_sync_history (GpilotDaemon   *daemon,
+                                const char     *pilot_name,
+                                guint           count,
+                                GVariant      **sessions,
+                                GError        **error)
+{
+        guint32 pilot_id = 0;
+
+        g_return_val_if_fail (GPILOT_IS_DAEMON (daemon), FALSE);
+
+        LOG (("get_sync_history(...)"));
+
+        if (sessions == NULL)
+                return FALSE;
+
+        if (pilot_name != NULL && pilot_name[0] != '\0') {
+                pilot_id = pilot_id_from_name (pilot_name,
+                                               daemon->priv->gpilotd_context);
+                if (pilot_id == 0) {
+                        g_set_error (error,
+                                     GPILOT_DAEMON_ERROR,
+                                     GPILOT_DAEMON_ERROR_GENERAL,
+                                     "Unknown pilot %s",
+                                     pilot_name);
+                        return FALSE;
+                }
+        }
+
+        *sessions = g_variant_ref_sink (gpilot_sync_history_query (pilot_id, count));
+
+        return TRUE;
+}
+
+/* Example:
+dbus-send --session --dest=org.gnome.GnomePilot \
+--type=method_call --print-reply \
+/org/gnome/GnomePilot/Daemon \
+org.gnome.GnomePilot.Daemon.GetTrace \
+uint32:100
+*/
+gboolean
+gpilot_daemon_get_trace (GpilotDaemon   *daemon,
+                         guint           count,
+                         GVariant      **events,
+                         GVariant      **counters,
+                         GError        **error)
+{
+        g_return_val_if_fail (GPILOT_IS_DAEMON (daemon), FALSE);
+
+        LOG (("get_trace(...)"));
+
+        if (events == NULL || counters == NULL)
+                return FALSE;
+
+        gpilot_trace_dump (count, events, counters);
+        g_variant_ref_sink (*events);
+        g_variant_ref_sink (*counters);
+
+        return TRUE;
+}
+
+static gboolean
+handle_get_sync_stats (GpilotDaemonDaemon    *skeleton,
+                       GDBusMethodInvocation *invocation,
+                       guint                  count,
+                       GpilotDaemon          *daemon)
+{
+        GVariant *sessions = NULL;
+        GError *error = NULL;
+
+        if (!gpilot_daemon_get_sync_stats (daemon, count, &sessions, &error)) {
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                g_error_free (error);
+                return TRUE;
+        }
+
+        gpilot_daemon_daemon_complete_get_sync_stats (skeleton, invocation, sessions);
+        g_variant_unref (sessions);
+
+        return TRUE;
+}
+
+static gboolean
+handle_get_dlp_profile (GpilotDaemonDaemon    *skeleton,
+                        GDBusMethodInvocation *invocation,
+                        GpilotDaemon          *daemon)
+{
+        gboolean enabled = FALSE;
+        GVariant *calls = NULL;
+        GError *error = NULL;
+
+        if (!gpilot_daemon_get_dlp_profile (daemon, &enabled, &calls, &error)) {
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                g_error_free (error);
+                return TRUE;
+        }
+
+        gpilot_daemon_daemon_complete_get_dlp_profile (skeleton, invocation, enabled, calls);
+        g_variant_unref (calls);
+
+        return TRUE;
+}
+
+static gboolean
+handle_get_sync_history (GpilotDaemonDaemon    *skeleton,
+                         GDBusMethodInvocation *invocation,
+                         const gchar           *pilot_name,
+                         guint                  count,
+                         GpilotDaemon          *daemon)
+{
+        GVariant *sessions = NULL;
+        GError *error = NULL;
+
+        if (!gpilot_daemon_get_sync_history (daemon, pilot_name, count, &sessions, &error)) {
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                g_error_free (error);
+                return TRUE;
+        }
+
+        gpilot_daemon_daemon_complete_get_sync_history (skeleton, invocation, sessions);
+        g_variant_unref (sessions);
+
+        return TRUE;
+}
+
+static gboolean
+handle_get_trace (GpilotDaemonDaemon    *skeleton,
+                  GDBusMethodInvocation *invocation,
+                  guint                  count,
+                  GpilotDaemon          *daemon)
+{
+        GVariant *events = NULL;
+        GVariant *counters = NULL;
+        GError *error = NULL;
+
+        if (!gpilot_daemon_get_trace (daemon, count, &events, &counters, &error)) {
+                g_dbus_method_invocation_return_gerror (invocation, error);
+                g_error_free (error);
+                return TRUE;
+        }
+
+        gpilot_daemon_daemon_complete_get_trace (skeleton, invocation, events, counters);
+        g_variant_unref (events);
+        g_variant_unref (counters);
+
+        return TRUE;
+}
+
 /* admin operations */
 /* Example:
 dbus-send --session --dest=org.gnome.GnomePilot \
@@ -2285,6 +2559,127 @@ gpilot_daemon_set_user_info (GpilotDaemon   *daemon,
         return ret;
 }
 
+/* ConduitProgress signals are coalesced per pilot. Within
+   notify_interval msec only the latest progress is kept; it is sent
+   by the next progress update due, or right before any other signal
+   for the pilot. Conduits report progress from the sync, which holds
+   the main loop, so nothing is sent from a timeout. */
+typedef struct {
+        gint64   last_sent;
+        gchar   *progress_conduit;
+        guint32  progress_current;
+        guint32  progress_total;
+} NotifyThrottle;
+
+static GHashTable *notify_throttles = NULL; /* pilot_id -> NotifyThrottle */
+static gint64 notify_interval = 0;
+
+static void
+notify_throttle_free (NotifyThrottle *throttle)
+{
+        g_free (throttle->progress_conduit);
+        g_free (throttle);
+}
+
+void
+dbus_notify_set_interval (gint msec)
+{
+        notify_interval = (gint64) MAX (msec, 0) * 1000;
+}
+
+static gchar *
+dbus_notify_conduit_name (GnomePilotConduit *conduit)
+{
+        gchar *name = NULL;
+
+        if (GNOME_IS_PILOT_CONDUIT (conduit))
+                name = gnome_pilot_conduit_get_name (conduit);
+        if (name == NULL)
+                name = g_strdup ("");
+
+        return name;
+}
+
+static void
+dbus_emit_conduit_progress (const gchar *pilot_id,
+                            const gchar *name,
+                            guint32      current,
+                            guint32      total)
+{
+        g_dbus_connection_emit_signal (gdbus_connection, NULL,
+                                       GP_DBUS_PATH, GP_DBUS_INTERFACE,
+                                       "ConduitProgress",
+                                       g_variant_new ("(ssuu)", pilot_id, name,
+                                                      current, total),
+                                       NULL);
+}
+
+static void
+dbus_emit_message (const gchar *pilot_id,
+                   const gchar *name,
+                   const gchar *msg,
+                   const gchar *signal_name)
+{
+        g_dbus_connection_emit_signal (gdbus_connection, NULL,
+                                       GP_DBUS_PATH, GP_DBUS_INTERFACE,
+                                       signal_name,
+                                       g_variant_new ("(sss)", pilot_id,
+                                                      IS_STR_SET (name) ? name : "",
+                                                      msg),
+                                       NULL);
+}
+
+static NotifyThrottle *
+dbus_notify_get_throttle (const gchar *pilot_id)
+{
+        NotifyThrottle *throttle;
+
+        if (notify_throttles == NULL)
+                notify_throttles = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                          g_free,
+                                                          (GDestroyNotify) notify_throttle_free);
+
+        throttle = g_hash_table_lookup (notify_throttles, pilot_id);
+        if (throttle == NULL) {
+                throttle = g_new0 (NotifyThrottle, 1);
+                g_hash_table_insert (notify_throttles, g_strdup (pilot_id), throttle);
+        }
+
+        return throttle;
+}
+
+/* send the progress being held back for pilot_id, if any */
+static void
+dbus_notify_flush (const gchar *pilot_id)
+{
+        NotifyThrottle *throttle;
+
+        if (notify_throttles == NULL || pilot_id == NULL) return;
+        throttle = g_hash_table_lookup (notify_throttles, pilot_id);
+        if (throttle == NULL || throttle->progress_conduit == NULL) return;
+
+        dbus_emit_conduit_progress (pilot_id, throttle->progress_conduit,
+                                    throttle->progress_current,
+                                    throttle->progress_total);
+        g_free (throttle->progress_conduit);
+        throttle->progress_conduit = NULL;
+        throttle->last_sent = g_get_monotonic_time ();
+}
+
+static void
+dbus_notify_flush_one (gpointer pilot_id, gpointer throttle, gpointer unused)
+{
+        dbus_notify_flush (pilot_id);
+}
+
+/* requests only know their cradle, not the pilot synced on it */
+static void
+dbus_notify_flush_all (void)
+{
+        if (notify_throttles != NULL)
+                g_hash_table_foreach (notify_throttles, dbus_notify_flush_one, NULL);
+}
+
 void
 dbus_notify_connected (const gchar     *pilot_id,
                        struct PilotUser user_info)
@@ -2307,6 +2702,11 @@ void
 dbus_notify_disconnected (const gchar *pilot_id)
 {
         if (gdbus_connection == NULL) return;
+
+        dbus_notify_flush (pilot_id);
+        if (notify_throttles != NULL)
+                g_hash_table_remove (notify_throttles, pilot_id);
+
         g_dbus_connection_emit_signal (gdbus_connection, NULL,
                                        GP_DBUS_PATH, GP_DBUS_INTERFACE,
                                        "Disconnected",
@@ -2324,6 +2724,7 @@ dbus_notify_completion (GPilotRequest **req)
         if (gdbus_connection == NULL) return;
 
         pilot_name = ((*req)->cradle) ? g_strdup ((*req)->cradle) : g_strdup ("");
+        dbus_notify_flush_all ();
         g_dbus_connection_emit_signal (gdbus_connection, NULL,
                                        GP_DBUS_PATH, GP_DBUS_INTERFACE,
                                        "RequestCompleted",
@@ -2389,6 +2790,8 @@ dbus_notify_conduit_start (const gchar              *pilot_id,
 
         if (gdbus_connection == NULL) return;
 
+        dbus_notify_flush (pilot_id);
+
         name = gnome_pilot_conduit_get_name (conduit);
         if (GNOME_IS_PILOT_CONDUIT_STANDARD (conduit))
                 database = g_strdup (gnome_pilot_conduit_standard_get_db_name (GNOME_PILOT_CONDUIT_STANDARD (conduit)));
@@ -2411,6 +2814,8 @@ dbus_notify_conduit_end (const gchar       *pilot_id,
         gchar *name;
         if (gdbus_connection == NULL) return;
 
+        dbus_notify_flush (pilot_id);
+
         name = gnome_pilot_conduit_get_name (conduit);
         g_dbus_connection_emit_signal (gdbus_connection, NULL,
                                        GP_DBUS_PATH, GP_DBUS_INTERFACE,
@@ -2426,17 +2831,29 @@ dbus_notify_conduit_progress (const gchar       *pilot_id,
                               guint32            current,
                               guint32            total)
 {
+        NotifyThrottle *throttle;
         gchar *name;
+        gint64 now;
         if (gdbus_connection == NULL) return;
 
-        name = gnome_pilot_conduit_get_name (conduit);
-        g_dbus_connection_emit_signal (gdbus_connection, NULL,
-                                       GP_DBUS_PATH, GP_DBUS_INTERFACE,
-                                       "ConduitProgress",
-                                       g_variant_new ("(ssuu)", pilot_id, name,
-                                                      current, total),
-                                       NULL);
-        g_free (name);
+        throttle = dbus_notify_get_throttle (pilot_id);
+        name = dbus_notify_conduit_name (conduit);
+        now = g_get_monotonic_time ();
+
+        /* the final step is always sent, so clients never get stuck
+           short of 100%; it supersedes anything held back */
+        if (current >= total || now - throttle->last_sent >= notify_interval) {
+                g_free (throttle->progress_conduit);
+                throttle->progress_conduit = NULL;
+                dbus_emit_conduit_progress (pilot_id, name, current, total);
+                throttle->last_sent = now;
+                g_free (name);
+        } else {
+                g_free (throttle->progress_conduit);
+                throttle->progress_conduit = name;
+                throttle->progress_current = current;
+                throttle->progress_total = total;
+        }
 }
 
 void
@@ -2445,6 +2862,8 @@ dbus_notify_overall_progress (const gchar    *pilot_id,
                               guint32         total)
 {
         if (gdbus_connection == NULL) return;
+
+        dbus_notify_flush (pilot_id);
         g_dbus_connection_emit_signal (gdbus_connection, NULL,
                                        GP_DBUS_PATH, GP_DBUS_INTERFACE,
                                        "OverallProgress",
@@ -2462,18 +2881,9 @@ dbus_notify_message (const gchar       *pilot_id,
         gchar *name;
         if (gdbus_connection == NULL) return;
 
-        if (GNOME_IS_PILOT_CONDUIT (conduit))
-                name = gnome_pilot_conduit_get_name (conduit);
-        else
-                name = g_strdup ("");
-
-        g_dbus_connection_emit_signal (gdbus_connection, NULL,
-                                       GP_DBUS_PATH, GP_DBUS_INTERFACE,
-                                       signal_name,
-                                       g_variant_new ("(sss)", pilot_id,
-                                                      IS_STR_SET (name) ? name : "",
-                                                      msg),
-                                       NULL);
+        dbus_notify_flush (pilot_id);
+        name = dbus_notify_conduit_name (conduit);
+        dbus_emit_message (pilot_id, name, msg, signal_name);
         g_free (name);
 }
 
@@ -2525,7 +2935,30 @@ register_daemon (GpilotDaemon *daemon)
         /* Store globally for signal emission from static functions */
         gdbus_connection = daemon->priv->connection;
 
-        /* TODO: register D-Bus interface using gdbus-codegen generated skeleton */
+        /* Only the methods with a handle-* handler below are served
+           over the skeleton, the others are answered as not implemented */
+        daemon->priv->skeleton = gpilot_daemon_daemon_skeleton_new ();
+        g_signal_connect (daemon->priv->skeleton, "handle-get-sync-stats",
+                          G_CALLBACK (handle_get_sync_stats), daemon);
+
+        g_signal_connect (daemon->priv->skeleton, "handle-get-dlp-profile",
+                          G_CALLBACK (handle_get_dlp_profile), daemon);
+
+        g_signal_connect (daemon->priv->skeleton, "handle-get-sync-history",
+                          G_CALLBACK (handle_get_sync_history), daemon);
+
+        g_signal_connect (daemon->priv->skeleton, "handle-get-trace",
+                          G_CALLBACK (handle_get_trace), daemon);
+
+        if (!g_dbus_interface_skeleton_export (G_DBUS_INTERFACE_SKELETON (daemon->priv->skeleton),
+                                               daemon->priv->connection,
+                                               GP_DBUS_PATH,
+                                               &error)) {
+                g_critical ("error exporting %s: %s", GP_DBUS_PATH, error->message);
+                g_error_free (error);
+                g_clear_object (&daemon->priv->skeleton);
+                return FALSE;
+        }
 
         return TRUE;
 }
@@ -2719,6 +3152,9 @@ gpilot_daemon_init (GpilotDaemon *daemon)
 
         daemon->priv->gpilotd_context = gpilot_context_new ();
         gpilot_context_init_user (daemon->priv->gpilotd_context);
+        gpilot_start_watches (daemon->priv->gpilotd_context, &daemon->priv->watches);
+        dbus_notify_set_interval (daemon->priv->gpilotd_context->notify_interval);
+        gpilot_dlp_profile_set_enabled (daemon->priv->gpilotd_context->profile_dlp);
 
         g_list_foreach (daemon->priv->gpilotd_context->devices,
                         (GFunc)monitor_channel,
@@ -2737,6 +3173,14 @@ gpilot_daemon_finalize (GObject *object)
 
         g_return_if_fail (daemon->priv != NULL);
 
+        gpilot_stop_watches (&daemon->priv->watches);
+        gpilot_sync_history_close ();
+
+        if (daemon->priv->skeleton != NULL) {
+                g_dbus_interface_skeleton_unexport (G_DBUS_INTERFACE_SKELETON (daemon->priv->skeleton));
+                g_object_unref (daemon->priv->skeleton);
+        }
+
         if (daemon->priv->connection != NULL) {
                 g_object_unref (daemon->priv->connection);
                 gdbus_connection = NULL;
@@ -250,6 +250,24 @@ gboolean        gpilot_daemon_get_databases_from_cache
                                                  const char     *pilot_name,
                                                  char         ***databases,
                                                  GError        **error);
+gboolean        gpilot_daemon_get_sync_stats    (GpilotDaemon   *daemon,
+                                                 guint           count,
+                                                 GVariant      **sessions,
+                                                 GError        **error);
+gboolean        gpilot_daemon_get_dlp_profile   (GpilotDaemon   *daemon,
+                                                 gboolean       *enabled,
+                                                 GVariant      **calls,
+                                                 GError        **error);
+gboolean        gpilot_daemon_get_sync_history (GpilotDaemon   *daemon,
+                                                 const char     *pilot_name,
+                                                 guint           count,
+                                                 GVariant      **sessions,
+                                                 GError        **error);
+gboolean        gpilot_daemon_get_trace         (GpilotDaemon   *daemon,
+                                                 guint           count,
+                                                 GVariant      **events,
+                                                 GVariant      **counters,
+                                                 GError        **error);
 /* admin operations */
 gboolean        gpilot_daemon_get_user_info     (GpilotDaemon   *daemon,
                                                  const char     *cradle,
@@ -273,6 +291,7 @@ gchar*          pilot_name_from_id              (guint32         id,
                                                  GPilotContext  *context);
 
 /* send dbus signals */
+void            dbus_notify_set_interval        (gint            msec);
 void            dbus_notify_connected           (const gchar    *pilot_id,
                                                  struct PilotUser user_info);
 void            dbus_notify_disconnected        (const gchar    *pilot_id);
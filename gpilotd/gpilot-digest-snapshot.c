@@ -0,0 +1,273 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-digest-snapshot: record digests kept between syncs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <string.h>
+#include <glib/gstdio.h>
+#include "gpilot-digest-snapshot.h"
+#include "gnome-pilot-config.h"
+
+#define SNAPSHOT_MAGIC   0x47504453 /* GPDS */
+#define SNAPSHOT_VERSION 1
+
+struct _GPilotDigestSnapshot {
+	gchar *filename;
+	GHashTable *base;    /* recordid_t -> guint64, as loaded */
+	GHashTable *current; /* recordid_t -> guint64, being collected */
+	gboolean has_base;
+	gboolean complete;
+};
+
+typedef struct {
+	guint32 id;
+	guint32 reserved;
+	guint64 digest;
+} SnapshotEntry;
+
+static GHashTable *
+snapshot_table_new (void)
+{
+	return g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+}
+
+static void
+snapshot_table_insert (GHashTable *table, recordid_t id, guint64 digest)
+{
+	guint64 *value = g_new (guint64, 1);
+
+	*value = digest;
+	g_hash_table_replace (table, GUINT_TO_POINTER (id), value);
+}
+
+GPilotDigestSnapshot *
+gpilot_digest_snapshot_load (guint32 pilot_id,
+			     const gchar *db_name,
+			     guint32 pc_id)
+{
+	GPilotDigestSnapshot *snapshot;
+	gchar *name, *contents = NULL;
+	gsize length = 0;
+	guint32 *header;
+	SnapshotEntry *entries;
+	guint32 i, count;
+
+	snapshot = g_new0 (GPilotDigestSnapshot, 1);
+	snapshot->base = snapshot_table_new ();
+
+	name = g_strdup_printf ("%u-%u-%s", pilot_id, pc_id, db_name);
+	g_strdelimit (name, "/\\", '_');
+	snapshot->filename = get_gpilotd_data_file ("digests", name);
+	g_free (name);
+
+	if (!g_file_get_contents (snapshot->filename, &contents, &length, NULL))
+		return snapshot;
+
+	header = (guint32 *) contents;
+	if (length < 3 * sizeof (guint32)
+	    || GUINT32_FROM_LE (header[0]) != SNAPSHOT_MAGIC
+	    || GUINT32_FROM_LE (header[1]) != SNAPSHOT_VERSION) {
+		g_warning ("Ignoring invalid record digest snapshot %s", snapshot->filename);
+		g_free (contents);
+		return snapshot;
+	}
+
+	count = GUINT32_FROM_LE (header[2]);
+	if (length != 3 * sizeof (guint32) + count * sizeof (SnapshotEntry)) {
+		g_warning ("Ignoring truncated record digest snapshot %s", snapshot->filename);
+		g_free (contents);
+		return snapshot;
+	}
+
+	entries = (SnapshotEntry *) (header + 3);
+	for (i = 0; i < count; i++)
+		snapshot_table_insert (snapshot->base,
+				       GUINT32_FROM_LE (entries[i].id),
+				       GUINT64_FROM_LE (entries[i].digest));
+
+	snapshot->has_base = TRUE;
+	g_free (contents);
+
+	return snapshot;
+}
+
+void
+gpilot_digest_snapshot_free (GPilotDigestSnapshot *snapshot)
+{
+	if (snapshot == NULL)
+		return;
+
+	g_hash_table_destroy (snapshot->base);
+	if (snapshot->current)
+		g_hash_table_destroy (snapshot->current);
+	g_free (snapshot->filename);
+	g_free (snapshot);
+}
+
+gboolean
+gpilot_digest_snapshot_has_base (GPilotDigestSnapshot *snapshot)
+{
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+
+	return snapshot->has_base;
+}
+
+gboolean
+gpilot_digest_snapshot_lookup (GPilotDigestSnapshot *snapshot,
+			       recordid_t id,
+			       guint64 *digest)
+{
+	guint64 *value;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+
+	value = g_hash_table_lookup (snapshot->base, GUINT_TO_POINTER (id));
+	if (value == NULL)
+		return FALSE;
+
+	if (digest)
+		*digest = *value;
+	return TRUE;
+}
+
+static void
+copy_entry (gpointer key, gpointer value, gpointer data)
+{
+	snapshot_table_insert ((GHashTable *) data,
+			       GPOINTER_TO_UINT (key), *(guint64 *) value);
+}
+
+void
+gpilot_digest_snapshot_begin (GPilotDigestSnapshot *snapshot,
+			      gboolean complete)
+{
+	g_return_if_fail (snapshot != NULL);
+
+	if (snapshot->current)
+		g_hash_table_destroy (snapshot->current);
+	snapshot->current = snapshot_table_new ();
+
+	/* a partial pass (fast sync) only sees the modified records, the
+	   rest are as they were in the loaded snapshot. Without a loaded
+	   snapshot the result is incomplete and won't be saved. */
+	snapshot->complete = complete || snapshot->has_base;
+	if (!complete)
+		g_hash_table_foreach (snapshot->base, copy_entry, snapshot->current);
+}
+
+void
+gpilot_digest_snapshot_set (GPilotDigestSnapshot *snapshot,
+			    recordid_t id,
+			    guint64 digest)
+{
+	g_return_if_fail (snapshot != NULL);
+
+	if (snapshot->current == NULL || id == 0)
+		return;
+
+	snapshot_table_insert (snapshot->current, id, digest);
+}
+
+void
+gpilot_digest_snapshot_remove (GPilotDigestSnapshot *snapshot,
+			       recordid_t id)
+{
+	g_return_if_fail (snapshot != NULL);
+
+	if (snapshot->current == NULL)
+		return;
+
+	g_hash_table_remove (snapshot->current, GUINT_TO_POINTER (id));
+}
+
+gboolean
+gpilot_digest_snapshot_save (GPilotDigestSnapshot *snapshot)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	guint32 *header;
+	SnapshotEntry *entries;
+	gsize length;
+	guint32 count, i = 0;
+	GError *error = NULL;
+	gboolean retval;
+
+	g_return_val_if_fail (snapshot != NULL, FALSE);
+
+	if (snapshot->current == NULL || !snapshot->complete)
+		return FALSE;
+
+	count = g_hash_table_size (snapshot->current);
+	length = 3 * sizeof (guint32) + count * sizeof (SnapshotEntry);
+	header = g_malloc0 (length);
+	header[0] = GUINT32_TO_LE (SNAPSHOT_MAGIC);
+	header[1] = GUINT32_TO_LE (SNAPSHOT_VERSION);
+	header[2] = GUINT32_TO_LE (count);
+
+	entries = (SnapshotEntry *) (header + 3);
+	g_hash_table_iter_init (&iter, snapshot->current);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		entries[i].id = GUINT32_TO_LE (GPOINTER_TO_UINT (key));
+		entries[i].digest = GUINT64_TO_LE (*(guint64 *) value);
+		i++;
+	}
+
+	retval = g_file_set_contents (snapshot->filename, (gchar *) header, length, &error);
+	if (!retval) {
+		g_warning ("Could not write record digest snapshot: %s", error->message);
+		g_error_free (error);
+	}
+	g_free (header);
+
+	return retval;
+}
+
+void
+gpilot_digest_snapshot_discard (GPilotDigestSnapshot *snapshot)
+{
+	g_return_if_fail (snapshot != NULL);
+
+	g_unlink (snapshot->filename);
+	if (snapshot->current) {
+		g_hash_table_destroy (snapshot->current);
+		snapshot->current = NULL;
+	}
+}
+
+/* 64 bit FNV-1a over the record contents and the attributes a user
+   can change on the pilot without touching the contents */
+guint64
+gpilot_record_digest (const guchar *buffer,
+		      gint length,
+		      gint category,
+		      gint flags)
+{
+	guint64 hash = G_GUINT64_CONSTANT (0xcbf29ce484222325);
+	const guint64 prime = G_GUINT64_CONSTANT (0x100000001b3);
+	gint i;
+
+	hash = (hash ^ (guchar) category) * prime;
+	hash = (hash ^ (guchar) (flags & (dlpRecAttrSecret | dlpRecAttrArchived))) * prime;
+
+	for (i = 0; i < length; i++)
+		hash = (hash ^ buffer[i]) * prime;
+
+	return hash;
+}
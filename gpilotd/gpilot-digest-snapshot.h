@@ -0,0 +1,73 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-digest-snapshot: record digests kept between syncs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_DIGEST_SNAPSHOT_H_
+#define _GPILOT_DIGEST_SNAPSHOT_H_
+#include <glib.h>
+#include <pi-dlp.h>
+
+/* A snapshot of the record ids and content digests of one database
+   on one pilot, as this host (sync_PC_Id) last saw them. When the
+   pilot has synced with another host in between, comparing digests
+   tells which records were changed there without asking the conduit
+   to compare every single record. */
+typedef struct _GPilotDigestSnapshot GPilotDigestSnapshot;
+
+/* Loads the snapshot for (pilot_id, db_name, pc_id). Always returns
+   a snapshot, gpilot_digest_snapshot_has_base tells if anything was
+   on disk. */
+GPilotDigestSnapshot *gpilot_digest_snapshot_load (guint32 pilot_id,
+						   const gchar *db_name,
+						   guint32 pc_id);
+void gpilot_digest_snapshot_free (GPilotDigestSnapshot *snapshot);
+
+gboolean gpilot_digest_snapshot_has_base (GPilotDigestSnapshot *snapshot);
+
+/* Look up the digest recorded for id in the snapshot loaded from disk */
+gboolean gpilot_digest_snapshot_lookup (GPilotDigestSnapshot *snapshot,
+					recordid_t id,
+					guint64 *digest);
+
+/* Start collecting the digests for the next snapshot. If complete is
+   TRUE every record of the database is going to be seen, so the new
+   snapshot starts out empty, otherwise it starts from the loaded one */
+void gpilot_digest_snapshot_begin (GPilotDigestSnapshot *snapshot,
+				   gboolean complete);
+void gpilot_digest_snapshot_set (GPilotDigestSnapshot *snapshot,
+				 recordid_t id,
+				 guint64 digest);
+void gpilot_digest_snapshot_remove (GPilotDigestSnapshot *snapshot,
+				    recordid_t id);
+
+/* Write the collected digests to disk. Does nothing unless the
+   collected snapshot is known to cover the whole database. */
+gboolean gpilot_digest_snapshot_save (GPilotDigestSnapshot *snapshot);
+
+/* Remove the snapshot from disk, eg. after a failed sync */
+void gpilot_digest_snapshot_discard (GPilotDigestSnapshot *snapshot);
+
+guint64 gpilot_record_digest (const guchar *buffer,
+			      gint length,
+			      gint category,
+			      gint flags);
+
+#endif /* _GPILOT_DIGEST_SNAPSHOT_H_ */
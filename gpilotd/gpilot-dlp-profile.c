@@ -0,0 +1,655 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-dlp-profile: DLP call profiling, per call and per database.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <config.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <glib.h>
+#include <pi-dlp.h>
+#include "gpilot-dlp-profile.h"
+
+typedef struct {
+	const gchar *call;
+	gchar *db;
+	guint count;
+	guint errors;
+	guint64 usecs;
+	guint64 bytes;
+	guint histogram[GPILOT_DLP_PROFILE_BUCKETS];
+} GPilotDlpStat;
+
+static gboolean profiling = FALSE;
+
+/* pilot_socket -> "call\tdb" -> GPilotDlpStat, for running syncs */
+static GHashTable *profiles = NULL;
+/* (pilot_socket, db handle) -> database name */
+static GHashTable *open_dbs = NULL;
+/* GPilotDlpStats of the last finished sync */
+static GPtrArray *last = NULL;
+
+#define DB_KEY(sd, handle) GINT_TO_POINTER (((sd) << 8) | ((handle) & 0xff))
+
+static void
+gpilot_dlp_stat_free (GPilotDlpStat *stat)
+{
+	g_free (stat->db);
+	g_free (stat);
+}
+
+void
+gpilot_dlp_profile_set_enabled (gboolean enabled)
+{
+	profiling = enabled;
+}
+
+gboolean
+gpilot_dlp_profile_get_enabled (void)
+{
+	return profiling;
+}
+
+static const gchar *
+db_name (int sd, int handle)
+{
+	const gchar *name = NULL;
+
+	if (open_dbs != NULL)
+		name = g_hash_table_lookup (open_dbs, DB_KEY (sd, handle));
+
+	return name ? name : "";
+}
+
+static void
+db_opened (int sd, int handle, const char *name)
+{
+	if (open_dbs == NULL)
+		open_dbs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, g_free);
+
+	g_hash_table_replace (open_dbs, DB_KEY (sd, handle), g_strdup (name));
+}
+
+static void
+db_closed (int sd, int handle)
+{
+	if (open_dbs != NULL)
+		g_hash_table_remove (open_dbs, DB_KEY (sd, handle));
+}
+
+static void
+account (int sd, const gchar *call, const gchar *db, gint64 started, int result, gsize bytes)
+{
+	GHashTable *profile;
+	GPilotDlpStat *stat;
+	gchar *key;
+	guint64 usecs;
+	guint bucket;
+
+	if (profiles == NULL)
+		profiles = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						  NULL, (GDestroyNotify) g_hash_table_destroy);
+
+	profile = g_hash_table_lookup (profiles, GINT_TO_POINTER (sd));
+	if (profile == NULL) {
+		profile = g_hash_table_new_full (g_str_hash, g_str_equal,
+						 g_free, (GDestroyNotify) gpilot_dlp_stat_free);
+		g_hash_table_insert (profiles, GINT_TO_POINTER (sd), profile);
+	}
+
+	key = g_strconcat (call, "\t", db, NULL);
+	stat = g_hash_table_lookup (profile, key);
+	if (stat == NULL) {
+		stat = g_new0 (GPilotDlpStat, 1);
+		stat->call = call;
+		stat->db = g_strdup (db);
+		g_hash_table_insert (profile, key, stat);
+	} else {
+		g_free (key);
+	}
+
+	usecs = g_get_monotonic_time () - started;
+	for (bucket = 0; bucket < GPILOT_DLP_PROFILE_BUCKETS - 1; bucket++) {
+		if (usecs < (128 << bucket))
+			break;
+	}
+
+	stat->count++;
+	if (result < 0)
+		stat->errors++;
+	else
+		stat->bytes += bytes;
+	stat->usecs += usecs;
+	stat->histogram[bucket]++;
+}
+
+static gint
+compare_usecs (gconstpointer a, gconstpointer b)
+{
+	const GPilotDlpStat *sa = *(GPilotDlpStat **) a;
+	const GPilotDlpStat *sb = *(GPilotDlpStat **) b;
+
+	if (sa->usecs == sb->usecs)
+		return 0;
+	return sa->usecs < sb->usecs ? 1 : -1;
+}
+
+void
+gpilot_dlp_profile_end (int pilot_socket)
+{
+	GHashTable *profile = NULL;
+	GHashTableIter iter;
+	gpointer key, value;
+	guint i;
+
+	if (open_dbs != NULL) {
+		g_hash_table_iter_init (&iter, open_dbs);
+		while (g_hash_table_iter_next (&iter, &key, NULL)) {
+			if (GPOINTER_TO_INT (key) >> 8 == pilot_socket)
+				g_hash_table_iter_remove (&iter);
+		}
+	}
+
+	if (profiles != NULL)
+		profile = g_hash_table_lookup (profiles, GINT_TO_POINTER (pilot_socket));
+	if (profile == NULL)
+		return;
+
+	if (last != NULL)
+		g_ptr_array_free (last, TRUE);
+	last = g_ptr_array_new_with_free_func ((GDestroyNotify) gpilot_dlp_stat_free);
+
+	g_hash_table_iter_init (&iter, profile);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		g_ptr_array_add (last, value);
+		g_hash_table_iter_steal (&iter);
+		g_free (key);
+	}
+	g_hash_table_remove (profiles, GINT_TO_POINTER (pilot_socket));
+
+	g_ptr_array_sort (last, compare_usecs);
+	for (i = 0; i < last->len; i++) {
+		GPilotDlpStat *stat = g_ptr_array_index (last, i);
+
+		g_message ("DLP %s%s%s: %u calls, %u failed, %.3fs, %.2fms each, %" G_GUINT64_FORMAT " bytes",
+			   stat->call, *stat->db ? " on " : "", stat->db,
+			   stat->count, stat->errors, stat->usecs / (gdouble) G_USEC_PER_SEC,
+			   stat->usecs / 1000.0 / stat->count, stat->bytes);
+	}
+}
+
+GVariant *
+gpilot_dlp_profile_get_last (void)
+{
+	GVariantBuilder builder;
+	guint i, j;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ssuuttat)"));
+	for (i = 0; last != NULL && i < last->len; i++) {
+		GPilotDlpStat *stat = g_ptr_array_index (last, i);
+
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("(ssuuttat)"));
+		g_variant_builder_add (&builder, "s", stat->db);
+		g_variant_builder_add (&builder, "s", stat->call);
+		g_variant_builder_add (&builder, "u", stat->count);
+		g_variant_builder_add (&builder, "u", stat->errors);
+		g_variant_builder_add (&builder, "t", stat->usecs);
+		g_variant_builder_add (&builder, "t", stat->bytes);
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("at"));
+		for (j = 0; j < GPILOT_DLP_PROFILE_BUCKETS; j++)
+			g_variant_builder_add (&builder, "t", (guint64) stat->histogram[j]);
+		g_variant_builder_close (&builder);
+		g_variant_builder_close (&builder);
+	}
+
+	return g_variant_builder_end (&builder);
+}
+
+/* The wrappers. REAL (f) is pilot-link's f, looked up on first use. */
+
+static gpointer
+real_symbol (const gchar *name)
+{
+	gpointer symbol;
+
+	symbol = dlsym (RTLD_NEXT, name);
+	if (symbol == NULL)
+		g_error ("Could not find %s in pilot-link: %s", name, dlerror ());
+
+	return symbol;
+}
+
+#define DECLARE_REAL(f) static __typeof__ (f) *real_##f = NULL
+#define REAL(f) (real_##f ? real_##f : (real_##f = real_symbol (#f)))
+
+#define BUFFER_BYTES(buffer) ((buffer) ? (buffer)->used : 0)
+
+DECLARE_REAL (dlp_ReadSysInfo);
+int
+dlp_ReadSysInfo (int sd, struct SysInfo *sysinfo)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadSysInfo) (sd, sysinfo);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadSysInfo) (sd, sysinfo);
+	account (sd, "ReadSysInfo", "", started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadUserInfo);
+int
+dlp_ReadUserInfo (int sd, struct PilotUser *user)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadUserInfo) (sd, user);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadUserInfo) (sd, user);
+	account (sd, "ReadUserInfo", "", started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_WriteUserInfo);
+int
+dlp_WriteUserInfo (int sd, PI_CONST struct PilotUser *user)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_WriteUserInfo) (sd, user);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_WriteUserInfo) (sd, user);
+	account (sd, "WriteUserInfo", "", started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadStorageInfo);
+int
+dlp_ReadStorageInfo (int sd, int cardno, struct CardInfo *info)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadStorageInfo) (sd, cardno, info);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadStorageInfo) (sd, cardno, info);
+	account (sd, "ReadStorageInfo", "", started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadDBList);
+int
+dlp_ReadDBList (int sd, int cardno, int flags, int start, pi_buffer_t *info)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadDBList) (sd, cardno, flags, start, info);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadDBList) (sd, cardno, flags, start, info);
+	account (sd, "ReadDBList", "", started, result, BUFFER_BYTES (info));
+	return result;
+}
+
+DECLARE_REAL (dlp_OpenDB);
+int
+dlp_OpenDB (int sd, int cardno, int mode, PI_CONST char *name, int *dbhandle)
+{
+	gint64 started;
+	int result;
+
+	/* handles are named even when not profiling, a sync may be
+	   under way when profiling is turned on */
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_OpenDB) (sd, cardno, mode, name, dbhandle);
+	if (result >= 0)
+		db_opened (sd, *dbhandle, name);
+	if (profiling)
+		account (sd, "OpenDB", name, started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_CreateDB);
+int
+dlp_CreateDB (int sd, unsigned long creator, unsigned long type, int cardno,
+	      int flags, unsigned int version, PI_CONST char *name, int *dbhandle)
+{
+	gint64 started;
+	int result;
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_CreateDB) (sd, creator, type, cardno, flags, version, name, dbhandle);
+	if (result >= 0)
+		db_opened (sd, *dbhandle, name);
+	if (profiling)
+		account (sd, "CreateDB", name, started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_CloseDB);
+int
+dlp_CloseDB (int sd, int dbhandle)
+{
+	gint64 started;
+	int result;
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_CloseDB) (sd, dbhandle);
+	if (profiling)
+		account (sd, "CloseDB", db_name (sd, dbhandle), started, result, 0);
+	db_closed (sd, dbhandle);
+	return result;
+}
+
+DECLARE_REAL (dlp_DeleteDB);
+int
+dlp_DeleteDB (int sd, int cardno, PI_CONST char *name)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_DeleteDB) (sd, cardno, name);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_DeleteDB) (sd, cardno, name);
+	account (sd, "DeleteDB", name, started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadOpenDBInfo);
+int
+dlp_ReadOpenDBInfo (int sd, int dbhandle, int *records)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadOpenDBInfo) (sd, dbhandle, records);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadOpenDBInfo) (sd, dbhandle, records);
+	account (sd, "ReadOpenDBInfo", db_name (sd, dbhandle), started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadAppBlock);
+int
+dlp_ReadAppBlock (int sd, int dbhandle, int offset, int reqbytes, pi_buffer_t *retbuf)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadAppBlock) (sd, dbhandle, offset, reqbytes, retbuf);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadAppBlock) (sd, dbhandle, offset, reqbytes, retbuf);
+	account (sd, "ReadAppBlock", db_name (sd, dbhandle), started, result, BUFFER_BYTES (retbuf));
+	return result;
+}
+
+DECLARE_REAL (dlp_WriteAppBlock);
+int
+dlp_WriteAppBlock (int sd, int dbhandle, PI_CONST void *databuf, size_t datasize)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_WriteAppBlock) (sd, dbhandle, databuf, datasize);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_WriteAppBlock) (sd, dbhandle, databuf, datasize);
+	account (sd, "WriteAppBlock", db_name (sd, dbhandle), started, result, datasize);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadRecordById);
+int
+dlp_ReadRecordById (int sd, int dbhandle, recordid_t id, pi_buffer_t *retbuf,
+		    int *recindex, int *recattrs, int *category)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadRecordById) (sd, dbhandle, id, retbuf, recindex, recattrs, category);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadRecordById) (sd, dbhandle, id, retbuf, recindex, recattrs, category);
+	account (sd, "ReadRecordById", db_name (sd, dbhandle), started, result, BUFFER_BYTES (retbuf));
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadRecordByIndex);
+int
+dlp_ReadRecordByIndex (int sd, int dbhandle, int recindex, pi_buffer_t *retbuf,
+		       recordid_t *recuid, int *recattrs, int *category)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadRecordByIndex) (sd, dbhandle, recindex, retbuf, recuid, recattrs, category);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadRecordByIndex) (sd, dbhandle, recindex, retbuf, recuid, recattrs, category);
+	account (sd, "ReadRecordByIndex", db_name (sd, dbhandle), started, result, BUFFER_BYTES (retbuf));
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadNextModifiedRec);
+int
+dlp_ReadNextModifiedRec (int sd, int dbhandle, pi_buffer_t *retbuf, recordid_t *recuid,
+			 int *recindex, int *recattrs, int *category)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadNextModifiedRec) (sd, dbhandle, retbuf, recuid, recindex, recattrs, category);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadNextModifiedRec) (sd, dbhandle, retbuf, recuid, recindex, recattrs, category);
+	account (sd, "ReadNextModifiedRec", db_name (sd, dbhandle), started, result, BUFFER_BYTES (retbuf));
+	return result;
+}
+
+DECLARE_REAL (dlp_WriteRecord);
+int
+dlp_WriteRecord (int sd, int dbhandle, int flags, recordid_t recuid, int catid,
+		 PI_CONST void *databuf, size_t datasize, recordid_t *newrecuid)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_WriteRecord) (sd, dbhandle, flags, recuid, catid, databuf, datasize, newrecuid);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_WriteRecord) (sd, dbhandle, flags, recuid, catid, databuf, datasize, newrecuid);
+	/* (size_t) -1 asks pilot-link to write a string with its NUL */
+	account (sd, "WriteRecord", db_name (sd, dbhandle), started, result,
+		 datasize == (size_t) -1 ? strlen (databuf) + 1 : datasize);
+	return result;
+}
+
+DECLARE_REAL (dlp_DeleteRecord);
+int
+dlp_DeleteRecord (int sd, int dbhandle, int all, recordid_t recuid)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_DeleteRecord) (sd, dbhandle, all, recuid);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_DeleteRecord) (sd, dbhandle, all, recuid);
+	account (sd, "DeleteRecord", db_name (sd, dbhandle), started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ReadResourceByIndex);
+int
+dlp_ReadResourceByIndex (int sd, int dbhandle, unsigned int resindex, pi_buffer_t *retbuf,
+			 unsigned long *restype, int *resid)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ReadResourceByIndex) (sd, dbhandle, resindex, retbuf, restype, resid);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ReadResourceByIndex) (sd, dbhandle, resindex, retbuf, restype, resid);
+	account (sd, "ReadResourceByIndex", db_name (sd, dbhandle), started, result, BUFFER_BYTES (retbuf));
+	return result;
+}
+
+DECLARE_REAL (dlp_WriteResource);
+int
+dlp_WriteResource (int sd, int dbhandle, unsigned long type, int resid,
+		   PI_CONST void *databuf, size_t datasize)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_WriteResource) (sd, dbhandle, type, resid, databuf, datasize);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_WriteResource) (sd, dbhandle, type, resid, databuf, datasize);
+	account (sd, "WriteResource", db_name (sd, dbhandle), started, result, datasize);
+	return result;
+}
+
+DECLARE_REAL (dlp_CleanUpDatabase);
+int
+dlp_CleanUpDatabase (int sd, int dbhandle)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_CleanUpDatabase) (sd, dbhandle);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_CleanUpDatabase) (sd, dbhandle);
+	account (sd, "CleanUpDatabase", db_name (sd, dbhandle), started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ResetSyncFlags);
+int
+dlp_ResetSyncFlags (int sd, int dbhandle)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ResetSyncFlags) (sd, dbhandle);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ResetSyncFlags) (sd, dbhandle);
+	account (sd, "ResetSyncFlags", db_name (sd, dbhandle), started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_OpenConduit);
+int
+dlp_OpenConduit (int sd)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_OpenConduit) (sd);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_OpenConduit) (sd);
+	account (sd, "OpenConduit", "", started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_AddSyncLogEntry);
+int
+dlp_AddSyncLogEntry (int sd, char *entry)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_AddSyncLogEntry) (sd, entry);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_AddSyncLogEntry) (sd, entry);
+	account (sd, "AddSyncLogEntry", "", started, result, strlen (entry));
+	return result;
+}
+
+DECLARE_REAL (dlp_EndOfSync);
+int
+dlp_EndOfSync (int sd, int status)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_EndOfSync) (sd, status);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_EndOfSync) (sd, status);
+	account (sd, "EndOfSync", "", started, result, 0);
+	return result;
+}
+
+DECLARE_REAL (dlp_ResetSystem);
+int
+dlp_ResetSystem (int sd)
+{
+	gint64 started;
+	int result;
+
+	if (!profiling)
+		return REAL (dlp_ResetSystem) (sd);
+
+	started = g_get_monotonic_time ();
+	result = REAL (dlp_ResetSystem) (sd);
+	account (sd, "ResetSystem", "", started, result, 0);
+	return result;
+}
@@ -0,0 +1,49 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-dlp-profile: DLP call profiling, per call and per database.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_DLP_PROFILE_H_
+#define _GPILOT_DLP_PROFILE_H_
+#include <glib.h>
+
+/* gpilotd defines the dlp_* functions used during a sync itself and
+   passes them on to pilot-link, so calls made by the conduits and by
+   pilot-link's sync engine go through it as well. While profiling is
+   enabled each call is counted, per call and per database, with its
+   latency and the record data it moved. Disabled, a call costs one
+   extra test. */
+
+/* Latency histogram: bucket 0 is below 128 usec, each next one twice
+   as wide, the last one takes everything above */
+#define GPILOT_DLP_PROFILE_BUCKETS 14
+
+void gpilot_dlp_profile_set_enabled (gboolean enabled);
+gboolean gpilot_dlp_profile_get_enabled (void);
+
+/* Log the calls made on pilot_socket, most expensive first, and keep
+   them as the last profile */
+void gpilot_dlp_profile_end (int pilot_socket);
+
+/* The last profile as "a(ssuuttat)": database, call, count, errors,
+   total usec, bytes and latency histogram. Floating reference. */
+GVariant *gpilot_dlp_profile_get_last (void);
+
+#endif /* _GPILOT_DLP_PROFILE_H_ */
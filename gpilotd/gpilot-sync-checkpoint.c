@@ -0,0 +1,172 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-checkpoint: journal of the databases a sync got through.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include <glib/gi18n.h>
+#include "gpilot-sync-checkpoint.h"
+#include "gnome-pilot-config.h"
+
+#define CHECKPOINT_MAGIC "gpilotd-checkpoint"
+#define CHECKPOINT_VERSION 1
+
+struct _GPilotSyncCheckpoint {
+	gchar *filename;
+	FILE *file;
+	/* db name -> modification date, from the interrupted sync */
+	GHashTable *done;
+};
+
+/* The first line is the header, each next one a database:
+   "<modification date> <name>". Returns FALSE when the file belongs
+   to another sync. */
+static gboolean
+checkpoint_load (GPilotSyncCheckpoint *checkpoint,
+		 guint32 sync_pc_id,
+		 guint32 last_sync_pc,
+		 time_t last_sync_date)
+{
+	gchar *contents = NULL;
+	gchar **lines, *header;
+	gboolean valid;
+	guint i;
+
+	if (!g_file_get_contents (checkpoint->filename, &contents, NULL, NULL))
+		return FALSE;
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	header = g_strdup_printf ("%s %d %u %u %ld", CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+				  sync_pc_id, last_sync_pc, (long) last_sync_date);
+	valid = lines[0] != NULL && strcmp (lines[0], header) == 0;
+	g_free (header);
+
+	for (i = 1; valid && lines[i] != NULL; i++) {
+		gchar *name;
+		glong date;
+
+		date = strtol (lines[i], &name, 10);
+		if (name == lines[i] || *name != ' ')
+			continue;
+		g_hash_table_replace (checkpoint->done, g_strdup (name + 1),
+				      GSIZE_TO_POINTER ((gsize) date));
+	}
+	g_strfreev (lines);
+
+	return valid;
+}
+
+GPilotSyncCheckpoint *
+gpilot_sync_checkpoint_open (guint32 pilot_id,
+			     guint32 sync_pc_id,
+			     guint32 last_sync_pc,
+			     time_t last_sync_date,
+			     guint window)
+{
+	GPilotSyncCheckpoint *checkpoint;
+	gchar *name;
+	struct stat st;
+	gboolean resume = FALSE;
+
+	if (window == 0)
+		return NULL;
+
+	checkpoint = g_new0 (GPilotSyncCheckpoint, 1);
+	name = g_strdup_printf ("%u", pilot_id);
+	checkpoint->filename = get_gpilotd_data_file ("checkpoints", name);
+	g_free (name);
+	checkpoint->done = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+
+	if (g_stat (checkpoint->filename, &st) == 0 &&
+	    time (NULL) - st.st_mtime < (time_t) window)
+		resume = checkpoint_load (checkpoint, sync_pc_id, last_sync_pc, last_sync_date);
+
+	if (resume) {
+		g_message (_("Resuming the interrupted sync, %d databases are done"),
+			   g_hash_table_size (checkpoint->done));
+		checkpoint->file = g_fopen (checkpoint->filename, "a");
+	} else {
+		g_hash_table_remove_all (checkpoint->done);
+		checkpoint->file = g_fopen (checkpoint->filename, "w");
+		if (checkpoint->file != NULL)
+			fprintf (checkpoint->file, "%s %d %u %u %ld\n", CHECKPOINT_MAGIC, CHECKPOINT_VERSION,
+				 sync_pc_id, last_sync_pc, (long) last_sync_date);
+	}
+	if (checkpoint->file == NULL)
+		g_warning ("Could not write sync checkpoint %s: %s",
+			   checkpoint->filename, g_strerror (errno));
+
+	return checkpoint;
+}
+
+gboolean
+gpilot_sync_checkpoint_done (GPilotSyncCheckpoint *checkpoint,
+			     const gchar *db_name,
+			     time_t modify_date)
+{
+	gpointer date;
+
+	if (checkpoint == NULL)
+		return FALSE;
+
+	if (!g_hash_table_lookup_extended (checkpoint->done, db_name, NULL, &date))
+		return FALSE;
+
+	return (time_t) GPOINTER_TO_SIZE (date) == modify_date;
+}
+
+void
+gpilot_sync_checkpoint_mark (GPilotSyncCheckpoint *checkpoint,
+			     const gchar *db_name,
+			     time_t modify_date)
+{
+	if (checkpoint == NULL || checkpoint->file == NULL)
+		return;
+
+	/* flushed for every database, the point is to survive the
+	   connection, or gpilotd, going away at any time */
+	fprintf (checkpoint->file, "%ld %s\n", (long) modify_date, db_name);
+	fflush (checkpoint->file);
+}
+
+void
+gpilot_sync_checkpoint_close (GPilotSyncCheckpoint *checkpoint,
+			      gboolean finished)
+{
+	if (checkpoint == NULL)
+		return;
+
+	if (checkpoint->file != NULL)
+		fclose (checkpoint->file);
+	if (finished)
+		g_unlink (checkpoint->filename);
+
+	g_hash_table_destroy (checkpoint->done);
+	g_free (checkpoint->filename);
+	g_free (checkpoint);
+}
@@ -0,0 +1,64 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-checkpoint: journal of the databases a sync got through.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_SYNC_CHECKPOINT_H_
+#define _GPILOT_SYNC_CHECKPOINT_H_
+#include <time.h>
+#include <glib.h>
+
+/* Databases a sync has finished with are written to
+   ~/.gnome-pilot/checkpoints/<pilot id> as the sync goes. When the
+   connection drops and the pilot syncs again within the resume
+   window, without having completed a sync with any host since,
+   databases whose modification date is still the one recorded are
+   skipped. All functions accept a NULL checkpoint, which resumes
+   nothing. */
+
+typedef struct _GPilotSyncCheckpoint GPilotSyncCheckpoint;
+
+/* Resume the checkpoint of pilot_id if it was written less than
+   window seconds ago for the same sync stamp, or start a new one.
+   last_sync_pc and last_sync_date are what the pilot reported for its
+   last completed sync. Returns NULL when window is 0. */
+GPilotSyncCheckpoint *gpilot_sync_checkpoint_open (guint32 pilot_id,
+						   guint32 sync_pc_id,
+						   guint32 last_sync_pc,
+						   time_t last_sync_date,
+						   guint window);
+
+/* Whether db_name was completed by the interrupted sync and has not
+   changed since */
+gboolean gpilot_sync_checkpoint_done (GPilotSyncCheckpoint *checkpoint,
+				      const gchar *db_name,
+				      time_t modify_date);
+
+/* Record db_name as done, with its modification date after the sync */
+void gpilot_sync_checkpoint_mark (GPilotSyncCheckpoint *checkpoint,
+				  const gchar *db_name,
+				  time_t modify_date);
+
+/* Free the checkpoint. When the sync got through all databases the
+   file is removed, otherwise it is kept for the next attempt. */
+void gpilot_sync_checkpoint_close (GPilotSyncCheckpoint *checkpoint,
+				   gboolean finished);
+
+#endif /* _GPILOT_SYNC_CHECKPOINT_H_ */
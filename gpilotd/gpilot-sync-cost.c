@@ -0,0 +1,214 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-cost: learned per-database sync costs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <stdio.h>
+#include <string.h>
+#include "gpilot-sync-cost.h"
+#include "gnome-pilot-config.h"
+
+#define COST_MAGIC "gpilotd-costs"
+#define COST_VERSION 1
+
+typedef struct {
+	gint64 usecs[2];	/* by GPilotSyncCostKind */
+	gboolean deferred;
+} GPilotSyncCostEntry;
+
+struct _GPilotSyncCost {
+	gchar *filename;
+	time_t last_full;
+	/* db name -> GPilotSyncCostEntry */
+	GHashTable *entries;
+	gboolean changed;
+};
+
+static GPilotSyncCostEntry *
+cost_entry (GPilotSyncCost *cost, const gchar *db_name)
+{
+	GPilotSyncCostEntry *entry;
+
+	entry = g_hash_table_lookup (cost->entries, db_name);
+	if (entry == NULL) {
+		entry = g_new0 (GPilotSyncCostEntry, 1);
+		g_hash_table_insert (cost->entries, g_strdup (db_name), entry);
+	}
+
+	return entry;
+}
+
+/* The first line is "gpilotd-costs <version> <last full sync>", each
+   next one "<conduit usec> <backup usec> <deferred> <name>" */
+GPilotSyncCost *
+gpilot_sync_cost_load (guint32 pilot_id)
+{
+	GPilotSyncCost *cost;
+	gchar *name, *contents = NULL, **lines;
+	gint version;
+	glong last_full;
+	guint i;
+
+	cost = g_new0 (GPilotSyncCost, 1);
+	name = g_strdup_printf ("%u", pilot_id);
+	cost->filename = get_gpilotd_data_file ("costs", name);
+	g_free (name);
+	cost->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	if (!g_file_get_contents (cost->filename, &contents, NULL, NULL))
+		return cost;
+
+	lines = g_strsplit (contents, "\n", -1);
+	g_free (contents);
+
+	if (lines[0] == NULL ||
+	    !g_str_has_prefix (lines[0], COST_MAGIC " ") ||
+	    sscanf (lines[0] + strlen (COST_MAGIC), "%d %ld", &version, &last_full) != 2 ||
+	    version != COST_VERSION) {
+		g_warning ("Ignoring invalid sync cost model %s", cost->filename);
+		g_strfreev (lines);
+		return cost;
+	}
+	cost->last_full = last_full;
+
+	for (i = 1; lines[i] != NULL; i++) {
+		GPilotSyncCostEntry *entry;
+		gint64 conduit, backup;
+		gint deferred, offset = 0;
+
+		if (sscanf (lines[i], "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %d %n",
+			    &conduit, &backup, &deferred, &offset) != 3 || offset == 0)
+			continue;
+
+		entry = cost_entry (cost, lines[i] + offset);
+		entry->usecs[GPILOT_SYNC_COST_CONDUIT] = conduit;
+		entry->usecs[GPILOT_SYNC_COST_BACKUP] = backup;
+		entry->deferred = deferred != 0;
+	}
+	g_strfreev (lines);
+
+	return cost;
+}
+
+void
+gpilot_sync_cost_save (GPilotSyncCost *cost)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GString *contents;
+	GError *error = NULL;
+
+	if (cost == NULL)
+		return;
+
+	if (cost->changed) {
+		contents = g_string_new (NULL);
+		g_string_append_printf (contents, "%s %d %ld\n", COST_MAGIC, COST_VERSION,
+					(long) cost->last_full);
+		g_hash_table_iter_init (&iter, cost->entries);
+		while (g_hash_table_iter_next (&iter, &key, &value)) {
+			GPilotSyncCostEntry *entry = value;
+
+			g_string_append_printf (contents, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT " %d %s\n",
+						entry->usecs[GPILOT_SYNC_COST_CONDUIT],
+						entry->usecs[GPILOT_SYNC_COST_BACKUP],
+						entry->deferred ? 1 : 0,
+						(gchar *) key);
+		}
+		if (!g_file_set_contents (cost->filename, contents->str, contents->len, &error)) {
+			g_warning ("Could not save sync cost model %s: %s", cost->filename, error->message);
+			g_error_free (error);
+		}
+		g_string_free (contents, TRUE);
+	}
+
+	g_hash_table_destroy (cost->entries);
+	g_free (cost->filename);
+	g_free (cost);
+}
+
+gint64
+gpilot_sync_cost_get (GPilotSyncCost *cost,
+		      const gchar *db_name,
+		      GPilotSyncCostKind kind)
+{
+	GPilotSyncCostEntry *entry;
+
+	entry = g_hash_table_lookup (cost->entries, db_name);
+
+	return entry ? entry->usecs[kind] : 0;
+}
+
+void
+gpilot_sync_cost_add (GPilotSyncCost *cost,
+		      const gchar *db_name,
+		      GPilotSyncCostKind kind,
+		      gint64 usecs)
+{
+	GPilotSyncCostEntry *entry;
+
+	entry = cost_entry (cost, db_name);
+
+	/* weighted towards the recent runs, a database that grew should
+	   show it within a few syncs */
+	if (entry->usecs[kind] == 0)
+		entry->usecs[kind] = usecs;
+	else
+		entry->usecs[kind] = (3 * entry->usecs[kind] + usecs) / 4;
+	cost->changed = TRUE;
+}
+
+gboolean
+gpilot_sync_cost_get_deferred (GPilotSyncCost *cost,
+			       const gchar *db_name)
+{
+	GPilotSyncCostEntry *entry;
+
+	entry = g_hash_table_lookup (cost->entries, db_name);
+
+	return entry ? entry->deferred : FALSE;
+}
+
+void
+gpilot_sync_cost_set_deferred (GPilotSyncCost *cost,
+			       const gchar *db_name,
+			       gboolean deferred)
+{
+	GPilotSyncCostEntry *entry;
+
+	entry = cost_entry (cost, db_name);
+	if (entry->deferred != deferred) {
+		entry->deferred = deferred;
+		cost->changed = TRUE;
+	}
+}
+
+time_t
+gpilot_sync_cost_get_last_full (GPilotSyncCost *cost)
+{
+	return cost->last_full;
+}
+
+void
+gpilot_sync_cost_set_last_full (GPilotSyncCost *cost, time_t when)
+{
+	cost->last_full = when;
+	cost->changed = TRUE;
+}
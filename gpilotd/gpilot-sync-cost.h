@@ -0,0 +1,68 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-cost: learned per-database sync costs.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_SYNC_COST_H_
+#define _GPILOT_SYNC_COST_H_
+#include <time.h>
+#include <glib.h>
+
+/* What each database of a pilot took to sync, learned from past syncs
+   and kept in ~/.gnome-pilot/costs/<pilot id>. Quick syncs use it to
+   order the databases and to tell which backups still fit in their
+   time budget. */
+
+typedef enum {
+	GPILOT_SYNC_COST_CONDUIT,
+	GPILOT_SYNC_COST_BACKUP
+} GPilotSyncCostKind;
+
+typedef struct _GPilotSyncCost GPilotSyncCost;
+
+GPilotSyncCost *gpilot_sync_cost_load (guint32 pilot_id);
+
+/* Write the model back if it changed, and free it */
+void gpilot_sync_cost_save (GPilotSyncCost *cost);
+
+/* Expected usec of db_name, 0 when it was never seen */
+gint64 gpilot_sync_cost_get (GPilotSyncCost *cost,
+			     const gchar *db_name,
+			     GPilotSyncCostKind kind);
+
+/* Learn from a run of db_name that took usecs */
+void gpilot_sync_cost_add (GPilotSyncCost *cost,
+			   const gchar *db_name,
+			   GPilotSyncCostKind kind,
+			   gint64 usecs);
+
+/* Whether the backup of db_name was left out by a quick sync and not
+   made since */
+gboolean gpilot_sync_cost_get_deferred (GPilotSyncCost *cost,
+					const gchar *db_name);
+void gpilot_sync_cost_set_deferred (GPilotSyncCost *cost,
+				    const gchar *db_name,
+				    gboolean deferred);
+
+/* When the last sync that ran everything completed */
+time_t gpilot_sync_cost_get_last_full (GPilotSyncCost *cost);
+void gpilot_sync_cost_set_last_full (GPilotSyncCost *cost, time_t when);
+
+#endif /* _GPILOT_SYNC_COST_H_ */
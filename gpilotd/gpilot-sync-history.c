@@ -0,0 +1,316 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-history: persistent ring of finished sync sessions.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
+#include "gpilot-sync-history.h"
+#include "gnome-pilot-config.h"
+
+#define HISTORY_MAGIC   0x47505348 /* GPSH */
+#define HISTORY_VERSION 2
+
+#define HISTORY_COMPLETED 1
+#define HISTORY_CONDUIT_SLOW 1
+
+typedef struct {
+	guint32 magic;
+	guint32 version;
+	guint32 record_size;
+	guint32 size;
+	guint32 next;		/* slot the next summary goes in */
+	guint32 count;		/* slots in use */
+	guint32 reserved[2];
+} HistoryHeader;
+
+typedef struct {
+	guint64 usecs;
+	guint32 records;
+	guint16 errors;
+	guint16 flags;		/* HISTORY_CONDUIT_* */
+	gchar name[32];
+} HistoryConduit;
+
+typedef struct {
+	guint32 pilot_id;
+	guint32 flags;		/* HISTORY_COMPLETED */
+	gint64 started;
+	guint64 usecs;
+	guint64 bytes;
+	guint32 databases;
+	guint32 records;
+	guint32 errors;
+	guint32 n_conduits;
+	gchar pilot[32];
+	gchar device[32];
+	HistoryConduit conduits[GPILOT_SYNC_HISTORY_CONDUITS];
+} HistoryRecord;
+
+G_STATIC_ASSERT (sizeof (HistoryHeader) == 32);
+G_STATIC_ASSERT (sizeof (HistoryConduit) == 48);
+G_STATIC_ASSERT (sizeof (HistoryRecord) == 112 + 48 * GPILOT_SYNC_HISTORY_CONDUITS);
+
+#define HISTORY_LENGTH (sizeof (HistoryHeader) + GPILOT_SYNC_HISTORY_SIZE * sizeof (HistoryRecord))
+
+static HistoryHeader *header = NULL;
+static HistoryRecord *records = NULL;
+
+static gboolean
+history_header_valid (void)
+{
+	return header->magic == HISTORY_MAGIC
+		&& header->version == HISTORY_VERSION
+		&& header->record_size == sizeof (HistoryRecord)
+		&& header->size == GPILOT_SYNC_HISTORY_SIZE
+		&& header->next < GPILOT_SYNC_HISTORY_SIZE
+		&& header->count <= GPILOT_SYNC_HISTORY_SIZE;
+}
+
+static gboolean
+history_open (void)
+{
+	gchar *filename;
+	struct stat st;
+	gpointer map;
+	int fd;
+
+	if (header != NULL)
+		return TRUE;
+
+	filename = get_gpilotd_data_file ("history", "sessions");
+	fd = g_open (filename, O_RDWR | O_CREAT, 0600);
+	if (fd < 0) {
+		g_warning ("Could not open sync history %s", filename);
+		g_free (filename);
+		return FALSE;
+	}
+
+	/* A file of another size was written by another version, start
+	   over rather than guess at its layout */
+	if (fstat (fd, &st) < 0 || st.st_size != (off_t) HISTORY_LENGTH) {
+		if (ftruncate (fd, 0) < 0 || ftruncate (fd, HISTORY_LENGTH) < 0) {
+			g_warning ("Could not size sync history %s", filename);
+			close (fd);
+			g_free (filename);
+			return FALSE;
+		}
+	}
+
+	map = mmap (NULL, HISTORY_LENGTH, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (map == MAP_FAILED) {
+		g_warning ("Could not map sync history %s", filename);
+		g_free (filename);
+		return FALSE;
+	}
+	g_free (filename);
+
+	header = map;
+	records = (HistoryRecord *) (header + 1);
+
+	if (!history_header_valid ()) {
+		memset (map, 0, HISTORY_LENGTH);
+		header->magic = HISTORY_MAGIC;
+		header->version = HISTORY_VERSION;
+		header->record_size = sizeof (HistoryRecord);
+		header->size = GPILOT_SYNC_HISTORY_SIZE;
+	}
+
+	return TRUE;
+}
+
+void
+gpilot_sync_history_close (void)
+{
+	if (header == NULL)
+		return;
+
+	munmap (header, HISTORY_LENGTH);
+	header = NULL;
+	records = NULL;
+}
+
+/* Copy src into the fixed size field dest, cutting it short on a
+   character boundary so the field stays valid UTF-8 */
+static void
+history_copy_name (gchar *dest, const gchar *src, gsize size)
+{
+	const gchar *end;
+
+	memset (dest, 0, size);
+	if (src == NULL)
+		return;
+
+	end = src;
+	while (*end) {
+		const gchar *next = g_utf8_next_char (end);
+
+		if (next - src > (gssize) size - 1)
+			break;
+		end = next;
+	}
+	memcpy (dest, src, end - src);
+}
+
+/* Read a field back; a file written by another build may still hold
+   bytes that are not UTF-8, which the "s" in the reply must not get */
+static gchar *
+history_read_name (const gchar *src, gsize size)
+{
+	gchar *name = g_strndup (src, size);
+	gchar *valid = g_utf8_make_valid (name, -1);
+
+	g_free (name);
+	return valid;
+}
+
+/* Add the counts of the conduit's own phases, which come before its
+   GPILOT_SYNC_PHASE_CONDUIT timing at index last */
+static void
+history_summarize_conduit (GPilotSyncSession *session,
+			   guint first,
+			   guint last,
+			   HistoryConduit *conduit)
+{
+	GPilotSyncTiming *end = &g_array_index (session->timings, GPilotSyncTiming, last);
+	guint records = 0, errors = 0;
+	guint i;
+
+	for (i = first; i <= last; i++) {
+		GPilotSyncTiming *timing = &g_array_index (session->timings, GPilotSyncTiming, i);
+
+		if (timing->phase == GPILOT_SYNC_PHASE_BACKUP ||
+		    g_strcmp0 (timing->name, end->name) != 0)
+			continue;
+		records += timing->records;
+		errors += timing->errors;
+	}
+
+	history_copy_name (conduit->name, end->name, sizeof (conduit->name));
+	conduit->usecs = end->usecs;
+	conduit->records = records;
+	conduit->errors = MIN (errors, G_MAXUINT16);
+	conduit->flags = end->slow ? HISTORY_CONDUIT_SLOW : 0;
+}
+
+void
+gpilot_sync_history_append (GPilotSyncSession *session)
+{
+	HistoryRecord *record;
+	guint i, first = 0;
+
+	g_return_if_fail (session != NULL);
+
+	if (!history_open ())
+		return;
+
+	record = &records[header->next];
+	memset (record, 0, sizeof (HistoryRecord));
+	record->pilot_id = session->pilot_id;
+	record->flags = session->completed ? HISTORY_COMPLETED : 0;
+	record->started = session->started;
+	record->usecs = session->usecs;
+	history_copy_name (record->pilot, session->pilot_name, sizeof (record->pilot));
+	history_copy_name (record->device, session->device, sizeof (record->device));
+
+	for (i = 0; i < session->timings->len; i++) {
+		GPilotSyncTiming *timing = &g_array_index (session->timings, GPilotSyncTiming, i);
+
+		record->errors += timing->errors;
+		if (timing->phase == GPILOT_SYNC_PHASE_ENUMERATE) {
+			record->databases = timing->records;
+			continue;
+		}
+		record->records += timing->records;
+		record->bytes += timing->bytes;
+
+		if (timing->phase == GPILOT_SYNC_PHASE_CONDUIT) {
+			if (record->n_conduits < GPILOT_SYNC_HISTORY_CONDUITS)
+				history_summarize_conduit (session, first, i,
+							   &record->conduits[record->n_conduits++]);
+			first = i + 1;
+		}
+	}
+
+	header->next = (header->next + 1) % GPILOT_SYNC_HISTORY_SIZE;
+	if (header->count < GPILOT_SYNC_HISTORY_SIZE)
+		header->count++;
+	msync (header, HISTORY_LENGTH, MS_ASYNC);
+}
+
+GVariant *
+gpilot_sync_history_query (guint32 pilot_id, guint count)
+{
+	GVariantBuilder builder;
+	guint i, n = 0;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(ussxtuutuba(stuub))"));
+	if (!history_open ())
+		return g_variant_builder_end (&builder);
+
+	for (i = 0; i < header->count && (count == 0 || n < count); i++) {
+		HistoryRecord *record;
+		gchar *pilot, *device;
+		guint j;
+
+		record = &records[(header->next + GPILOT_SYNC_HISTORY_SIZE - 1 - i) % GPILOT_SYNC_HISTORY_SIZE];
+		if (pilot_id != 0 && record->pilot_id != pilot_id)
+			continue;
+		n++;
+
+		pilot = history_read_name (record->pilot, sizeof (record->pilot));
+		device = history_read_name (record->device, sizeof (record->device));
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("(ussxtuutuba(stuub))"));
+		g_variant_builder_add (&builder, "u", record->pilot_id);
+		g_variant_builder_add (&builder, "s", pilot);
+		g_variant_builder_add (&builder, "s", device);
+		g_variant_builder_add (&builder, "x", record->started);
+		g_variant_builder_add (&builder, "t", record->usecs);
+		g_variant_builder_add (&builder, "u", record->databases);
+		g_variant_builder_add (&builder, "u", record->records);
+		g_variant_builder_add (&builder, "t", record->bytes);
+		g_variant_builder_add (&builder, "u", record->errors);
+		g_variant_builder_add (&builder, "b", (record->flags & HISTORY_COMPLETED) != 0);
+		g_variant_builder_open (&builder, G_VARIANT_TYPE ("a(stuub)"));
+		for (j = 0; j < MIN (record->n_conduits, GPILOT_SYNC_HISTORY_CONDUITS); j++) {
+			HistoryConduit *conduit = &record->conduits[j];
+			gchar *name = history_read_name (conduit->name, sizeof (conduit->name));
+
+			g_variant_builder_add (&builder, "(stuub)",
+					       name,
+					       conduit->usecs,
+					       conduit->records,
+					       (guint32) conduit->errors,
+					       (conduit->flags & HISTORY_CONDUIT_SLOW) != 0);
+			g_free (name);
+		}
+		g_variant_builder_close (&builder);
+		g_variant_builder_close (&builder);
+		g_free (pilot);
+		g_free (device);
+	}
+
+	return g_variant_builder_end (&builder);
+}
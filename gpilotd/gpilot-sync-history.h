@@ -0,0 +1,52 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-history: persistent ring of finished sync sessions.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_SYNC_HISTORY_H_
+#define _GPILOT_SYNC_HISTORY_H_
+#include <glib.h>
+#include "gpilot-sync-stats.h"
+
+/* A summary of every finished sync is kept in a fixed size ring of
+   fixed size records in ~/.gnome-pilot/history/sessions, so syncs can
+   be compared over time and across daemon restarts. The oldest
+   summary is overwritten once the ring is full. */
+
+#define GPILOT_SYNC_HISTORY_SIZE 512
+
+/* Conduits summarized per session, later ones are left out */
+#define GPILOT_SYNC_HISTORY_CONDUITS 8
+
+/* Summarize a finished session and add it to the ring */
+void gpilot_sync_history_append (GPilotSyncSession *session);
+
+/* The stored summaries of pilot_id, or of all pilots when pilot_id is
+   0, most recent first and at most count of them (0 for all), as
+   "a(ussxtuutuba(stuub))": pilot id, pilot, device, start time, usec,
+   databases, records, bytes, errors, completed and the conduits run
+   with name, usec, records, errors and whether the sync was slow.
+   Floating reference. */
+GVariant *gpilot_sync_history_query (guint32 pilot_id, guint count);
+
+/* Unmap the ring */
+void gpilot_sync_history_close (void);
+
+#endif /* _GPILOT_SYNC_HISTORY_H_ */
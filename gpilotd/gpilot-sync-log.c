@@ -0,0 +1,130 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-log: pilot log entries collected during a sync.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <string.h>
+#include <glib/gi18n.h>
+#include <pi-dlp.h>
+#include "gpilot-sync-log.h"
+
+typedef struct {
+	GQueue *entries;
+	gsize length;
+} GPilotSyncLog;
+
+/* pilot_socket -> GPilotSyncLog */
+static GHashTable *sync_logs = NULL;
+
+static void
+gpilot_sync_log_free (GPilotSyncLog *log)
+{
+	g_queue_foreach (log->entries, (GFunc) g_free, NULL);
+	g_queue_free (log->entries);
+	g_free (log);
+}
+
+void
+gpilot_sync_log_begin (int pilot_socket)
+{
+	GPilotSyncLog *log;
+
+	if (sync_logs == NULL)
+		sync_logs = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						   NULL, (GDestroyNotify) gpilot_sync_log_free);
+
+	log = g_new0 (GPilotSyncLog, 1);
+	log->entries = g_queue_new ();
+	g_hash_table_replace (sync_logs, GINT_TO_POINTER (pilot_socket), log);
+}
+
+void
+gpilot_sync_log_add (int pilot_socket, const gchar *entry)
+{
+	GPilotSyncLog *log = NULL;
+
+	g_return_if_fail (entry != NULL);
+
+	if (sync_logs != NULL)
+		log = g_hash_table_lookup (sync_logs, GINT_TO_POINTER (pilot_socket));
+
+	if (log == NULL) {
+		dlp_AddSyncLogEntry (pilot_socket, (char *) entry);
+		return;
+	}
+
+	g_queue_push_tail (log->entries, g_strdup (entry));
+	log->length += strlen (entry);
+}
+
+gint
+gpilot_sync_log_flush (int pilot_socket)
+{
+	GPilotSyncLog *log = NULL;
+	GString *buffer;
+	gchar *marker = NULL;
+	guint dropped = 0;
+	gint result = 0;
+
+	if (sync_logs != NULL)
+		log = g_hash_table_lookup (sync_logs, GINT_TO_POINTER (pilot_socket));
+	if (log == NULL)
+		return 0;
+
+	/* Keep the most recent entries, the end of the log is what the
+	   user wants to see on the PDA */
+	while (log->length + (marker ? strlen (marker) : 0) > GPILOT_SYNC_LOG_MAX
+	       && g_queue_get_length (log->entries) > 1) {
+		gchar *entry = g_queue_pop_head (log->entries);
+
+		log->length -= strlen (entry);
+		g_free (entry);
+		dropped++;
+
+		g_free (marker);
+		marker = g_strdup_printf (_("(%d earlier log entries omitted)\n"), dropped);
+	}
+
+	buffer = g_string_sized_new (log->length + (marker ? strlen (marker) : 0));
+	if (marker != NULL)
+		g_string_append (buffer, marker);
+	while (!g_queue_is_empty (log->entries)) {
+		gchar *entry = g_queue_pop_head (log->entries);
+
+		g_string_append (buffer, entry);
+		g_free (entry);
+	}
+	log->length = 0;
+
+	/* a single remaining oversized entry is simply cut */
+	if (buffer->len > GPILOT_SYNC_LOG_MAX)
+		g_string_truncate (buffer, GPILOT_SYNC_LOG_MAX);
+
+	if (buffer->len > 0)
+		result = dlp_AddSyncLogEntry (pilot_socket, buffer->str);
+	if (result < 0)
+		g_warning ("dlp_AddSyncLogEntry failed (%d)", result);
+
+	g_string_free (buffer, TRUE);
+	g_free (marker);
+	g_hash_table_remove (sync_logs, GINT_TO_POINTER (pilot_socket));
+
+	return result;
+}
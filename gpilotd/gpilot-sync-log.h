@@ -0,0 +1,45 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-log: pilot log entries collected during a sync.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_SYNC_LOG_H_
+#define _GPILOT_SYNC_LOG_H_
+#include <glib.h>
+
+/* The PDA only keeps a couple of kilobytes of HotSync log, anything
+   beyond that is cut off by the device itself. */
+#define GPILOT_SYNC_LOG_MAX 2048
+
+/* Start buffering log entries for pilot_socket. Until
+   gpilot_sync_log_flush is called, entries are kept in memory instead
+   of being written with one dlp_AddSyncLogEntry per entry. */
+void gpilot_sync_log_begin (int pilot_socket);
+
+/* Add an entry to the sync log. If no buffer has been started for
+   pilot_socket, the entry is written to the PDA right away. */
+void gpilot_sync_log_add (int pilot_socket, const gchar *entry);
+
+/* Write the buffered log to the PDA in a single call, dropping the
+   oldest entries if it exceeds GPILOT_SYNC_LOG_MAX, and release the
+   buffer. Returns the dlp result, or 0 if there was nothing to write. */
+gint gpilot_sync_log_flush (int pilot_socket);
+
+#endif /* _GPILOT_SYNC_LOG_H_ */
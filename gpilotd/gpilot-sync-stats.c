@@ -0,0 +1,233 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-stats: timings of the phases of a sync.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <time.h>
+#include "gpilot-sync-stats.h"
+
+typedef struct {
+	GPilotSyncSession *session;
+	gint64 begun;
+	/* counted by gpilot_sync_stats_count, not yet in a timing */
+	guint records;
+	guint64 bytes;
+	guint errors;
+	/* set by gpilot_sync_stats_set_slow until the conduit ends */
+	gboolean slow;
+} GPilotSyncStatsActive;
+
+/* pilot_socket -> GPilotSyncStatsActive */
+static GHashTable *active = NULL;
+
+/* finished GPilotSyncSessions, most recent first */
+static GQueue *history = NULL;
+
+static void
+gpilot_sync_session_free (GPilotSyncSession *session)
+{
+	guint i;
+
+	for (i = 0; i < session->timings->len; i++)
+		g_free (g_array_index (session->timings, GPilotSyncTiming, i).name);
+	g_array_free (session->timings, TRUE);
+	g_free (session->pilot_name);
+	g_free (session->device);
+	g_free (session);
+}
+
+static void
+gpilot_sync_stats_active_free (GPilotSyncStatsActive *stats)
+{
+	if (stats->session)
+		gpilot_sync_session_free (stats->session);
+	g_free (stats);
+}
+
+static GPilotSyncStatsActive *
+gpilot_sync_stats_lookup (int pilot_socket)
+{
+	if (active == NULL)
+		return NULL;
+
+	return g_hash_table_lookup (active, GINT_TO_POINTER (pilot_socket));
+}
+
+void
+gpilot_sync_stats_begin (int pilot_socket,
+			 const gchar *device,
+			 gint64 connected)
+{
+	GPilotSyncStatsActive *stats;
+
+	if (active == NULL)
+		active = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+						NULL, (GDestroyNotify) gpilot_sync_stats_active_free);
+
+	stats = g_new0 (GPilotSyncStatsActive, 1);
+	stats->begun = connected;
+	stats->session = g_new0 (GPilotSyncSession, 1);
+	stats->session->device = g_strdup (device);
+	stats->session->started = time (NULL) - (g_get_monotonic_time () - connected) / G_USEC_PER_SEC;
+	stats->session->timings = g_array_new (FALSE, FALSE, sizeof (GPilotSyncTiming));
+	g_hash_table_replace (active, GINT_TO_POINTER (pilot_socket), stats);
+
+	gpilot_sync_stats_add (pilot_socket, GPILOT_SYNC_PHASE_CONNECT, NULL, connected, 0, 0);
+}
+
+void
+gpilot_sync_stats_set_pilot (int pilot_socket,
+			     guint32 pilot_id,
+			     const gchar *pilot_name)
+{
+	GPilotSyncStatsActive *stats;
+
+	stats = gpilot_sync_stats_lookup (pilot_socket);
+	if (stats == NULL)
+		return;
+
+	stats->session->pilot_id = pilot_id;
+	g_free (stats->session->pilot_name);
+	stats->session->pilot_name = g_strdup (pilot_name);
+}
+
+void
+gpilot_sync_stats_add (int pilot_socket,
+		       GPilotSyncPhase phase,
+		       const gchar *name,
+		       gint64 since,
+		       guint records,
+		       guint64 bytes)
+{
+	GPilotSyncStatsActive *stats;
+	GPilotSyncTiming timing;
+
+	stats = gpilot_sync_stats_lookup (pilot_socket);
+	if (stats == NULL)
+		return;
+
+	timing.phase = phase;
+	timing.name = g_strdup (name);
+	timing.usecs = g_get_monotonic_time () - since;
+	timing.records = records + stats->records;
+	timing.bytes = bytes + stats->bytes;
+	timing.errors = stats->errors;
+	timing.slow = stats->slow;
+	g_array_append_val (stats->session->timings, timing);
+
+	stats->records = 0;
+	stats->bytes = 0;
+	stats->errors = 0;
+	if (phase == GPILOT_SYNC_PHASE_CONDUIT)
+		stats->slow = FALSE;
+}
+
+void
+gpilot_sync_stats_count (int pilot_socket, guint records, guint64 bytes)
+{
+	GPilotSyncStatsActive *stats;
+
+	stats = gpilot_sync_stats_lookup (pilot_socket);
+	if (stats == NULL)
+		return;
+
+	stats->records += records;
+	stats->bytes += bytes;
+}
+
+void
+gpilot_sync_stats_error (int pilot_socket)
+{
+	GPilotSyncStatsActive *stats;
+
+	stats = gpilot_sync_stats_lookup (pilot_socket);
+	if (stats == NULL)
+		return;
+
+	stats->errors++;
+}
+
+void
+gpilot_sync_stats_set_slow (int pilot_socket, gboolean slow)
+{
+	GPilotSyncStatsActive *stats;
+
+	stats = gpilot_sync_stats_lookup (pilot_socket);
+	if (stats == NULL)
+		return;
+
+	stats->slow = slow;
+}
+
+GPilotSyncSession *
+gpilot_sync_stats_end (int pilot_socket, gboolean completed)
+{
+	GPilotSyncStatsActive *stats;
+	GPilotSyncSession *session;
+
+	stats = gpilot_sync_stats_lookup (pilot_socket);
+	if (stats == NULL)
+		return NULL;
+
+	session = stats->session;
+	stats->session = NULL;
+	session->usecs = g_get_monotonic_time () - stats->begun;
+	session->completed = completed;
+	g_hash_table_remove (active, GINT_TO_POINTER (pilot_socket));
+
+	if (history == NULL)
+		history = g_queue_new ();
+	g_queue_push_head (history, session);
+	while (g_queue_get_length (history) > GPILOT_SYNC_STATS_HISTORY)
+		gpilot_sync_session_free (g_queue_pop_tail (history));
+
+	return session;
+}
+
+GList *
+gpilot_sync_stats_get_history (void)
+{
+	return history ? history->head : NULL;
+}
+
+const gchar *
+gpilot_sync_phase_to_str (GPilotSyncPhase phase)
+{
+	switch (phase) {
+	case GPILOT_SYNC_PHASE_CONNECT:
+		return "connect";
+	case GPILOT_SYNC_PHASE_HANDSHAKE:
+		return "handshake";
+	case GPILOT_SYNC_PHASE_ENUMERATE:
+		return "enumerate";
+	case GPILOT_SYNC_PHASE_CONDUIT:
+		return "conduit";
+	case GPILOT_SYNC_PHASE_PRE_SYNC:
+		return "pre_sync";
+	case GPILOT_SYNC_PHASE_TRANSFER:
+		return "transfer";
+	case GPILOT_SYNC_PHASE_POST_SYNC:
+		return "post_sync";
+	case GPILOT_SYNC_PHASE_BACKUP:
+		return "backup";
+	}
+
+	return "unknown";
+}
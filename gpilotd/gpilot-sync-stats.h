@@ -0,0 +1,104 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-sync-stats: timings of the phases of a sync.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_SYNC_STATS_H_
+#define _GPILOT_SYNC_STATS_H_
+#include <glib.h>
+
+/* Number of finished sync sessions kept around for GetSyncStats */
+#define GPILOT_SYNC_STATS_HISTORY 16
+
+typedef enum {
+	GPILOT_SYNC_PHASE_CONNECT,
+	GPILOT_SYNC_PHASE_HANDSHAKE,	/* system and user info */
+	GPILOT_SYNC_PHASE_ENUMERATE,	/* reading the database list */
+	GPILOT_SYNC_PHASE_CONDUIT,	/* a whole conduit run */
+	GPILOT_SYNC_PHASE_PRE_SYNC,
+	GPILOT_SYNC_PHASE_TRANSFER,
+	GPILOT_SYNC_PHASE_POST_SYNC,
+	GPILOT_SYNC_PHASE_BACKUP
+} GPilotSyncPhase;
+
+typedef struct {
+	GPilotSyncPhase phase;
+	gchar *name;		/* conduit or database, may be NULL */
+	gint64 usecs;
+	guint records;
+	guint64 bytes;
+	guint errors;
+	gboolean slow;		/* a conduit ran a slow sync */
+} GPilotSyncTiming;
+
+typedef struct {
+	guint32 pilot_id;
+	gchar *pilot_name;
+	gchar *device;
+	gint64 started;		/* wall clock, seconds since the epoch */
+	gint64 usecs;
+	gboolean completed;
+	GArray *timings;	/* of GPilotSyncTiming, in order */
+} GPilotSyncSession;
+
+/* Start timing a session on pilot_socket. connected is the monotonic
+   time at which connecting to the device started. */
+void gpilot_sync_stats_begin (int pilot_socket,
+			      const gchar *device,
+			      gint64 connected);
+
+void gpilot_sync_stats_set_pilot (int pilot_socket,
+				  guint32 pilot_id,
+				  const gchar *pilot_name);
+
+/* Record a phase that began at the monotonic time since and ends
+   now. Counts passed to gpilot_sync_stats_count since the previous
+   phase was recorded are added to records and bytes. Does nothing
+   when no session was begun on pilot_socket. */
+void gpilot_sync_stats_add (int pilot_socket,
+			    GPilotSyncPhase phase,
+			    const gchar *name,
+			    gint64 since,
+			    guint records,
+			    guint64 bytes);
+
+/* Count records and bytes moved for the phase in progress, for code
+   that does the moving but does not time the phase itself */
+void gpilot_sync_stats_count (int pilot_socket, guint records, guint64 bytes);
+
+/* Count a failure for the phase in progress */
+void gpilot_sync_stats_error (int pilot_socket);
+
+/* Mark the conduit in progress as running a slow sync. The flag is
+   set on each phase recorded up to and including the conduit's
+   GPILOT_SYNC_PHASE_CONDUIT. */
+void gpilot_sync_stats_set_slow (int pilot_socket, gboolean slow);
+
+/* Finish the session on pilot_socket and move it to the history.
+   Returns the session, owned by the history, or NULL when none was
+   begun on pilot_socket. */
+GPilotSyncSession *gpilot_sync_stats_end (int pilot_socket, gboolean completed);
+
+/* The finished sessions, most recent first. Owned by the history. */
+GList *gpilot_sync_stats_get_history (void);
+
+const gchar *gpilot_sync_phase_to_str (GPilotSyncPhase phase);
+
+#endif /* _GPILOT_SYNC_STATS_H_ */
@@ -0,0 +1,162 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-trace: binary ring of per-record sync events.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#include <string.h>
+#include "gpilot-trace.h"
+
+typedef struct {
+	gint64 time;		/* monotonic usec */
+	gint16 pilot_socket;
+	guint16 event;
+	guint32 id;
+	guint32 arg;
+	guint32 reserved;
+} GPilotTraceRecord;
+
+G_STATIC_ASSERT ((GPILOT_TRACE_SIZE & (GPILOT_TRACE_SIZE - 1)) == 0);
+
+static GPilotTraceRecord ring[GPILOT_TRACE_SIZE];
+
+/* events ever written, the next one goes in head % GPILOT_TRACE_SIZE */
+static volatile gint head = 0;
+
+static guint counters[GPILOT_TRACE_LAST];
+static guint cases[GPILOT_TRACE_CASES];
+
+void
+gpilot_trace_begin (int pilot_socket)
+{
+	memset (counters, 0, sizeof (counters));
+	memset (cases, 0, sizeof (cases));
+	gpilot_trace (pilot_socket, GPILOT_TRACE_SESSION_BEGIN, 0, 0);
+}
+
+void
+gpilot_trace (int pilot_socket,
+	      GPilotTraceEvent event,
+	      guint32 id,
+	      guint32 arg)
+{
+	GPilotTraceRecord *record;
+
+	record = &ring[(guint) g_atomic_int_add (&head, 1) & (GPILOT_TRACE_SIZE - 1)];
+	record->time = g_get_monotonic_time ();
+	record->pilot_socket = pilot_socket;
+	record->event = event;
+	record->id = id;
+	record->arg = arg;
+
+	counters[event]++;
+	if (event == GPILOT_TRACE_RECORD_CASE && arg < GPILOT_TRACE_CASES)
+		cases[arg]++;
+}
+
+void
+gpilot_trace_dump (guint count, GVariant **events, GVariant **counters_out)
+{
+	GVariantBuilder builder;
+	guint written, first, i;
+	gint64 start = 0;
+
+	written = (guint) g_atomic_int_get (&head);
+	if (count == 0 || count > MIN (written, GPILOT_TRACE_SIZE))
+		count = MIN (written, GPILOT_TRACE_SIZE);
+	first = written - count;
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(tisuu)"));
+	for (i = first; i != written; i++) {
+		GPilotTraceRecord *record = &ring[i & (GPILOT_TRACE_SIZE - 1)];
+
+		if (i == first)
+			start = record->time;
+		g_variant_builder_add (&builder, "(tisuu)",
+				       (guint64) (record->time - start),
+				       (gint32) record->pilot_socket,
+				       gpilot_trace_event_to_str (record->event),
+				       record->id,
+				       record->arg);
+	}
+	*events = g_variant_builder_end (&builder);
+
+	g_variant_builder_init (&builder, G_VARIANT_TYPE ("a(su)"));
+	for (i = 0; i < GPILOT_TRACE_LAST; i++) {
+		if (counters[i] != 0)
+			g_variant_builder_add (&builder, "(su)", gpilot_trace_event_to_str (i), counters[i]);
+	}
+	for (i = 0; i < GPILOT_TRACE_CASES; i++) {
+		gchar *name;
+
+		if (cases[i] == 0)
+			continue;
+		name = g_strdup_printf ("case %u", i);
+		g_variant_builder_add (&builder, "(su)", name, cases[i]);
+		g_free (name);
+	}
+	*counters_out = g_variant_builder_end (&builder);
+}
+
+const gchar *
+gpilot_trace_event_to_str (GPilotTraceEvent event)
+{
+	switch (event) {
+	case GPILOT_TRACE_SESSION_BEGIN:
+		return "session_begin";
+	case GPILOT_TRACE_SESSION_END:
+		return "session_end";
+	case GPILOT_TRACE_SLOW_SYNC:
+		return "slow_sync";
+	case GPILOT_TRACE_FAST_SYNC:
+		return "fast_sync";
+	case GPILOT_TRACE_RECORD_CASE:
+		return "record_case";
+	case GPILOT_TRACE_RECORD_SKIPPED:
+		return "record_skipped";
+	case GPILOT_TRACE_RECORD_RETRIEVE:
+		return "record_retrieve";
+	case GPILOT_TRACE_RECORD_TO_PILOT:
+		return "record_to_pilot";
+	case GPILOT_TRACE_RECORD_DELETE_PILOT:
+		return "record_delete_pilot";
+	case GPILOT_TRACE_RECORD_DELETE_LOCAL:
+		return "record_delete_local";
+	case GPILOT_TRACE_RECORD_UNCHANGED:
+		return "record_unchanged";
+	case GPILOT_TRACE_RECORD_ADD:
+		return "record_add";
+	case GPILOT_TRACE_RECORD_REPLACE:
+		return "record_replace";
+	case GPILOT_TRACE_RECORD_DELETE:
+		return "record_delete";
+	case GPILOT_TRACE_RECORD_ARCHIVE:
+		return "record_archive";
+	case GPILOT_TRACE_BACKUP_RECORD:
+		return "backup_record";
+	case GPILOT_TRACE_BACKUP_RESOURCE:
+		return "backup_resource";
+	case GPILOT_TRACE_BACKUP_ERROR:
+		return "backup_error";
+	case GPILOT_TRACE_LAST:
+		break;
+	}
+
+	return "unknown";
+}
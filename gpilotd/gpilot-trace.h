@@ -0,0 +1,85 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-trace: binary ring of per-record sync events.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+
+#ifndef _GPILOT_TRACE_H_
+#define _GPILOT_TRACE_H_
+#include <glib.h>
+
+/* A flight recorder for the per-record work of a sync. Each event is
+   a fixed size binary record in a ring of the last GPILOT_TRACE_SIZE
+   events, and is counted per kind. Nothing is formatted until the
+   trace is asked for, see gpilot_trace_dump. */
+
+/* Events kept, a power of two */
+#define GPILOT_TRACE_SIZE 8192
+
+/* sync_record cases counted separately, see the table in
+   gnome-pilot-conduit-standard-abs.c */
+#define GPILOT_TRACE_CASES 21
+
+typedef enum {
+	GPILOT_TRACE_SESSION_BEGIN,
+	GPILOT_TRACE_SESSION_END,	/* arg: completed */
+	GPILOT_TRACE_SLOW_SYNC,
+	GPILOT_TRACE_FAST_SYNC,
+	GPILOT_TRACE_RECORD_CASE,	/* arg: sync_record case */
+	GPILOT_TRACE_RECORD_SKIPPED,	/* already processed */
+	GPILOT_TRACE_RECORD_RETRIEVE,	/* read from the pilot by id */
+	GPILOT_TRACE_RECORD_TO_PILOT,
+	GPILOT_TRACE_RECORD_DELETE_PILOT,
+	GPILOT_TRACE_RECORD_DELETE_LOCAL,
+	GPILOT_TRACE_RECORD_UNCHANGED,	/* digest matched, not compared */
+	GPILOT_TRACE_RECORD_ADD,	/* arg: bytes */
+	GPILOT_TRACE_RECORD_REPLACE,	/* arg: bytes */
+	GPILOT_TRACE_RECORD_DELETE,
+	GPILOT_TRACE_RECORD_ARCHIVE,
+	GPILOT_TRACE_BACKUP_RECORD,	/* arg: bytes */
+	GPILOT_TRACE_BACKUP_RESOURCE,	/* id: type, arg: bytes */
+	GPILOT_TRACE_BACKUP_ERROR,
+	GPILOT_TRACE_LAST
+} GPilotTraceEvent;
+
+/* Per-record g_message output costs more than the records themselves
+   on a large database, so it is only built with --enable-record-debug */
+#ifdef GPILOT_DEBUG_RECORDS
+#define GPILOT_RECORD_LOG(x) g_message x
+#else
+#define GPILOT_RECORD_LOG(x)
+#endif
+
+/* Start a session on pilot_socket, clearing the counters */
+void gpilot_trace_begin (int pilot_socket);
+
+void gpilot_trace (int pilot_socket,
+		   GPilotTraceEvent event,
+		   guint32 id,
+		   guint32 arg);
+
+/* Decode the last count events (0 for all kept) as "a(tisuu)": usec
+   since the first one, pilot socket, event, record id and argument,
+   and the counters of the last session as "a(su)". Floating
+   references. */
+void gpilot_trace_dump (guint count, GVariant **events, GVariant **counters);
+
+const gchar *gpilot_trace_event_to_str (GPilotTraceEvent event);
+
+#endif /* _GPILOT_TRACE_H_ */
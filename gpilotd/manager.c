@@ -41,9 +41,14 @@
 #include "gnome-pilot-conduit-backup.h"
 #include "gnome-pilot-conduit-file.h"
 #include "gnome-pilot-conduit-standard.h"
+#include "gnome-pilot-conduit-sync-abs.h"
 #include "gnome-pilot-structures.h"
 #include "gnome-pilot-dbinfo.h"
 #include "gpilot-gui.h"
+#include "gpilot-sync-log.h"
+#include "gpilot-sync-stats.h"
+#include "gpilot-sync-checkpoint.h"
+#include "gpilot-sync-cost.h"
 #include "gnome-pilot-config.h"
 
 #include "gnome-pilot-conduit-management.h"
@@ -84,7 +89,7 @@ static void gpilot_unload_conduit_foreach (GnomePilotConduit *conduit, gpointer
 static gint find_matching_conduit_compare_func (GnomePilotConduit *a,
 						GnomePilotDBInfo *b);
 static GnomePilotConduit *find_matching_conduit (GList *conlist, GnomePilotDBInfo *dbinfo);
-static void backup_foreach (GnomePilotConduitBackup *conduit, GnomePilotDBInfo *info);
+static gint backup_foreach (GnomePilotConduitBackup *conduit, GnomePilotDBInfo *info);
 static gint iterate_dbs (gint pfd,
 			 GnomePilotSyncStamp *stamp,
 			 struct PilotUser *pu,
@@ -261,19 +266,26 @@ set_callbacks (gboolean set, GnomePilotConduit *conduit, gchar *pilot_name)
 
 /* Carrier structure for backup conduits restore callback */
 
-static void
+/* Returns < 0 if the backup failed */
+static gint
 backup_foreach (GnomePilotConduitBackup *conduit, GnomePilotDBInfo *info)
 {
 	int result;
+	gint64 started;
 	
 	if (GNOME_IS_PILOT_CONDUIT_BACKUP (conduit) == FALSE) {
 		g_error (_("non-backup conduit in backup conduit list"));
-		return;
+		return -1;
 	}
 	g_assert (info != NULL);
 	
 	set_callbacks (TRUE, GNOME_PILOT_CONDUIT (conduit), info->pilotInfo->name);
+	started = g_get_monotonic_time ();
 	result = gnome_pilot_conduit_backup_backup (conduit, info);	
+	if (result < 0)
+		gpilot_sync_stats_error (info->pilot_socket);
+	gpilot_sync_stats_add (info->pilot_socket, GPILOT_SYNC_PHASE_BACKUP,
+			       PI_DBINFO (info)->name, started, 0, 0);
 	if (result == 0) {
 		gpilot_add_log_entry (info->pilot_socket, _("%s backed up\n"), PI_DBINFO (info)->name);
 	} else if (result < 0) {
@@ -282,6 +294,80 @@ backup_foreach (GnomePilotConduitBackup *conduit, GnomePilotDBInfo *info)
 		/* db not modified, not backup up */
 	}
 	set_callbacks (FALSE, GNOME_PILOT_CONDUIT (conduit), info->pilotInfo->name);
+
+	return result;
+}
+
+/* The modification date to checkpoint a database with. A conduit
+   that wrote to it changed it, so that is asked for again. */
+static time_t
+checkpoint_modify_date (gint pfd, GnomePilotDBInfo *dbinfo, gboolean written)
+{
+	struct DBInfo info;
+
+	if (written &&
+	    dlp_FindDBByName (pfd, 0, PI_DBINFO (dbinfo)->name, NULL, NULL, &info, NULL) >= 0)
+		return info.modifyDate;
+
+	return PI_DBINFO (dbinfo)->modifyDate;
+}
+
+typedef struct {
+	GList *conduits;
+	GPilotSyncCost *cost;
+} QuickSyncOrder;
+
+/* Quick syncs take the databases that have a conduit first, then
+   the ones that only get backed up, those deferred before first.
+   Cheaper ones go first, so more of them fit in the budget. */
+static gint
+quick_sync_compare (GnomePilotDBInfo *a, GnomePilotDBInfo *b, QuickSyncOrder *order)
+{
+	gboolean critical_a, critical_b, deferred_a, deferred_b;
+	gint64 cost_a, cost_b;
+
+	critical_a = find_matching_conduit (order->conduits, a) != NULL;
+	critical_b = find_matching_conduit (order->conduits, b) != NULL;
+	if (critical_a != critical_b)
+		return critical_a ? -1 : 1;
+
+	deferred_a = gpilot_sync_cost_get_deferred (order->cost, PI_DBINFO (a)->name);
+	deferred_b = gpilot_sync_cost_get_deferred (order->cost, PI_DBINFO (b)->name);
+	if (deferred_a != deferred_b)
+		return deferred_a ? -1 : 1;
+
+	cost_a = gpilot_sync_cost_get (order->cost, PI_DBINFO (a)->name, GPILOT_SYNC_COST_CONDUIT) +
+		gpilot_sync_cost_get (order->cost, PI_DBINFO (a)->name, GPILOT_SYNC_COST_BACKUP);
+	cost_b = gpilot_sync_cost_get (order->cost, PI_DBINFO (b)->name, GPILOT_SYNC_COST_CONDUIT) +
+		gpilot_sync_cost_get (order->cost, PI_DBINFO (b)->name, GPILOT_SYNC_COST_BACKUP);
+
+	return cost_a < cost_b ? -1 : (cost_a > cost_b ? 1 : 0);
+}
+
+/* Tell the user and the pilot's log which backups a quick sync left
+   for later */
+static void
+report_deferred (gint pfd, GPilotPilot *pilot_info, GSList *deferred)
+{
+	GString *names;
+	GSList *l;
+	gchar *message;
+
+	names = g_string_new (NULL);
+	for (l = deferred; l; l = l->next) {
+		if (names->len)
+			g_string_append (names, ", ");
+		g_string_append (names, l->data);
+	}
+
+	message = g_strdup_printf (_("Quick sync deferred the backup of %d databases to the next full sync: %s"),
+				   g_slist_length (deferred), names->str);
+	g_message ("%s", message);
+	dbus_notify_daemon_message (pilot_info->name, NULL, message);
+	g_free (message);
+	g_string_free (names, TRUE);
+
+	gpilot_add_log_entry (pfd, _("Deferred %d backups\n"), g_slist_length (deferred));
 }
 
 static gint
@@ -291,53 +377,118 @@ iterate_dbs (gint pfd,
 	     GList *conlist,
 	     GList *bconlist,
 	     iterate_func iter,
+	     gboolean resumable,
 	     GPilotContext *context)
 {
 	GList *dbs = NULL, *iterator;
 	GnomePilotConduit *conduit = NULL;
 	GSList *db_list = NULL;
 	GPilotPilot *pilot_info;
+	GPilotSyncCheckpoint *checkpoint = NULL;
+	GPilotSyncCost *cost = NULL;
+	GSList *deferred = NULL;
+	GList *preparing = NULL;
+	pi_buffer_t *pi_buf;
+	gboolean failed = FALSE;
+	gboolean quick = FALSE;
 	int error = 0;
 	int index = 0;
 	int result;
+	gint64 started, sync_started;
 
+	sync_started = g_get_monotonic_time ();
 	pilot_info = gpilot_find_pilot_by_id (pu->userID, context->pilots);
 
+	if (resumable) {
+		checkpoint = gpilot_sync_checkpoint_open (pu->userID,
+							  stamp->sync_PC_Id,
+							  pu->lastSyncPC,
+							  pu->successfulSyncDate,
+							  context->resume_window);
+
+		/* with a budget, syncs are quick ones except when the
+		   last full one is older than full_sync_interval hours */
+		cost = gpilot_sync_cost_load (pu->userID);
+		if (context->quick_sync_budget > 0 &&
+		    (context->full_sync_interval == 0 ||
+		     time (NULL) - gpilot_sync_cost_get_last_full (cost) < (time_t) context->full_sync_interval * 3600)) {
+			quick = TRUE;
+			g_message (_("Quick sync, %u seconds budget"), context->quick_sync_budget);
+		}
+	}
+
 	dbus_notify_daemon_message (pilot_info->name, NULL, _("Collecting synchronization info..."));
 
+	started = g_get_monotonic_time ();
+	pi_buf = pi_buffer_new (sizeof (struct DBInfo));
 	while (1) {
 		GnomePilotDBInfo *dbinfo;
-		pi_buffer_t *pi_buf;
-		dbinfo = g_new0 (GnomePilotDBInfo, 1);
 
-		pi_buf = pi_buffer_new (sizeof (struct DBInfo));
+		pi_buffer_clear (pi_buf);
 		result = dlp_ReadDBList (pfd, 0, dlpDBListRAM, index, pi_buf);
 		/* load next dbinfo block */
 		if (result < 0) {
 			/* is <0, there are no more databases, break
                            out so we can save the list */
-			g_free (dbinfo);
 			break;
 		}
 
+		/* freed once no preparation can still be using it */
+		dbinfo = g_new0 (GnomePilotDBInfo, 1);
 		memcpy (dbinfo, pi_buf->data, sizeof (struct DBInfo));
-		pi_buffer_free (pi_buf);
 		index = PI_DBINFO (dbinfo)->index + 1;
 
-		dbs = g_list_append (dbs, dbinfo);
+		dbs = g_list_prepend (dbs, dbinfo);
+	}
+	pi_buffer_free (pi_buf);
+	dbs = g_list_reverse (dbs);
+	gpilot_sync_stats_add (pfd, GPILOT_SYNC_PHASE_ENUMERATE, NULL, started,
+			       g_list_length (dbs), g_list_length (dbs) * sizeof (struct DBInfo));
+
+	if (quick) {
+		QuickSyncOrder order;
+
+		order.conduits = conlist;
+		order.cost = cost;
+		dbs = g_list_sort_with_data (dbs, (GCompareDataFunc) quick_sync_compare, &order);
+	}
+
+	/* Let the conduits load their local data while the link is busy
+	   with the databases ahead of theirs */
+	for (iterator = dbs; iterator; iterator = g_list_next (iterator)) {
+		GnomePilotDBInfo *dbinfo = GNOME_PILOT_DBINFO (iterator->data);
+
+		if ((PI_DBINFO (dbinfo)->miscFlags & dlpDBMiscFlagExcludeFromSync) ||
+		    gpilot_sync_checkpoint_done (checkpoint, PI_DBINFO (dbinfo)->name,
+						 PI_DBINFO (dbinfo)->modifyDate))
+			continue;
+
+		dbinfo->pu = pu;
+		dbinfo->pilot_socket = pfd;
+		dbinfo->manager_data = (void *) stamp;
+		dbinfo->pilotInfo = pilot_info;
+
+		conduit = find_matching_conduit (conlist, dbinfo);
+		if (conduit && GNOME_IS_PILOT_CONDUIT_SYNC_ABS (conduit) &&
+		    gnome_pilot_conduit_sync_abs_prepare_local (GNOME_PILOT_CONDUIT_SYNC_ABS (conduit), dbinfo))
+			preparing = g_list_prepend (preparing, conduit);
 	}
+	conduit = NULL;
 
 	index = 1;
 	for (iterator = dbs; iterator; iterator = g_list_next (iterator)) {
 		GnomePilotDBInfo *dbinfo = GNOME_PILOT_DBINFO (iterator->data);
+		gboolean backed_up = TRUE;
+		GList *bcon;
 
 		if (dlp_OpenConduit (pfd) < 0) {
 			g_warning ("Unable to open conduit!");
 			error = -1;
+			failed = TRUE;
 			break;
 		}
 
-		db_list = g_slist_append (db_list, g_strdup (PI_DBINFO (dbinfo)->name));
+		db_list = g_slist_prepend (db_list, g_strdup (PI_DBINFO (dbinfo)->name));
 
 		if (0) {
 			char creat[4];
@@ -355,6 +506,14 @@ iterate_dbs (gint pfd,
 
 		/* check if the base is marked as being excluded from sync */
 		if (!(PI_DBINFO (dbinfo)->miscFlags & dlpDBMiscFlagExcludeFromSync)) {
+			if (gpilot_sync_checkpoint_done (checkpoint, PI_DBINFO (dbinfo)->name,
+							 PI_DBINFO (dbinfo)->modifyDate)) {
+				LOG (("Base %s was synced before the connection was lost", PI_DBINFO (dbinfo)->name));
+				dbus_notify_overall_progress (pilot_info->name, index, g_list_length (dbs));
+				index++;
+				continue;
+			}
+
 			dbinfo->pu = pu;
 			dbinfo->pilot_socket = pfd;
 			dbinfo->manager_data = (void *) stamp;
@@ -367,9 +526,26 @@ iterate_dbs (gint pfd,
 				   the signals. The signals aren't set before, since we 
 				   want to pass dbinfo as the userdata, and we don't do it
 				   in "iter", since it's a parameterized funtion */				
+				gchar *conduit_name;
+
 				set_callbacks (TRUE, GNOME_PILOT_CONDUIT (conduit), pilot_info->name);
+				started = g_get_monotonic_time ();
 				error = iter (GNOME_PILOT_CONDUIT_STANDARD (conduit), dbinfo);
+				if (error < 0)
+					gpilot_sync_stats_error (pfd);
+				else if (cost)
+					gpilot_sync_cost_add (cost, PI_DBINFO (dbinfo)->name, GPILOT_SYNC_COST_CONDUIT,
+							      g_get_monotonic_time () - started);
+				conduit_name = gnome_pilot_conduit_get_name (conduit);
+				gpilot_sync_stats_add (pfd, GPILOT_SYNC_PHASE_CONDUIT, conduit_name, started, 0, 0);
+				g_free (conduit_name);
 				set_callbacks (FALSE, GNOME_PILOT_CONDUIT (conduit), pilot_info->name);
+				/* the preparation uses dbinfo, in case the
+				   conduit's turn ended before pre_sync */
+				if (GNOME_IS_PILOT_CONDUIT_SYNC_ABS (conduit))
+					gnome_pilot_conduit_sync_abs_wait_prepared (GNOME_PILOT_CONDUIT_SYNC_ABS (conduit));
+				if (error < 0)
+					failed = TRUE;
 			}
 
 			dbus_notify_overall_progress (pilot_info->name, index, g_list_length (dbs)); 
@@ -379,19 +555,60 @@ iterate_dbs (gint pfd,
 			  so I'm not doing this check.
 			if (PI_DBINFO (dbinfo)->miscFlags & dlpDBFlagBackup)
 			*/
-				g_list_foreach (bconlist,
-						(GFunc) backup_foreach,
-						dbinfo);
+			if (quick && bconlist &&
+			    g_get_monotonic_time () - sync_started +
+			    gpilot_sync_cost_get (cost, PI_DBINFO (dbinfo)->name, GPILOT_SYNC_COST_BACKUP) >
+			    (gint64) context->quick_sync_budget * G_USEC_PER_SEC) {
+				deferred = g_slist_append (deferred, g_strdup (PI_DBINFO (dbinfo)->name));
+				gpilot_sync_cost_set_deferred (cost, PI_DBINFO (dbinfo)->name, TRUE);
+				backed_up = FALSE;
+			} else if (bconlist) {
+				started = g_get_monotonic_time ();
+				for (bcon = bconlist; bcon; bcon = g_list_next (bcon)) {
+					if (backup_foreach (bcon->data, dbinfo) < 0)
+						backed_up = FALSE;
+				}
+				if (cost) {
+					gpilot_sync_cost_add (cost, PI_DBINFO (dbinfo)->name, GPILOT_SYNC_COST_BACKUP,
+							      g_get_monotonic_time () - started);
+					gpilot_sync_cost_set_deferred (cost, PI_DBINFO (dbinfo)->name, FALSE);
+				}
+			}
 
+			/* a database whose backup failed or was deferred is
+			   not done, the next attempt has to back it up */
+			if ((conduit == NULL || error >= 0) && backed_up)
+				gpilot_sync_checkpoint_mark (checkpoint, PI_DBINFO (dbinfo)->name,
+							     checkpoint_modify_date (pfd, dbinfo,
+										     conduit != NULL));
 		} else {
 			LOG (("Base %s is to be ignored by sync", PI_DBINFO (dbinfo)->name));
 			continue;
 		}
-		g_free (dbinfo); 
 		index++;
 	}
-	g_list_free (dbs);
 
+	/* the conduits are unloaded after the sync, nothing may still be
+	   preparing by then */
+	for (iterator = preparing; iterator; iterator = g_list_next (iterator))
+		gnome_pilot_conduit_sync_abs_wait_prepared (GNOME_PILOT_CONDUIT_SYNC_ABS (iterator->data));
+	g_list_free (preparing);
+	g_list_free_full (dbs, g_free);
+
+	/* kept for the next attempt unless every database went fine */
+	gpilot_sync_checkpoint_close (checkpoint, !failed);
+
+	if (deferred) {
+		report_deferred (pfd, pilot_info, deferred);
+		g_slist_free_full (deferred, g_free);
+	}
+	if (cost) {
+		if (!quick && !failed)
+			gpilot_sync_cost_set_last_full (cost, time (NULL));
+		gpilot_sync_cost_save (cost);
+	}
+
+	db_list = g_slist_reverse (db_list);
 	gpilot_manager_save_databases (pilot_info, db_list);
 	return error;
 }
@@ -723,6 +940,76 @@ gpilot_unload_conduits (GList *list)
 	g_list_free (list);
 }
 
+typedef struct {
+	GnomePilotConduitManagement *manager;
+	gpointer handle;
+} GPilotWatch;
+
+void
+gpilot_start_watches (GPilotContext *context,
+		      GList **watches)
+{
+	GList *l;
+
+	*watches = NULL;
+
+	if (!context->watch_local_changes)
+		return;
+
+	for (l = context->pilots; l != NULL; l = l->next) {
+		GPilotPilot *pilot = l->data;
+		GKeyFile *kfile;
+		gchar **conduit_name;
+		gsize cnt = 0;
+		int i;
+
+		kfile = get_conduits_kfile (pilot->pilot_id);
+		conduit_name = g_key_file_get_string_list (kfile, "General", "conduits", &cnt, NULL);
+		g_key_file_free (kfile);
+
+		for (i = 0; i < cnt; i++) {
+			GnomePilotConduitManagement *manager;
+			GPilotWatch *watch;
+			gpointer handle;
+
+			/* the list only names the enabled conduits */
+			manager = gnome_pilot_conduit_management_new (conduit_name[i], GNOME_PILOT_CONDUIT_MGMT_ID);
+			if (manager == NULL)
+				continue;
+
+			handle = gnome_pilot_conduit_management_start_watch (manager, pilot);
+			if (handle == NULL) {
+				gnome_pilot_conduit_management_destroy (manager);
+				continue;
+			}
+
+			g_message ("Watching local changes for conduit \"%s\" of pilot %s",
+				   conduit_name[i], pilot->name);
+			watch = g_new0 (GPilotWatch, 1);
+			watch->manager = manager;
+			watch->handle = handle;
+			*watches = g_list_prepend (*watches, watch);
+		}
+		g_strfreev (conduit_name);
+	}
+}
+
+void
+gpilot_stop_watches (GList **watches)
+{
+	GList *l;
+
+	for (l = *watches; l != NULL; l = l->next) {
+		GPilotWatch *watch = l->data;
+
+		gnome_pilot_conduit_management_stop_watch (watch->manager, watch->handle);
+		gnome_pilot_conduit_management_destroy (watch->manager);
+		g_free (watch);
+	}
+	g_list_free (*watches);
+	*watches = NULL;
+}
+
 /* 
  * Start restoring a pilot profile, using the given (open hopefully)
  * filedescriptor, given a device (in case we need it again) and the
@@ -912,6 +1199,7 @@ gpilot_synchronize (int pilot_socket,
 			     conduit_list,
 			     backup_conduit_list,
 			     conduit_synchronize,
+			     TRUE,
 			     context);
 
 	/* FIXME: empty queue for pilot here */
@@ -941,6 +1229,7 @@ gpilot_copy_to_pilot (int pilot_socket,
 			     conduit_list,
 			     backup_conduit_list,
 			     conduit_copy_to_pilot,
+			     FALSE,
 			     context);
 	return error;
 }
@@ -958,6 +1247,7 @@ gpilot_copy_from_pilot (int pilot_socket,
 			    conduit_list,
 			    backup_conduit_list,
 			    conduit_copy_from_pilot,
+			    FALSE,
 			    context);
 	return error;
 }
@@ -984,6 +1274,7 @@ gpilot_merge_to_pilot (int pilot_socket,
 			     conduit_list,
 			     backup_conduit_list,
 			     conduit_merge_to_pilot,
+			     FALSE,
 			     context);
 
 	return error;
@@ -999,7 +1290,7 @@ gpilot_merge_from_pilot (int pilot_socket,
 {
 	gint error;
 	error = iterate_dbs (pilot_socket, stamp, pu, conduit_list, backup_conduit_list,
-			  conduit_merge_from_pilot, context);
+			  conduit_merge_from_pilot, FALSE, context);
 	return error;
 }
 
@@ -1025,6 +1316,7 @@ gpilot_sync_default (int pilot_socket, GnomePilotSyncStamp *stamp,
 			   conduit_list, 
 			   backup_conduit_list,
 			   conduit_sync_default, 
+			   TRUE,
 			   context);
 	return error;
 }
@@ -1040,7 +1332,7 @@ gpilot_add_log_entry (int pilot_socket,
 	va_start (ap, entry);
 	e = g_strdup_vprintf (entry, ap);
 	f = g_strdup_printf ("%s ", e);
-	dlp_AddSyncLogEntry (pilot_socket, f);
+	gpilot_sync_log_add (pilot_socket, f);
 	g_free (e);
 	g_free (f);
 }
@@ -1070,8 +1362,6 @@ gpilot_manager_save_databases (GPilotPilot *pilot_info,
 	save_pilot_cache_kfile (kfile, pilot_info->pilot_id);
 	g_key_file_free (kfile);
 
-	/* FIXME: is this okay ? */
-	g_slist_foreach (databases,(GFunc)g_free, NULL);
 	g_free (charlist);
-	g_slist_free (databases);
+	g_slist_free_full (databases, g_free);
 }
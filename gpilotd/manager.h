@@ -103,6 +103,12 @@ void gpilot_load_conduits(GPilotContext *context,
 /* Deinstantiate a list of conduits */
 void gpilot_unload_conduits(GList *l);
 
+/* Have the enabled conduits of every pilot in the context follow
+   local changes until gpilot_stop_watches, see watch_local_changes */
+void gpilot_start_watches(GPilotContext *context,
+			  GList **watches);
+void gpilot_stop_watches(GList **watches);
+
 /* Restore a connected (on pfd/device) pilot (pilot) */
 gboolean gpilot_start_unknown_restore (int pfd, GPilotDevice *device, GPilotPilot *pilot);
 
@@ -0,0 +1,256 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-map-bench: times the EDS conduits' pilot id map.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/*
+ * Runs e-pilot-map.c the way a conduit does, on a made up map in a
+ * scratch directory: a slow sync inserting every entry and writing
+ * the file, a sync reading it back and looking every entry up, and a
+ * fast sync changing a few entries, which only appends to the log.
+ * Every lookup is checked, so a wrong answer fails the run. Each
+ * phase also prints the peak resident size so far, and the map's own
+ * footprint is printed after it is filled and after each read. Needs
+ * neither a pilot nor evolution-data-server; "make bench" runs it
+ * with $(MAP_BENCH_FLAGS).
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib/gi18n.h>
+
+#include "e-pilot-map.h"
+
+static gint arg_entries = 100000;
+static gint arg_changed = 1;
+static gchar *arg_dir = NULL;
+
+static GOptionEntry options[] = {
+	{"entries", 'n', 0, G_OPTION_ARG_INT, &arg_entries, N_("Entries in the map"), N_("COUNT")},
+	{"changed", '\0', 0, G_OPTION_ARG_INT, &arg_changed, N_("Percentage of entries a fast sync changes"), N_("PERCENT")},
+	{"dir", 'd', 0, G_OPTION_ARG_STRING, &arg_dir, N_("Keep the map files in this directory"), N_("DIRECTORY")},
+	{NULL}
+};
+
+static gint failures = 0;
+
+/* Made up like the UIDs evolution-data-server hands out */
+static gchar *
+bench_uid (guint32 i)
+{
+	return g_strdup_printf ("pas-id-%08X%08X", g_int_hash (&i), i);
+}
+
+/* Spread out, like the ids of a pilot that saw many edits */
+static guint32
+bench_pid (guint32 i)
+{
+	return 0x100000 + i * 7;
+}
+
+/* Peak resident size of the process in kilobytes, 0 if unknown */
+static glong
+peak_rss (void)
+{
+	struct rusage usage;
+
+	if (getrusage (RUSAGE_SELF, &usage) < 0)
+		return 0;
+
+	return usage.ru_maxrss;
+}
+
+static void
+report (const gchar *phase, guint ops, gint64 started)
+{
+	gint64 usecs = MAX (g_get_monotonic_time () - started, 1);
+
+	g_print ("%-20s %8u ops %10.3f ms %14.0f ops/s %10ld KB peak\n", phase, ops,
+		 usecs / 1000.0, ops * (gdouble) G_USEC_PER_SEC / usecs, peak_rss ());
+}
+
+static void
+report_footprint (const gchar *phase, EPilotMap *map)
+{
+	gsize mapped, strings, heap;
+
+	e_pilot_map_get_footprint (map, &mapped, &strings, &heap);
+	g_print ("%-20s %10" G_GSIZE_FORMAT " KB mapped %10" G_GSIZE_FORMAT " KB strings %10" G_GSIZE_FORMAT " KB tables\n",
+		 phase, mapped / 1024, strings / 1024, heap / 1024);
+}
+
+static void
+check (gboolean ok, const gchar *what, guint32 i)
+{
+	if (!ok && failures++ < 10)
+		g_printerr ("%s: wrong answer for entry %u\n", what, i);
+}
+
+static void
+lookup_all (EPilotMap *map, gchar **uids, const gchar *phase)
+{
+	gchar *name;
+	gint64 started;
+	guint32 i;
+
+	name = g_strdup_printf ("%s pid", phase);
+	started = g_get_monotonic_time ();
+	for (i = 0; i < arg_entries; i++)
+		check (e_pilot_map_lookup_pid (map, uids[i], FALSE) == bench_pid (i), name, i);
+	report (name, arg_entries, started);
+	g_free (name);
+
+	name = g_strdup_printf ("%s uid", phase);
+	started = g_get_monotonic_time ();
+	for (i = 0; i < arg_entries; i++)
+		check (g_strcmp0 (e_pilot_map_lookup_uid (map, bench_pid (i), FALSE), uids[i]) == 0, name, i);
+	report (name, arg_entries, started);
+	g_free (name);
+}
+
+static void
+remove_dir (const gchar *dirname)
+{
+	GDir *dir;
+	const gchar *name;
+
+	if (!(dir = g_dir_open (dirname, 0, NULL)))
+		return;
+
+	while ((name = g_dir_read_name (dir))) {
+		gchar *path = g_build_filename (dirname, name, NULL);
+
+		g_unlink (path);
+		g_free (path);
+	}
+	g_dir_close (dir);
+	g_rmdir (dirname);
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *option_context;
+	GError *error = NULL;
+	EPilotMap *map;
+	gchar **uids, *dir, *filename;
+	gint64 started;
+	guint32 i, step;
+
+	bindtextdomain (PACKAGE, GNOMELOCALEDIR);
+	textdomain (PACKAGE);
+
+	option_context = g_option_context_new (_("- time the pilot id map"));
+	g_option_context_add_main_entries (option_context, options, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return 1;
+	}
+	g_option_context_free (option_context);
+
+	if (arg_entries <= 0 || arg_changed < 0 || arg_changed > 100) {
+		g_printerr (_("Nothing to do\n"));
+		return 1;
+	}
+
+	if (arg_dir) {
+		dir = g_strdup (arg_dir);
+	} else if (!(dir = g_dir_make_tmp ("gpilot-map-bench-XXXXXX", &error))) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return 1;
+	}
+	filename = g_build_filename (dir, "pilot-map-bench.xml", NULL);
+
+	uids = g_new0 (gchar *, arg_entries + 1);
+	for (i = 0; i < arg_entries; i++)
+		uids[i] = bench_uid (i);
+
+	/* A slow sync: nothing on disk yet, every record gets mapped */
+	e_pilot_map_read (filename, &map);
+
+	started = g_get_monotonic_time ();
+	for (i = 0; i < arg_entries; i++)
+		e_pilot_map_insert (map, bench_pid (i), uids[i], FALSE);
+	report ("insert", arg_entries, started);
+	report_footprint ("inserted", map);
+
+	lookup_all (map, uids, "lookup");
+
+	started = g_get_monotonic_time ();
+	if (e_pilot_map_write (filename, map) < 0)
+		check (FALSE, "write", 0);
+	report ("write", arg_entries, started);
+	e_pilot_map_destroy (map);
+
+	/* The next sync, answered from the file */
+	started = g_get_monotonic_time ();
+	if (e_pilot_map_read (filename, &map) < 0) {
+		g_printerr (_("Could not read %s back\n"), filename);
+		return 1;
+	}
+	report ("read", 1, started);
+	report_footprint ("read", map);
+	check (e_pilot_map_count_pids (map) == arg_entries, "count", 0);
+
+	lookup_all (map, uids, "file lookup");
+
+	/* A fast sync changing a few records, which goes to the log */
+	step = arg_changed > 0 ? 100 / arg_changed : 0;
+	started = g_get_monotonic_time ();
+	for (i = 0; step > 0 && i < arg_entries; i += step) {
+		e_pilot_map_remove_by_uid (map, uids[i]);
+		e_pilot_map_insert (map, bench_pid (i), uids[i], FALSE);
+		check (!e_pilot_map_uid_is_archived (map, uids[i]), "change", i);
+	}
+	if (e_pilot_map_write (filename, map) < 0)
+		check (FALSE, "append", 0);
+	report ("change and append", step > 0 ? (arg_entries + step - 1) / step : 0, started);
+	e_pilot_map_destroy (map);
+
+	if (e_pilot_map_read (filename, &map) < 0) {
+		g_printerr (_("Could not read %s back\n"), filename);
+		return 1;
+	}
+	report_footprint ("log read", map);
+	lookup_all (map, uids, "log lookup");
+	e_pilot_map_destroy (map);
+
+	if (arg_dir == NULL)
+		remove_dir (dir);
+
+	g_strfreev (uids);
+	g_free (filename);
+	g_free (dir);
+
+	if (failures > 0) {
+		g_printerr (_("%d wrong answers\n"), failures);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,1557 @@
+/* -*- Mode: C; indent-tabs-mode: t; c-basic-offset: 8; tab-width: 8 -*- */
+/*
+ * gpilot-mock-pda: a stand-in PDA for exercising gpilotd without one.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public
+ * License along with this program; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ *
+ */
+
+/*
+ * Plays the PDA end of a NetSync session: connects to a gpilotd
+ * network device, does the NetSync handshake and answers the DLP
+ * calls from a set of databases held in memory. The databases come
+ * from a directory of PDB/PRC files, are made up (memo, todo,
+ * address, datebook and any number of plain ones), or both. Every
+ * sync starts from the same databases, so runs can be compared.
+ *
+ * gpilotd needs a network device listening where --host and --port
+ * point (for "net:any" that is port 14238), and a PDA with the user
+ * id and name given by --userid and --user. The first sync is a slow
+ * one unless the PDA is told it last synced with this PC, after that
+ * gpilotd's WriteUserInfo is remembered for the rest of the run.
+ *
+ * At the end, the time spent per database between OpenDB and CloseDB
+ * and what went through it is reported, which is per conduit for the
+ * databases that have one.
+ *
+ * The conduits write what the PDA sends to the gpilotd and
+ * evolution-data-server of the session, so run it with HOME and the
+ * XDG_* directories pointing at a scratch directory, in a session of
+ * its own (dbus-run-session) with its own gpilotd and
+ * evolution-data-server, never against the real ones. Ten syncs of
+ * 500 records, 20 of them changed each time, is
+ * --syncs=10 --records=500 --dirty=20. A slow sync of a 20000
+ * contact address book is --synthetic=address --records=20000
+ * --dirty=0 --syncs=1, run twice: the first run fills the book, the
+ * second matches every record against it.
+ */
+
+#include <config.h>
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+
+#include <glib.h>
+#include <glib/gi18n.h>
+
+#include <pi-source.h>
+#include <pi-dlp.h>
+#include <pi-file.h>
+#include <pi-macros.h>
+#include <pi-memo.h>
+#include <pi-todo.h>
+#include <pi-address.h>
+#include <pi-datebook.h>
+
+/* NetSync framing */
+#define NET_HEADER_LEN   6
+#define NET_TYPE_DATA    0x01
+#define NET_TYPE_TICKLE  0x02
+
+/* DLP argument encoding */
+#define DLP_ARG_FIRST_ID   0x20
+#define DLP_ARG_FLAG_SHORT 0x80
+#define DLP_ARG_FLAG_LONG  0x40
+#define DLP_ARG_ID_MASK    0x3f
+#define DLP_MAX_ARGS       8
+
+/* DLP function codes, as in pi-dlp.h */
+enum {
+	FUNC_READ_USER_INFO      = 0x10,
+	FUNC_WRITE_USER_INFO     = 0x11,
+	FUNC_READ_SYS_INFO       = 0x12,
+	FUNC_READ_STORAGE_INFO   = 0x15,
+	FUNC_READ_DB_LIST        = 0x16,
+	FUNC_OPEN_DB             = 0x17,
+	FUNC_CREATE_DB           = 0x18,
+	FUNC_CLOSE_DB            = 0x19,
+	FUNC_DELETE_DB           = 0x1a,
+	FUNC_READ_APP_BLOCK      = 0x1b,
+	FUNC_WRITE_APP_BLOCK     = 0x1c,
+	FUNC_READ_NEXT_MODIFIED  = 0x1f,
+	FUNC_READ_RECORD         = 0x20,
+	FUNC_WRITE_RECORD        = 0x21,
+	FUNC_DELETE_RECORD       = 0x22,
+	FUNC_READ_RESOURCE       = 0x23,
+	FUNC_WRITE_RESOURCE      = 0x24,
+	FUNC_CLEAN_UP_DATABASE   = 0x26,
+	FUNC_RESET_SYNC_FLAGS    = 0x27,
+	FUNC_RESET_SYSTEM        = 0x29,
+	FUNC_ADD_SYNC_LOG_ENTRY  = 0x2a,
+	FUNC_READ_OPEN_DB_INFO   = 0x2b,
+	FUNC_OPEN_CONDUIT        = 0x2e,
+	FUNC_END_OF_SYNC         = 0x2f,
+	FUNC_RESET_RECORD_INDEX  = 0x30
+};
+
+/* DLP error codes */
+enum {
+	ERR_NONE       = 0,
+	ERR_SYSTEM     = 1,
+	ERR_PARAM      = 4,
+	ERR_NOT_FOUND  = 5,
+	ERR_NONE_OPEN  = 6,
+	ERR_TOO_MANY   = 8,
+	ERR_EXISTS     = 9,
+	ERR_NOT_SUPP   = 13
+};
+
+#define REC_ATTR_DELETED  0x80
+#define REC_ATTR_DIRTY    0x40
+#define REC_ATTR_ARCHIVED 0x08
+
+#define MAX_OPEN_DBS 12
+
+typedef struct {
+	guint32 id;
+	guint8 attr;
+	guint8 category;
+	/* resources only */
+	guint32 type;
+	guint16 res_id;
+	guint8 *data;
+	gsize size;
+} MockRecord;
+
+typedef struct {
+	struct DBInfo info;
+	guint8 *app_info;
+	gsize app_info_size;
+	GPtrArray *records;
+	guint32 next_id;
+} MockDB;
+
+typedef struct {
+	guint64 opens;
+	guint64 records_read;
+	guint64 records_written;
+	guint64 bytes_read;
+	guint64 bytes_written;
+	gint64 usecs;
+} MockStats;
+
+typedef struct {
+	MockDB *db;
+	guint cursor;
+	gint64 opened_at;
+} MockHandle;
+
+typedef struct {
+	gint fd;
+	guint8 txid;
+	GPtrArray *dbs;
+	MockHandle handles[MAX_OPEN_DBS];
+	gboolean ended;
+
+	guint64 calls;
+	guint64 wire_in;
+	guint64 wire_out;
+} MockSession;
+
+typedef struct {
+	guint8 id;
+	const guint8 *data;
+	gsize len;
+} DlpArg;
+
+typedef struct {
+	guint8 cmd;
+	gint argc;
+	DlpArg argv[DLP_MAX_ARGS];
+} DlpRequest;
+
+typedef struct {
+	guint16 err;
+	gint argc;
+	GByteArray *argv[DLP_MAX_ARGS];
+} DlpResponse;
+
+/* The PDA's user info, which gpilotd updates at the end of a sync */
+static struct {
+	guint32 user_id;
+	guint32 viewer_id;
+	guint32 last_sync_pc;
+	time_t successful_sync;
+	time_t last_sync;
+	gchar *name;
+} user;
+
+static gchar *arg_host = NULL;
+static gint arg_port = 14238;
+static gchar *arg_dir = NULL;
+static gchar *arg_synthetic = NULL;
+static gint arg_records = 100;
+static gint arg_record_size = 64;
+static gint arg_dirty = 10;
+static gint arg_extra_dbs = 0;
+static gint arg_latency = 0;
+static gint arg_syncs = 1;
+static gint arg_timeout = 30;
+static gint arg_seed = 1;
+static gint arg_userid = 4242;
+static gchar *arg_user = NULL;
+static gint arg_last_pc = 0;
+static gboolean arg_verbose = FALSE;
+
+static GOptionEntry options[] = {
+	{"host", '\0', 0, G_OPTION_ARG_STRING, &arg_host, N_("Host gpilotd listens on (default localhost)"), N_("HOST")},
+	{"port", '\0', 0, G_OPTION_ARG_INT, &arg_port, N_("NetSync port (default 14238)"), N_("PORT")},
+	{"dir", 'd', 0, G_OPTION_ARG_STRING, &arg_dir, N_("Serve the PDB/PRC files in this directory"), N_("DIRECTORY")},
+	{"synthetic", 's', 0, G_OPTION_ARG_STRING, &arg_synthetic, N_("Made up databases, from memo,todo,address,datebook"), N_("LIST")},
+	{"records", 'n', 0, G_OPTION_ARG_INT, &arg_records, N_("Records per made up database"), N_("COUNT")},
+	{"record-size", '\0', 0, G_OPTION_ARG_INT, &arg_record_size, N_("Text bytes per made up record"), N_("BYTES")},
+	{"dirty", '\0', 0, G_OPTION_ARG_INT, &arg_dirty, N_("Percentage of made up records flagged dirty"), N_("PERCENT")},
+	{"extra-databases", '\0', 0, G_OPTION_ARG_INT, &arg_extra_dbs, N_("Plain databases to add, which no conduit handles"), N_("COUNT")},
+	{"latency", 'l', 0, G_OPTION_ARG_INT, &arg_latency, N_("Delay before each DLP response"), N_("MSEC")},
+	{"syncs", 'c', 0, G_OPTION_ARG_INT, &arg_syncs, N_("Number of syncs to run"), N_("COUNT")},
+	{"timeout", '\0', 0, G_OPTION_ARG_INT, &arg_timeout, N_("Seconds to keep trying to connect"), N_("SECONDS")},
+	{"seed", '\0', 0, G_OPTION_ARG_INT, &arg_seed, N_("Seed for the made up records"), N_("SEED")},
+	{"userid", '\0', 0, G_OPTION_ARG_INT, &arg_userid, N_("User id of the PDA"), N_("ID")},
+	{"user", '\0', 0, G_OPTION_ARG_STRING, &arg_user, N_("User name of the PDA"), N_("NAME")},
+	{"last-pc", '\0', 0, G_OPTION_ARG_INT, &arg_last_pc, N_("PC id the PDA last synced with, for a fast first sync"), N_("ID")},
+	{"verbose", 'v', 0, G_OPTION_ARG_NONE, &arg_verbose, N_("Log every DLP call"), NULL},
+	{NULL},
+};
+
+static GHashTable *stats = NULL;
+
+/* Databases */
+
+static void
+mock_record_free (MockRecord *rec)
+{
+	g_free (rec->data);
+	g_free (rec);
+}
+
+static MockDB *
+mock_db_new (const gchar *name, guint32 type, guint32 creator, guint flags)
+{
+	MockDB *db;
+	time_t now = time (NULL);
+
+	db = g_new0 (MockDB, 1);
+	g_strlcpy (db->info.name, name, sizeof (db->info.name));
+	db->info.type = type;
+	db->info.creator = creator;
+	db->info.flags = flags;
+	db->info.createDate = now;
+	db->info.modifyDate = now;
+	db->records = g_ptr_array_new_with_free_func ((GDestroyNotify) mock_record_free);
+	db->next_id = 0x100000;
+
+	return db;
+}
+
+static void
+mock_db_free (MockDB *db)
+{
+	g_ptr_array_free (db->records, TRUE);
+	g_free (db->app_info);
+	g_free (db);
+}
+
+static MockRecord *
+mock_db_append (MockDB *db, guint32 id, guint8 attr, guint8 category, const void *data, gsize size)
+{
+	MockRecord *rec;
+
+	rec = g_new0 (MockRecord, 1);
+	rec->id = id ? id : db->next_id++;
+	rec->attr = attr;
+	rec->category = category;
+	rec->data = g_memdup (data, size);
+	rec->size = size;
+	g_ptr_array_add (db->records, rec);
+
+	if (rec->id >= db->next_id)
+		db->next_id = rec->id + 1;
+
+	return rec;
+}
+
+static MockDB *
+mock_db_copy (MockDB *orig)
+{
+	MockDB *db;
+	guint i;
+
+	db = g_new0 (MockDB, 1);
+	db->info = orig->info;
+	db->app_info = g_memdup (orig->app_info, orig->app_info_size);
+	db->app_info_size = orig->app_info_size;
+	db->next_id = orig->next_id;
+	db->records = g_ptr_array_new_with_free_func ((GDestroyNotify) mock_record_free);
+
+	for (i = 0; i < orig->records->len; i++) {
+		MockRecord *rec = g_ptr_array_index (orig->records, i), *copy;
+
+		copy = g_memdup (rec, sizeof (MockRecord));
+		copy->data = g_memdup (rec->data, rec->size);
+		g_ptr_array_add (db->records, copy);
+	}
+
+	return db;
+}
+
+static gboolean
+load_file (GPtrArray *dbs, const gchar *path)
+{
+	pi_file_t *file;
+	MockDB *db;
+	void *buffer;
+	size_t size;
+	int entries, i;
+
+	file = pi_file_open ((char *) path);
+	if (file == NULL) {
+		g_warning ("Could not open %s", path);
+		return FALSE;
+	}
+
+	db = g_new0 (MockDB, 1);
+	db->records = g_ptr_array_new_with_free_func ((GDestroyNotify) mock_record_free);
+	pi_file_get_info (file, &db->info);
+	pi_file_get_app_info (file, &buffer, &size);
+	if (size > 0) {
+		db->app_info = g_memdup (buffer, size);
+		db->app_info_size = size;
+	}
+
+	pi_file_get_entries (file, &entries);
+	for (i = 0; i < entries; i++) {
+		MockRecord *rec;
+
+		if (db->info.flags & dlpDBFlagResource) {
+			unsigned long type;
+			int id;
+
+			if (pi_file_read_resource (file, i, &buffer, &size, &type, &id) < 0)
+				break;
+			rec = mock_db_append (db, 0, 0, 0, buffer, size);
+			rec->type = type;
+			rec->res_id = id;
+		} else {
+			int attr, category;
+			recordid_t id;
+
+			if (pi_file_read_record (file, i, &buffer, &size, &attr, &category, &id) < 0)
+				break;
+			mock_db_append (db, id, attr, category, buffer, size);
+		}
+	}
+	pi_file_close (file);
+
+	g_ptr_array_add (dbs, db);
+
+	return TRUE;
+}
+
+static void
+load_dir (GPtrArray *dbs, const gchar *dirname)
+{
+	GDir *dir;
+	const gchar *name;
+	GError *error = NULL;
+
+	dir = g_dir_open (dirname, 0, &error);
+	if (dir == NULL) {
+		g_warning ("%s", error->message);
+		g_error_free (error);
+		return;
+	}
+
+	while ((name = g_dir_read_name (dir)) != NULL) {
+		gchar *path;
+
+		if (!g_str_has_suffix (name, ".pdb") && !g_str_has_suffix (name, ".PDB")
+		    && !g_str_has_suffix (name, ".prc") && !g_str_has_suffix (name, ".PRC"))
+			continue;
+
+		path = g_build_filename (dirname, name, NULL);
+		load_file (dbs, path);
+		g_free (path);
+	}
+	g_dir_close (dir);
+}
+
+/* Made up databases */
+
+static gchar *
+made_up_text (GRand *rand, gint size)
+{
+	static const gchar words[] = "lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod tempor ";
+	gchar *text;
+	gint i, start;
+
+	text = g_malloc (size + 1);
+	start = g_rand_int_range (rand, 0, sizeof (words) - 1);
+	for (i = 0; i < size; i++)
+		text[i] = words[(start + i) % (sizeof (words) - 1)];
+	text[size] = '\0';
+
+	return text;
+}
+
+static void
+made_up_categories (struct CategoryAppInfo *category)
+{
+	memset (category, 0, sizeof (*category));
+	strcpy (category->name[0], "Unfiled");
+	strcpy (category->name[1], "Business");
+	strcpy (category->name[2], "Personal");
+	category->ID[0] = 0;
+	category->ID[1] = 1;
+	category->ID[2] = 2;
+	category->lastUniqueID = 15;
+}
+
+static guint8
+made_up_attr (GRand *rand)
+{
+	return g_rand_int_range (rand, 0, 100) < arg_dirty ? REC_ATTR_DIRTY : 0;
+}
+
+static void
+made_up_tm (GRand *rand, struct tm *tm)
+{
+	time_t t = 1104537600 + g_rand_int_range (rand, 0, 365) * 86400 + g_rand_int_range (rand, 8, 18) * 3600;
+
+	localtime_r (&t, tm);
+}
+
+static MockDB *
+made_up_db (const gchar *kind, GRand *rand)
+{
+	MockDB *db;
+	pi_buffer_t *buffer;
+	guchar appinfo[0xffff];
+	gint i, len = -1;
+
+	buffer = pi_buffer_new (arg_record_size + 256);
+
+	if (!strcmp (kind, "memo")) {
+		struct MemoAppInfo ai;
+
+		db = mock_db_new ("MemoDB", pi_mktag ('D', 'A', 'T', 'A'), pi_mktag ('m', 'e', 'm', 'o'), dlpDBFlagBackup);
+		memset (&ai, 0, sizeof (ai));
+		made_up_categories (&ai.category);
+		len = pack_MemoAppInfo (&ai, appinfo, sizeof (appinfo));
+
+		for (i = 0; i < arg_records; i++) {
+			struct Memo memo;
+
+			memo.text = made_up_text (rand, arg_record_size);
+			pi_buffer_clear (buffer);
+			pack_Memo (&memo, buffer, memo_v1);
+			mock_db_append (db, 0, made_up_attr (rand), i % 3, buffer->data, buffer->used);
+			g_free (memo.text);
+		}
+	} else if (!strcmp (kind, "todo")) {
+		struct ToDoAppInfo ai;
+
+		db = mock_db_new ("ToDoDB", pi_mktag ('D', 'A', 'T', 'A'), pi_mktag ('t', 'o', 'd', 'o'), dlpDBFlagBackup);
+		memset (&ai, 0, sizeof (ai));
+		made_up_categories (&ai.category);
+		len = pack_ToDoAppInfo (&ai, appinfo, sizeof (appinfo));
+
+		for (i = 0; i < arg_records; i++) {
+			struct ToDo todo;
+
+			memset (&todo, 0, sizeof (todo));
+			todo.indefinite = i % 2;
+			made_up_tm (rand, &todo.due);
+			todo.priority = 1 + i % 5;
+			todo.complete = i % 7 == 0;
+			todo.description = made_up_text (rand, MIN (arg_record_size, 40));
+			todo.note = arg_record_size > 40 ? made_up_text (rand, arg_record_size - 40) : NULL;
+			pi_buffer_clear (buffer);
+			pack_ToDo (&todo, buffer, todo_v1);
+			mock_db_append (db, 0, made_up_attr (rand), i % 3, buffer->data, buffer->used);
+			g_free (todo.description);
+			g_free (todo.note);
+		}
+	} else if (!strcmp (kind, "address")) {
+		struct AddressAppInfo ai;
+
+		db = mock_db_new ("AddressDB", pi_mktag ('D', 'A', 'T', 'A'), pi_mktag ('a', 'd', 'd', 'r'), dlpDBFlagBackup);
+		memset (&ai, 0, sizeof (ai));
+		made_up_categories (&ai.category);
+		len = pack_AddressAppInfo (&ai, appinfo, sizeof (appinfo));
+
+		for (i = 0; i < arg_records; i++) {
+			struct Address address;
+			gint j;
+
+			memset (&address, 0, sizeof (address));
+			for (j = 0; j < 5; j++)
+				address.phoneLabel[j] = j;
+			address.entry[entryLastname] = g_strdup_printf ("Last%d", i);
+			address.entry[entryFirstname] = g_strdup_printf ("First%d", i);
+			address.entry[entryPhone1] = g_strdup_printf ("555-%04d", i % 10000);
+			address.entry[entryNote] = made_up_text (rand, arg_record_size);
+			pi_buffer_clear (buffer);
+			pack_Address (&address, buffer, address_v1);
+			mock_db_append (db, 0, made_up_attr (rand), i % 3, buffer->data, buffer->used);
+			for (j = 0; j < 19; j++)
+				g_free (address.entry[j]);
+		}
+	} else if (!strcmp (kind, "datebook")) {
+		struct AppointmentAppInfo ai;
+
+		db = mock_db_new ("DatebookDB", pi_mktag ('D', 'A', 'T', 'A'), pi_mktag ('d', 'a', 't', 'e'), dlpDBFlagBackup);
+		memset (&ai, 0, sizeof (ai));
+		made_up_categories (&ai.category);
+		len = pack_AppointmentAppInfo (&ai, appinfo, sizeof (appinfo));
+
+		for (i = 0; i < arg_records; i++) {
+			struct Appointment appt;
+			time_t end;
+
+			memset (&appt, 0, sizeof (appt));
+			made_up_tm (rand, &appt.begin);
+			end = mktime (&appt.begin) + 3600;
+			localtime_r (&end, &appt.end);
+			appt.repeatType = repeatNone;
+			appt.description = made_up_text (rand, MIN (arg_record_size, 40));
+			appt.note = arg_record_size > 40 ? made_up_text (rand, arg_record_size - 40) : NULL;
+			pi_buffer_clear (buffer);
+			pack_Appointment (&appt, buffer, datebook_v1);
+			mock_db_append (db, 0, made_up_attr (rand), 0, buffer->data, buffer->used);
+			g_free (appt.description);
+			g_free (appt.note);
+		}
+	} else {
+		g_warning ("Unknown kind of database \"%s\"", kind);
+		pi_buffer_free (buffer);
+		return NULL;
+	}
+
+	if (len > 0) {
+		db->app_info = g_memdup (appinfo, len);
+		db->app_info_size = len;
+	}
+	pi_buffer_free (buffer);
+
+	return db;
+}
+
+static MockDB *
+made_up_plain_db (gint n, GRand *rand)
+{
+	MockDB *db;
+	gchar *name;
+	gint i;
+
+	name = g_strdup_printf ("MockDB-%d", n);
+	db = mock_db_new (name, pi_mktag ('D', 'A', 'T', 'A'), pi_mktag ('M', 'O', 'C', 'K'), dlpDBFlagBackup);
+	g_free (name);
+
+	for (i = 0; i < arg_records; i++) {
+		gchar *data = made_up_text (rand, arg_record_size);
+
+		mock_db_append (db, 0, made_up_attr (rand), 0, data, arg_record_size);
+		g_free (data);
+	}
+
+	return db;
+}
+
+/* Statistics */
+
+static MockStats *
+stats_for (MockDB *db)
+{
+	MockStats *s;
+
+	s = g_hash_table_lookup (stats, db->info.name);
+	if (s == NULL) {
+		s = g_new0 (MockStats, 1);
+		g_hash_table_insert (stats, g_strdup (db->info.name), s);
+	}
+
+	return s;
+}
+
+static void
+stats_read (MockDB *db, gsize bytes)
+{
+	MockStats *s = stats_for (db);
+
+	s->records_read++;
+	s->bytes_read += bytes;
+}
+
+static void
+stats_written (MockDB *db, gsize bytes)
+{
+	MockStats *s = stats_for (db);
+
+	s->records_written++;
+	s->bytes_written += bytes;
+}
+
+/* NetSync */
+
+static gboolean
+read_all (gint fd, guint8 *buf, gsize len)
+{
+	while (len > 0) {
+		ssize_t n = read (fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FALSE;
+		buf += n;
+		len -= n;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+write_all (gint fd, const guint8 *buf, gsize len)
+{
+	while (len > 0) {
+		ssize_t n = write (fd, buf, len);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return FALSE;
+		buf += n;
+		len -= n;
+	}
+
+	return TRUE;
+}
+
+static gboolean
+net_send (MockSession *session, const guint8 *data, gsize len)
+{
+	guint8 header[NET_HEADER_LEN];
+
+	header[0] = NET_TYPE_DATA;
+	header[1] = session->txid;
+	set_long (header + 2, len);
+
+	session->wire_out += NET_HEADER_LEN + len;
+
+	return write_all (session->fd, header, NET_HEADER_LEN)
+		&& write_all (session->fd, data, len);
+}
+
+/* Reads the next data packet, FALSE once the desktop hangs up */
+static gboolean
+net_recv (MockSession *session, GByteArray *packet)
+{
+	guint8 header[NET_HEADER_LEN];
+	guint32 len;
+
+	for (;;) {
+		if (!read_all (session->fd, header, NET_HEADER_LEN))
+			return FALSE;
+
+		len = get_long (header + 2);
+		g_byte_array_set_size (packet, len);
+		if (!read_all (session->fd, packet->data, len))
+			return FALSE;
+
+		session->wire_in += NET_HEADER_LEN + len;
+
+		if (header[0] == NET_TYPE_DATA)
+			break;
+	}
+
+	/* answers go out under the transaction id they were asked under */
+	session->txid = header[1];
+
+	return TRUE;
+}
+
+/*
+ * The desktop does not look into these, they are what a Palm sends
+ */
+static gboolean
+net_handshake (MockSession *session)
+{
+	static const guint8 msg1[22] = {
+		0x90, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x20, 0x00, 0x00, 0x00, 0x08, 0x01, 0x00,
+		0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+	};
+	static const guint8 msg3[46] = {
+		0x93, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+		0x00, 0x20, 0x00, 0x00, 0x00, 0x24, 0x00, 0x00
+	};
+	GByteArray *packet;
+	gboolean ok;
+
+	packet = g_byte_array_new ();
+	session->txid = 1;
+	ok = net_send (session, msg1, sizeof (msg1))
+		&& net_recv (session, packet)
+		&& net_send (session, msg3, sizeof (msg3));
+	g_byte_array_free (packet, TRUE);
+
+	return ok;
+}
+
+/* DLP */
+
+static gboolean
+dlp_parse (const guint8 *buf, gsize len, DlpRequest *req)
+{
+	gsize pos = 2;
+	gint i;
+
+	if (len < 2)
+		return FALSE;
+
+	req->cmd = buf[0];
+	req->argc = MIN (buf[1], DLP_MAX_ARGS);
+
+	for (i = 0; i < req->argc; i++) {
+		DlpArg *arg = &req->argv[i];
+
+		if (pos + 2 > len)
+			return FALSE;
+
+		if (buf[pos] & DLP_ARG_FLAG_LONG) {
+			if (pos + 6 > len)
+				return FALSE;
+			arg->id = buf[pos] & DLP_ARG_ID_MASK;
+			arg->len = get_long (buf + pos + 2);
+			pos += 6;
+		} else if (buf[pos] & DLP_ARG_FLAG_SHORT) {
+			if (pos + 4 > len)
+				return FALSE;
+			arg->id = buf[pos] & DLP_ARG_ID_MASK;
+			arg->len = get_short (buf + pos + 2);
+			pos += 4;
+		} else {
+			arg->id = buf[pos];
+			arg->len = buf[pos + 1];
+			pos += 2;
+		}
+
+		if (pos + arg->len > len)
+			return FALSE;
+		arg->data = buf + pos;
+		pos += arg->len;
+	}
+
+	return TRUE;
+}
+
+static const DlpArg *
+dlp_arg (DlpRequest *req, guint8 id, gsize min_len)
+{
+	gint i;
+
+	for (i = 0; i < req->argc; i++) {
+		if (req->argv[i].id == id && req->argv[i].len >= min_len)
+			return &req->argv[i];
+	}
+
+	return NULL;
+}
+
+static GByteArray *
+dlp_response_arg (DlpResponse *res)
+{
+	GByteArray *arg = g_byte_array_new ();
+
+	g_assert (res->argc < DLP_MAX_ARGS);
+	res->argv[res->argc++] = arg;
+
+	return arg;
+}
+
+static void
+append_byte (GByteArray *arg, guint8 value)
+{
+	g_byte_array_append (arg, &value, 1);
+}
+
+static void
+append_short (GByteArray *arg, guint16 value)
+{
+	guint8 buf[2];
+
+	set_short (buf, value);
+	g_byte_array_append (arg, buf, 2);
+}
+
+static void
+append_long (GByteArray *arg, guint32 value)
+{
+	guint8 buf[4];
+
+	set_long (buf, value);
+	g_byte_array_append (arg, buf, 4);
+}
+
+static void
+append_date (GByteArray *arg, time_t t)
+{
+	guint8 buf[8];
+	struct tm tm;
+
+	memset (buf, 0, sizeof (buf));
+	if (t != 0 && localtime_r (&t, &tm) != NULL) {
+		set_short (buf, tm.tm_year + 1900);
+		buf[2] = tm.tm_mon + 1;
+		buf[3] = tm.tm_mday;
+		buf[4] = tm.tm_hour;
+		buf[5] = tm.tm_min;
+		buf[6] = tm.tm_sec;
+	}
+	g_byte_array_append (arg, buf, sizeof (buf));
+}
+
+static time_t
+get_date (const guint8 *buf)
+{
+	struct tm tm;
+
+	if (get_short (buf) == 0)
+		return 0;
+
+	memset (&tm, 0, sizeof (tm));
+	tm.tm_year = get_short (buf) - 1900;
+	tm.tm_mon = buf[2] - 1;
+	tm.tm_mday = buf[3];
+	tm.tm_hour = buf[4];
+	tm.tm_min = buf[5];
+	tm.tm_sec = buf[6];
+	tm.tm_isdst = -1;
+
+	return mktime (&tm);
+}
+
+static GByteArray *
+dlp_encode (guint8 cmd, DlpResponse *res)
+{
+	GByteArray *out;
+	guint8 head[4];
+	gint i;
+
+	out = g_byte_array_new ();
+	head[0] = cmd | 0x80;
+	head[1] = res->argc;
+	set_short (head + 2, res->err);
+	g_byte_array_append (out, head, 4);
+
+	for (i = 0; i < res->argc; i++) {
+		GByteArray *arg = res->argv[i];
+		guint8 id = DLP_ARG_FIRST_ID + i;
+		guint8 argh[6];
+
+		if (arg->len < 256) {
+			argh[0] = id;
+			argh[1] = arg->len;
+			g_byte_array_append (out, argh, 2);
+		} else if (arg->len < 65536) {
+			argh[0] = id | DLP_ARG_FLAG_SHORT;
+			argh[1] = 0;
+			set_short (argh + 2, arg->len);
+			g_byte_array_append (out, argh, 4);
+		} else {
+			argh[0] = id | DLP_ARG_FLAG_LONG;
+			argh[1] = 0;
+			set_long (argh + 2, arg->len);
+			g_byte_array_append (out, argh, 6);
+		}
+		g_byte_array_append (out, arg->data, arg->len);
+		g_byte_array_free (arg, TRUE);
+	}
+
+	return out;
+}
+
+static MockDB *
+find_db (MockSession *session, const gchar *name)
+{
+	guint i;
+
+	for (i = 0; i < session->dbs->len; i++) {
+		MockDB *db = g_ptr_array_index (session->dbs, i);
+
+		if (!strncmp (db->info.name, name, sizeof (db->info.name)))
+			return db;
+	}
+
+	return NULL;
+}
+
+static MockHandle *
+find_handle (MockSession *session, guint8 handle)
+{
+	if (handle == 0 || handle > MAX_OPEN_DBS || session->handles[handle - 1].db == NULL)
+		return NULL;
+
+	return &session->handles[handle - 1];
+}
+
+static guint16
+open_handle (MockSession *session, MockDB *db, GByteArray *arg)
+{
+	gint i;
+
+	for (i = 0; i < MAX_OPEN_DBS; i++) {
+		if (session->handles[i].db == NULL) {
+			session->handles[i].db = db;
+			session->handles[i].cursor = 0;
+			session->handles[i].opened_at = g_get_monotonic_time ();
+			stats_for (db)->opens++;
+			append_byte (arg, i + 1);
+			return ERR_NONE;
+		}
+	}
+
+	return ERR_TOO_MANY;
+}
+
+static void
+close_handle (MockHandle *handle)
+{
+	if (handle->db == NULL)
+		return;
+
+	stats_for (handle->db)->usecs += g_get_monotonic_time () - handle->opened_at;
+	handle->db = NULL;
+}
+
+static void
+append_record (GByteArray *arg, MockDB *db, MockRecord *rec, guint index, gsize offset, gsize max)
+{
+	gsize len = offset < rec->size ? MIN (rec->size - offset, max) : 0;
+
+	append_long (arg, rec->id);
+	append_short (arg, index);
+	append_short (arg, len);
+	append_byte (arg, rec->attr);
+	append_byte (arg, rec->category);
+	g_byte_array_append (arg, rec->data + offset, len);
+
+	stats_read (db, len);
+}
+
+static MockRecord *
+find_record (MockDB *db, guint32 id, guint *index)
+{
+	guint i;
+
+	for (i = 0; i < db->records->len; i++) {
+		MockRecord *rec = g_ptr_array_index (db->records, i);
+
+		if (rec->id == id) {
+			if (index)
+				*index = i;
+			return rec;
+		}
+	}
+
+	return NULL;
+}
+
+static void
+set_record_data (MockRecord *rec, const guint8 *data, gsize size)
+{
+	g_free (rec->data);
+	rec->data = g_memdup (data, size);
+	rec->size = size;
+}
+
+static guint16
+dlp_dispatch (MockSession *session, DlpRequest *req, DlpResponse *res)
+{
+	const DlpArg *a;
+	MockHandle *h;
+	MockRecord *rec;
+	GByteArray *out;
+	guint i;
+
+	switch (req->cmd) {
+	case FUNC_READ_SYS_INFO:
+		out = dlp_response_arg (res);
+		append_long (out, 0x04003000);
+		append_long (out, 0);
+		append_byte (out, 0);
+		append_byte (out, 4);
+		g_byte_array_append (out, (const guint8 *) "mock", 4);
+		out = dlp_response_arg (res);
+		append_short (out, 1);
+		append_short (out, 2);
+		append_short (out, 1);
+		append_short (out, 1);
+		append_long (out, 0xffff);
+		return ERR_NONE;
+
+	case FUNC_READ_USER_INFO:
+		out = dlp_response_arg (res);
+		append_long (out, user.user_id);
+		append_long (out, user.viewer_id);
+		append_long (out, user.last_sync_pc);
+		append_date (out, user.successful_sync);
+		append_date (out, user.last_sync);
+		append_byte (out, strlen (user.name) + 1);
+		append_byte (out, 0);
+		g_byte_array_append (out, (const guint8 *) user.name, strlen (user.name) + 1);
+		return ERR_NONE;
+
+	case FUNC_WRITE_USER_INFO:
+		if (!(a = dlp_arg (req, 0x20, 22)))
+			return ERR_PARAM;
+		if (a->data[20] & 0x80)
+			user.user_id = get_long (a->data);
+		if (a->data[20] & 0x08)
+			user.viewer_id = get_long (a->data + 4);
+		if (a->data[20] & 0x40)
+			user.last_sync_pc = get_long (a->data + 8);
+		if (a->data[20] & 0x20) {
+			user.last_sync = get_date (a->data + 12);
+			user.successful_sync = user.last_sync;
+		}
+		if ((a->data[20] & 0x10) && a->data[21] > 0 && 22 + a->data[21] <= a->len) {
+			g_free (user.name);
+			user.name = g_strndup ((const gchar *) a->data + 22, a->data[21]);
+		}
+		return ERR_NONE;
+
+	case FUNC_READ_STORAGE_INFO:
+		out = dlp_response_arg (res);
+		append_byte (out, 0);
+		append_byte (out, 0);
+		append_byte (out, 0);
+		append_byte (out, 1);
+		append_byte (out, 30 + 4 + 4);
+		append_byte (out, 0);
+		append_short (out, 1);
+		append_date (out, 1104537600);
+		append_long (out, 4 * 1024 * 1024);
+		append_long (out, 16 * 1024 * 1024);
+		append_long (out, 8 * 1024 * 1024);
+		append_byte (out, 4);
+		append_byte (out, 4);
+		g_byte_array_append (out, (const guint8 *) "MockMock", 8);
+		return ERR_NONE;
+
+	case FUNC_READ_DB_LIST: {
+		MockDB *db;
+		guint start, size;
+
+		if (!(a = dlp_arg (req, 0x20, 4)))
+			return ERR_PARAM;
+		start = get_short (a->data + 2);
+		if (!(a->data[0] & dlpDBListRAM) || start >= session->dbs->len)
+			return ERR_NOT_FOUND;
+
+		db = g_ptr_array_index (session->dbs, start);
+		size = 44 + strlen (db->info.name) + 1;
+		size += size & 1;
+
+		out = dlp_response_arg (res);
+		append_short (out, start);
+		append_byte (out, start + 1 < session->dbs->len ? 0x80 : 0);
+		append_byte (out, 1);
+		append_byte (out, size);
+		append_byte (out, db->info.miscFlags);
+		append_short (out, db->info.flags);
+		append_long (out, db->info.type);
+		append_long (out, db->info.creator);
+		append_short (out, db->info.version);
+		append_long (out, db->info.modnum);
+		append_date (out, db->info.createDate);
+		append_date (out, db->info.modifyDate);
+		append_date (out, db->info.backupDate);
+		append_short (out, start);
+		g_byte_array_append (out, (const guint8 *) db->info.name, strlen (db->info.name) + 1);
+		if ((strlen (db->info.name) + 1) & 1)
+			append_byte (out, 0);
+		return ERR_NONE;
+	}
+
+	case FUNC_OPEN_DB: {
+		MockDB *db;
+
+		if (!(a = dlp_arg (req, 0x20, 3)))
+			return ERR_PARAM;
+		db = find_db (session, (const gchar *) a->data + 2);
+		if (db == NULL)
+			return ERR_NOT_FOUND;
+		return open_handle (session, db, dlp_response_arg (res));
+	}
+
+	case FUNC_CREATE_DB: {
+		MockDB *db;
+		const gchar *name;
+
+		if (!(a = dlp_arg (req, 0x20, 15)))
+			return ERR_PARAM;
+		name = (const gchar *) a->data + 14;
+		if (find_db (session, name))
+			return ERR_EXISTS;
+		db = mock_db_new (name, get_long (a->data + 4), get_long (a->data), get_short (a->data + 10));
+		db->info.version = get_short (a->data + 12);
+		g_ptr_array_add (session->dbs, db);
+		return open_handle (session, db, dlp_response_arg (res));
+	}
+
+	case FUNC_DELETE_DB: {
+		MockDB *db;
+
+		if (!(a = dlp_arg (req, 0x20, 3)))
+			return ERR_PARAM;
+		db = find_db (session, (const gchar *) a->data + 2);
+		if (db == NULL)
+			return ERR_NOT_FOUND;
+		for (i = 0; i < MAX_OPEN_DBS; i++) {
+			if (session->handles[i].db == db)
+				close_handle (&session->handles[i]);
+		}
+		g_ptr_array_remove (session->dbs, db);
+		mock_db_free (db);
+		return ERR_NONE;
+	}
+
+	case FUNC_CLOSE_DB:
+		if ((a = dlp_arg (req, 0x20, 1))) {
+			if (!(h = find_handle (session, a->data[0])))
+				return ERR_NONE_OPEN;
+			close_handle (h);
+		} else {
+			for (i = 0; i < MAX_OPEN_DBS; i++)
+				close_handle (&session->handles[i]);
+		}
+		return ERR_NONE;
+
+	case FUNC_READ_OPEN_DB_INFO:
+		if (!(a = dlp_arg (req, 0x20, 1)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		append_short (dlp_response_arg (res), h->db->records->len);
+		return ERR_NONE;
+
+	case FUNC_READ_APP_BLOCK: {
+		gsize offset, len;
+
+		if (!(a = dlp_arg (req, 0x20, 6)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		if (h->db->app_info == NULL)
+			return ERR_NOT_FOUND;
+		offset = MIN (get_short (a->data + 2), h->db->app_info_size);
+		len = MIN (get_short (a->data + 4), h->db->app_info_size - offset);
+
+		out = dlp_response_arg (res);
+		append_short (out, len);
+		g_byte_array_append (out, h->db->app_info + offset, len);
+		return ERR_NONE;
+	}
+
+	case FUNC_WRITE_APP_BLOCK:
+		if (!(a = dlp_arg (req, 0x20, 4)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		g_free (h->db->app_info);
+		h->db->app_info_size = MIN (get_short (a->data + 2), a->len - 4);
+		h->db->app_info = g_memdup (a->data + 4, h->db->app_info_size);
+		return ERR_NONE;
+
+	case FUNC_RESET_RECORD_INDEX:
+		if (!(a = dlp_arg (req, 0x20, 1)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		h->cursor = 0;
+		return ERR_NONE;
+
+	case FUNC_READ_NEXT_MODIFIED:
+		if (!(a = dlp_arg (req, 0x20, 1)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		for (; h->cursor < h->db->records->len; h->cursor++) {
+			rec = g_ptr_array_index (h->db->records, h->cursor);
+			if (rec->attr & (REC_ATTR_DIRTY | REC_ATTR_DELETED)) {
+				append_record (dlp_response_arg (res), h->db, rec, h->cursor, 0, G_MAXSIZE);
+				h->cursor++;
+				return ERR_NONE;
+			}
+		}
+		return ERR_NOT_FOUND;
+
+	case FUNC_READ_RECORD:
+		if ((a = dlp_arg (req, 0x20, 10))) {
+			/* by id */
+			if (!(h = find_handle (session, a->data[0])))
+				return ERR_NONE_OPEN;
+			if (!(rec = find_record (h->db, get_long (a->data + 2), &i)))
+				return ERR_NOT_FOUND;
+			append_record (dlp_response_arg (res), h->db, rec, i,
+				       get_short (a->data + 6), get_short (a->data + 8));
+			return ERR_NONE;
+		} else if ((a = dlp_arg (req, 0x21, 8))) {
+			/* by index */
+			if (!(h = find_handle (session, a->data[0])))
+				return ERR_NONE_OPEN;
+			i = get_short (a->data + 2);
+			if (i >= h->db->records->len)
+				return ERR_NOT_FOUND;
+			append_record (dlp_response_arg (res), h->db, g_ptr_array_index (h->db->records, i), i,
+				       get_short (a->data + 4), get_short (a->data + 6));
+			return ERR_NONE;
+		}
+		return ERR_PARAM;
+
+	case FUNC_WRITE_RECORD: {
+		guint32 id;
+
+		if (!(a = dlp_arg (req, 0x20, 8)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		id = get_long (a->data + 2);
+		rec = id ? find_record (h->db, id, NULL) : NULL;
+		if (rec != NULL) {
+			rec->attr = a->data[6];
+			rec->category = a->data[7];
+			set_record_data (rec, a->data + 8, a->len - 8);
+		} else {
+			rec = mock_db_append (h->db, id, a->data[6], a->data[7], a->data + 8, a->len - 8);
+		}
+		stats_written (h->db, a->len - 8);
+		h->db->info.modnum++;
+		append_long (dlp_response_arg (res), rec->id);
+		return ERR_NONE;
+	}
+
+	case FUNC_DELETE_RECORD:
+		if (!(a = dlp_arg (req, 0x20, 6)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		if (a->data[1] & 0x80) {
+			g_ptr_array_set_size (h->db->records, 0);
+		} else {
+			if (!(rec = find_record (h->db, get_long (a->data + 2), &i)))
+				return ERR_NOT_FOUND;
+			g_ptr_array_remove_index (h->db->records, i);
+		}
+		stats_written (h->db, 0);
+		h->db->info.modnum++;
+		return ERR_NONE;
+
+	case FUNC_READ_RESOURCE: {
+		gsize offset, max, len;
+
+		if (!(a = dlp_arg (req, 0x20, 8)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		i = get_short (a->data + 2);
+		if (i >= h->db->records->len)
+			return ERR_NOT_FOUND;
+		rec = g_ptr_array_index (h->db->records, i);
+		offset = get_short (a->data + 4);
+		max = get_short (a->data + 6);
+		len = offset < rec->size ? MIN (rec->size - offset, max) : 0;
+
+		out = dlp_response_arg (res);
+		append_long (out, rec->type);
+		append_short (out, rec->res_id);
+		append_short (out, i);
+		append_short (out, len);
+		g_byte_array_append (out, rec->data + offset, len);
+		stats_read (h->db, len);
+		return ERR_NONE;
+	}
+
+	case FUNC_WRITE_RESOURCE:
+		if (!(a = dlp_arg (req, 0x20, 10)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		rec = NULL;
+		for (i = 0; i < h->db->records->len; i++) {
+			MockRecord *r = g_ptr_array_index (h->db->records, i);
+
+			if (r->type == get_long (a->data + 2) && r->res_id == get_short (a->data + 6))
+				rec = r;
+		}
+		if (rec == NULL) {
+			rec = mock_db_append (h->db, 0, 0, 0, NULL, 0);
+			rec->type = get_long (a->data + 2);
+			rec->res_id = get_short (a->data + 6);
+		}
+		set_record_data (rec, a->data + 10, a->len - 10);
+		stats_written (h->db, a->len - 10);
+		return ERR_NONE;
+
+	case FUNC_CLEAN_UP_DATABASE:
+		if (!(a = dlp_arg (req, 0x20, 1)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		for (i = h->db->records->len; i > 0; i--) {
+			rec = g_ptr_array_index (h->db->records, i - 1);
+			if (rec->attr & (REC_ATTR_DELETED | REC_ATTR_ARCHIVED))
+				g_ptr_array_remove_index (h->db->records, i - 1);
+		}
+		return ERR_NONE;
+
+	case FUNC_RESET_SYNC_FLAGS:
+		if (!(a = dlp_arg (req, 0x20, 1)) || !(h = find_handle (session, a->data[0])))
+			return ERR_NONE_OPEN;
+		for (i = 0; i < h->db->records->len; i++) {
+			rec = g_ptr_array_index (h->db->records, i);
+			rec->attr &= ~REC_ATTR_DIRTY;
+		}
+		h->db->info.backupDate = time (NULL);
+		return ERR_NONE;
+
+	case FUNC_ADD_SYNC_LOG_ENTRY:
+		if (arg_verbose && (a = dlp_arg (req, 0x20, 1)))
+			g_message ("log: %.*s", (gint) a->len, a->data);
+		return ERR_NONE;
+
+	case FUNC_OPEN_CONDUIT:
+	case FUNC_RESET_SYSTEM:
+		return ERR_NONE;
+
+	case FUNC_END_OF_SYNC:
+		session->ended = TRUE;
+		return ERR_NONE;
+
+	default:
+		if (arg_verbose)
+			g_message ("unsupported DLP call 0x%02x", req->cmd);
+		return ERR_NOT_SUPP;
+	}
+}
+
+static gboolean
+run_session (MockSession *session)
+{
+	GByteArray *packet;
+	gboolean ok = TRUE;
+
+	if (!net_handshake (session)) {
+		g_warning ("NetSync handshake failed");
+		return FALSE;
+	}
+
+	packet = g_byte_array_new ();
+	while (net_recv (session, packet)) {
+		DlpRequest req;
+		DlpResponse res;
+		GByteArray *out;
+
+		if (!dlp_parse (packet->data, packet->len, &req)) {
+			g_warning ("Malformed DLP request");
+			ok = FALSE;
+			break;
+		}
+
+		memset (&res, 0, sizeof (res));
+		res.err = dlp_dispatch (session, &req, &res);
+		session->calls++;
+
+		if (arg_verbose)
+			g_message ("DLP 0x%02x, %d args -> error %d", req.cmd, req.argc, res.err);
+
+		if (arg_latency > 0)
+			g_usleep (arg_latency * 1000);
+
+		out = dlp_encode (req.cmd, &res);
+		ok = net_send (session, out->data, out->len);
+		g_byte_array_free (out, TRUE);
+		if (!ok)
+			break;
+	}
+	g_byte_array_free (packet, TRUE);
+
+	return ok && session->ended;
+}
+
+static gint
+connect_desktop (void)
+{
+	struct addrinfo hints, *result, *ai;
+	gchar *port;
+	gint64 deadline;
+	gint fd = -1;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	port = g_strdup_printf ("%d", arg_port);
+	if (getaddrinfo (arg_host ? arg_host : "localhost", port, &hints, &result) != 0) {
+		g_warning ("Could not resolve %s", arg_host ? arg_host : "localhost");
+		g_free (port);
+		return -1;
+	}
+	g_free (port);
+
+	/* gpilotd takes a moment to listen again after a sync */
+	deadline = g_get_monotonic_time () + (gint64) arg_timeout * G_USEC_PER_SEC;
+	while (fd < 0 && g_get_monotonic_time () < deadline) {
+		for (ai = result; ai != NULL && fd < 0; ai = ai->ai_next) {
+			fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+			if (fd >= 0 && connect (fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+				close (fd);
+				fd = -1;
+			}
+		}
+		if (fd < 0)
+			g_usleep (G_USEC_PER_SEC / 10);
+	}
+	freeaddrinfo (result);
+
+	return fd;
+}
+
+static void
+report (gint syncs, gint failed, gint64 usecs, guint64 calls, guint64 wire_in, guint64 wire_out)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	gdouble secs = usecs / (gdouble) G_USEC_PER_SEC;
+
+	g_print ("%d syncs (%d failed) in %.2fs: %.1f syncs/minute, %.0f DLP calls/s, %.0f bytes/s on the wire\n",
+		 syncs, failed, secs, secs > 0 ? syncs * 60 / secs : 0.0,
+		 secs > 0 ? calls / secs : 0.0, secs > 0 ? (wire_in + wire_out) / secs : 0.0);
+
+	g_print ("%-32s %6s %10s %10s %12s %12s %9s %10s %12s\n",
+		 "database", "opens", "rec read", "rec wrote", "bytes read", "bytes wrote",
+		 "seconds", "records/s", "bytes/s");
+
+	g_hash_table_iter_init (&iter, stats);
+	while (g_hash_table_iter_next (&iter, &key, &value)) {
+		MockStats *s = value;
+		gdouble db_secs = s->usecs / (gdouble) G_USEC_PER_SEC;
+		guint64 records = s->records_read + s->records_written;
+		guint64 bytes = s->bytes_read + s->bytes_written;
+
+		g_print ("%-32s %6" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT
+			 " %12" G_GUINT64_FORMAT " %12" G_GUINT64_FORMAT " %9.3f %10.0f %12.0f\n",
+			 (const gchar *) key, s->opens, s->records_read, s->records_written,
+			 s->bytes_read, s->bytes_written, db_secs,
+			 db_secs > 0 ? records / db_secs : 0.0,
+			 db_secs > 0 ? bytes / db_secs : 0.0);
+	}
+}
+
+int
+main (int argc, char *argv[])
+{
+	GOptionContext *option_context;
+	GError *error = NULL;
+	GPtrArray *protos;
+	GRand *rand;
+	guint64 calls = 0, wire_in = 0, wire_out = 0;
+	gint64 start;
+	gint i, failed = 0;
+
+	bindtextdomain (PACKAGE, GNOMELOCALEDIR);
+	textdomain (PACKAGE);
+
+	option_context = g_option_context_new (_("- stand-in PDA for gpilotd"));
+	g_option_context_add_main_entries (option_context, options, NULL);
+	if (!g_option_context_parse (option_context, &argc, &argv, &error)) {
+		g_printerr ("%s\n", error->message);
+		g_error_free (error);
+		return 1;
+	}
+	g_option_context_free (option_context);
+
+	user.user_id = arg_userid;
+	user.last_sync_pc = arg_last_pc;
+	user.name = g_strdup (arg_user ? arg_user : "MockPDA");
+
+	protos = g_ptr_array_new_with_free_func ((GDestroyNotify) mock_db_free);
+	rand = g_rand_new_with_seed (arg_seed);
+
+	if (arg_dir)
+		load_dir (protos, arg_dir);
+	if (arg_synthetic || (arg_dir == NULL && arg_extra_dbs == 0)) {
+		gchar **kinds;
+
+		kinds = g_strsplit (arg_synthetic ? arg_synthetic : "memo,todo,address,datebook", ",", -1);
+		for (i = 0; kinds[i] != NULL; i++) {
+			MockDB *db = made_up_db (g_strstrip (kinds[i]), rand);
+
+			if (db != NULL)
+				g_ptr_array_add (protos, db);
+		}
+		g_strfreev (kinds);
+	}
+	for (i = 0; i < arg_extra_dbs; i++)
+		g_ptr_array_add (protos, made_up_plain_db (i, rand));
+	g_rand_free (rand);
+
+	if (protos->len == 0) {
+		g_printerr ("No databases to serve\n");
+		return 1;
+	}
+
+	stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+	start = g_get_monotonic_time ();
+	for (i = 0; i < arg_syncs; i++) {
+		MockSession session;
+		guint j;
+
+		memset (&session, 0, sizeof (session));
+		session.dbs = g_ptr_array_new_with_free_func ((GDestroyNotify) mock_db_free);
+		for (j = 0; j < protos->len; j++)
+			g_ptr_array_add (session.dbs, mock_db_copy (g_ptr_array_index (protos, j)));
+
+		session.fd = connect_desktop ();
+		if (session.fd < 0) {
+			g_printerr ("Could not connect to gpilotd\n");
+			g_ptr_array_free (session.dbs, TRUE);
+			failed += arg_syncs - i;
+			break;
+		}
+
+		if (!run_session (&session)) {
+			g_warning ("Sync %d did not end cleanly", i + 1);
+			failed++;
+		}
+		close (session.fd);
+
+		for (j = 0; j < MAX_OPEN_DBS; j++)
+			close_handle (&session.handles[j]);
+		g_ptr_array_free (session.dbs, TRUE);
+
+		calls += session.calls;
+		wire_in += session.wire_in;
+		wire_out += session.wire_out;
+	}
+
+	report (arg_syncs, failed, g_get_monotonic_time () - start, calls, wire_in, wire_out);
+
+	g_hash_table_destroy (stats);
+	g_ptr_array_free (protos, TRUE);
+	g_free (user.name);
+
+	return failed ? 1 : 0;
+}
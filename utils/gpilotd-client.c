@@ -5,6 +5,8 @@
  */
 #include <config.h>
 
+#include <time.h>
+
 #include <glib/gi18n.h>
 
 #include <gnome-pilot-client.h>
@@ -20,6 +22,10 @@ int     arg_pause=0,
 	arg_listusers = 0,
 	arg_listcradles = 0,
 	arg_monitor,
+	arg_syncstats = 0,
+	arg_dlpprofile = 0,
+	arg_synchistory = 0,
+	arg_dumptrace = 0,
 	arg_getinfo = 0;
 char
 	*arg_install = NULL,
@@ -52,6 +58,10 @@ static GOptionEntry options[] = {
 	{"listusers", '\0', 0, G_OPTION_ARG_NONE, &arg_listusers, N_("List users"), NULL},
 	{"listcradles", '\0', 0, G_OPTION_ARG_NONE, &arg_listcradles, N_("List cradles"), NULL},
 	{"listbases", 'l', 0, G_OPTION_ARG_NONE, &arg_listbases, N_("List the specified PDA's bases"), NULL},
+	{"syncstats", '\0', 0, G_OPTION_ARG_INT, &arg_syncstats, N_("Show the timings of the last COUNT syncs"), N_("COUNT")},
+	{"dlpprofile", '\0', 0, G_OPTION_ARG_NONE, &arg_dlpprofile, N_("Show the DLP calls of the last sync"), NULL},
+	{"synchistory", '\0', 0, G_OPTION_ARG_INT, &arg_synchistory, N_("Show the stored summaries of the last COUNT syncs, of all PDAs unless --pilot is given"), N_("COUNT")},
+	{"dump-trace", '\0', 0, G_OPTION_ARG_NONE, &arg_dumptrace, N_("Decode the per-record trace of the last syncs"), NULL},
 	{NULL},
 };
 
@@ -247,6 +257,200 @@ static void list_bases (void) {
 		g_message ("No databases");
 }
 
+static void sync_stats (void) {
+	GVariant *sessions = NULL, *timings;
+	GVariantIter iter, titer;
+	const gchar *pilot, *phase, *name;
+	guint64 started, usecs, bytes;
+	guint records;
+	gboolean completed;
+
+	if (gnome_pilot_client_get_sync_stats (gpc, arg_syncstats, &sessions) != GPILOTD_OK)
+		return;
+
+	if (g_variant_n_children (sessions) == 0)
+		g_message ("No syncs");
+
+	g_variant_iter_init (&iter, sessions);
+	while (g_variant_iter_next (&iter, "(&sttb@a(sstut))", &pilot, &started, &usecs, &completed, &timings)) {
+		time_t when = started;
+		gchar *date = g_strstrip (g_strdup (ctime (&when)));
+
+		g_message ("%s synced %s, %.3fs, %s", *pilot ? pilot : "unknown PDA", date,
+			   usecs / (gdouble) G_USEC_PER_SEC, completed ? "completed" : "did not complete");
+		g_free (date);
+
+		g_variant_iter_init (&titer, timings);
+		while (g_variant_iter_next (&titer, "(&s&stut)", &phase, &name, &usecs, &records, &bytes)) {
+			g_message ("  %-10s %-24s %9.3fs %6u records %9" G_GUINT64_FORMAT " bytes",
+				   phase, name, usecs / (gdouble) G_USEC_PER_SEC, records, bytes);
+		}
+		g_variant_unref (timings);
+	}
+	g_variant_unref (sessions);
+}
+
+static void dlp_profile (void) {
+	GVariant *calls = NULL, *histogram;
+	GVariantIter iter;
+	const gchar *db, *call;
+	guint count, errors;
+	guint64 usecs, bytes;
+	gboolean enabled;
+
+	if (gnome_pilot_client_get_dlp_profile (gpc, &enabled, &calls) != GPILOTD_OK)
+		return;
+
+	if (!enabled)
+		g_message ("DLP profiling is off, set profile_dlp in the gpilotd configuration");
+	if (g_variant_n_children (calls) == 0)
+		g_message ("No DLP calls profiled");
+
+	g_variant_iter_init (&iter, calls);
+	while (g_variant_iter_next (&iter, "(&s&suutt@at)", &db, &call, &count, &errors, &usecs, &bytes, &histogram)) {
+		GString *buckets = g_string_new (NULL);
+		gsize i, n;
+		const guint64 *h = g_variant_get_fixed_array (histogram, &n, sizeof (guint64));
+
+		for (i = 0; i < n; i++)
+			g_string_append_printf (buckets, " %" G_GUINT64_FORMAT, h[i]);
+
+		g_message ("%-20s %-16s %6u calls %4u failed %9.3fs %9" G_GUINT64_FORMAT " bytes |%s",
+			   call, db, count, errors, usecs / (gdouble) G_USEC_PER_SEC, bytes, buckets->str);
+		g_string_free (buckets, TRUE);
+		g_variant_unref (histogram);
+	}
+	g_variant_unref (calls);
+}
+
+typedef struct {
+	guint sessions;		/* completed ones listed */
+	guint seen;
+	guint64 usecs[2];	/* newer, older half */
+	guint64 databases[2];
+	guint64 bytes[2];
+} HistoryTrend;
+
+static void sync_history_trend (gpointer key, gpointer value, gpointer data) {
+	HistoryTrend *trend = value;
+	guint n[2];
+	gdouble usecs[2];
+
+	n[0] = trend->sessions / 2;
+	n[1] = trend->sessions - n[0];
+	if (n[0] == 0)
+		return;
+	usecs[0] = trend->usecs[0] / (gdouble) n[0] / G_USEC_PER_SEC;
+	usecs[1] = trend->usecs[1] / (gdouble) n[1] / G_USEC_PER_SEC;
+
+	g_message ("%s: %u syncs, %.3fs -> %.3fs (%+.0f%%), %.1f -> %.1f databases, %.0f -> %.0f bytes",
+		   (gchar *) key, trend->sessions, usecs[1], usecs[0],
+		   usecs[1] > 0 ? (usecs[0] - usecs[1]) * 100 / usecs[1] : 0.0,
+		   trend->databases[1] / (gdouble) n[1], trend->databases[0] / (gdouble) n[0],
+		   trend->bytes[1] / (gdouble) n[1], trend->bytes[0] / (gdouble) n[0]);
+}
+
+static void sync_history (const gchar *pilot_name) {
+	GVariant *sessions = NULL, *conduits;
+	GVariantIter iter, citer;
+	GHashTable *trends;
+	HistoryTrend *trend;
+	const gchar *pilot, *device, *name;
+	guint32 pilot_id;
+	gint64 started;
+	guint64 usecs, conduit_usecs, bytes;
+	guint databases, records, errors, conduit_records, conduit_errors;
+	gboolean completed, slow;
+
+	if (gnome_pilot_client_get_sync_history (gpc, pilot_name, arg_synchistory, &sessions) != GPILOTD_OK)
+		return;
+
+	if (g_variant_n_children (sessions) == 0)
+		g_message ("No syncs");
+
+	/* count the completed syncs of each PDA first, so they can be
+	   split in an older and a newer half for the trend */
+	trends = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, g_free);
+	g_variant_iter_init (&iter, sessions);
+	while (g_variant_iter_next (&iter, "(u&s&sxtuutub@a(stuub))", &pilot_id, &pilot, &device, &started,
+				    &usecs, &databases, &records, &bytes, &errors, &completed, &conduits)) {
+		g_variant_unref (conduits);
+		if (!completed)
+			continue;
+		trend = g_hash_table_lookup (trends, pilot);
+		if (trend == NULL) {
+			trend = g_new0 (HistoryTrend, 1);
+			g_hash_table_insert (trends, (gpointer) pilot, trend);
+		}
+		trend->sessions++;
+	}
+
+	g_variant_iter_init (&iter, sessions);
+	while (g_variant_iter_next (&iter, "(u&s&sxtuutub@a(stuub))", &pilot_id, &pilot, &device, &started,
+				    &usecs, &databases, &records, &bytes, &errors, &completed, &conduits)) {
+		time_t when = started;
+		gchar *date = g_strstrip (g_strdup (ctime (&when)));
+
+		g_message ("%s (%u) on %s synced %s, %.3fs, %u databases, %u records, %" G_GUINT64_FORMAT " bytes, %u errors, %s",
+			   *pilot ? pilot : "unknown PDA", pilot_id, device, date,
+			   usecs / (gdouble) G_USEC_PER_SEC, databases, records, bytes, errors,
+			   completed ? "completed" : "did not complete");
+		g_free (date);
+
+		g_variant_iter_init (&citer, conduits);
+		while (g_variant_iter_next (&citer, "(&stuub)", &name, &conduit_usecs,
+					    &conduit_records, &conduit_errors, &slow)) {
+			g_message ("  %-24s %9.3fs %6u records %4u errors %s",
+				   name, conduit_usecs / (gdouble) G_USEC_PER_SEC,
+				   conduit_records, conduit_errors, slow ? "slow" : "fast");
+		}
+		g_variant_unref (conduits);
+
+		if (completed) {
+			/* newest first, so the newer half comes first */
+			guint half;
+
+			trend = g_hash_table_lookup (trends, pilot);
+			half = trend->seen++ < trend->sessions / 2 ? 0 : 1;
+			trend->usecs[half] += usecs;
+			trend->databases[half] += databases;
+			trend->bytes[half] += bytes;
+		}
+	}
+
+	g_hash_table_foreach (trends, sync_history_trend, NULL);
+	g_hash_table_destroy (trends);
+	g_variant_unref (sessions);
+}
+
+static void dump_trace (void) {
+	GVariant *events = NULL, *counters = NULL;
+	GVariantIter iter;
+	const gchar *event;
+	guint64 usecs;
+	gint32 pilot_socket;
+	guint32 id, arg, count;
+
+	if (gnome_pilot_client_get_trace (gpc, 0, &events, &counters) != GPILOTD_OK)
+		return;
+
+	if (g_variant_n_children (events) == 0)
+		g_message ("No events");
+
+	g_variant_iter_init (&iter, events);
+	while (g_variant_iter_next (&iter, "(ti&suu)", &usecs, &pilot_socket, &event, &id, &arg)) {
+		g_message ("%12.6f %3d %-20s %10u %u",
+			   usecs / (gdouble) G_USEC_PER_SEC, pilot_socket, event, id, arg);
+	}
+
+	g_variant_iter_init (&iter, counters);
+	while (g_variant_iter_next (&iter, "(&su)", &event, &count))
+		g_message ("%-20s %u", event, count);
+
+	g_variant_unref (events);
+	g_variant_unref (counters);
+}
+
 static void list_by_login (void) {
 	GList *list = NULL, *ptr;
 	gint *ids = NULL;
@@ -449,6 +653,7 @@ int
 main (int argc, char *argv[]) {
 	GOptionContext *option_context;
 	GError *error = NULL;
+	gchar *history_pilot;
 
 	bind_textdomain_codeset (GETTEXT_PACKAGE, "UTF-8");
 	bindtextdomain (PACKAGE, GNOMELOCALEDIR);
@@ -471,6 +676,8 @@ main (int argc, char *argv[]) {
 
 	g_message (_("\nBEWARE!!\nThis is a tool for certain parts of the gnome-pilot package.\nUnless you know what you're doing, don't use this tool."));
 
+	/* --synchistory shows all PDAs unless one is given */
+	history_pilot = arg_pilot;
 	if (arg_pilot==NULL) arg_pilot = g_strdup ("MyPilot");
 
 	gpc = GNOME_PILOT_CLIENT (gnome_pilot_client_new ());
@@ -506,6 +713,14 @@ main (int argc, char *argv[]) {
 		list_cradles ();
 	} else if (arg_listbases) {
 		list_bases ();
+	} else if (arg_syncstats) {
+		sync_stats ();
+	} else if (arg_dlpprofile) {
+		dlp_profile ();
+	} else if (arg_synchistory) {
+		sync_history (history_pilot);
+	} else if (arg_dumptrace) {
+		dump_trace ();
 	} else if (arg_list_by_login) {
 		list_by_login ();
 	} else if (arg_monitor) {